@@ -2,11 +2,20 @@
 # LltGpgpuRtConfig.cmake, too. There are two versions because the internal
 # version has to depend on the compiler's target, while the deployed version has
 # to find the compiler installed on the system.
+#
+# Further arguments are passed to the compiler instead of -cl-std=CL1.2, e.g.
+# -cl-std=CL2.0 for kernels that support non-uniform work groups.
 function(llt_gpgpu_compile_i915 CL_TARGET CL_SRC)
+	if (ARGN)
+		set(CL_OPTIONS ${ARGN})
+	else()
+		set(CL_OPTIONS -cl-std=CL1.2)
+	endif()
+
 	add_custom_command(
 		OUTPUT "${CMAKE_CURRENT_BINARY_DIR}/${CL_TARGET}"
 		COMMAND
-			llt_gpgpu_rt_i915_c -cl-std=CL1.2
+			llt_gpgpu_rt_i915_c ${CL_OPTIONS}
 				-o "${CMAKE_CURRENT_BINARY_DIR}/${CL_TARGET}"
 				"${CMAKE_CURRENT_SOURCE_DIR}/${CL_SRC}"
 		DEPENDS
@@ -16,6 +16,11 @@ public:
 
 	virtual std::optional<std::pair<const char*, size_t>>
 		get_bin(i915_device_type device_type) const = 0;
+
+	/* Options that the program was compiled with; they determine e.g.
+	 * whether its kernels support non-uniform work groups. Programs generated
+	 * by compilers that did not record them were built with -cl-std=CL1.2. */
+	virtual const char* get_build_options() const;
 };
 
 }
@@ -2,8 +2,11 @@
 #ifndef __LLT_GPGPU_RT_I915_RUNTIME_H
 #define __LLT_GPGPU_RT_I915_RUNTIME_H
 
+#include <cstdio>
 #include <string>
 #include <memory>
+#include <vector>
+#include <chrono>
 #include <llt_gpgpu_rt/ocl_runtime.h>
 #include <llt_gpgpu_rt/i915_compiled_program.h>
 
@@ -20,6 +23,26 @@ public:
 	~I915Kernel() = 0;
 };
 
+/* Partitioning of the L3 cache in ways. Only the configurations validated
+ * for Gen9 (see Mesa's intel_l3_config.c) are supported:
+ * (SLM, URB, all) = (0, 48, 48), (0, 32, 64) and (32, 16, 48). */
+struct I915L3Config
+{
+	unsigned slm_ways = 0;
+	unsigned urb_ways = 0;
+	unsigned all_ways = 0;
+
+	bool operator==(const I915L3Config& o) const
+	{
+		return slm_ways == o.slm_ways && urb_ways == o.urb_ways && all_ways == o.all_ways;
+	}
+
+	bool operator!=(const I915L3Config& o) const
+	{
+		return !(*this == o);
+	}
+};
+
 class I915PreparedKernel : public PreparedKernel
 {
 public:
@@ -27,8 +50,185 @@ public:
 
 	/* @param size is in bytes */
 	virtual void add_argument_gem_name(uint32_t name) = 0;
+	virtual void add_argument_gem_name(uint32_t name, CacheHint hint) = 0;
+	virtual void set_argument_gem_name(unsigned index, uint32_t name) = 0;
+	virtual void set_argument_gem_name(unsigned index, uint32_t name, CacheHint hint) = 0;
+
+	/* Use @param config instead of the L3 partitioning that is derived from
+	 * the kernel's SLM size. Dispatches with different configurations do not
+	 * share a batch. */
+	virtual void set_l3_config(const I915L3Config& config) = 0;
+	virtual void reset_l3_config() = 0;
+};
+
+/* How threads wait for the completion of kernels */
+enum class I915WaitMode
+{
+	/* Spin on the completion location; lowest latency, but occupies a CPU
+	 * core */
+	BusyPoll,
+
+	/* Spin for I915WaitPolicy::spin_time, then block */
+	Adaptive,
+
+	/* Block in the kernel only; lowest power consumption */
+	Blocking
+};
+
+struct I915WaitPolicy
+{
+	I915WaitMode mode = I915WaitMode::Blocking;
+	std::chrono::microseconds spin_time{50};
+
+	/* Measure the wake-up latency, which costs a register read per wait */
+	bool measure_latency = false;
+
+	/* Event::wait() throws a TimeoutError if the kernel did not complete
+	 * within this time; 0 means no timeout */
+	std::chrono::nanoseconds timeout{0};
+};
+
+struct I915WaitStats
+{
+	/* Waits for kernels that were not complete yet */
+	uint64_t waits = 0;
+
+	/* Waits that ended while spinning / that blocked in the kernel */
+	uint64_t spin_completions = 0;
+	uint64_t blocking_waits = 0;
+	uint64_t gem_wait_ioctls = 0;
+
+	/* Time from the GPU finishing a batch until the waiting thread noticed
+	 * it; only if I915WaitPolicy::measure_latency is set */
+	uint64_t latency_samples = 0;
+	std::chrono::nanoseconds latency_min{0};
+	std::chrono::nanoseconds latency_max{0};
+	std::chrono::nanoseconds latency_total{0};
+};
+
+/* Collects kernel dispatches and submits them to the GPU in one batch buffer
+ * with a single EXECBUFFER2 call. Dispatches between two barriers may execute
+ * concurrently. If the state of a dispatch does not fit into the current
+ * batch anymore, the batch is flushed implicitly. */
+class I915CommandQueue
+{
+public:
+	virtual ~I915CommandQueue() = 0;
+
+	/* The kernel's arguments are captured when enqueuing, hence they may be
+	 * changed afterwards. Buffers must not be freed before the dispatch
+	 * completed. */
+	virtual void enqueue(PreparedKernel& kernel,
+			NDRange global_size, NDRange local_size) = 0;
+
+	/* See PreparedKernel::execute */
+	virtual void enqueue(PreparedKernel& kernel, NDRange global_offset,
+			NDRange global_size, NDRange local_size) = 0;
+
+	virtual void enqueue(PreparedKernel& kernel, NDRange global_size) = 0;
+
+	/* Dispatches enqueued after the barrier start only after all previously
+	 * enqueued dispatches completed and their memory writes are visible. */
+	virtual void barrier() = 0;
+
+	/* Submit all enqueued dispatches.
+	 * @returns an event that completes when all dispatches submitted so far
+	 *          have completed */
+	virtual std::shared_ptr<Event> flush() = 0;
+
+	/* Submit all enqueued dispatches and wait for them to complete */
+	virtual void finish() = 0;
+
+	/* Applies to events created by flush() afterwards. The queue starts with
+	 * the RTE's policy. */
+	virtual void set_wait_policy(const I915WaitPolicy& policy) = 0;
+	virtual I915WaitStats get_wait_stats() = 0;
+
+	/* Record GPU timestamps around dispatches enqueued afterwards. Profiled
+	 * dispatches do not overlap. The queue starts with the RTE's setting. */
+	virtual void set_profiling(bool enable) = 0;
+};
+
+/* Host CPU time spent in a phase of dispatching a kernel */
+struct I915PhaseProfile
+{
+	std::string phase;
+	uint64_t samples = 0;
+
+	std::chrono::nanoseconds min{0};
+	std::chrono::nanoseconds mean{0};
+	std::chrono::nanoseconds p99{0};
+	std::chrono::nanoseconds max{0};
+};
+
+/* Batches submitted by command queues are accounted to the pseudo kernel
+ * "(command queue)" */
+struct I915KernelProfile
+{
+	std::string kernel;
+	std::vector<I915PhaseProfile> phases;
+};
+
+/* Counters of the RTE's pool of state- and batch buffer bos */
+struct I915BoPoolStats
+{
+	/* Bos that had to be allocated and registered with the kernel */
+	uint64_t allocated = 0;
+
+	/* Requests that were served by a cached bo */
+	uint64_t reused = 0;
+
+	/* Bos that are currently cached in the pool */
+	size_t cached_bos = 0;
+	size_t cached_bytes = 0;
+
+	/* All USERPTR / GEM_CLOSE ioctls issued by the RTE (not only the ones
+	 * caused by the pool) */
+	uint64_t userptr_ioctls = 0;
+	uint64_t gem_close_ioctls = 0;
+};
+
+/* Counters of the RTE's cache of registered host memory ranges */
+struct I915UserptrCacheStats
+{
+	/* Buffer arguments that were covered by a cached range */
+	uint64_t hits = 0;
+
+	/* Buffer arguments that had to be registered with the kernel */
+	uint64_t misses = 0;
+
+	/* Implicitly cached ranges that were dropped to make room or because
+	 * they overlapped a new range */
+	uint64_t evictions = 0;
+
+	size_t explicit_ranges = 0;
+	size_t implicit_ranges = 0;
+};
+
+/* A GEM object imported by its flink name */
+struct I915GEMNameImport
+{
+	uint32_t name = 0;
+	uint32_t handle = 0;
+	uint64_t size = 0;
+
+	/* Number of kernel arguments that refer to the import */
+	unsigned refs = 0;
 };
 
+/* Measures the execution time of a dispatch for the autotuner; see
+ * I915RTE::tune() */
+class I915TuningTimer
+{
+public:
+	virtual ~I915TuningTimer() = 0;
+
+	virtual std::chrono::nanoseconds measure(PreparedKernel& kernel,
+			NDRange global_size, NDRange local_size) = 0;
+};
+
+/* NOTE: Kernels, prepared kernels, command queues and events must be destroyed before the RTE
+ * that created them, as they keep resources (e.g. the kernel code) in it. */
 class I915RTE : public RTE
 {
 public:
@@ -38,12 +238,159 @@ public:
 	virtual std::shared_ptr<Kernel> read_compiled_kernel(
 			const I915CompiledProgram& program, const char* name) = 0;
 
+	/* NOTE: The command queue must be destroyed before the RTE */
+	virtual std::unique_ptr<I915CommandQueue> create_command_queue() = 0;
+
 	virtual size_t get_page_size() = 0;
 	virtual drm_magic_t get_drm_magic() = 0;
+
+	/* Register host memory which is passed as buffer argument repeatedly.
+	 * Buffer arguments within a registered range reuse its bo instead of
+	 * being registered with the kernel for each submission. @param ptr and
+	 * @param size must be aligned to the page size.
+	 *
+	 * Buffer arguments outside of registered ranges are cached, too, but
+	 * are reused for the same address and size only, and may be dropped at
+	 * any time. */
+	virtual void register_host_memory(void* ptr, size_t size) = 0;
+
+	/* @param ptr must be the start of a registered range. The memory may be
+	 * freed once all dispatches that use it completed. */
+	virtual void unregister_host_memory(void* ptr) = 0;
+
+	virtual I915UserptrCacheStats get_userptr_cache_stats() = 0;
+
+	/* Policy for execute() and execute_async() of prepared kernels, and the
+	 * default for command queues created afterwards */
+	virtual void set_wait_policy(const I915WaitPolicy& policy) = 0;
+	virtual I915WaitPolicy get_wait_policy() = 0;
+	virtual I915WaitStats get_wait_stats() = 0;
+
+	/* Record GPU timestamps around dispatches of execute() and
+	 * execute_async(), and the default for command queues created
+	 * afterwards. See Event::get_dispatch_times(). */
+	virtual void set_profiling(bool enable) = 0;
+
+	/* Print each batch buffer decoded to @param f before submitting it,
+	 * including warnings about redundant state and flushes; nullptr
+	 * disables it */
+	virtual void set_batch_dump(FILE* f) = 0;
+
+	/* Dispatches without a local size take it from the tuning database at
+	 * @param path if it has an entry for the kernel, the device and the
+	 * magnitude of the global size. The file is created by tune() if it does
+	 * not exist. nullptr disables the lookups. */
+	virtual void set_tuning_database(const char* path) = 0;
+
+	/* Replaces the GPU timestamps used by tune(), e.g. by a deterministic
+	 * source for testing; nullptr restores them */
+	virtual void set_tuning_timer(std::shared_ptr<I915TuningTimer> timer) = 0;
+
+	/* Time candidate local sizes of @param kernel for @param global_size and
+	 * store the fastest one in the tuning database. The kernel is executed
+	 * repeatedly with its current arguments.
+	 * @returns the chosen local size */
+	virtual NDRange tune(PreparedKernel& kernel, NDRange global_size) = 0;
+
+	/* Host-side phase timings per kernel. Only recorded if the library was
+	 * built with ENABLE_HOST_PROFILER; empty otherwise. */
+	virtual std::vector<I915KernelProfile> get_profile() = 0;
+	virtual void reset_profile() = 0;
+
+	/* Number of GPU hangs and context bans that affected this RTE. The GPU
+	 * context is recreated after each one. */
+	virtual uint64_t get_gpu_hang_count() = 0;
+
+	/* GEM names passed as kernel arguments stay imported after the arguments
+	 * are destroyed s.t. binding them again costs no ioctl. They must be
+	 * evicted explicitly when they are not used anymore. */
+	virtual std::vector<I915GEMNameImport> get_gem_name_imports() = 0;
+
+	/* Close the import of @param name; it must not be referenced by a kernel
+	 * argument anymore. */
+	virtual void evict_gem_name(uint32_t name) = 0;
+
+	/* Close all imports that are not referenced by a kernel argument */
+	virtual void evict_unused_gem_names() = 0;
+
+	virtual I915BoPoolStats get_bo_pool_stats() = 0;
+
+	/* Free all bos that are currently cached in the pool */
+	virtual void trim_bo_pool() = 0;
+};
+
+/* Counters of an emulated device */
+struct I915FakeDeviceStats
+{
+	uint64_t ioctls = 0;
+	uint64_t execbufs = 0;
+	uint64_t relocations = 0;
+
+	/* Commands parsed by the emulated command streamer */
+	uint64_t commands = 0;
+
+	size_t open_handles = 0;
+
+	/* Batches that were submitted but did not complete yet */
+	size_t pending_batches = 0;
+
+	/* Injected GPU resets */
+	uint64_t resets = 0;
+};
+
+/* An emulated i915 device. It validates submissions like the kernel does
+ * (handles, contexts, pinned addresses and relocation targets) and completes
+ * them by performing the post-sync writes of their PIPE_CONTROLs, without
+ * executing kernels. This allows to measure and test the host side of
+ * dispatches on machines without an Intel GPU. */
+class I915FakeDevice
+{
+public:
+	virtual ~I915FakeDevice() = 0;
+
+	/* Create a bo that can be passed to add_argument_gem_name().
+	 * @returns its GEM name */
+	virtual uint32_t create_named_bo(size_t size) = 0;
+
+	virtual I915FakeDeviceStats get_stats() = 0;
+
+	/* By default, batches complete when they are submitted. With manual
+	 * completion, they stay pending until complete_next() or complete_all()
+	 * is called, and GEM_WAIT blocks until then or until its timeout
+	 * expires. Batches complete in submission order; disabling manual
+	 * completion completes the pending ones. These functions may be called
+	 * from other threads than the RTE's. */
+	virtual void set_manual_completion(bool enable) = 0;
+
+	/* Complete the oldest pending batch.
+	 * @returns false if no batch is pending */
+	virtual bool complete_next() = 0;
+
+	/* @returns the number of batches that completed */
+	virtual size_t complete_all() = 0;
+
+	/* The next submitted batch hangs: it never completes, and later batches
+	 * queue up behind it, until reset_gpu() is called. */
+	virtual void hang_next_batch() = 0;
+
+	/* Emulate a GPU reset: all pending batches are dropped without
+	 * completing. Like with the kernel, the reset stats of the context that
+	 * submitted the oldest (active) batch count it as active, the other
+	 * batches count as pending for their contexts. */
+	virtual void reset_gpu() = 0;
+
+	/* By default, the timestamp counter follows the host's clock. With a
+	 * step > 0, it advances by @param ticks whenever a timestamp is written
+	 * or read instead, which makes measured dispatch times deterministic. */
+	virtual void set_timestamp_step(uint64_t ticks) = 0;
 };
 
 std::unique_ptr<I915RTE> create_i915_rte(const char* device);
 
+/* @param pci_id selects the emulated device; the default is a SKL GT2 */
+std::shared_ptr<I915FakeDevice> create_i915_fake_device(int pci_id = 0x1912);
+std::unique_ptr<I915RTE> create_i915_rte(std::shared_ptr<I915FakeDevice> device);
+
 }
 
 #endif /* __LLT_GPGPU_RT_I915_RUNTIME_H */
@@ -3,8 +3,11 @@
 #define __LLT_GPGPU_RT_OCL_RUNTIME_H
 
 #include <cstdint>
+#include <chrono>
 #include <memory>
 #include <string>
+#include <stdexcept>
+#include <vector>
 
 namespace OCL
 {
@@ -19,6 +22,68 @@ public:
 	NDRange(uint32_t x, uint32_t y = 1, uint32_t z = 1);
 };
 
+/* Waiting for a kernel exceeded the configured timeout. The kernel may still
+ * be running, hence its buffers must not be freed yet. */
+class TimeoutError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+/* A kernel did not complete because the GPU hung or the context was banned.
+ * The RTE stays usable. */
+class GpuHangError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+/* GPU execution time of a dispatch. The timestamps are relative to an
+ * arbitrary epoch. */
+struct DispatchTimes
+{
+	std::chrono::nanoseconds start{0};
+	std::chrono::nanoseconds end{0};
+};
+
+/* Completion of an asynchronously executed kernel */
+class Event
+{
+public:
+	virtual ~Event() = 0;
+
+	/* Block until the kernel finished.
+	 * @throws TimeoutError if the RTE's or queue's timeout expired
+	 * @throws GpuHangError */
+	virtual void wait() = 0;
+
+	virtual bool is_complete() = 0;
+
+	/* @returns true if the kernel finished within @param timeout
+	 * @throws GpuHangError */
+	virtual bool wait_for(std::chrono::nanoseconds timeout) = 0;
+
+	/* Execution times of the profiled dispatches covered by the event in
+	 * submission order; empty if profiling was disabled. The event must be
+	 * complete. */
+	virtual std::vector<DispatchTimes> get_dispatch_times() = 0;
+};
+
+/* Cache policy for the accesses to a buffer argument */
+enum class CacheHint
+{
+	/* As chosen by the compiler */
+	Default,
+
+	/* Kept in the LLC and L3, e.g. for lookup tables or reference frames
+	 * that are read repeatedly */
+	Cached,
+
+	/* Bypasses the LLC and L3, e.g. for output that is written once and not
+	 * read by the GPU again */
+	Streaming,
+};
+
 class Kernel
 {
 public:
@@ -36,11 +101,66 @@ public:
 	virtual void add_argument(int32_t) = 0;
 	virtual void add_argument(uint64_t) = 0;
 	virtual void add_argument(int64_t) = 0;
+	virtual void add_argument(float) = 0;
+	virtual void add_argument(double) = 0;
 
 	/* @param size is in bytes */
 	virtual void add_argument(void*, size_t) = 0;
+	virtual void add_argument(void*, size_t, CacheHint) = 0;
+
+	/* By-value argument of any type, e.g. a vector or struct, in the
+	 * kernel's layout. @param size must match the size of the type. */
+	virtual void add_argument_value(const void*, size_t) = 0;
+
+	/* __constant pointer argument whose @param size bytes are copied when
+	 * binding. Each dispatch copies them again to its own state, from where
+	 * the kernel reads them like a buffer; intended for small lookup tables
+	 * that would otherwise need a buffer of their own. At most 64KiB. */
+	virtual void add_argument_constant(const void*, size_t) = 0;
+
+	/* __local pointer argument that receives @param size bytes of shared
+	 * local memory per work group */
+	virtual void add_argument_local(size_t) = 0;
+
+	/* Bind or rebind the argument at @param index. Only the state that
+	 * depends on changed arguments is rebuilt when the kernel is executed
+	 * next. */
+	virtual void set_argument(unsigned index, uint32_t) = 0;
+	virtual void set_argument(unsigned index, int32_t) = 0;
+	virtual void set_argument(unsigned index, uint64_t) = 0;
+	virtual void set_argument(unsigned index, int64_t) = 0;
+	virtual void set_argument(unsigned index, float) = 0;
+	virtual void set_argument(unsigned index, double) = 0;
+
+	/* @param size is in bytes */
+	virtual void set_argument(unsigned index, void*, size_t) = 0;
+	virtual void set_argument(unsigned index, void*, size_t, CacheHint) = 0;
+
+	virtual void set_argument_value(unsigned index, const void*, size_t) = 0;
+	virtual void set_argument_constant(unsigned index, const void*, size_t) = 0;
+	virtual void set_argument_local(unsigned index, size_t) = 0;
 
 	virtual void execute(NDRange global_size, NDRange local_size) = 0;
+
+	/* Returns as soon as the kernel has been submitted to the GPU. The
+	 * arguments of the prepared kernel may be changed and the kernel may be
+	 * executed again while it is still running; however buffer arguments must
+	 * not be freed before the event completed. */
+	virtual std::shared_ptr<Event> execute_async(NDRange global_size, NDRange local_size) = 0;
+
+	/* Execute the work items global_offset ... global_offset + global_size -
+	 * 1. get_global_id() includes the offset, while work group ids start at
+	 * 0. */
+	virtual void execute(NDRange global_offset,
+			NDRange global_size, NDRange local_size) = 0;
+
+	virtual std::shared_ptr<Event> execute_async(NDRange global_offset,
+			NDRange global_size, NDRange local_size) = 0;
+
+	/* The local size is chosen by the runtime based on the kernel's
+	 * requirements and the device */
+	virtual void execute(NDRange global_size) = 0;
+	virtual std::shared_ptr<Event> execute_async(NDRange global_size) = 0;
 };
 
 /* Runtime environment */
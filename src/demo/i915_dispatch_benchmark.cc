@@ -0,0 +1,149 @@
+/** Measures the host-side cost of dispatching kernels. Runs against an
+ * emulated device by default, hence it does not require an Intel GPU; pass a
+ * DRM device node to measure a real one. */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <new>
+
+#include <llt_gpgpu_rt/i915_runtime.h>
+#include "utils.h"
+#include "i915_memset.clch"
+
+using namespace std;
+
+
+/* Count heap allocations */
+static atomic<uint64_t> cnt_allocations{0};
+
+void* operator new(size_t size)
+{
+	cnt_allocations.fetch_add(1, memory_order_relaxed);
+
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+
+template<typename F>
+void measure(const char* name, unsigned iterations, F f)
+{
+	/* Warm up caches and pools */
+	for (unsigned i = 0; i < 16; i++)
+		f();
+
+	auto allocations = cnt_allocations.load();
+	auto t_start = chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; i++)
+		f();
+
+	auto t_end = chrono::steady_clock::now();
+	allocations = cnt_allocations.load() - allocations;
+
+	double seconds = chrono::duration<double>(t_end - t_start).count();
+
+	printf("%-24s %10.0f dispatches/s  %8.3f us/dispatch  %6.2f allocations/dispatch\n",
+			name,
+			iterations / seconds,
+			seconds * 1e6 / iterations,
+			(double) allocations / iterations);
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned iterations = 100000;
+
+	try
+	{
+		shared_ptr<OCL::I915FakeDevice> device;
+		unique_ptr<OCL::I915RTE> rte;
+
+		if (argc > 1)
+		{
+			rte = OCL::create_i915_rte(argv[1]);
+			iterations = 10000;
+		}
+		else
+		{
+			device = OCL::create_i915_fake_device();
+			rte = OCL::create_i915_rte(device);
+		}
+
+		auto kernel = rte->read_compiled_kernel(CompiledGPUProgramsI915::i915_memset(), "cl_memset");
+
+		AlignedBuffer buf(rte->get_page_size(), 1024 * 1024);
+		memset(buf.ptr(), 0, buf.size());
+		rte->register_host_memory(buf.ptr(), buf.size());
+
+		auto pkernel = rte->prepare_kernel(kernel);
+		pkernel->add_argument((unsigned) buf.size() / 4);
+		pkernel->add_argument(0x12345678U);
+		pkernel->add_argument((void*) buf.ptr(), buf.size());
+
+		OCL::NDRange global_size(buf.size() / 4);
+		OCL::NDRange local_size(256);
+
+		measure("execute", iterations, [&]() {
+			pkernel->execute(global_size, local_size);
+		});
+
+		measure("execute_async", iterations, [&]() {
+			pkernel->execute_async(global_size, local_size)->wait();
+		});
+
+		auto queue = rte->create_command_queue();
+		measure("command queue (x16)", iterations / 16, [&]() {
+			for (unsigned i = 0; i < 16; i++)
+				queue->enqueue(*pkernel, global_size, local_size);
+
+			queue->finish();
+		});
+
+		queue.reset();
+		pkernel.reset();
+		rte->unregister_host_memory(buf.ptr());
+
+		auto pool_stats = rte->get_bo_pool_stats();
+		printf("\nbo pool: %lu allocated, %lu reused, %lu USERPTR, %lu GEM_CLOSE\n",
+				(unsigned long) pool_stats.allocated,
+				(unsigned long) pool_stats.reused,
+				(unsigned long) pool_stats.userptr_ioctls,
+				(unsigned long) pool_stats.gem_close_ioctls);
+
+		if (device)
+		{
+			auto stats = device->get_stats();
+			printf("fake device: %lu ioctls, %lu execbufs, %lu relocations, %lu commands, %lu open handles\n",
+					(unsigned long) stats.ioctls,
+					(unsigned long) stats.execbufs,
+					(unsigned long) stats.relocations,
+					(unsigned long) stats.commands,
+					(unsigned long) stats.open_handles);
+		}
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/** Measures the host-side cost of the per-thread local id payload of 1024
+ * work item groups: generating it with a divide/modulo chain per lane, as
+ * dispatches used to, with the runtime's generators, and copying a cached
+ * payload. Does not require an Intel GPU. */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <vector>
+
+#include "i915_local_ids.h"
+
+using namespace std;
+
+
+/* The former per-dispatch generation */
+static bool generate_local_ids_divmod(const OCL::I915LocalIdShape& shape, char* dst)
+{
+	uint16_t x = 0;
+	uint16_t y = 0;
+	uint16_t z = 0;
+
+	for (unsigned i = 0; i < shape.cnt_threads; i++)
+	{
+		auto local_id_x = (uint16_t*) (dst);
+		auto local_id_y = (uint16_t*) (dst + shape.local_id_size);
+		auto local_id_z = (uint16_t*) (dst + shape.local_id_size * 2);
+
+		for (unsigned j = 0; j < shape.simd_size; j++)
+		{
+			local_id_x[j] = x;
+			local_id_y[j] = y;
+			local_id_z[j] = z;
+
+			x += 1;
+			y += x / shape.local_size[0];
+			x = x % shape.local_size[0];
+			z += y / shape.local_size[1];
+			y = y % shape.local_size[1];
+		}
+
+		dst += shape.per_thread_size;
+	}
+
+	return true;
+}
+
+template<typename F>
+void measure(const char* name, unsigned iterations, F f)
+{
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (!f())
+		{
+			printf("  %-10s not supported\n", name);
+			return;
+		}
+	}
+
+	auto t_start = chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; i++)
+		f();
+
+	auto t_end = chrono::steady_clock::now();
+	double seconds = chrono::duration<double>(t_end - t_start).count();
+
+	printf("  %-10s %8.1f ns/group\n", name, seconds * 1e9 / iterations);
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+	struct
+	{
+		uint32_t local_size[3];
+		unsigned simd_size;
+	} configs[] = {
+		{ { 1024, 1, 1 }, 16 },
+		{ { 1024, 1, 1 }, 32 },
+		{ { 32, 32, 1 }, 16 },
+		{ { 16, 8, 8 }, 16 },
+		{ { 8, 8, 16 }, 32 },
+	};
+
+	try
+	{
+		for (auto& c : configs)
+		{
+			OCL::I915LocalIdShape shape;
+			memcpy(shape.local_size, c.local_size, sizeof(shape.local_size));
+			shape.simd_size = c.simd_size;
+			shape.cnt_threads = 1024 / c.simd_size;
+			shape.local_id_size = 32 * (c.simd_size == 32 ? 2 : 1);
+			shape.per_thread_size = 3 * shape.local_id_size;
+
+			vector<char> dst(shape.per_thread_size * shape.cnt_threads);
+			vector<char> cached(dst.size());
+			OCL::generate_local_ids(shape, cached.data());
+
+			printf("local size %ux%ux%u, SIMD%u:\n",
+					c.local_size[0], c.local_size[1], c.local_size[2], c.simd_size);
+
+			measure("div/mod", iterations, [&]() {
+				return generate_local_ids_divmod(shape, dst.data());
+			});
+
+			measure("scalar", iterations, [&]() {
+				return OCL::generate_local_ids_scalar(shape, dst.data());
+			});
+
+			measure("SSE2", iterations, [&]() {
+				return OCL::generate_local_ids_sse2(shape, dst.data());
+			});
+
+			measure("AVX2", iterations, [&]() {
+				return OCL::generate_local_ids_avx2(shape, dst.data());
+			});
+
+			measure("cached", iterations, [&]() {
+				memcpy(dst.data(), cached.data(), dst.size());
+				return true;
+			});
+		}
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -521,6 +521,11 @@ void draw(OCL::I915RTE& rte, shared_ptr<OCL::Kernel> kernel, XCBWindow& win,
 	if (win.get_width() > 3840 || win.get_height() > 2160)
 		return;
 
+	/* Back buffers are reallocated when the window is resized; close the
+	 * imports of old ones */
+	if (rte.get_gem_name_imports().size() > 2)
+		rte.evict_unused_gem_names();
+
 	auto buf = win.get_backbuffer();
 
 	/* Execute kernel */
@@ -546,24 +546,26 @@ void update_pattern(int width, int height,
 	}
 }
 
-void draw(OCL::I915RTE& rte, shared_ptr<OCL::Kernel> kernel, XCBWindow& win,
+void draw(OCL::I915RTE& rte, OCL::I915PreparedKernel& pkernel, XCBWindow& win,
 		double pos, AlignedBuffer& colormap)
 {
-	auto buf = win.get_backbuffer();
+	/* Back buffers are reallocated when the window is resized; close the
+	 * imports of old ones */
+	if (rte.get_gem_name_imports().size() > 2)
+		rte.evict_unused_gem_names();
 
-	/* Execute kernel */
-	auto pkernel = rte.prepare_kernel(kernel);
-	auto& i915_pkernel = static_cast<OCL::I915PreparedKernel&>(*pkernel);
+	auto buf = win.get_backbuffer();
 
+	/* Execute kernel; only changed arguments are applied again */
 	unsigned x_tiles = DIV_ROUND_UP(buf.width, 128);
 
-	pkernel->add_argument((unsigned) buf.width);
-	pkernel->add_argument((unsigned) buf.height);
-	pkernel->add_argument((unsigned) buf.pitch / 4);
-	pkernel->add_argument((unsigned) (pos * 65535));
-	pkernel->add_argument(colormap.ptr(), colormap.size());
-	i915_pkernel.add_argument_gem_name(buf.name);
-	pkernel->execute(
+	pkernel.set_argument(0, (unsigned) buf.width);
+	pkernel.set_argument(1, (unsigned) buf.height);
+	pkernel.set_argument(2, (unsigned) buf.pitch / 4);
+	pkernel.set_argument(3, (unsigned) (pos * 65535));
+	pkernel.set_argument(4, colormap.ptr(), colormap.size());
+	pkernel.set_argument_gem_name(5, buf.name);
+	pkernel.execute(
 			OCL::NDRange(x_tiles * 128, ((buf.height + 1) / 2) * 2),
 			OCL::NDRange(128, 2));
 
@@ -610,6 +612,9 @@ int main(int argc, char** argv)
 		*ptr++ = 0xff; *ptr++ = 0xff; *ptr++ = 0xff; ptr++;
 		*ptr++ = 0xff; *ptr++ = 0xff; *ptr++ = 0xff; ptr++;
 
+		auto pkernel = rte->prepare_kernel(kernel);
+		auto& i915_pkernel = static_cast<OCL::I915PreparedKernel&>(*pkernel);
+
 		/* Main loop */
 		while (!win.is_closed())
 		{
@@ -617,7 +622,7 @@ int main(int argc, char** argv)
 			pos = pos - floor(pos);
 
 			xcb.main_iteration(false);
-			draw(*rte, kernel, win, pos, colormap);
+			draw(*rte, i915_pkernel, win, pos, colormap);
 		}
 	}
 	catch (exception& e)
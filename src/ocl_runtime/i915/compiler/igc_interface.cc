@@ -278,11 +278,16 @@ vector<string> IGCInterface::get_supported_extensions()
 	return exts;
 }
 
-string IGCInterface::get_internal_options()
+string IGCInterface::get_internal_options(const string& build_options)
 {
 	string options;
 
-	options += "-ocl-version=120 ";
+	/* The frontend rejects a -cl-std above the device's OpenCL version;
+	 * OpenCL 1.2 programs keep seeing an OpenCL 1.2 device */
+	if (build_options.find("-cl-std=CL2.0") != string::npos)
+		options += "-ocl-version=200 ";
+	else
+		options += "-ocl-version=120 ";
 
 	/* Add supported extensions */
 	options += "-cl-ext=-all";
@@ -382,7 +387,7 @@ unique_ptr<IGCInterface::Binary> IGCInterface::build(
 	if (!options_buf)
 		throw runtime_error("Failed to create buffer for options");
 
-	string internal_options = get_internal_options();
+	string internal_options = get_internal_options(options);
 	auto internal_options_buf = CIF::Builtins::CreateConstBuffer(fcl_main.get(),
 			internal_options.c_str(), internal_options.size());
 
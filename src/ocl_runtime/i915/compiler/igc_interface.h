@@ -99,7 +99,7 @@ protected:
 	CIF::RAII::UPtr_t<IGC::IgcOclDeviceCtxTagOCL> igc_device_ctx = nullptr;
 
 	std::vector<std::string> get_supported_extensions();
-	std::string get_internal_options();
+	std::string get_internal_options(const std::string& build_options);
 	std::unique_ptr<IntermediateRepresentation> build_ir(
 			const std::string& src,
 			CIF::Builtins::BufferLatest* options,
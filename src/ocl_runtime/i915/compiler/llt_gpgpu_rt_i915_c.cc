@@ -25,6 +25,7 @@ struct Args
 	string input_filename;
 	string output_filename;
 	string cl_standard;
+	bool uniform_work_group_size = false;
 
 	void print_help()
 	{
@@ -35,7 +36,10 @@ struct Args
 
 				"Options:\n"
 				"    -o <output filename>\n"
-				"    -cl-std=<OpenCL standard>  Currently only CL1.2 is supported\n"
+				"    -cl-std=<OpenCL standard>  CL1.2 or CL2.0\n"
+				"    -cl-uniform-work-group-size\n"
+				"                               Only with CL2.0; the global size\n"
+				"                               must be a multiple of the local size\n"
 				"    --help\n\n",
 				LLT_GPGPU_RT_VERSION_MAJOR, LLT_GPGPU_RT_VERSION_MINOR,
 				LLT_GPGPU_RT_VERSION_PATCH);
@@ -70,7 +74,8 @@ struct Args
 					output_filename = argv[i];
 					have_output_filename = true;
 				}
-				else if (strcmp(arg, "-cl-std=CL1.2") == 0)
+				else if (strcmp(arg, "-cl-std=CL1.2") == 0 ||
+						strcmp(arg, "-cl-std=CL2.0") == 0)
 				{
 					if (have_cl_standard)
 					{
@@ -78,9 +83,13 @@ struct Args
 						return false;
 					}
 
-					cl_standard = "CL1.2";
+					cl_standard = arg + strlen("-cl-std=");
 					have_cl_standard = true;
 				}
+				else if (strcmp(arg, "-cl-uniform-work-group-size") == 0)
+				{
+					uniform_work_group_size = true;
+				}
 				else if (strcmp(arg, "--help") == 0)
 				{
 					print_help();
@@ -111,6 +120,13 @@ struct Args
 			return false;
 		}
 
+		/* Work groups are always uniform before OpenCL 2.0 */
+		if (uniform_work_group_size && cl_standard != "CL2.0")
+		{
+			fprintf(stderr, "-cl-uniform-work-group-size requires -cl-std=CL2.0\n");
+			return false;
+		}
+
 		return true;
 	}
 };
@@ -208,6 +224,8 @@ string device_type_to_string(OCL::i915_device_type type)
 bool main_exc(Args& args)
 {
 	string options = "-cl-std=" + args.cl_standard;
+	if (args.uniform_work_group_size)
+		options += " -cl-uniform-work-group-size";
 
 	File input(args.input_filename.c_str(), "r");
 	File output(args.output_filename.c_str(), "w");
@@ -378,6 +396,10 @@ bool main_exc(Args& args)
 	}
 )SRC");
 
+	/* The options consist of characters that need no escaping */
+	output.write("\n\tconst char* get_build_options() const override\n\t{\n"
+			"\t\treturn \"" + options + "\";\n\t}\n");
+
 	output.write("};\n\n");
 
 	/* Binaries definition */
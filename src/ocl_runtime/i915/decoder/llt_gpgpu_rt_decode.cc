@@ -0,0 +1,110 @@
+/** Decodes batch buffers from memory dumps, e.g. without a GPU in CI.
+ *
+ * Each dump is given as <GPU address>:<file>; decoding starts at the address
+ * of the first one. Further dumps supply the second level batch buffer and the
+ * dynamic- and surface state heaps. The exit status is 2 if the decoder
+ * reported warnings. */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+#include "llt_gpgpu_rt_config.h"
+#include "i915_batch_decoder.h"
+
+using namespace std;
+using namespace OCL;
+
+
+struct Dump
+{
+	uint64_t address;
+	vector<char> data;
+};
+
+static void print_help()
+{
+	fprintf(stderr,
+			"Batch buffer decoder of LLT GPGPU Runtime Version %d.%d.%d\n\n"
+
+			"Usage: llt_gpgpu_rt_decode <address>:<file> [<address>:<file> ...]\n\n"
+
+			"Decodes the batch buffer at the address of the first memory dump.\n",
+			LLT_GPGPU_RT_VERSION_MAJOR, LLT_GPGPU_RT_VERSION_MINOR,
+			LLT_GPGPU_RT_VERSION_PATCH);
+}
+
+static Dump read_dump(const char* arg)
+{
+	auto sep = strchr(arg, ':');
+	if (!sep)
+		throw invalid_argument(string("Invalid dump specification `") + arg + "'");
+
+	Dump dump;
+
+	char* end;
+	dump.address = strtoull(arg, &end, 0);
+	if (end != sep)
+		throw invalid_argument(string("Invalid address in `") + arg + "'");
+
+	auto fp = fopen(sep + 1, "rb");
+	if (!fp)
+		throw system_error(errno, generic_category(), string("open ") + (sep + 1));
+
+	char buf[10240];
+	size_t cnt;
+	while ((cnt = fread(buf, 1, sizeof(buf), fp)) > 0)
+		dump.data.insert(dump.data.end(), buf, buf + cnt);
+
+	bool failed = ferror(fp);
+	fclose(fp);
+
+	if (failed)
+		throw runtime_error(string("Failed to read ") + (sep + 1));
+
+	return dump;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || strcmp(argv[1], "--help") == 0)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		vector<Dump> dumps;
+		for (int i = 1; i < argc; i++)
+			dumps.push_back(read_dump(argv[i]));
+
+		auto resolve = [&dumps](uint64_t address, size_t size) -> const char* {
+			for (auto& d : dumps)
+			{
+				if (address >= d.address && address + size <= d.address + d.data.size())
+					return d.data.data() + (address - d.address);
+			}
+
+			return nullptr;
+		};
+
+		I915BatchDecoder decoder(stdout, resolve);
+		auto cnt_warnings = decoder.decode(dumps[0].address);
+
+		if (cnt_warnings > 0)
+		{
+			fprintf(stderr, "%u warnings\n", cnt_warnings);
+			return 2;
+		}
+
+		return EXIT_SUCCESS;
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "Error: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+}
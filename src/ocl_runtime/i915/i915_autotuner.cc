@@ -0,0 +1,252 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include "i915_autotuner.h"
+#include "i915_runtime_impl.h"
+
+using namespace std;
+
+namespace OCL
+{
+
+I915TuningTimer::~I915TuningTimer()
+{
+}
+
+
+static uint8_t ndrange_class(uint32_t size)
+{
+	uint8_t c = 0;
+	while (c < 32 && (1ULL << c) < size)
+		c++;
+
+	return c;
+}
+
+I915TuningKey::I915TuningKey(uint32_t checksum, uint32_t device_id,
+		const NDRange& global_size)
+	:
+		checksum(checksum), device_id(device_id)
+{
+	ndrange_class[0] = OCL::ndrange_class(global_size.x);
+	ndrange_class[1] = OCL::ndrange_class(global_size.y);
+	ndrange_class[2] = OCL::ndrange_class(global_size.z);
+}
+
+bool I915TuningKey::operator<(const I915TuningKey& o) const
+{
+	return
+		tie(checksum, device_id, ndrange_class[0], ndrange_class[1], ndrange_class[2]) <
+		tie(o.checksum, o.device_id, o.ndrange_class[0], o.ndrange_class[1], o.ndrange_class[2]);
+}
+
+
+I915TuningDatabase::I915TuningDatabase(const string& path)
+	: path(path)
+{
+	load();
+}
+
+void I915TuningDatabase::load()
+{
+	auto fp = fopen(path.c_str(), "r");
+	if (!fp)
+	{
+		if (errno == ENOENT)
+			return;
+
+		throw system_error(errno, generic_category(), "Failed to open tuning database");
+	}
+
+	char line[256];
+	unsigned line_no = 0;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		line_no++;
+
+		unsigned checksum, device_id;
+		unsigned c[3], l[3];
+		unsigned long long time_ns;
+
+		if (sscanf(line, "%x %x %u %u %u %u %u %u %llu",
+					&checksum, &device_id, &c[0], &c[1], &c[2],
+					&l[0], &l[1], &l[2], &time_ns) != 9 ||
+				c[0] > 32 || c[1] > 32 || c[2] > 32 ||
+				l[0] < 1 || l[1] < 1 || l[2] < 1)
+		{
+			fclose(fp);
+			throw runtime_error("Malformed tuning database `" + path + "' at line " +
+					std::to_string(line_no));
+		}
+
+		I915TuningKey key;
+		key.checksum = checksum;
+		key.device_id = device_id;
+
+		I915TuningEntry entry;
+		entry.time_ns = time_ns;
+
+		for (int d = 0; d < 3; d++)
+		{
+			key.ndrange_class[d] = c[d];
+			entry.local_size[d] = l[d];
+		}
+
+		entries[key] = entry;
+	}
+
+	bool failed = ferror(fp);
+	fclose(fp);
+
+	if (failed)
+		throw runtime_error("Failed to read tuning database `" + path + "'");
+}
+
+void I915TuningDatabase::save() const
+{
+	/* Replace the file atomically s.t. readers never see a partial
+	 * database */
+	auto tmp_path = path + ".tmp";
+
+	auto fp = fopen(tmp_path.c_str(), "w");
+	if (!fp)
+		throw system_error(errno, generic_category(), "Failed to create tuning database");
+
+	for (auto& [key, entry] : entries)
+	{
+		fprintf(fp, "%08x %04x %u %u %u %u %u %u %" PRIu64 "\n",
+				(unsigned) key.checksum, (unsigned) key.device_id,
+				(unsigned) key.ndrange_class[0],
+				(unsigned) key.ndrange_class[1],
+				(unsigned) key.ndrange_class[2],
+				(unsigned) entry.local_size[0],
+				(unsigned) entry.local_size[1],
+				(unsigned) entry.local_size[2],
+				entry.time_ns);
+	}
+
+	if (fclose(fp) != 0)
+		throw system_error(errno, generic_category(), "Failed to write tuning database");
+
+	if (rename(tmp_path.c_str(), path.c_str()) != 0)
+		throw system_error(errno, generic_category(), "Failed to replace tuning database");
+}
+
+const I915TuningEntry* I915TuningDatabase::lookup(const I915TuningKey& key) const
+{
+	auto i = entries.find(key);
+	if (i == entries.end())
+		return nullptr;
+
+	return &i->second;
+}
+
+void I915TuningDatabase::store(const I915TuningKey& key, const I915TuningEntry& entry)
+{
+	entries[key] = entry;
+	save();
+}
+
+
+chrono::nanoseconds I915GpuTuningTimer::measure(PreparedKernel& _kernel,
+		NDRange global_size, NDRange local_size)
+{
+	auto kernel = dynamic_cast<I915PreparedKernelImpl*>(&_kernel);
+	if (!kernel)
+		throw invalid_argument("Given PreparedKernel must be an I915PreparedKernel");
+
+	auto event = kernel->submit(NDRange(0, 0, 0), global_size, local_size, true);
+	event->wait();
+
+	auto times = event->get_dispatch_times();
+	if (times.size() != 1)
+		throw runtime_error("Expected the times of exactly one dispatch");
+
+	return times[0].end - times[0].start;
+}
+
+
+vector<array<uint32_t, 3>> tuning_candidates(const NDRange& global_size,
+		uint32_t simd_size, uint32_t max_threads, bool exact)
+{
+	const uint32_t global[3] = { global_size.x, global_size.y, global_size.z };
+	uint32_t max_items = min<uint32_t>(max_threads * simd_size, 1024);
+
+	/* Sizes per dimension */
+	vector<uint32_t> sizes[3];
+
+	for (uint32_t t = 1; t <= max_threads && t * simd_size <= max_items; t *= 2)
+		sizes[0].push_back(min(t * simd_size, global[0]));
+
+	for (int d = 1; d < 3; d++)
+	{
+		for (uint32_t s = 1; s <= max_items; s *= 2)
+			sizes[d].push_back(min(s, global[d]));
+	}
+
+	set<array<uint32_t, 3>> candidates;
+
+	for (auto x : sizes[0])
+	{
+		for (auto y : sizes[1])
+		{
+			for (auto z : sizes[2])
+			{
+				if ((uint64_t) x * y * z > max_items)
+					continue;
+
+				if (exact && (global[0] % x != 0 || global[1] % y != 0 || global[2] % z != 0))
+					continue;
+
+				candidates.insert({ x, y, z });
+			}
+		}
+	}
+
+	return vector<array<uint32_t, 3>>(candidates.begin(), candidates.end());
+}
+
+size_t select_fastest(I915TuningTimer& timer, PreparedKernel& kernel,
+		const NDRange& global_size, const vector<array<uint32_t, 3>>& candidates,
+		unsigned samples, uint64_t& time_ns)
+{
+	if (candidates.empty())
+		throw invalid_argument("No candidate local sizes");
+
+	if (samples < 1)
+		throw invalid_argument("At least one sample is required");
+
+	size_t best = 0;
+	vector<uint64_t> times(samples);
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		NDRange local_size(candidates[i][0], candidates[i][1], candidates[i][2]);
+
+		/* Warm up caches, TLBs and the GPU's clock */
+		timer.measure(kernel, global_size, local_size);
+
+		for (auto& t : times)
+			t = timer.measure(kernel, global_size, local_size).count();
+
+		nth_element(times.begin(), times.begin() + samples / 2, times.end());
+		uint64_t median = times[samples / 2];
+
+		if (i == 0 || median < time_ns)
+		{
+			best = i;
+			time_ns = median;
+		}
+	}
+
+	return best;
+}
+
+}
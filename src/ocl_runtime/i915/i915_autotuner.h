@@ -0,0 +1,89 @@
+/** Empirical choice of local sizes.
+ *
+ * Candidate local sizes are timed for a kernel and a global size, and the
+ * fastest one is kept in a tuning database. The database is a text file with
+ * one entry per line:
+ *
+ *   <checksum> <device id> <class x> <class y> <class z> <local x> <local y> <local z> <time ns>
+ *
+ * Checksum and device id are hexadecimal. The class of a global size is the
+ * rounded-up binary logarithm of each dimension, s.t. similar global sizes
+ * share an entry. */
+#ifndef __I915_AUTOTUNER_H
+#define __I915_AUTOTUNER_H
+
+#include <cstdint>
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <llt_gpgpu_rt/i915_runtime.h>
+
+namespace OCL
+{
+
+struct I915TuningKey
+{
+	uint32_t checksum = 0;
+	uint32_t device_id = 0;
+	uint8_t ndrange_class[3] = {};
+
+	I915TuningKey() = default;
+	I915TuningKey(uint32_t checksum, uint32_t device_id, const NDRange& global_size);
+
+	bool operator<(const I915TuningKey& o) const;
+};
+
+struct I915TuningEntry
+{
+	std::array<uint32_t, 3> local_size{};
+	uint64_t time_ns = 0;
+};
+
+class I915TuningDatabase final
+{
+protected:
+	const std::string path;
+	std::map<I915TuningKey, I915TuningEntry> entries;
+
+	void load();
+	void save() const;
+
+public:
+	/* Reads the file at @param path if it exists */
+	I915TuningDatabase(const std::string& path);
+
+	I915TuningDatabase(const I915TuningDatabase&) = delete;
+	I915TuningDatabase& operator=(const I915TuningDatabase&) = delete;
+
+	/* @returns nullptr if there is no entry for @param key */
+	const I915TuningEntry* lookup(const I915TuningKey& key) const;
+
+	/* Add or replace an entry and write the database back to its file */
+	void store(const I915TuningKey& key, const I915TuningEntry& entry);
+};
+
+/* Measures with the GPU timestamps of a profiled dispatch */
+class I915GpuTuningTimer final : public I915TuningTimer
+{
+public:
+	std::chrono::nanoseconds measure(PreparedKernel& kernel,
+			NDRange global_size, NDRange local_size) override;
+};
+
+/* Local sizes with a power of two number of threads in x and power of two
+ * sizes in y and z, which do not exceed the global size. If @param exact,
+ * only local sizes that divide the global size are returned. */
+std::vector<std::array<uint32_t, 3>> tuning_candidates(const NDRange& global_size,
+		uint32_t simd_size, uint32_t max_threads, bool exact);
+
+/* Measure each candidate @param samples times after a warm-up run.
+ * @returns the index of the candidate with the lowest median time, which is
+ *          stored in @param time_ns */
+size_t select_fastest(I915TuningTimer& timer, PreparedKernel& kernel,
+		const NDRange& global_size, const std::vector<std::array<uint32_t, 3>>& candidates,
+		unsigned samples, uint64_t& time_ns);
+
+}
+
+#endif /* __I915_AUTOTUNER_H */
@@ -0,0 +1,126 @@
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include "i915_backend.h"
+#include "i915_utils.h"
+
+extern "C" {
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+}
+
+using namespace std;
+
+namespace OCL {
+
+I915Backend::~I915Backend()
+{
+}
+
+
+I915DrmBackend::I915DrmBackend(const char* device_path)
+{
+	fd = open(device_path, O_RDWR);
+	if (fd < 0)
+		throw system_error(errno, generic_category(), "Failed to open DRM device");
+}
+
+I915DrmBackend::~I915DrmBackend()
+{
+	close(fd);
+}
+
+drm_version_t I915DrmBackend::get_drm_version(char* driver_name, size_t driver_name_size)
+{
+	return OCL::get_drm_version(fd, driver_name, driver_name_size);
+}
+
+bool I915DrmBackend::get_device_info(struct intel_device_info& dev_info)
+{
+	return intel_get_device_info_from_fd(fd, &dev_info);
+}
+
+int I915DrmBackend::i915_getparam(int32_t param)
+{
+	return OCL::i915_getparam(fd, param);
+}
+
+bool I915DrmBackend::gem_supports_wc_mmap()
+{
+	return OCL::gem_supports_wc_mmap(fd);
+}
+
+uint32_t I915DrmBackend::gem_userptr(void* ptr, uint64_t size, bool probe)
+{
+	return OCL::gem_userptr(fd, ptr, size, probe);
+}
+
+void I915DrmBackend::gem_open(uint32_t name, uint32_t& handle, uint64_t& size)
+{
+	OCL::gem_open(fd, name, handle, size);
+}
+
+void I915DrmBackend::gem_close(uint32_t handle)
+{
+	OCL::gem_close(fd, handle);
+}
+
+uint32_t I915DrmBackend::gem_context_create()
+{
+	return OCL::gem_context_create(fd);
+}
+
+void I915DrmBackend::gem_context_destroy(uint32_t id)
+{
+	OCL::gem_context_destroy(fd, id);
+}
+
+void I915DrmBackend::gem_context_set_vm(uint32_t ctx_id, uint32_t vm_id)
+{
+	OCL::gem_context_set_vm(fd, ctx_id, vm_id);
+}
+
+uint32_t I915DrmBackend::gem_vm_create()
+{
+	return OCL::gem_vm_create(fd);
+}
+
+void I915DrmBackend::gem_vm_destroy(uint32_t id)
+{
+	OCL::gem_vm_destroy(fd, id);
+}
+
+void I915DrmBackend::gem_execbuffer2(uint32_t ctx_id, vector<I915ExecBo>& bos,
+		size_t batch_len)
+{
+	OCL::gem_execbuffer2(fd, ctx_id, bos, batch_len);
+}
+
+int64_t I915DrmBackend::gem_wait(uint32_t bo, int64_t timeout_ns)
+{
+	return OCL::gem_wait(fd, bo, timeout_ns);
+}
+
+void I915DrmBackend::gem_get_reset_stats(uint32_t ctx_id,
+		uint32_t& batch_active, uint32_t& batch_pending)
+{
+	OCL::gem_get_reset_stats(fd, ctx_id, batch_active, batch_pending);
+}
+
+uint64_t I915DrmBackend::reg_read(uint64_t offset)
+{
+	return OCL::reg_read(fd, offset);
+}
+
+drm_magic_t I915DrmBackend::get_drm_magic()
+{
+	drm_magic_t magic;
+	if (drmGetMagic(fd, &magic) != 0)
+		throw runtime_error("drmGetMagic failed");
+
+	return magic;
+}
+
+}
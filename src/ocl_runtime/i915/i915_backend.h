@@ -0,0 +1,111 @@
+/** Access to the i915 kernel driver. All ioctls of the RTE go through a
+ * backend s.t. the device can be replaced by an emulation (see
+ * i915_fake_backend.h). */
+#ifndef __I915_BACKEND_H
+#define __I915_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <tuple>
+
+extern "C" {
+#include <xf86drm.h>
+#include "third_party/drm-uapi/i915_drm.h"
+}
+
+#include "third_party/mesa/intel_device_info.h"
+
+namespace OCL {
+
+/* A bo passed to EXECBUFFER2: handle, address at which the bo is pinned and
+ * relocations. Bos with relocations or a null address are not pinned, but
+ * placed by the kernel; e.g. imported bos, which are relocation targets. */
+typedef std::tuple<uint32_t, void*, std::vector<struct drm_i915_gem_relocation_entry>>
+	I915ExecBo;
+
+class I915Backend
+{
+public:
+	virtual ~I915Backend() = 0;
+
+	virtual drm_version_t get_drm_version(char* driver_name, size_t driver_name_size) = 0;
+	virtual bool get_device_info(struct intel_device_info& dev_info) = 0;
+
+	virtual int i915_getparam(int32_t param) = 0;
+	virtual bool gem_supports_wc_mmap() = 0;
+
+	/* NOTE: ptr, size must be aligned to the system's page size */
+	virtual uint32_t gem_userptr(void* ptr, uint64_t size, bool probe) = 0;
+	virtual void gem_open(uint32_t name, uint32_t& handle, uint64_t& size) = 0;
+	virtual void gem_close(uint32_t handle) = 0;
+
+	virtual uint32_t gem_context_create() = 0;
+	virtual void gem_context_destroy(uint32_t id) = 0;
+	virtual void gem_context_set_vm(uint32_t ctx_id, uint32_t vm_id) = 0;
+
+	virtual uint32_t gem_vm_create() = 0;
+	virtual void gem_vm_destroy(uint32_t id) = 0;
+
+	/* The last bo is the batch buffer */
+	virtual void gem_execbuffer2(uint32_t ctx_id, std::vector<I915ExecBo>& bos,
+			size_t batch_len) = 0;
+
+	/* @returns the remaining time or -1 if the timeout expired */
+	virtual int64_t gem_wait(uint32_t bo, int64_t timeout_ns) = 0;
+
+	virtual void gem_get_reset_stats(uint32_t ctx_id,
+			uint32_t& batch_active, uint32_t& batch_pending) = 0;
+
+	/* @param offset may include I915_REG_READ_8B_WA */
+	virtual uint64_t reg_read(uint64_t offset) = 0;
+
+	virtual drm_magic_t get_drm_magic() = 0;
+};
+
+/* A DRM device node */
+class I915DrmBackend final : public I915Backend
+{
+protected:
+	int fd = -1;
+
+public:
+	I915DrmBackend(const char* device_path);
+
+	I915DrmBackend(const I915DrmBackend&) = delete;
+	I915DrmBackend& operator=(const I915DrmBackend&) = delete;
+
+	~I915DrmBackend();
+
+	drm_version_t get_drm_version(char* driver_name, size_t driver_name_size) override;
+	bool get_device_info(struct intel_device_info& dev_info) override;
+
+	int i915_getparam(int32_t param) override;
+	bool gem_supports_wc_mmap() override;
+
+	uint32_t gem_userptr(void* ptr, uint64_t size, bool probe) override;
+	void gem_open(uint32_t name, uint32_t& handle, uint64_t& size) override;
+	void gem_close(uint32_t handle) override;
+
+	uint32_t gem_context_create() override;
+	void gem_context_destroy(uint32_t id) override;
+	void gem_context_set_vm(uint32_t ctx_id, uint32_t vm_id) override;
+
+	uint32_t gem_vm_create() override;
+	void gem_vm_destroy(uint32_t id) override;
+
+	void gem_execbuffer2(uint32_t ctx_id, std::vector<I915ExecBo>& bos,
+			size_t batch_len) override;
+
+	int64_t gem_wait(uint32_t bo, int64_t timeout_ns) override;
+
+	void gem_get_reset_stats(uint32_t ctx_id,
+			uint32_t& batch_active, uint32_t& batch_pending) override;
+
+	uint64_t reg_read(uint64_t offset) override;
+
+	drm_magic_t get_drm_magic() override;
+};
+
+}
+
+#endif /* __I915_BACKEND_H */
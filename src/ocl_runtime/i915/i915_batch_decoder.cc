@@ -0,0 +1,349 @@
+#include <cstring>
+#include <string>
+#include "i915_batch_decoder.h"
+#include "i915_kernel_utils.h"
+#include "gen9_hw_int.h"
+
+using namespace std;
+
+namespace OCL
+{
+
+using namespace HWInt;
+
+/* Upper bound for malformed (e.g. cyclic) batches */
+static constexpr unsigned MAX_COMMANDS = 65536;
+
+template<typename C>
+static bool read_cmd(const I915BatchDecoder::resolve_t& resolve,
+		uint64_t address, C& cmd, const char*& ptr)
+{
+	ptr = resolve(address, cmd.bin_size());
+	return ptr && cmd.bin_read(ptr);
+}
+
+static uint32_t pipe_control_flags(const Gen9::CmdPipeControl& pc)
+{
+	return
+		(pc.command_streamer_stall_enable ? 1 << 0 : 0) |
+		(pc.dc_flush_enable ? 1 << 1 : 0) |
+		(pc.render_target_cache_flush_enable ? 1 << 2 : 0) |
+		(pc.depth_cache_flush_enable ? 1 << 3 : 0) |
+		(pc.texture_cache_invalidation_enable ? 1 << 4 : 0) |
+		(pc.constant_cache_invalidation_enable ? 1 << 5 : 0) |
+		(pc.state_cache_invalidation_enable ? 1 << 6 : 0) |
+		(pc.instruction_cache_invalidate_enable ? 1 << 7 : 0) |
+		(pc.vf_cache_invalidation_enable ? 1 << 8 : 0) |
+		(pc.tlb_invalidate ? 1 << 9 : 0) |
+		(pc.generic_media_state_clear ? 1 << 10 : 0);
+}
+
+
+I915BatchDecoder::I915BatchDecoder(FILE* f, resolve_t resolve)
+	: f(f), resolve(resolve)
+{
+}
+
+void I915BatchDecoder::warn(const char* msg)
+{
+	fprintf(f, "%*sWARNING: %s\n", 2 * level, "", msg);
+	cnt_warnings++;
+}
+
+void I915BatchDecoder::check_redundant(vector<uint32_t>& last, const char* ptr,
+		size_t size, const char* name)
+{
+	vector<uint32_t> current(size / 4);
+	memcpy(current.data(), ptr, size);
+
+	if (current == last)
+		warn((string("Redundant ") + name).c_str());
+
+	last = current;
+}
+
+void I915BatchDecoder::decode_buffer(uint64_t address)
+{
+	string indent(2 * level, ' ');
+
+	for (unsigned i = 0; i < MAX_COMMANDS; i++)
+	{
+		auto hdr = resolve(address, 4);
+		if (!hdr)
+		{
+			fprintf(f, "%s0x%llx: not available\n", indent.c_str(),
+					(unsigned long long) address);
+			warn("Batch buffer ends without MI_BATCH_BUFFER_END");
+			return;
+		}
+
+		const char* ptr;
+
+		/* NOOPs are used for padding */
+		Gen9::CmdMiNoop noop;
+		if (read_cmd(resolve, address, noop, ptr))
+		{
+			address += noop.bin_size();
+			continue;
+		}
+
+		fprintf(f, "%s0x%llx:\n", indent.c_str(), (unsigned long long) address);
+
+		Gen9::CmdPipeControl pc;
+		if (read_cmd(resolve, address, pc, ptr))
+		{
+			pc.print(f, indent.c_str());
+
+			auto flags = pipe_control_flags(pc);
+			if (prev_pipe_control &&
+					pc.post_sync_operation == Gen9::CmdPipeControl::NoWrite &&
+					(flags & ~prev_pipe_control_flags) == 0)
+			{
+				warn("PIPE_CONTROL flushes nothing that the previous one did not flush");
+			}
+
+			prev_pipe_control = true;
+			prev_pipe_control_flags = flags;
+
+			address += pc.bin_size();
+			continue;
+		}
+
+		prev_pipe_control = false;
+
+		Gen9::CmdMiBatchBufferEnd bbe;
+		if (read_cmd(resolve, address, bbe, ptr))
+		{
+			bbe.print(f, indent.c_str());
+			return;
+		}
+
+		Gen9::CmdMiBatchBufferStart bbs;
+		if (read_cmd(resolve, address, bbs, ptr))
+		{
+			bbs.print(f, indent.c_str());
+
+			uint64_t target = canonical_address(bbs.batch_buffer_start_address << 2);
+
+			if (bbs.second_level_batch_buffer == Gen9::CmdMiBatchBufferStart::Secondlevelbatch)
+			{
+				level++;
+				decode_buffer(target);
+				level--;
+
+				address += bbs.bin_size();
+				continue;
+			}
+
+			/* Chained batch buffer */
+			address = target;
+			continue;
+		}
+
+		Gen9::CmdStateBaseAddress sba;
+		if (read_cmd(resolve, address, sba, ptr))
+		{
+			sba.print(f, indent.c_str());
+			check_redundant(last_sba, ptr, sba.bin_size(), "STATE_BASE_ADDRESS");
+
+			if (sba.surface_state_base_address_modify_enable)
+				surface_state_base = canonical_address(sba.surface_state_base_address << 12);
+
+			if (sba.dynamic_state_base_address_modify_enable)
+				dynamic_state_base = canonical_address(sba.dynamic_state_base_address << 12);
+
+			if (sba.indirect_object_base_address_modify_enable)
+				indirect_object_base = canonical_address(sba.indirect_object_base_address << 12);
+
+			address += sba.bin_size();
+			continue;
+		}
+
+		Gen9::CmdPipelineSelect ps;
+		if (read_cmd(resolve, address, ps, ptr))
+		{
+			ps.print(f, indent.c_str());
+			check_redundant(last_pipeline_select, ptr, ps.bin_size(), "PIPELINE_SELECT");
+
+			address += ps.bin_size();
+			continue;
+		}
+
+		Gen9::CmdMediaVfeState vfe;
+		if (read_cmd(resolve, address, vfe, ptr))
+		{
+			vfe.print(f, indent.c_str());
+			check_redundant(last_vfe, ptr, vfe.bin_size(), "MEDIA_VFE_STATE");
+
+			address += vfe.bin_size();
+			continue;
+		}
+
+		Gen9::CmdMiLoadRegisterImm lri;
+		if (read_cmd(resolve, address, lri, ptr))
+		{
+			lri.print(f, indent.c_str());
+
+			uint64_t reg = lri.register_offset << 2;
+			auto i = register_values.find(reg);
+			if (i != register_values.end() && i->second == lri.data_dword)
+				warn("MI_LOAD_REGISTER_IMM writes the register's current value");
+
+			register_values[reg] = lri.data_dword;
+
+			address += lri.bin_size();
+			continue;
+		}
+
+		Gen9::CmdMediaInterfaceDescriptorLoad midl;
+		if (read_cmd(resolve, address, midl, ptr))
+		{
+			midl.print(f, indent.c_str());
+			decode_interface_descriptors(midl.interface_descriptor_data_start_address,
+					midl.interface_descriptor_total_length);
+
+			address += midl.bin_size();
+			continue;
+		}
+
+		Gen9::CmdGpgpuWalker walker;
+		if (read_cmd(resolve, address, walker, ptr))
+		{
+			walker.print(f, indent.c_str());
+			decode_cross_thread_data(walker.interface_descriptor_offset,
+					walker.indirect_data_start_address << 6);
+
+			address += walker.bin_size();
+			continue;
+		}
+
+		Gen9::CmdMediaStateFlush msf;
+		if (read_cmd(resolve, address, msf, ptr))
+		{
+			msf.print(f, indent.c_str());
+
+			address += msf.bin_size();
+			continue;
+		}
+
+		uint32_t dw;
+		memcpy(&dw, hdr, sizeof(dw));
+		fprintf(f, "%sunknown command 0x%08x\n", indent.c_str(), dw);
+		warn("Decoding stopped at an unknown command");
+		return;
+	}
+
+	warn("Too many commands; the batch buffer may be cyclic");
+}
+
+void I915BatchDecoder::decode_interface_descriptors(uint64_t offset, uint32_t length)
+{
+	string indent(2 * level + 2, ' ');
+
+	cross_thread_read_lengths.clear();
+
+	for (uint32_t i = 0; i < length / Gen9::INTERFACE_DESCRIPTOR_DATA::cnt_bytes; i++)
+	{
+		Gen9::INTERFACE_DESCRIPTOR_DATA idesc;
+
+		auto ptr = resolve(dynamic_state_base + offset + i * idesc.cnt_bytes, idesc.cnt_bytes);
+		if (!ptr)
+		{
+			fprintf(f, "%sinterface descriptor not available\n", indent.c_str());
+			return;
+		}
+
+		memcpy(idesc.data, ptr, idesc.cnt_bytes);
+		idesc.print(f, indent.c_str());
+
+		cross_thread_read_lengths.push_back(
+				idesc.get_cross_thread_constant_data_read_length());
+
+		decode_binding_table(idesc.get_binding_table_pointer() << 5,
+				idesc.get_binding_table_entry_count());
+	}
+}
+
+void I915BatchDecoder::decode_binding_table(uint64_t offset, uint32_t cnt_entries)
+{
+	string indent(2 * level + 4, ' ');
+
+	for (uint32_t i = 0; i < cnt_entries; i++)
+	{
+		Gen9::BINDING_TABLE_STATE bts;
+
+		auto ptr = resolve(surface_state_base + offset + i * bts.cnt_bytes, bts.cnt_bytes);
+		if (!ptr)
+		{
+			fprintf(f, "%sbinding table not available\n", indent.c_str());
+			return;
+		}
+
+		memcpy(bts.data, ptr, bts.cnt_bytes);
+		bts.print(f, indent.c_str());
+
+		Gen9::RENDER_SURFACE_STATE ss;
+
+		ptr = resolve(surface_state_base + (bts.get_surface_state_pointer() << 6), ss.cnt_bytes);
+		if (!ptr)
+		{
+			fprintf(f, "%ssurface state not available\n", indent.c_str());
+			continue;
+		}
+
+		memcpy(ss.data, ptr, ss.cnt_bytes);
+		ss.print(f, (indent + "  ").c_str());
+	}
+}
+
+void I915BatchDecoder::decode_cross_thread_data(uint32_t idesc_index, uint64_t offset)
+{
+	string indent(2 * level + 2, ' ');
+
+	if (idesc_index >= cross_thread_read_lengths.size())
+	{
+		fprintf(f, "%scross-thread data not available\n", indent.c_str());
+		return;
+	}
+
+	/* The cross-thread data starts the walker's indirect data; the read
+	 * length is in 32-byte units */
+	size_t cnt_dwords = cross_thread_read_lengths[idesc_index] * 8;
+
+	auto ptr = resolve(indirect_object_base + offset, cnt_dwords * 4);
+	if (!ptr)
+	{
+		fprintf(f, "%scross-thread data not available\n", indent.c_str());
+		return;
+	}
+
+	fprintf(f, "%scross_thread_data:\n", indent.c_str());
+
+	for (size_t i = 0; i < cnt_dwords; i += 8)
+	{
+		fprintf(f, "%s ", indent.c_str());
+
+		for (size_t j = i; j < i + 8; j++)
+		{
+			uint32_t dw;
+			memcpy(&dw, ptr + 4 * j, sizeof(dw));
+			fprintf(f, " 0x%08x", dw);
+		}
+
+		fprintf(f, "\n");
+	}
+}
+
+unsigned I915BatchDecoder::decode(uint64_t address)
+{
+	cnt_warnings = 0;
+	decode_buffer(address);
+	return cnt_warnings;
+}
+
+const char* I915BatchDecoder::resolve_host_address(uint64_t address, size_t size)
+{
+	return (const char*) (uintptr_t) address;
+}
+
+}
@@ -0,0 +1,76 @@
+/** Pretty-printer for the Gen9 GPGPU batch buffers emitted by the runtime.
+ *
+ * Follows chained and second level batch buffers and prints the interface
+ * descriptors, binding tables and surface states referenced by dispatches,
+ * and the cross-thread data of each walker.
+ * Commands that set state to the value it already has, and flushes that
+ * follow a flush without work in between, are reported as warnings. */
+#ifndef __I915_BATCH_DECODER_H
+#define __I915_BATCH_DECODER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace OCL
+{
+
+class I915BatchDecoder final
+{
+public:
+	/* Maps @param size bytes at GPU address @param address to memory of
+	 * the decoder's process; @returns nullptr if they are not available */
+	using resolve_t = std::function<const char*(uint64_t address, size_t size)>;
+
+protected:
+	FILE* f;
+	resolve_t resolve;
+
+	unsigned cnt_warnings = 0;
+
+	/* Nesting of batch buffers */
+	unsigned level = 0;
+
+	/* State programmed so far */
+	uint64_t surface_state_base = 0;
+	uint64_t dynamic_state_base = 0;
+	uint64_t indirect_object_base = 0;
+
+	/* Cross-thread data read length of the loaded interface descriptors */
+	std::vector<uint32_t> cross_thread_read_lengths;
+
+	std::vector<uint32_t> last_sba;
+	std::vector<uint32_t> last_vfe;
+	std::vector<uint32_t> last_pipeline_select;
+	std::map<uint64_t, uint32_t> register_values;
+
+	/* Flush bits of the previous command if it was a PIPE_CONTROL */
+	bool prev_pipe_control = false;
+	uint32_t prev_pipe_control_flags = 0;
+
+	void warn(const char* msg);
+	void check_redundant(std::vector<uint32_t>& last, const char* ptr,
+			size_t size, const char* name);
+
+	void decode_buffer(uint64_t address);
+	void decode_interface_descriptors(uint64_t offset, uint32_t length);
+	void decode_binding_table(uint64_t offset, uint32_t cnt_entries);
+	void decode_cross_thread_data(uint32_t idesc_index, uint64_t offset);
+
+public:
+	I915BatchDecoder(FILE* f, resolve_t resolve);
+
+	/* Decode the batch buffer at @param address.
+	 * @returns the number of warnings */
+	unsigned decode(uint64_t address);
+
+	/* For batches built by this process: userptr bos are bound at their
+	 * host address */
+	static const char* resolve_host_address(uint64_t address, size_t size);
+};
+
+}
+
+#endif /* __I915_BATCH_DECODER_H */
@@ -0,0 +1,721 @@
+/** Batching of kernel dispatches into a single batch buffer.
+ *
+ * A batch consists of two batch buffers: the first one contains the prologue
+ * (pipeline selection, L3 configuration, VFE state and state base addresses),
+ * and starts the second one, which contains one
+ * MEDIA_INTERFACE_DESCRIPTOR_LOAD / GPGPU_WALKER / MEDIA_STATE_FLUSH group per
+ * walker of each dispatch and the final PIPE_CONTROLs. */
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include "i915_runtime_impl.h"
+#include "i915_batch_decoder.h"
+#include "i915_utils.h"
+#include "utils.h"
+#include "macros.h"
+#include "gen9_hw_int.h"
+
+using namespace std;
+
+namespace OCL
+{
+
+using namespace HWInt;
+
+I915Batch::I915Batch(I915RTEImpl& rte, bool profiling)
+	:
+		rte(rte),
+		profiling(profiling),
+		submission(make_shared<I915Submission>()),
+		surface_state_bo(rte.bo_pool.get(SURFACE_STATE_SIZE)),
+		dynamic_state_bo(rte.bo_pool.get(DYNAMIC_STATE_SIZE)),
+		indirect_object_bo(rte.bo_pool.get(INDIRECT_OBJECT_SIZE))
+{
+	if (profiling)
+		query_bo = make_unique<I915PooledBo>(rte.bo_pool.get(QUERY_SIZE));
+}
+
+I915Batch::~I915Batch()
+{
+}
+
+bool I915Batch::empty() const
+{
+	return cnt_dispatches == 0;
+}
+
+bool I915Batch::fits(const I915DispatchLayout& layout) const
+{
+	return
+		align_value(surface_state_used, STATE_ALIGNMENT) + layout.surface_state_size <=
+			SURFACE_STATE_SIZE &&
+		align_value(dynamic_state_used, STATE_ALIGNMENT) + layout.cnt_walkers *
+			align_value(HWInt::Gen9::INTERFACE_DESCRIPTOR_DATA::cnt_bytes, STATE_ALIGNMENT) <=
+			DYNAMIC_STATE_SIZE &&
+		align_value(indirect_object_used, STATE_ALIGNMENT) + layout.indirect_data_size <=
+			INDIRECT_OBJECT_SIZE &&
+		(!profiling || (cnt_dispatches + 1) * 2 * sizeof(uint64_t) <= QUERY_SIZE) &&
+		(cnt_dispatches == 0 ||
+		 (layout.has_l3_override == has_l3_override &&
+		  (!has_l3_override || layout.l3_override == l3_override)));
+}
+
+/* Gen9 configurations with an 'all' partition from Mesa's
+ * intel_l3_config.c, in ways */
+static const I915L3Config gen9_l3_configs[] = {
+	{ 0, 48, 48 },
+	{ 0, 32, 64 },
+	{ 32, 16, 48 },
+};
+
+bool I915Batch::is_valid_l3_config(const I915L3Config& config)
+{
+	for (auto& c : gen9_l3_configs)
+	{
+		if (c == config)
+			return true;
+	}
+
+	return false;
+}
+
+I915L3Config I915Batch::choose_l3_config(const struct intel_device_info& dev_info,
+		bool slm)
+{
+	/* See Mesa's intel_get_l3_config_urb_size */
+	size_t way_size = (dev_info.l3_banks == 1 ? 4 : 2) * dev_info.l3_banks * 1024;
+	size_t urb_size = (URB_ALLOCATION_SIZE * URB_ENTRIES + URB_IDESC_LINES) * 32;
+
+	const I915L3Config* best = nullptr;
+
+	for (auto& c : gen9_l3_configs)
+	{
+		if ((c.slm_ways > 0) != slm || c.urb_ways * way_size < urb_size)
+			continue;
+
+		if (!best || c.all_ways > best->all_ways)
+			best = &c;
+	}
+
+	if (!best)
+		throw runtime_error("Not enough L3 memory for URB");
+
+	return *best;
+}
+
+size_t I915Batch::alloc_state(size_t& used, size_t capacity, size_t size)
+{
+	size_t offset = align_value(used, STATE_ALIGNMENT);
+	if (offset + size > capacity)
+		throw runtime_error("State heap of batch exhausted");
+
+	used = offset + size;
+	return offset;
+}
+
+size_t I915Batch::alloc_surface_state(size_t size)
+{
+	return alloc_state(surface_state_used, SURFACE_STATE_SIZE, size);
+}
+
+size_t I915Batch::alloc_dynamic_state(size_t size)
+{
+	return alloc_state(dynamic_state_used, DYNAMIC_STATE_SIZE, size);
+}
+
+size_t I915Batch::alloc_indirect_object(size_t size)
+{
+	return alloc_state(indirect_object_used, INDIRECT_OBJECT_SIZE, size);
+}
+
+void I915Batch::add_userptr_argument(void* ptr, size_t size)
+{
+	/* Bos are pinned at their host address, hence the bos of a batch must
+	 * not overlap. Bos that cover the same addresses are interchangeable. */
+	auto start = (uintptr_t) ptr;
+	auto end = start + size;
+
+	auto& bos = submission->arg_userptr_bos;
+	for (auto& bo : bos)
+	{
+		auto bo_start = (uintptr_t) bo->ptr();
+		if (start >= bo_start && end <= bo_start + bo->size())
+			return;
+	}
+
+	auto new_bo = rte.userptr_cache.get(ptr, size);
+	start = (uintptr_t) new_bo->ptr();
+	end = start + new_bo->size();
+
+	for (auto i = bos.begin(); i != bos.end();)
+	{
+		auto bo_start = (uintptr_t) (*i)->ptr();
+		auto bo_end = bo_start + (*i)->size();
+
+		if (bo_start >= start && bo_end <= end)
+		{
+			i = bos.erase(i);
+			continue;
+		}
+
+		if (start < bo_end && end > bo_start)
+		{
+			throw invalid_argument("Overlapping buffer arguments in one "
+					"batch are not supported");
+		}
+
+		i++;
+	}
+
+	bos.push_back(new_bo);
+}
+
+void I915Batch::add_userptr_bo(const shared_ptr<I915UserptrBo>& bo)
+{
+	/* The runtime's bos do not overlap buffer arguments */
+	auto& bos = submission->arg_userptr_bos;
+	if (find(bos.begin(), bos.end(), bo) == bos.end())
+		bos.push_back(bo);
+}
+
+void I915Batch::add_kernel(const shared_ptr<I915KernelImpl>& kernel)
+{
+	auto& kernels = submission->kernels;
+	if (find(kernels.begin(), kernels.end(), kernel) == kernels.end())
+		kernels.push_back(kernel);
+}
+
+void I915Batch::add_surface_state_reloc(uint32_t handle, uint64_t offset)
+{
+	if (find(reloc_handles.begin(), reloc_handles.end(), handle) == reloc_handles.end())
+		reloc_handles.push_back(handle);
+
+	struct drm_i915_gem_relocation_entry reloc = { 0 };
+	reloc.target_handle = handle;
+	reloc.offset = offset;
+	reloc.write_domain = reloc.read_domains = I915_GEM_DOMAIN_RENDER;
+
+	surface_state_relocs.push_back(reloc);
+}
+
+void I915Batch::add_indirect_object_reloc(uint32_t handle, uint64_t offset)
+{
+	/* Ensure that the bo is in the list of bos passed to EXECBUFFER2 */
+	if (find(reloc_handles.begin(), reloc_handles.end(), handle) == reloc_handles.end())
+	{
+		throw runtime_error("Bo specified for indirect object buffer "
+				"relocation but is not in list of bos");
+	}
+
+	struct drm_i915_gem_relocation_entry reloc = { 0 };
+	reloc.target_handle = handle;
+	reloc.offset = offset;
+	reloc.write_domain = reloc.read_domains = I915_GEM_DOMAIN_RENDER;
+
+	indirect_object_relocs.push_back(reloc);
+}
+
+void I915Batch::add_dispatch(vector<unique_ptr<I915RingCmd>>&& dispatch_cmds,
+		uint32_t slm_size, const I915DispatchLayout& layout)
+{
+	if (barrier_pending && cnt_dispatches > 0)
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmd->dc_flush_enable = true;
+		cmds.push_back(move(cmd));
+	}
+
+	barrier_pending = false;
+
+	auto query = profiling ? (uint64_t*) query_bo->ptr() + 2 * cnt_dispatches : nullptr;
+
+	if (query)
+		cmds.push_back(build_timestamp_write(query));
+
+	for (auto& cmd : dispatch_cmds)
+		cmds.push_back(move(cmd));
+
+	if (query)
+		cmds.push_back(build_timestamp_write(query + 1));
+
+	this->slm_size = max(this->slm_size, slm_size);
+	scratch_size = max(scratch_size, layout.scratch_size);
+	has_l3_override = layout.has_l3_override;
+	l3_override = layout.l3_override;
+	cnt_dispatches++;
+}
+
+void I915Batch::barrier()
+{
+	barrier_pending = true;
+}
+
+unique_ptr<I915RingCmd> I915Batch::build_timestamp_write(void* address)
+{
+	auto cmd = make_unique<Gen9::CmdPipeControl>();
+	cmd->command_streamer_stall_enable = true;
+	cmd->post_sync_operation = Gen9::CmdPipeControl::WriteTimestamp;
+	cmd->address = canonical_address(address) >> 2;
+	return cmd;
+}
+
+shared_ptr<I915Submission> I915Batch::submit()
+{
+	if (!submission)
+		throw runtime_error("Batch has already been submitted");
+
+	PROFILE_PHASE(profile, BatchBuild);
+
+	/* State memory areas */
+	auto general_state_bo = rte.get_general_state_bo(scratch_size);
+	size_t bindless_surface_size = 1024;
+
+	bindless_surface_size = rte.align_size_to_page(bindless_surface_size);
+	auto bindless_surface_bo = rte.bo_pool.get(bindless_surface_size);
+
+	/* Sync location and completion timestamp */
+	size_t gp_bo_size = rte.align_size_to_page(2 * sizeof(uint64_t));
+	auto gp_bo = rte.bo_pool.get(gp_bo_size);
+
+
+	/* Allocate L3 */
+	auto l3_config = has_l3_override ? l3_override :
+		choose_l3_config(rte.dev_info, slm_size > 0);
+
+	if (slm_size > 0 && l3_config.slm_ways == 0)
+		throw runtime_error("L3 configuration does not provide SLM");
+
+	Gen9::REG_L3CNTLREG l3cntlreg;
+	l3cntlreg.set_slm_enable(l3_config.slm_ways > 0);
+	l3cntlreg.set_urb_allocation(l3_config.urb_ways);
+	l3cntlreg.set_all_allocation(l3_config.all_ways);
+
+	/* The register is part of the context image, hence it only needs to be
+	 * written if the configuration changed or the context was replaced */
+	bool l3_changed =
+		!rte.l3cntlreg_valid ||
+		rte.l3cntlreg != l3cntlreg.data[0] ||
+		rte.l3cntlreg_ctx_generation != rte.ctx_generation;
+
+
+	/* Build second batch buffer */
+	vector<unique_ptr<I915RingCmd>> cmds2;
+
+	{
+		cmds2.push_back(make_unique<Gen9::CmdMediaStateFlush>());
+	}
+
+	for (auto& cmd : cmds)
+		cmds2.push_back(move(cmd));
+
+	cmds.clear();
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmds2.push_back(move(cmd));
+	}
+
+	cmds2.push_back(build_timestamp_write((char*) gp_bo.ptr() + 8));
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmd->dc_flush_enable = true;
+		cmd->post_sync_operation = Gen9::CmdPipeControl::WriteImmediateData;
+		cmd->address = canonical_address(gp_bo.ptr()) >> 2;
+		cmd->immediate_data = 0x1;
+		cmds2.push_back(move(cmd));
+	}
+
+	{
+		cmds2.push_back(make_unique<Gen9::CmdMiBatchBufferEnd>());
+		cmds2.push_back(make_unique<Gen9::CmdMiNoop>());
+	}
+
+	/* Copy to a Bo */
+	size_t bb2_bo_size = 0;
+	for (auto& cmd : cmds2)
+		bb2_bo_size += cmd->bin_size();
+
+	auto bb2 = rte.bo_pool.get(bb2_bo_size);
+	auto bb2_ptr = (char*) bb2.ptr();
+	for (auto& cmd : cmds2)
+		bb2_ptr += cmd->bin_write(bb2_ptr);
+
+
+	/* Build first batch buffer */
+	vector<unique_ptr<I915RingCmd>> cmds1;
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmd->texture_cache_invalidation_enable = true;
+		cmd->constant_cache_invalidation_enable = true;
+		cmd->state_cache_invalidation_enable = true;
+		cmd->instruction_cache_invalidate_enable = true;
+		cmd->render_target_cache_flush_enable = true;
+		cmd->dc_flush_enable = true;
+		cmd->depth_cache_flush_enable = true;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmd->render_target_cache_flush_enable = true;
+		cmd->dc_flush_enable = true;
+		cmd->depth_cache_flush_enable = true;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipelineSelect>();
+		cmd->pipeline_selection = Gen9::CmdPipelineSelect::GPGPU;
+		cmd->media_sampler_dop_clock_gate_enable = true;
+		cmd->mask_bits = 0x13;
+		cmds1.push_back(move(cmd));
+	}
+
+	if (l3_changed)
+	{
+		{
+			auto cmd = make_unique<Gen9::CmdMiLoadRegisterImm>();
+			cmd->register_offset = l3cntlreg.address >> 2;
+			cmd->data_dword = l3cntlreg.data[0];
+			cmds1.push_back(move(cmd));
+		}
+
+		{
+			auto cmd = make_unique<Gen9::CmdPipeControl>();
+			cmd->command_streamer_stall_enable = true;
+			cmd->render_target_cache_flush_enable = true;
+			cmd->dc_flush_enable = true;
+			cmd->depth_cache_flush_enable = true;
+			cmds1.push_back(move(cmd));
+		}
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdMediaVfeState>();
+		/* The pointer is relative to the general state base address */
+		if (scratch_size > 0)
+		{
+			cmd->scratch_space_base_pointer = I915RTEImpl::SCRATCH_OFFSET >> 10;
+			cmd->per_thread_scratch_space = scratch_size_to_vfe(scratch_size);
+		}
+
+		cmd->stack_size = 0;
+		cmd->maximum_number_of_threads = rte.dev_info.max_cs_threads - 1;
+		cmd->number_of_urb_entries = URB_ENTRIES;
+		cmd->urb_entry_allocation_size = URB_ALLOCATION_SIZE;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		Gen9::REG_CS_CHICKEN1 reg;
+		reg.set_replay_mode(Gen9::REG_CS_CHICKEN1::ReplayMode_MidcmdbufferPreemption);
+
+		auto cmd= make_unique<Gen9::CmdMiLoadRegisterImm>();
+		cmd->register_offset = reg.address >> 2;
+		cmd->data_dword = reg.data[0];
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->texture_cache_invalidation_enable = true;
+		cmd->dc_flush_enable = true;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdStateBaseAddress>();
+
+		/* State is read by every thread of a dispatch, hence it is cached
+		 * like intel-compute-runtime does; the PIPE_CONTROL at the start of
+		 * the batch invalidates stale copies of reused bos */
+		cmd->general_state_base_address = canonical_address(general_state_bo->ptr()) >> 12;
+		cmd->general_state_mocs = I915_MOCS_CACHED << 1;
+		cmd->general_state_base_address_modify_enable = true;
+		cmd->general_state_buffer_size = DIV_ROUND_UP(general_state_bo->size(), 4096);
+		cmd->general_state_buffer_size_modify_enable = true;
+
+		cmd->stateless_data_port_access_mocs = I915_MOCS_CACHED << 1;
+
+		cmd->surface_state_base_address = canonical_address(surface_state_bo.ptr()) >> 12;
+		cmd->surface_state_mocs = I915_MOCS_CACHED << 1;
+		cmd->surface_state_base_address_modify_enable = true;
+
+		cmd->dynamic_state_base_address = canonical_address(dynamic_state_bo.ptr()) >> 12;
+		cmd->dynamic_state_mocs = I915_MOCS_CACHED << 1;
+		cmd->dynamic_state_base_address_modify_enable = true;
+		cmd->dynamic_state_buffer_size = DIV_ROUND_UP(dynamic_state_bo.size(), 4096);
+		cmd->dynamic_state_buffer_size_modify_enable = true;
+
+		cmd->indirect_object_base_address = canonical_address(indirect_object_bo.ptr()) >> 12;
+		cmd->indirect_object_mocs = I915_MOCS_CACHED << 1;
+		cmd->indirect_object_base_address_modify_enable = true;
+		cmd->indirect_object_buffer_size = DIV_ROUND_UP(indirect_object_bo.size(), 4096);
+		cmd->indirect_object_buffer_size_modify_enable = true;
+
+		cmd->instruction_base_address = canonical_address(rte.instruction_heap.ptr()) >> 12;
+		cmd->instruction_mocs = I915_MOCS_CACHED << 1;
+		cmd->instruction_base_address_modify_enable = true;
+		cmd->instruction_buffer_size = DIV_ROUND_UP(rte.instruction_heap.size(), 4096);
+		cmd->instruction_buffer_size_modify_enable = true;
+
+		cmd->bindless_surface_state_base_address = canonical_address(bindless_surface_bo.ptr()) >> 12;
+		cmd->bindless_surface_state_mocs = I915_MOCS_CACHED << 1;
+		cmd->bindless_surface_state_base_address_modify_enable = true;
+		// cmd->bindless_surface_state_size = 0;
+
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdPipeControl>();
+		cmd->command_streamer_stall_enable = true;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		auto cmd = make_unique<Gen9::CmdMiBatchBufferStart>();
+		cmd->address_space_indicator = Gen9::CmdMiBatchBufferStart::ASI_PPGTT;
+		cmd->batch_buffer_start_address = canonical_address(bb2.ptr()) >> 2;
+		cmds1.push_back(move(cmd));
+	}
+
+	{
+		cmds1.push_back(make_unique<Gen9::CmdMiNoop>());
+	}
+
+	/* Copy to a Bo */
+	size_t bb_bo_size = 0;
+	for (auto& cmd : cmds1)
+		bb_bo_size += cmd->bin_size();
+
+	auto bb = rte.bo_pool.get(bb_bo_size);
+	auto bb_ptr = (char*) bb.ptr();
+	for (auto& cmd : cmds1)
+		bb_ptr += cmd->bin_write(bb_ptr);
+
+
+	/* Execute Bo */
+	vector<I915ExecBo> bos;
+
+	for (auto& bo : submission->arg_userptr_bos)
+		bos.emplace_back(bo->handle(), bo->ptr(), vector<struct drm_i915_gem_relocation_entry>());
+
+	/* Imported bos are placed by the kernel; their addresses are written by
+	 * relocations */
+	for (auto handle : reloc_handles)
+		bos.emplace_back(handle, nullptr, vector<struct drm_i915_gem_relocation_entry>());
+
+	bos.emplace_back(general_state_bo->handle(), general_state_bo->ptr(),
+			vector<struct drm_i915_gem_relocation_entry>());
+
+	bos.emplace_back(surface_state_bo.handle(), surface_state_bo.ptr(), surface_state_relocs);
+
+	bos.emplace_back(dynamic_state_bo.handle(), dynamic_state_bo.ptr(),
+			vector<struct drm_i915_gem_relocation_entry>());
+
+	bos.emplace_back(indirect_object_bo.handle(), indirect_object_bo.ptr(),
+			indirect_object_relocs);
+
+	bos.emplace_back(rte.instruction_heap.handle(), rte.instruction_heap.ptr(),
+			vector<struct drm_i915_gem_relocation_entry>());
+
+	bos.emplace_back(bindless_surface_bo.handle(), bindless_surface_bo.ptr(),
+			vector<struct drm_i915_gem_relocation_entry>());
+
+	bos.emplace_back(gp_bo.handle(), gp_bo.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+
+	if (query_bo)
+	{
+		bos.emplace_back(query_bo->handle(), query_bo->ptr(),
+				vector<struct drm_i915_gem_relocation_entry>());
+	}
+
+	bos.emplace_back(bb2.handle(), bb2.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+	bos.emplace_back(bb.handle(), bb.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+
+	submission->sync_ptr = (uint64_t*) gp_bo.ptr();
+	*(submission->sync_ptr) = 0;
+	submission->timestamp_ptr = submission->sync_ptr + 1;
+	submission->bb_handle = bb.handle();
+	submission->ctx_generation = rte.ctx_generation;
+
+	if (query_bo)
+	{
+		submission->query_ptr = (uint64_t*) query_bo->ptr();
+		submission->cnt_profiled_dispatches = cnt_dispatches;
+	}
+
+	if (rte.batch_dump)
+	{
+		I915BatchDecoder decoder(rte.batch_dump, I915BatchDecoder::resolve_host_address);
+		decoder.decode((uintptr_t) bb.ptr());
+	}
+
+	PROFILE_NEXT_PHASE(Execbuf);
+
+	try
+	{
+		rte.backend->gem_execbuffer2(rte.ctx_id, bos, bb_bo_size);
+	}
+	catch (system_error& e)
+	{
+		/* The kernel rejects submissions to banned contexts with EIO */
+		if (e.code().value() != EIO)
+			throw;
+
+		rte.recreate_context();
+		throw GpuHangError("The GPU context was banned after GPU hangs; it has been recreated");
+	}
+
+	rte.l3cntlreg_valid = true;
+	rte.l3cntlreg = l3cntlreg.data[0];
+	rte.l3cntlreg_ctx_generation = rte.ctx_generation;
+
+	/* Keep the bos until the GPU finished the batch */
+	submission->general_state_bo = move(general_state_bo);
+	submission->bos.push_back(move(dynamic_state_bo));
+	submission->bos.push_back(move(bindless_surface_bo));
+	submission->bos.push_back(move(gp_bo));
+	submission->bos.push_back(move(surface_state_bo));
+	submission->bos.push_back(move(indirect_object_bo));
+	submission->bos.push_back(move(bb2));
+	submission->bos.push_back(move(bb));
+
+	if (query_bo)
+		submission->bos.push_back(move(*query_bo));
+
+	rte.add_in_flight(submission);
+
+	auto s = move(submission);
+	submission = nullptr;
+	return s;
+}
+
+
+I915CommandQueueImpl::I915CommandQueueImpl(I915RTEImpl& rte)
+	:
+		rte(rte), profiling(rte.profiling),
+		profile(&rte.host_profiler.get_kernel("(command queue)")),
+		waiter(make_shared<I915Waiter>(rte, rte.waiter->get_policy()))
+{
+}
+
+I915CommandQueueImpl::~I915CommandQueueImpl()
+{
+}
+
+void I915CommandQueueImpl::submit_batch()
+{
+	/* Batches are executed in order by the same context, and each one ends
+	 * with a command streamer stall. Hence the last submission completes
+	 * after all previous ones. */
+	last_submission = batch->submit();
+	batch = nullptr;
+
+	PROFILE_COMMIT(profile);
+
+	if (last_submission->cnt_profiled_dispatches > 0)
+		profiled_submissions.push_back(last_submission);
+}
+
+void I915CommandQueueImpl::enqueue(PreparedKernel& kernel,
+		NDRange global_size, NDRange local_size)
+{
+	enqueue(kernel, NDRange(0, 0, 0), global_size, local_size);
+}
+
+void I915CommandQueueImpl::enqueue(PreparedKernel& _kernel, NDRange global_size)
+{
+	auto kernel = dynamic_cast<I915PreparedKernelImpl*>(&_kernel);
+	if (!kernel)
+		throw invalid_argument("Given PreparedKernel must be an I915PreparedKernel");
+
+	enqueue(*kernel, NDRange(0, 0, 0), global_size, kernel->choose_local_size(global_size));
+}
+
+void I915CommandQueueImpl::enqueue(PreparedKernel& _kernel, NDRange global_offset,
+		NDRange global_size, NDRange local_size)
+{
+	auto kernel = dynamic_cast<I915PreparedKernelImpl*>(&_kernel);
+	if (!kernel)
+		throw invalid_argument("Given PreparedKernel must be an I915PreparedKernel");
+
+	auto layout = kernel->plan_dispatch(global_offset, global_size, local_size);
+
+	if (batch && !batch->fits(layout))
+		submit_batch();
+
+	if (!batch)
+	{
+		batch = make_unique<I915Batch>(rte, profiling);
+		batch->profile = profile;
+	}
+
+	if (!batch->fits(layout))
+		throw invalid_argument("Kernel state does not fit into a batch");
+
+	kernel->record_dispatch(*batch, layout, global_offset, local_size);
+}
+
+void I915CommandQueueImpl::barrier()
+{
+	/* Batch boundaries imply a barrier */
+	if (batch)
+		batch->barrier();
+}
+
+shared_ptr<Event> I915CommandQueueImpl::flush()
+{
+	if (batch && !batch->empty())
+		submit_batch();
+
+	batch = nullptr;
+
+	if (!last_submission)
+		return make_shared<I915EventImpl>(rte, waiter, make_shared<I915Submission>());
+
+	auto event = make_shared<I915EventImpl>(rte, waiter, last_submission,
+			move(profiled_submissions));
+
+	profiled_submissions.clear();
+	return event;
+}
+
+void I915CommandQueueImpl::finish()
+{
+	auto event = flush();
+
+	{
+		PROFILE_PHASE(profile, Wait);
+		event->wait();
+	}
+
+	PROFILE_COMMIT(profile);
+}
+
+void I915CommandQueueImpl::set_wait_policy(const I915WaitPolicy& policy)
+{
+	waiter->set_policy(policy);
+}
+
+I915WaitStats I915CommandQueueImpl::get_wait_stats()
+{
+	return waiter->get_stats();
+}
+
+void I915CommandQueueImpl::set_profiling(bool enable)
+{
+	/* The current batch keeps its setting */
+	profiling = enable;
+}
+
+}
@@ -13,4 +13,9 @@ I915CompiledProgram::~I915CompiledProgram()
 {
 }
 
+const char* I915CompiledProgram::get_build_options() const
+{
+	return "-cl-std=CL1.2";
+}
+
 }
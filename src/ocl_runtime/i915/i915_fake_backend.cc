@@ -0,0 +1,668 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include "i915_fake_backend.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace OCL {
+
+using namespace HWInt;
+
+/* Upper bound for malformed (e.g. cyclic) batches */
+static constexpr unsigned MAX_COMMANDS = 1024 * 1024;
+
+/* The GPU's virtual address space */
+static constexpr uint64_t ADDRESS_MASK = (1ULL << 48) - 1;
+
+static constexpr uint32_t REG_TIMESTAMP = 0x2358;
+
+/* Errors are reported like failed ioctls */
+[[noreturn]] static void fail(int err, const char* ioctl, const string& msg)
+{
+	throw system_error(err, generic_category(), string(ioctl) + " failed: " + msg);
+}
+
+
+I915FakeDevice::~I915FakeDevice()
+{
+}
+
+shared_ptr<I915FakeDevice> create_i915_fake_device(int pci_id)
+{
+	return make_shared<I915FakeBackend>(pci_id);
+}
+
+
+I915FakeBackend::I915FakeBackend(int pci_id)
+	: pci_id(pci_id)
+{
+	if (!intel_get_device_info_from_pci_id(pci_id, &dev_info))
+		throw invalid_argument("Unknown PCI id for the emulated device");
+}
+
+I915FakeBackend::~I915FakeBackend()
+{
+}
+
+const I915FakeBackend::Object& I915FakeBackend::get_object(uint32_t handle) const
+{
+	auto i = objects.find(handle);
+	if (i == objects.end())
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_EXECBUFFER2", "no such handle");
+
+	return i->second;
+}
+
+char* I915FakeBackend::resolve(uint64_t address, size_t size) const
+{
+	address &= ADDRESS_MASK;
+
+	for (auto& b : bindings)
+	{
+		if (address >= b.address && address + size <= b.address + b.size)
+			return b.ptr + (address - b.address);
+	}
+
+	return nullptr;
+}
+
+uint64_t I915FakeBackend::timestamp()
+{
+	if (timestamp_step > 0)
+		return stepped_timestamp += timestamp_step;
+
+	auto ns = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+
+	return (uint64_t) ((__uint128_t) ns * dev_info.timestamp_frequency / 1000000000ULL);
+}
+
+void I915FakeBackend::post_sync_write(PendingBatch& batch, const Gen9::CmdPipeControl& pc)
+{
+	PendingWrite write{};
+
+	switch (pc.post_sync_operation)
+	{
+	case Gen9::CmdPipeControl::NoWrite:
+		return;
+
+	case Gen9::CmdPipeControl::WriteImmediateData:
+		write.value = pc.immediate_data;
+		break;
+
+	case Gen9::CmdPipeControl::WriteTimestamp:
+		/* Taken when the batch completes */
+		write.timestamp = true;
+		break;
+
+	default:
+		break;
+	}
+
+	uint64_t address = pc.address << 2;
+	if (address % 8 != 0)
+	{
+		fail(EINVAL, "DRM_IOCTL_I915_GEM_EXECBUFFER2",
+				"PIPE_CONTROL post-sync write to an unaligned address");
+	}
+
+	write.dst = resolve(address, sizeof(write.value));
+	if (!write.dst)
+	{
+		fail(EFAULT, "DRM_IOCTL_I915_GEM_EXECBUFFER2",
+				"PIPE_CONTROL post-sync write outside of the submitted bos");
+	}
+
+	batch.writes.push_back(write);
+}
+
+bool I915FakeBackend::is_busy(uint32_t handle) const
+{
+	for (auto& batch : pending)
+	{
+		if (find(batch.handles.begin(), batch.handles.end(), handle) != batch.handles.end())
+			return true;
+	}
+
+	return false;
+}
+
+void I915FakeBackend::complete(PendingBatch& batch)
+{
+	for (auto& write : batch.writes)
+	{
+		uint64_t value = write.timestamp ? timestamp() : write.value;
+		memcpy(write.dst, &value, sizeof(value));
+	}
+}
+
+size_t I915FakeBackend::complete_pending(size_t max)
+{
+	size_t cnt = 0;
+
+	while (cnt < max && !pending.empty() && !pending.front().hung)
+	{
+		complete(pending.front());
+		pending.pop_front();
+		cnt++;
+	}
+
+	if (cnt > 0)
+		completed.notify_all();
+
+	return cnt;
+}
+
+void I915FakeBackend::execute(PendingBatch& batch, uint64_t address, uint64_t end,
+		unsigned level)
+{
+	const char* ioctl = "DRM_IOCTL_I915_GEM_EXECBUFFER2";
+
+	for (unsigned i = 0; i < MAX_COMMANDS; i++)
+	{
+		if (address >= end)
+			fail(EINVAL, ioctl, "batch buffer does not end with MI_BATCH_BUFFER_END");
+
+		auto ptr = resolve(address, 4);
+		if (!ptr)
+			fail(EFAULT, ioctl, "command outside of the submitted bos");
+
+		uint32_t dw;
+		memcpy(&dw, ptr, sizeof(dw));
+
+		stats.commands++;
+
+		size_t cnt_dwords;
+		uint32_t type = dw >> 29;
+
+		if (type == 0)
+		{
+			/* MI commands */
+			uint32_t opcode = (dw >> 23) & 0x3f;
+
+			if (opcode == 0x00)
+			{
+				/* MI_NOOP */
+				cnt_dwords = 1;
+			}
+			else if (opcode == 0x0a)
+			{
+				/* MI_BATCH_BUFFER_END */
+				return;
+			}
+			else if (opcode == 0x31)
+			{
+				Gen9::CmdMiBatchBufferStart bbs;
+
+				ptr = resolve(address, bbs.bin_size());
+				if (!ptr || !bbs.bin_read(ptr))
+					fail(EINVAL, ioctl, "invalid MI_BATCH_BUFFER_START");
+
+				uint64_t target = bbs.batch_buffer_start_address << 2;
+
+				if (bbs.second_level_batch_buffer ==
+						Gen9::CmdMiBatchBufferStart::Secondlevelbatch)
+				{
+					if (level > 0)
+						fail(EINVAL, ioctl, "third level batch buffer");
+
+					execute(batch, target, ~0ULL, level + 1);
+					address += bbs.bin_size();
+				}
+				else
+				{
+					/* Chained batch buffer */
+					address = target;
+					end = ~0ULL;
+				}
+
+				continue;
+			}
+			else
+			{
+				cnt_dwords = (dw & 0xff) + 2;
+			}
+		}
+		else if (type == 3)
+		{
+			Gen9::CmdPipelineSelect ps;
+			Gen9::CmdPipeControl pc;
+
+			if (ps.bin_read(ptr))
+			{
+				cnt_dwords = 1;
+			}
+			else
+			{
+				cnt_dwords = (dw & 0xff) + 2;
+
+				ptr = resolve(address, pc.bin_size());
+				if (ptr && pc.bin_read(ptr))
+					post_sync_write(batch, pc);
+			}
+		}
+		else
+		{
+			fail(EINVAL, ioctl, "unknown command 0x" + to_hex_string(dw));
+		}
+
+		address += cnt_dwords * 4;
+	}
+
+	fail(EINVAL, ioctl, "too many commands; the batch buffer may be cyclic");
+}
+
+uint32_t I915FakeBackend::create_named_bo(size_t size)
+{
+	lock_guard<mutex> lock(m);
+
+	if (size == 0)
+		throw invalid_argument("Bo size must not be 0");
+
+	auto page_size = 4096;
+	auto storage = make_shared<vector<char>>(
+			((size + page_size - 1) / page_size) * page_size, 0);
+
+	auto name = next_name++;
+	names.emplace(name, storage);
+	return name;
+}
+
+I915FakeDeviceStats I915FakeBackend::get_stats()
+{
+	lock_guard<mutex> lock(m);
+
+	auto s = stats;
+	s.open_handles = objects.size();
+	s.pending_batches = pending.size();
+	return s;
+}
+
+void I915FakeBackend::set_manual_completion(bool enable)
+{
+	lock_guard<mutex> lock(m);
+	manual_completion = enable;
+
+	/* Later batches must not overtake pending ones */
+	if (!enable)
+		complete_pending(pending.size());
+}
+
+bool I915FakeBackend::complete_next()
+{
+	lock_guard<mutex> lock(m);
+	return complete_pending(1) > 0;
+}
+
+size_t I915FakeBackend::complete_all()
+{
+	lock_guard<mutex> lock(m);
+	return complete_pending(pending.size());
+}
+
+void I915FakeBackend::hang_next_batch()
+{
+	lock_guard<mutex> lock(m);
+	hang_next = true;
+}
+
+void I915FakeBackend::reset_gpu()
+{
+	lock_guard<mutex> lock(m);
+	stats.resets++;
+
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		/* The context may have been destroyed in the meantime */
+		auto c = contexts.find(pending[i].ctx_id);
+		if (c == contexts.end())
+			continue;
+
+		if (i == 0)
+			c->second.batch_active++;
+		else
+			c->second.batch_pending++;
+	}
+
+	pending.clear();
+	completed.notify_all();
+}
+
+void I915FakeBackend::set_timestamp_step(uint64_t ticks)
+{
+	lock_guard<mutex> lock(m);
+	timestamp_step = ticks;
+}
+
+drm_version_t I915FakeBackend::get_drm_version(char* driver_name, size_t driver_name_size)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	drm_version_t version{};
+	version.version_major = 1;
+	version.version_minor = 6;
+
+	strncpy(driver_name, "i915", driver_name_size - 1);
+	driver_name[driver_name_size - 1] = '\0';
+
+	version.name_len = strlen(driver_name);
+	version.name = driver_name;
+
+	return version;
+}
+
+bool I915FakeBackend::get_device_info(struct intel_device_info& dev_info)
+{
+	dev_info = this->dev_info;
+	return true;
+}
+
+int I915FakeBackend::i915_getparam(int32_t param)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	switch (param)
+	{
+	case I915_PARAM_CHIPSET_ID:
+		return pci_id;
+
+	case I915_PARAM_REVISION:
+		return 0;
+
+	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_EXEC_NO_RELOC:
+	case I915_PARAM_HAS_USERPTR_PROBE:
+		return 1;
+
+	default:
+		fail(EINVAL, "DRM_IOCTL_I915_GETPARAM", "unknown parameter");
+	}
+}
+
+bool I915FakeBackend::gem_supports_wc_mmap()
+{
+	return true;
+}
+
+uint32_t I915FakeBackend::gem_userptr(void* ptr, uint64_t size, bool probe)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if (size == 0 || (uintptr_t) ptr % 4096 != 0 || size % 4096 != 0)
+		fail(EINVAL, "DRM_IOCTL_I915_GEM_USERPTR", "unaligned range");
+
+	Object obj;
+	obj.ptr = (char*) ptr;
+	obj.size = size;
+
+	auto handle = next_handle++;
+	objects.emplace(handle, obj);
+	return handle;
+}
+
+void I915FakeBackend::gem_open(uint32_t name, uint32_t& handle, uint64_t& size)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	auto i = names.find(name);
+	if (i == names.end())
+		fail(ENOENT, "DRM_IOCTL_GEM_OPEN", "no such name");
+
+	Object obj;
+	obj.storage = i->second;
+	obj.ptr = obj.storage->data();
+	obj.size = obj.storage->size();
+
+	handle = next_handle++;
+	size = obj.size;
+	objects.emplace(handle, obj);
+}
+
+void I915FakeBackend::gem_close(uint32_t handle)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if (objects.erase(handle) == 0)
+		fail(EINVAL, "DRM_IOCTL_GEM_CLOSE", "no such handle");
+}
+
+uint32_t I915FakeBackend::gem_context_create()
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	auto id = next_context++;
+	contexts.emplace(id, Context());
+	return id;
+}
+
+void I915FakeBackend::gem_context_destroy(uint32_t id)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if (contexts.erase(id) == 0)
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_CONTEXT_DESTROY", "no such context");
+}
+
+void I915FakeBackend::gem_context_set_vm(uint32_t ctx_id, uint32_t vm_id)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	auto i = contexts.find(ctx_id);
+	if (i == contexts.end())
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_CONTEXT_SETPARAM", "no such context");
+
+	if (vms.find(vm_id) == vms.end())
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_CONTEXT_SETPARAM", "no such vm");
+
+	i->second.vm = vm_id;
+}
+
+uint32_t I915FakeBackend::gem_vm_create()
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	auto id = next_vm++;
+	vms.insert(id);
+	return id;
+}
+
+void I915FakeBackend::gem_vm_destroy(uint32_t id)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if (vms.erase(id) == 0)
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_VM_DESTROY", "no such vm");
+}
+
+void I915FakeBackend::gem_execbuffer2(uint32_t ctx_id, vector<I915ExecBo>& bos,
+		size_t batch_len)
+{
+	const char* ioctl = "DRM_IOCTL_I915_GEM_EXECBUFFER2";
+
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if (contexts.find(ctx_id) == contexts.end())
+		fail(ENOENT, ioctl, "no such context");
+
+	if (bos.empty())
+		fail(EINVAL, ioctl, "no bos");
+
+	/* Bind the bos. Pinned bos must lie in the address space and must not
+	 * overlap; other bos, i.e. the ones with relocations or a null address,
+	 * are bound at their host address, which is the address the kernel would
+	 * choose for userptr bos without overlap, too. */
+	bindings.clear();
+
+	for (size_t i = 0; i < bos.size(); i++)
+	{
+		auto& bo = bos[i];
+		auto handle = get<0>(bo);
+		auto& obj = get_object(handle);
+
+		for (size_t j = 0; j < i; j++)
+		{
+			if (get<0>(bos[j]) == handle)
+				fail(EINVAL, ioctl, "bo passed twice");
+		}
+
+		Binding b;
+		b.size = obj.size;
+		b.ptr = obj.ptr;
+
+		if (get<2>(bo).empty() && get<1>(bo))
+		{
+			b.address = (uintptr_t) get<1>(bo);
+			if (b.address % 4096 != 0 || b.address + b.size > ADDRESS_MASK + 1)
+				fail(EINVAL, ioctl, "invalid pinned address");
+		}
+		else
+		{
+			b.address = (uintptr_t) obj.ptr;
+		}
+
+		for (auto& o : bindings)
+		{
+			if (b.address < o.address + o.size && o.address < b.address + b.size)
+				fail(EINVAL, ioctl, "overlapping bos");
+		}
+
+		bindings.push_back(b);
+	}
+
+	/* Apply relocations; targets must be part of the submission */
+	for (size_t i = 0; i < bos.size(); i++)
+	{
+		for (auto& reloc : get<2>(bos[i]))
+		{
+			const Binding* target = nullptr;
+			for (size_t j = 0; j < bos.size(); j++)
+			{
+				if (get<0>(bos[j]) == reloc.target_handle)
+					target = &bindings[j];
+			}
+
+			if (!target)
+				fail(ENOENT, ioctl, "relocation target is not part of the submission");
+
+			if (reloc.offset % 4 != 0 || reloc.offset + 8 > bindings[i].size)
+				fail(EINVAL, ioctl, "relocation outside of its bo");
+
+			uint64_t address = canonical_address(target->address + reloc.delta);
+			memcpy(bindings[i].ptr + reloc.offset, &address, sizeof(address));
+
+			stats.relocations++;
+		}
+	}
+
+	/* Execute the batch buffer, which is the last bo */
+	auto& bb = bindings.back();
+	if (batch_len == 0 || batch_len > bb.size)
+		fail(EINVAL, ioctl, "invalid batch length");
+
+	PendingBatch batch;
+
+	try
+	{
+		execute(batch, bb.address, bb.address + batch_len, 0);
+	}
+	catch (...)
+	{
+		bindings.clear();
+		throw;
+	}
+
+	bindings.clear();
+	stats.execbufs++;
+
+	batch.ctx_id = ctx_id;
+	batch.hung = hang_next;
+	hang_next = false;
+
+	if (!manual_completion && !batch.hung && pending.empty())
+	{
+		complete(batch);
+		return;
+	}
+
+	for (auto& bo : bos)
+		batch.handles.push_back(get<0>(bo));
+
+	pending.push_back(move(batch));
+}
+
+int64_t I915FakeBackend::gem_wait(uint32_t bo, int64_t timeout_ns)
+{
+	unique_lock<mutex> lock(m);
+	stats.ioctls++;
+
+	if (objects.find(bo) == objects.end())
+		fail(ENOENT, "DRM_IOCTL_I915_GEM_WAIT", "no such handle");
+
+	/* Like the kernel, a negative timeout waits indefinitely */
+	if (timeout_ns < 0)
+	{
+		completed.wait(lock, [&]() { return !is_busy(bo); });
+		return 0;
+	}
+
+	auto start = chrono::steady_clock::now();
+	if (!completed.wait_for(lock, chrono::nanoseconds(timeout_ns),
+				[&]() { return !is_busy(bo); }))
+	{
+		return -1;
+	}
+
+	auto elapsed = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now() - start).count();
+
+	return max(timeout_ns - elapsed, (int64_t) 0);
+}
+
+void I915FakeBackend::gem_get_reset_stats(uint32_t ctx_id,
+		uint32_t& batch_active, uint32_t& batch_pending)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	auto i = contexts.find(ctx_id);
+	if (i == contexts.end())
+		fail(ENOENT, "DRM_IOCTL_I915_GET_RESET_STATS", "no such context");
+
+	batch_active = i->second.batch_active;
+	batch_pending = i->second.batch_pending;
+}
+
+uint64_t I915FakeBackend::reg_read(uint64_t offset)
+{
+	lock_guard<mutex> lock(m);
+	stats.ioctls++;
+
+	if ((offset & ~I915_REG_READ_8B_WA) != REG_TIMESTAMP)
+		fail(EINVAL, "DRM_IOCTL_I915_REG_READ", "unsupported register");
+
+	return timestamp();
+}
+
+drm_magic_t I915FakeBackend::get_drm_magic()
+{
+	return 1;
+}
+
+}
@@ -0,0 +1,185 @@
+/** An emulated i915 device for running the RTE without an Intel GPU.
+ *
+ * Handles, contexts and vms are plain ids. Bos are either userptr bos, which
+ * refer to the caller's memory, or named bos, whose memory is allocated by
+ * the emulation. EXECBUFFER2 validates the bos and relocations like the
+ * kernel, binds the bos at their pinned- or chosen addresses, and parses the
+ * batch buffer. Instead of executing the commands, only the post-sync writes
+ * of PIPE_CONTROLs are recorded. They are performed when the batch completes,
+ * which is right after the submission unless completion is manual or an
+ * earlier batch hung.
+ *
+ * All entry points lock the device, as batches may be completed by another
+ * thread than the one that waits for them. */
+#ifndef __I915_FAKE_BACKEND_H
+#define __I915_FAKE_BACKEND_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <llt_gpgpu_rt/i915_runtime.h>
+#include "i915_backend.h"
+#include "i915_kernel_utils.h"
+#include "gen9_hw_int.h"
+
+namespace OCL {
+
+class I915FakeBackend final : public I915Backend, public I915FakeDevice
+{
+protected:
+	const int pci_id;
+	struct intel_device_info dev_info{};
+
+	struct Object
+	{
+		char* ptr = nullptr;
+		uint64_t size = 0;
+
+		/* Memory of named bos */
+		std::shared_ptr<std::vector<char>> storage;
+	};
+
+	std::map<uint32_t, Object> objects;
+	uint32_t next_handle = 1;
+
+	/* Name -> memory */
+	std::map<uint32_t, std::shared_ptr<std::vector<char>>> names;
+	uint32_t next_name = 1;
+
+	struct Context
+	{
+		uint32_t vm = 0;
+
+		/* Reset stats */
+		uint32_t batch_active = 0;
+		uint32_t batch_pending = 0;
+	};
+
+	std::map<uint32_t, Context> contexts;
+	uint32_t next_context = 1;
+
+	std::set<uint32_t> vms;
+	uint32_t next_vm = 1;
+
+	I915FakeDeviceStats stats;
+
+	/* Bos of the batch that is being executed */
+	struct Binding
+	{
+		uint64_t address;
+		uint64_t size;
+		char* ptr;
+	};
+
+	std::vector<Binding> bindings;
+
+	/* A post-sync write, which is performed when its batch completes */
+	struct PendingWrite
+	{
+		char* dst;
+		bool timestamp;
+		uint64_t value;
+	};
+
+	struct PendingBatch
+	{
+		uint32_t ctx_id = 0;
+
+		/* Bos of the batch, which are busy until it completes */
+		std::vector<uint32_t> handles;
+		std::vector<PendingWrite> writes;
+
+		/* Completes only by a reset, which drops it */
+		bool hung = false;
+	};
+
+	/* In submission order */
+	std::deque<PendingBatch> pending;
+	bool manual_completion = false;
+	bool hang_next = false;
+
+	/* See set_timestamp_step() */
+	uint64_t timestamp_step = 0;
+	uint64_t stepped_timestamp = 0;
+
+	std::mutex m;
+
+	/* Notified when batches complete */
+	std::condition_variable completed;
+
+	const Object& get_object(uint32_t handle) const;
+
+	/* @returns nullptr if the range does not lie in a bound bo */
+	char* resolve(uint64_t address, size_t size) const;
+
+	void execute(PendingBatch& batch, uint64_t address, uint64_t end, unsigned level);
+	void post_sync_write(PendingBatch& batch, const HWInt::Gen9::CmdPipeControl& pc);
+
+	uint64_t timestamp();
+
+	bool is_busy(uint32_t handle) const;
+	void complete(PendingBatch& batch);
+
+	/* Complete up to @param max pending batches in order, stopping at a hung
+	 * one.
+	 * @returns the number of batches that completed */
+	size_t complete_pending(size_t max);
+
+public:
+	I915FakeBackend(int pci_id);
+
+	I915FakeBackend(const I915FakeBackend&) = delete;
+	I915FakeBackend& operator=(const I915FakeBackend&) = delete;
+
+	~I915FakeBackend();
+
+	/* I915FakeDevice */
+	uint32_t create_named_bo(size_t size) override;
+	I915FakeDeviceStats get_stats() override;
+
+	void set_manual_completion(bool enable) override;
+	bool complete_next() override;
+	size_t complete_all() override;
+
+	void hang_next_batch() override;
+	void reset_gpu() override;
+	void set_timestamp_step(uint64_t ticks) override;
+
+	/* I915Backend */
+	drm_version_t get_drm_version(char* driver_name, size_t driver_name_size) override;
+	bool get_device_info(struct intel_device_info& dev_info) override;
+
+	int i915_getparam(int32_t param) override;
+	bool gem_supports_wc_mmap() override;
+
+	uint32_t gem_userptr(void* ptr, uint64_t size, bool probe) override;
+	void gem_open(uint32_t name, uint32_t& handle, uint64_t& size) override;
+	void gem_close(uint32_t handle) override;
+
+	uint32_t gem_context_create() override;
+	void gem_context_destroy(uint32_t id) override;
+	void gem_context_set_vm(uint32_t ctx_id, uint32_t vm_id) override;
+
+	uint32_t gem_vm_create() override;
+	void gem_vm_destroy(uint32_t id) override;
+
+	void gem_execbuffer2(uint32_t ctx_id, std::vector<I915ExecBo>& bos,
+			size_t batch_len) override;
+
+	int64_t gem_wait(uint32_t bo, int64_t timeout_ns) override;
+
+	void gem_get_reset_stats(uint32_t ctx_id,
+			uint32_t& batch_active, uint32_t& batch_pending) override;
+
+	uint64_t reg_read(uint64_t offset) override;
+
+	drm_magic_t get_drm_magic() override;
+};
+
+}
+
+#endif /* __I915_FAKE_BACKEND_H */
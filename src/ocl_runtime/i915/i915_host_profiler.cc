@@ -0,0 +1,162 @@
+#include <limits>
+#include "i915_host_profiler.h"
+
+using namespace std;
+
+namespace OCL
+{
+
+const char* host_phase_name(I915HostPhase phase)
+{
+	switch (phase)
+	{
+		case I915HostPhase::Validation:
+			return "validation";
+
+		case I915HostPhase::SurfaceState:
+			return "surface state";
+
+		case I915HostPhase::CrossThreadData:
+			return "cross-thread data";
+
+		case I915HostPhase::LocalIds:
+			return "local ids";
+
+		case I915HostPhase::BoRegistration:
+			return "bo registration";
+
+		case I915HostPhase::BatchBuild:
+			return "batch build";
+
+		case I915HostPhase::Execbuf:
+			return "execbuf";
+
+		case I915HostPhase::Wait:
+			return "wait";
+
+		default:
+			return "unknown";
+	}
+}
+
+
+unsigned I915PhaseHistogram::bucket_index(uint64_t ns)
+{
+	if (ns < 4)
+		return ns;
+
+	unsigned msb = 63 - __builtin_clzll(ns);
+	return msb * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+uint64_t I915PhaseHistogram::bucket_upper_bound(unsigned index)
+{
+	if (index < 4)
+		return index;
+
+	unsigned msb = index / 4;
+	uint64_t lower = (4ULL + (index % 4)) << (msb - 2);
+	uint64_t width = 1ULL << (msb - 2);
+
+	if (lower > numeric_limits<uint64_t>::max() - width)
+		return numeric_limits<uint64_t>::max();
+
+	return lower + width - 1;
+}
+
+void I915PhaseHistogram::add(uint64_t ns)
+{
+	if (samples == 0 || ns < min)
+		min = ns;
+
+	if (ns > max)
+		max = ns;
+
+	samples++;
+	total += ns;
+	buckets[bucket_index(ns)]++;
+}
+
+void I915PhaseHistogram::get(I915PhaseProfile& profile) const
+{
+	profile.samples = samples;
+	if (samples == 0)
+		return;
+
+	profile.min = chrono::nanoseconds(min);
+	profile.max = chrono::nanoseconds(max);
+	profile.mean = chrono::nanoseconds(total / samples);
+
+	/* Upper bound of the bucket that contains the 99th percentile */
+	uint64_t rank = (samples * 99 + 99) / 100;
+	uint64_t cnt = 0;
+
+	for (unsigned i = 0; i < CNT_BUCKETS; i++)
+	{
+		cnt += buckets[i];
+		if (cnt >= rank)
+		{
+			profile.p99 = chrono::nanoseconds(std::min(bucket_upper_bound(i), max));
+			break;
+		}
+	}
+}
+
+
+void I915KernelPhaseStats::add(I915HostPhase phase, chrono::steady_clock::duration d)
+{
+	pending[(unsigned) phase] += chrono::duration_cast<chrono::nanoseconds>(d).count();
+	pending_valid[(unsigned) phase] = true;
+}
+
+void I915KernelPhaseStats::commit()
+{
+	for (unsigned i = 0; i < phases.size(); i++)
+	{
+		if (pending_valid[i])
+			phases[i].add(pending[i]);
+	}
+
+	pending.fill(0);
+	pending_valid.fill(false);
+}
+
+
+I915KernelPhaseStats& I915HostProfiler::get_kernel(const string& name)
+{
+	return kernels[name];
+}
+
+vector<I915KernelProfile> I915HostProfiler::get_profile() const
+{
+	vector<I915KernelProfile> profile;
+
+	for (auto& [name, stats] : kernels)
+	{
+		I915KernelProfile kp;
+		kp.kernel = name;
+
+		for (unsigned i = 0; i < (unsigned) I915HostPhase::COUNT; i++)
+		{
+			I915PhaseProfile pp;
+			pp.phase = host_phase_name((I915HostPhase) i);
+			stats.phases[i].get(pp);
+
+			if (pp.samples > 0)
+				kp.phases.push_back(pp);
+		}
+
+		if (!kp.phases.empty())
+			profile.push_back(kp);
+	}
+
+	return profile;
+}
+
+void I915HostProfiler::reset()
+{
+	for (auto& [name, stats] : kernels)
+		stats = I915KernelPhaseStats();
+}
+
+}
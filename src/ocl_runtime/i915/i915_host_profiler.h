@@ -0,0 +1,146 @@
+/** Aggregates the host CPU time spent in the phases of dispatching kernels.
+ *
+ * Phases are timed with PROFILE_PHASE / PROFILE_NEXT_PHASE and accumulated
+ * until PROFILE_COMMIT ends the dispatch. The macros compile to nothing unless
+ * ENABLE_HOST_PROFILER is set. */
+#ifndef __I915_HOST_PROFILER_H
+#define __I915_HOST_PROFILER_H
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <llt_gpgpu_rt/i915_runtime.h>
+#include "llt_gpgpu_rt_config.h"
+
+namespace OCL
+{
+
+enum class I915HostPhase : unsigned
+{
+	Validation = 0,
+	SurfaceState,
+	CrossThreadData,
+	LocalIds,
+	BoRegistration,
+	BatchBuild,
+	Execbuf,
+	Wait,
+	COUNT
+};
+
+const char* host_phase_name(I915HostPhase phase);
+
+/* Log-linear histogram of durations with four buckets per power of two,
+ * which bounds the error of percentiles to 25% */
+class I915PhaseHistogram final
+{
+protected:
+	static constexpr unsigned CNT_BUCKETS = 64 * 4;
+
+	uint64_t samples = 0;
+	uint64_t min = 0;
+	uint64_t max = 0;
+	uint64_t total = 0;
+
+	std::array<uint64_t, CNT_BUCKETS> buckets{};
+
+	static unsigned bucket_index(uint64_t ns);
+	static uint64_t bucket_upper_bound(unsigned index);
+
+public:
+	void add(uint64_t ns);
+	void get(I915PhaseProfile& profile) const;
+};
+
+/* Histograms of all phases of one kernel */
+class I915KernelPhaseStats final
+{
+protected:
+	/* Time spent in each phase during the current dispatch; a phase may be
+	 * entered multiple times per dispatch */
+	std::array<uint64_t, (unsigned) I915HostPhase::COUNT> pending{};
+	std::array<bool, (unsigned) I915HostPhase::COUNT> pending_valid{};
+
+public:
+	std::array<I915PhaseHistogram, (unsigned) I915HostPhase::COUNT> phases;
+
+	void add(I915HostPhase phase, std::chrono::steady_clock::duration d);
+
+	/* Add the current dispatch's times to the histograms */
+	void commit();
+};
+
+class I915HostProfiler final
+{
+protected:
+	/* Nodes of a map are stable, hence the stats may be referenced */
+	std::map<std::string, I915KernelPhaseStats> kernels;
+
+public:
+	I915KernelPhaseStats& get_kernel(const std::string& name);
+
+	std::vector<I915KernelProfile> get_profile() const;
+	void reset();
+};
+
+/* Times consecutive phases of a function; the current phase ends when the
+ * next one starts or the timer is destroyed */
+class I915PhaseTimer final
+{
+protected:
+	I915KernelPhaseStats* stats;
+	I915HostPhase phase;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	inline I915PhaseTimer(I915KernelPhaseStats* stats, I915HostPhase phase)
+		: stats(stats), phase(phase), start(std::chrono::steady_clock::now())
+	{
+	}
+
+	I915PhaseTimer(const I915PhaseTimer&) = delete;
+	I915PhaseTimer& operator=(const I915PhaseTimer&) = delete;
+
+	inline ~I915PhaseTimer()
+	{
+		stop();
+	}
+
+	inline void next(I915HostPhase next_phase)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (stats)
+			stats->add(phase, now - start);
+
+		phase = next_phase;
+		start = now;
+	}
+
+	inline void stop()
+	{
+		if (stats)
+			stats->add(phase, std::chrono::steady_clock::now() - start);
+
+		stats = nullptr;
+	}
+};
+
+}
+
+#if ENABLE_HOST_PROFILER
+#define PROFILE_PHASE(STATS, PHASE) \
+	OCL::I915PhaseTimer _phase_timer((STATS), OCL::I915HostPhase::PHASE)
+#define PROFILE_NEXT_PHASE(PHASE) _phase_timer.next(OCL::I915HostPhase::PHASE)
+#define PROFILE_STOP() _phase_timer.stop()
+#define PROFILE_COMMIT(STATS) (STATS)->commit()
+#else
+#define PROFILE_PHASE(STATS, PHASE)
+#define PROFILE_NEXT_PHASE(PHASE)
+#define PROFILE_STOP()
+#define PROFILE_COMMIT(STATS)
+#endif
+
+#endif /* __I915_HOST_PROFILER_H */
@@ -20,12 +20,45 @@ using namespace std;
 
 namespace OCL {
 
+KernelArg::KernelArg(KernelArgType type)
+	: type(type)
+{
+}
+
 KernelArg::~KernelArg()
 {
 }
 
-KernelArgPtr::KernelArgPtr(size_t page_size, void* _ptr, size_t _size)
-	: _ptr(_ptr), _size(_size)
+KernelArgValue::KernelArgValue(const void* ptr, size_t size, KernelArgType type)
+	: KernelArg(type), _bytes((const char*) ptr, (const char*) ptr + size)
+{
+}
+
+KernelArgValue::~KernelArgValue()
+{
+}
+
+const vector<char>& KernelArgValue::bytes() const
+{
+	return _bytes;
+}
+
+KernelArgDispatchConstant::KernelArgDispatchConstant(const void* ptr, size_t size)
+	: KernelArgValue(ptr, size, KernelArgType::DispatchConstant)
+{
+	if (size < 1 || size > MAX_SIZE)
+		throw invalid_argument("Invalid size of __constant kernel argument");
+}
+
+KernelArgDispatchConstant::~KernelArgDispatchConstant()
+{
+}
+
+KernelArgPtr::KernelArgPtr(size_t page_size, void* _ptr, size_t _size,
+		CacheHint _cache_hint)
+	:
+		KernelArg(KernelArgType::Ptr),
+		_ptr(_ptr), _size(_size), _cache_hint(_cache_hint)
 {
 	if ((uintptr_t) _ptr % page_size != 0 || _size % page_size != 0)
 		throw invalid_argument("The pointer and size must be aligned to the page size");
@@ -45,15 +78,47 @@ size_t KernelArgPtr::size() const
 	return _size;
 }
 
-KernelArgGEMName::KernelArgGEMName(I915RTEImpl& rte, uint32_t name)
-	: rte(rte)
+CacheHint KernelArgPtr::cache_hint() const
+{
+	return _cache_hint;
+}
+
+KernelArgLocal::KernelArgLocal(size_t size)
+	: KernelArg(KernelArgType::Local), _size(size)
+{
+	if (size < 1 || size > 64 * 1024)
+		throw invalid_argument("Invalid size of __local kernel argument");
+}
+
+KernelArgLocal::~KernelArgLocal()
+{
+}
+
+size_t KernelArgLocal::size() const
+{
+	return _size;
+}
+
+
+KernelArgGEMName::KernelArgGEMName(I915RTEImpl& rte, uint32_t name,
+		CacheHint cache_hint)
+	:
+		KernelArg(KernelArgType::GEMName),
+		rte(rte), _name(name), _cache_hint(cache_hint)
 {
-	rte.gem_open(name, _handle, _size);
+	uint64_t size;
+	rte.acquire_gem_name(name, _handle, size);
+	_size = size;
 }
 
 KernelArgGEMName::~KernelArgGEMName()
 {
-	rte.gem_close(_handle);
+	rte.release_gem_name(_name);
+}
+
+uint32_t KernelArgGEMName::name() const
+{
+	return _name;
 }
 
 uint32_t KernelArgGEMName::handle() const
@@ -66,228 +131,285 @@ size_t KernelArgGEMName::size() const
 	return _size;
 }
 
+CacheHint KernelArgGEMName::cache_hint() const
+{
+	return _cache_hint;
+}
+
 I915RingCmd::~I915RingCmd()
 {
 }
 
 
-void set_param(
-		uint32_t offset, uint32_t data_size, uint64_t value,
-		size_t& size, char* dst, size_t capacity)
+static KernelArgKind decode_argument_kind(
+		const KernelParameters::KernelArgumentInfo& info, uint32_t& value_size)
 {
-	if (data_size > 8)
-		throw runtime_error("data_size > 8");
+	value_size = 0;
 
-	size_t req_size = offset + data_size;
-	if (req_size > capacity)
-		throw invalid_argument("Size written exceeds capacity");
+	auto& type_name = info.type_name;
+	bool is_pointer = type_name.size() >= 3 &&
+		type_name.compare(type_name.size() - 3, 3, "*;8") == 0;
 
-	size = max(size, req_size);
-	memcpy(dst + offset, &value, data_size);
+	if (
+			info.address_qualifier == "__global" &&
+			info.access_qualifier == "NONE" &&
+			is_pointer &&
+			info.type_qualifier == "NONE")
+	{
+		return KernelArgKind::Buffer;
+	}
 
-	// printf("offset: %d, data_size: %d, value: 0x%llx\n",
-	// 		(int) offset, (int) data_size, (long long) value);
-}
+	if (
+			info.address_qualifier == "__local" &&
+			info.access_qualifier == "NONE" &&
+			is_pointer &&
+			(info.type_qualifier == "NONE" || info.type_qualifier == "const"))
+	{
+		return KernelArgKind::Local;
+	}
 
-template<typename T>
-bool try_set_int_arg(const KernelArg* arg,
-		uint32_t offset, uint32_t data_size,
-		size_t& size, char* dst, size_t capacity)
-{
-	auto int_arg = dynamic_cast<const KernelArgInt<T>*>(arg);
-	if (!int_arg)
-		return false;
+	if (
+			info.address_qualifier == "__constant" &&
+			info.access_qualifier == "NONE" &&
+			is_pointer &&
+			(info.type_qualifier == "NONE" || info.type_qualifier == "const"))
+	{
+		return KernelArgKind::Constant;
+	}
 
-	if (data_size < sizeof(T))
-		throw invalid_argument("data_size too small for type");
+	if (
+			info.address_qualifier != "__private" ||
+			info.access_qualifier != "NONE" ||
+			info.type_qualifier != "NONE")
+	{
+		return KernelArgKind::Unsupported;
+	}
 
-	set_param(
-			offset,
-			data_size,
-			int_arg->value(),
-			size, dst, capacity);
+	static const struct
+	{
+		const char* type_name;
+		KernelArgKind kind;
+		uint32_t size;
+	} scalar_types[] = {
+		{ "int;4", KernelArgKind::Int32, 4 },
+		{ "uint;4", KernelArgKind::UInt32, 4 },
+		{ "long;8", KernelArgKind::Int64, 8 },
+		{ "ulong;8", KernelArgKind::UInt64, 8 },
+		{ "float;4", KernelArgKind::Float, 4 },
+		{ "double;8", KernelArgKind::Double, 8 },
+	};
+
+	for (auto& t : scalar_types)
+	{
+		if (type_name == t.type_name)
+		{
+			value_size = t.size;
+			return t.kind;
+		}
+	}
 
-	return true;
+	/* Other types, e.g. vectors and structs, are described by their name and
+	 * size in bytes only */
+	auto sep = type_name.rfind(';');
+	if (
+			sep == string::npos || sep == 0 || sep + 1 == type_name.size() ||
+			type_name.find('*') != string::npos ||
+			type_name.compare(0, sep, "sampler_t") == 0)
+	{
+		return KernelArgKind::Unsupported;
+	}
+
+	uint64_t size = 0;
+	for (auto i = sep + 1; i < type_name.size(); i++)
+	{
+		if (type_name[i] < '0' || type_name[i] > '9' || size > UINT32_MAX / 10)
+			return KernelArgKind::Unsupported;
+
+		size = size * 10 + (type_name[i] - '0');
+	}
+
+	if (size == 0 || size > UINT32_MAX)
+		return KernelArgKind::Unsupported;
+
+	value_size = size;
+	return KernelArgKind::Value;
 }
 
-size_t build_cross_thread_data(
-		const KernelParameters& params,
-		const NDRange& global_offset,
-		const NDRange& local_size,
-		const vector<unique_ptr<KernelArg>>& args,
-		const char* surface_state_base, size_t surface_state_size,
-		char* dst, size_t capacity,
-		vector<tuple<uint32_t, uint64_t>>& relocs)
+static CrossThreadPatch make_patch(uint32_t offset, uint32_t size,
+		uint32_t source_offset, size_t cross_thread_size)
 {
-	size_t size = 0;
+	if ((uint64_t) offset + size > cross_thread_size)
+		throw invalid_argument("Kernel parameter lies outside of the cross-thread data");
+
+	CrossThreadPatch p;
+	p.offset = offset;
+	p.size = size;
+	p.source_offset = source_offset;
+	return p;
+}
 
-	for (auto& dpb : params.data_parameter_buffers)
+static CrossThreadPatch make_ndrange_patch(
+		const KernelParameters::DataParameterBuffer& dpb, size_t cross_thread_size)
+{
+	if (dpb.source_offset != 0 && dpb.source_offset != 4 && dpb.source_offset != 8)
 	{
-		// printf("\nargument_number: %d, source_offset: %d, location_index: %d, "
-		// 		"location_index2: %d, is_emulation_argument: %d\n",
-		// 		(int) dpb.argument_number, (int) dpb.source_offset,
-		// 		(int) dpb.location_index, (int) dpb.location_index2,
-		// 		(int) dpb.is_emulation_argument);
+		throw invalid_argument("Invalid source_offset for DataParameterBuffer " +
+				to_hex_string(dpb.type));
+	}
 
-		switch (dpb.type)
-		{
-		case iOpenCL::DATA_PARAMETER_GLOBAL_WORK_OFFSET:
-			{
-				// printf("global work offset\n");
+	if (dpb.data_size > 4)
+		throw invalid_argument("data_size > 4 for DataParameterBuffer " + to_hex_string(dpb.type));
 
-				uint32_t val = 0;
-				switch (dpb.source_offset)
-				{
-				case 0:
-					val = global_offset.x;
-					break;
+	return make_patch(dpb.offset, dpb.data_size, dpb.source_offset, cross_thread_size);
+}
 
-				case 4:
-					val = global_offset.y;
-					break;
+KernelBindingPlan compile_binding_plan(const KernelParameters& params,
+		const vector<uint32_t>& surface_state_pointers, size_t cross_thread_size)
+{
+	KernelBindingPlan plan;
 
-				case 8:
-					val = global_offset.z;
-					break;
+	auto get_arg = [&plan](uint32_t argument_number) -> KernelArgPlan& {
+		if (argument_number >= plan.args.size())
+			plan.args.resize(argument_number + 1);
 
-				default:
-					throw invalid_argument("Invalid source_offset for DATA_PARAMETER_GLOBAL_WORK_OFFSET");
-				}
+		return plan.args[argument_number];
+	};
 
-				set_param(
-						dpb.offset,
-						dpb.data_size,
-						val,
-						size, dst, capacity);
-			}
-			break;
+	for (auto& info : params.kernel_argument_infos)
+	{
+		auto& ap = get_arg(info.argument_number);
+		ap.info = &info;
+		ap.kind = decode_argument_kind(info, ap.value_size);
+	}
 
-		case iOpenCL::DATA_PARAMETER_LOCAL_WORK_SIZE:
-			{
-				// printf("local work size\n");
+	/* The constant surface's binding table entry is the one that refers to
+	 * its surface state */
+	auto& cs = params.allocate_stateless_constant_memory_surface_with_initialization;
+	if (cs)
+	{
+		if (cs->data_param_size != 8)
+			throw invalid_argument("Stateless constant memory surface with data param size != 8");
 
-				uint32_t val = 0;
-				switch (dpb.source_offset)
-				{
-				case 0:
-					val = local_size.x;
-					break;
+		plan.has_constant_surface = true;
+		plan.constant_buffer_index = cs->constant_buffer_index;
+		plan.constant_surface_patches.push_back(make_patch(
+					cs->data_param_offset, cs->data_param_size, 0, cross_thread_size));
 
-				case 4:
-					val = local_size.y;
-					break;
+		for (unsigned i = 0; i < surface_state_pointers.size(); i++)
+		{
+			if (surface_state_pointers[i] == cs->surface_state_heap_offset)
+			{
+				plan.constant_surface_bt_index = i;
+				break;
+			}
+		}
+	}
 
-				case 8:
-					val = local_size.z;
-					break;
+	/* The other binding table entries are assigned to buffer arguments in
+	 * order */
+	int bt_index = 0;
+	for (unsigned i = 0; i < plan.args.size(); i++)
+	{
+		if (plan.args[i].kind == KernelArgKind::Constant)
+			plan.constant_args.push_back(i);
 
-				default:
-					throw invalid_argument("Invalid source_offset for DATA_PARAMETER_LOCAL_WORK_SIZE");
-				}
+		if (plan.args[i].kind == KernelArgKind::Local)
+			plan.local_args.push_back(i);
 
-				set_param(
-						dpb.offset,
-						dpb.data_size,
-						val,
-						size, dst, capacity);
-			}
-			break;
+		if (is_buffer_kind(plan.args[i].kind))
+		{
+			if (bt_index == plan.constant_surface_bt_index)
+				bt_index++;
 
-		case iOpenCL::DATA_PARAMETER_ENQUEUED_LOCAL_WORK_SIZE:
-			{
-				// printf("enqueued local work size\n");
+			plan.args[i].bt_index = bt_index++;
 
-				uint32_t val = 0;
+			if (!surface_state_pointers.empty())
+				plan.bt_args.push_back(i);
+		}
+	}
 
-				switch (dpb.source_offset)
-				{
-				case 0:
-					val = local_size.x;
-					break;
+	size_t cnt_bt_entries = plan.bt_args.size() +
+		(plan.constant_surface_bt_index >= 0 ? 1 : 0);
 
-				case 4:
-					val = local_size.y;
-					break;
+	if (!surface_state_pointers.empty() && cnt_bt_entries != surface_state_pointers.size())
+		throw invalid_argument("Kernel binding table entry count != buffer-like kernel argument count");
 
-				case 8:
-					val = local_size.z;
-					break;
+	for (auto& dpb : params.data_parameter_buffers)
+	{
+		switch (dpb.type)
+		{
+		case iOpenCL::DATA_PARAMETER_GLOBAL_WORK_OFFSET:
+			plan.global_offset_patches.push_back(make_ndrange_patch(dpb, cross_thread_size));
+			break;
 
-				default:
-					throw invalid_argument("Invalid source_offset for DATA_PARAMETER_LOCAL_WORK_SIZE");
-				}
+		case iOpenCL::DATA_PARAMETER_LOCAL_WORK_SIZE:
+			plan.local_size_patches.push_back(make_ndrange_patch(dpb, cross_thread_size));
+			break;
 
-				set_param(
-						dpb.offset,
-						dpb.data_size,
-						val,
-						size, dst, capacity);
-			}
+		case iOpenCL::DATA_PARAMETER_ENQUEUED_LOCAL_WORK_SIZE:
+			plan.enqueued_local_size_patches.push_back(make_ndrange_patch(dpb, cross_thread_size));
 			break;
 
 		case iOpenCL::DATA_PARAMETER_KERNEL_ARGUMENT:
 			{
-				// printf("kernel argument\n");
-
-				if (args.size() <= dpb.argument_number)
-					throw invalid_argument("Missing kernel argument");
-
-
-				if (try_set_int_arg<int32_t>(
-							args[dpb.argument_number].get(),
-							dpb.offset, dpb.data_size, size, dst, capacity))
+				auto& ap = get_arg(dpb.argument_number);
+				if (is_buffer_kind(ap.kind))
 				{
-						break;
+					throw invalid_argument("Kernel buffer argument " +
+							std::to_string(dpb.argument_number) + " is passed by value");
 				}
 
-				if (try_set_int_arg<uint32_t>(
-							args[dpb.argument_number].get(),
-							dpb.offset, dpb.data_size, size, dst, capacity))
+				/* Structs are passed as one parameter per member */
+				if (ap.kind != KernelArgKind::Unsupported &&
+						(uint64_t) dpb.source_offset + dpb.data_size > ap.value_size)
 				{
-						break;
+					throw invalid_argument("data_size too large for type of kernel argument " +
+							std::to_string(dpb.argument_number));
 				}
 
-				if (try_set_int_arg<int64_t>(
-							args[dpb.argument_number].get(),
-							dpb.offset, dpb.data_size, size, dst, capacity))
-				{
-						break;
-				}
+				ap.value_patches.push_back(make_patch(
+							dpb.offset, dpb.data_size, dpb.source_offset, cross_thread_size));
+			}
+			break;
 
-				if (try_set_int_arg<uint64_t>(
-							args[dpb.argument_number].get(),
-							dpb.offset, dpb.data_size, size, dst, capacity))
+		case iOpenCL::DATA_PARAMETER_SUM_OF_LOCAL_MEMORY_OBJECT_ARGUMENT_SIZES:
+			{
+				/* Like intel-compute-runtime, the source offset is the
+				 * alignment of the allocation */
+				auto& ap = get_arg(dpb.argument_number);
+				if (ap.kind != KernelArgKind::Local)
 				{
-						break;
+					throw invalid_argument("SLM offset for non-__local kernel argument " +
+							std::to_string(dpb.argument_number));
 				}
 
-				throw invalid_argument("Invalid kernel argument number " +
-						std::to_string(dpb.argument_number) +
-						" has unsupported type");
+				uint32_t alignment = max<uint32_t>(dpb.source_offset, 1);
+				if ((alignment & (alignment - 1)) != 0)
+					throw invalid_argument("SLM alignment is not a power of two");
+
+				if (dpb.data_size > 4)
+					throw invalid_argument("data_size > 4 for SLM offset");
+
+				ap.slm_alignment = max(ap.slm_alignment, alignment);
+				ap.slm_offset_patches.push_back(make_patch(
+							dpb.offset, dpb.data_size, 0, cross_thread_size));
 			}
+			break;
 
 		case iOpenCL::DATA_PARAMETER_BUFFER_STATEFUL:
 			{
-				if (args.size() <= dpb.argument_number)
-					throw invalid_argument("Missing kernel argument");
-
-				/* TODO: What is this? */
-				uint32_t bt_entry = 0;
-				for (unsigned i = 0; i < dpb.argument_number; i++)
+				auto& ap = get_arg(dpb.argument_number);
+				if (!is_buffer_kind(ap.kind))
 				{
-					if (
-							dynamic_cast<const KernelArgPtr*>(args[i].get()) ||
-							dynamic_cast<const KernelArgGEMName*>(args[i].get()))
-					{
-						bt_entry++;
-					}
+					throw invalid_argument("DATA_PARAMETER_BUFFER_STATEFUL for non-buffer "
+							"kernel argument " + std::to_string(dpb.argument_number));
 				}
 
-				set_param(
-						dpb.offset,
-						dpb.data_size,
-						bt_entry,
-						size, dst, capacity);
+				if (dpb.data_size > 4)
+					throw invalid_argument("data_size > 4 for DATA_PARAMETER_BUFFER_STATEFUL");
+
+				ap.bt_index_patches.push_back(make_patch(
+							dpb.offset, dpb.data_size, 0, cross_thread_size));
 			}
 			break;
 
@@ -297,76 +419,218 @@ size_t build_cross_thread_data(
 		}
 	}
 
-	for (auto& sgo : params.stateless_global_memory_object_kernel_arguments)
+	auto add_pointer_patches = [&](
+			const vector<KernelParameters::StatelessGlobalMemoryObjectKernelArgument>& objects,
+			KernelArgKind kind, const char* what)
 	{
-		if (args.size() <= sgo.argument_number)
-			throw invalid_argument("Missing kernel argument");
+		for (auto& so : objects)
+		{
+			auto& ap = get_arg(so.argument_number);
+			if (ap.kind != kind)
+			{
+				throw invalid_argument(string("Stateless ") + what + " memory object for "
+						"kernel argument " + std::to_string(so.argument_number) +
+						" of a different type");
+			}
 
-		// printf("DEBUG: %d %d %x\n",
-		// 		(int) sgo.location_index,
-		// 		(int) sgo.location_index2,
-		// 		(unsigned) sgo.surface_state_heap_offset);
+			if (so.data_param_size != 8)
+			{
+				throw invalid_argument(string("Stateless ") + what + " memory object "
+						"with data param size != 8");
+			}
 
-		HWInt::Gen9::RENDER_SURFACE_STATE rss;
-		if (sgo.surface_state_heap_offset + sizeof(rss) > surface_state_size)
-		{
-			throw invalid_argument("Stateless global memory object's surface "
-					"state does not lie in the surface state heap");
+			ap.pointer_patches.push_back(make_patch(
+						so.data_param_offset, so.data_param_size, 0, cross_thread_size));
 		}
+	};
+
+	if (params.allocate_local_surface)
+		plan.inline_slm_size = params.allocate_local_surface->total_inline_local_memory_size;
+
+	add_pointer_patches(params.stateless_global_memory_object_kernel_arguments,
+			KernelArgKind::Buffer, "global");
 
-		if (sgo.data_param_size != 8)
+	add_pointer_patches(params.stateless_constant_memory_object_kernel_arguments,
+			KernelArgKind::Constant, "constant");
+
+	return plan;
+}
+
+
+static void write_patches(const vector<CrossThreadPatch>& patches,
+		const char* src, char* dst)
+{
+	for (auto& p : patches)
+		memcpy(dst + p.offset, src + p.source_offset, p.size);
+}
+
+/* Calls @param f with the SLM offset of each __local argument and returns the
+ * total size */
+template<typename F>
+static uint32_t place_local_arguments(const KernelBindingPlan& plan,
+		const vector<unique_ptr<KernelArg>>& args, F f)
+{
+	uint64_t offset = plan.inline_slm_size;
+
+	for (auto i : plan.local_args)
+	{
+		auto arg = i < args.size() ? args[i].get() : nullptr;
+		if (!arg || arg->type != KernelArgType::Local)
+			throw invalid_argument("Missing kernel argument " + std::to_string(i));
+
+		auto alignment = plan.args[i].slm_alignment;
+		offset = (offset + alignment - 1) & ~((uint64_t) alignment - 1);
+		f(plan.args[i], (uint32_t) offset);
+
+		offset += static_cast<KernelArgLocal*>(arg)->size();
+		if (offset > 64 * 1024)
+			throw invalid_argument("requested SLM size > 64kiB");
+	}
+
+	return offset;
+}
+
+uint32_t local_memory_size(const KernelBindingPlan& plan,
+		const vector<unique_ptr<KernelArg>>& args)
+{
+	return place_local_arguments(plan, args, [](const KernelArgPlan&, uint32_t) {});
+}
+
+void write_cross_thread_pointer(const vector<CrossThreadPatch>& patches,
+		uint64_t address, char* dst)
+{
+	write_patches(patches, (const char*) &address, dst);
+}
+
+void build_cross_thread_data(
+		const KernelBindingPlan& plan,
+		const NDRange& global_offset,
+		const NDRange& local_size,
+		const vector<unique_ptr<KernelArg>>& args,
+		char* dst,
+		vector<tuple<uint32_t, uint64_t>>& relocs,
+		const vector<bool>* dirty_args)
+{
+	/* Only argument values can change between updates */
+	if (!dirty_args)
+	{
+		const uint32_t offset[3] = { global_offset.x, global_offset.y, global_offset.z };
+		const uint32_t local[3] = { local_size.x, local_size.y, local_size.z };
+
+		write_patches(plan.global_offset_patches, (const char*) offset, dst);
+		write_patches(plan.local_size_patches, (const char*) local, dst);
+		write_patches(plan.enqueued_local_size_patches, (const char*) local, dst);
+	}
+
+	for (unsigned i = 0; i < plan.args.size(); i++)
+	{
+		auto& ap = plan.args[i];
+		if (ap.value_patches.empty() && ap.bt_index_patches.empty() &&
+				ap.pointer_patches.empty())
 		{
-			throw invalid_argument("Stateless global memory object with data "
-					"param size != 8");
+			continue;
 		}
 
-		/* Find argument for surface state */
-		auto arg = args[sgo.argument_number].get();
-		auto arg_gem_name = dynamic_cast<const KernelArgGEMName*>(arg);
-		uint64_t addr;
+		auto arg = i < args.size() ? args[i].get() : nullptr;
+		if (!arg)
+			throw invalid_argument("Missing kernel argument " + std::to_string(i));
 
-		if (arg_gem_name)
-		{
-			/* Relocate bo start address */
-			relocs.push_back({arg_gem_name->handle(), sgo.data_param_offset});
+		bool dirty = !dirty_args || (i < dirty_args->size() && (*dirty_args)[i]);
+		uint32_t bt_index = ap.bt_index;
 
-			addr = 0;
-		}
-		else
+		switch (arg->type)
 		{
-			/* Take address of pinned bo */
-			memcpy(rss.data,
-					surface_state_base + sgo.surface_state_heap_offset,
-					sizeof(rss.data));
+		case KernelArgType::Value:
+			if (dirty)
+			{
+				write_patches(ap.value_patches,
+						static_cast<const KernelArgValue*>(arg)->bytes().data(), dst);
+			}
+			break;
+
+		case KernelArgType::Ptr:
+			if (dirty)
+			{
+				uint64_t addr = (uintptr_t) static_cast<KernelArgPtr*>(arg)->ptr();
+				write_patches(ap.pointer_patches, (const char*) &addr, dst);
+				write_patches(ap.bt_index_patches, (const char*) &bt_index, dst);
+			}
+			break;
 
-			addr = rss.get_surface_base_address();
+		case KernelArgType::GEMName:
+			{
+				/* Relocate bo start address */
+				auto handle = static_cast<const KernelArgGEMName*>(arg)->handle();
+				for (auto& p : ap.pointer_patches)
+					relocs.push_back({handle, p.offset});
+
+				if (dirty)
+				{
+					uint64_t addr = 0;
+					write_patches(ap.pointer_patches, (const char*) &addr, dst);
+					write_patches(ap.bt_index_patches, (const char*) &bt_index, dst);
+				}
+			}
+			break;
+
+		case KernelArgType::DispatchConstant:
+			/* The pointers are set per dispatch */
+			if (dirty)
+				write_patches(ap.bt_index_patches, (const char*) &bt_index, dst);
+			break;
+
+		case KernelArgType::Local:
+			break;
 		}
+	}
+
+	/* A changed size moves the allocations of all later __local arguments */
+	bool local_dirty = !dirty_args;
+	for (auto i : plan.local_args)
+		local_dirty = local_dirty || (i < dirty_args->size() && (*dirty_args)[i]);
+
+	if (local_dirty)
+	{
+		place_local_arguments(plan, args, [dst](const KernelArgPlan& ap, uint32_t offset) {
+			write_patches(ap.slm_offset_patches, (const char*) &offset, dst);
+		});
+	}
+}
+
+void set_local_work_size(
+		const KernelBindingPlan& plan,
+		const NDRange& local_size,
+		char* dst)
+{
+	const uint32_t local[3] = { local_size.x, local_size.y, local_size.z };
+	write_patches(plan.local_size_patches, (const char*) local, dst);
+}
+
+bool build_options_allow_non_uniform_groups(const char* options)
+{
+	bool cl2 = false;
+	bool uniform = false;
+
+	string opts(options ? options : "");
+	size_t pos = 0;
+
+	while (pos < opts.size())
+	{
+		auto start = opts.find_first_not_of(" \t\n", pos);
+		if (start == string::npos)
+			break;
+
+		pos = opts.find_first_of(" \t\n", start);
+		auto opt = opts.substr(start, pos == string::npos ? string::npos : pos - start);
 
-		set_param(
-				sgo.data_param_offset,
-				sgo.data_param_size,
-				addr,
-				size, dst, capacity);
+		/* The last -cl-std wins */
+		if (opt.compare(0, 10, "-cl-std=CL") == 0)
+			cl2 = opt.size() > 10 && opt[10] >= '2' && opt[10] <= '9';
+		else if (opt == "-cl-uniform-work-group-size")
+			uniform = true;
 	}
 
-	// auto ptr = (const unsigned char*) dst;
-	// for (unsigned i = 0; i < size && (i + 31) < capacity; i += 32)
-	// {
-	// 	printf("%02x%02x%02x%02x %02x%02x%02x%02x %02x%02x%02x%02x %02x%02x%02x%02x "
-	// 			"%02x%02x%02x%02x %02x%02x%02x%02x %02x%02x%02x%02x %02x%02x%02x%02x\n",
-	// 			(unsigned) ptr[31], (unsigned) ptr[30], (unsigned) ptr[29], (unsigned) ptr[28],
-	// 			(unsigned) ptr[27], (unsigned) ptr[26], (unsigned) ptr[25], (unsigned) ptr[24],
-	// 			(unsigned) ptr[23], (unsigned) ptr[22], (unsigned) ptr[21], (unsigned) ptr[20],
-	// 			(unsigned) ptr[19], (unsigned) ptr[18], (unsigned) ptr[17], (unsigned) ptr[16],
-	// 			(unsigned) ptr[15], (unsigned) ptr[14], (unsigned) ptr[13], (unsigned) ptr[12],
-	// 			(unsigned) ptr[11], (unsigned) ptr[10], (unsigned) ptr[9], (unsigned) ptr[8],
-	// 			(unsigned) ptr[7], (unsigned) ptr[6], (unsigned) ptr[5], (unsigned) ptr[4],
-	// 			(unsigned) ptr[3], (unsigned) ptr[2], (unsigned) ptr[1], (unsigned) ptr[0]);
-
-	// 	ptr += 32;
-	// }
-
-	return size;
+	return cl2 && !uniform;
 }
 
 }
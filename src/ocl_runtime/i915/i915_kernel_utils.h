@@ -13,32 +13,52 @@ namespace OCL {
 /* Prototoypes of mutually required header files */
 class I915RTEImpl;
 
+/* Arguments are distinguished by their type s.t. dispatches do not need
+ * dynamic_casts */
+enum class KernelArgType
+{
+	Value,
+	Ptr,
+	GEMName,
+	DispatchConstant,
+	Local
+};
+
 class KernelArg
 {
 public:
+	const KernelArgType type;
+
+	KernelArg(KernelArgType type);
 	virtual ~KernelArg() = 0;
 };
 
-template <typename T>
-class KernelArgInt : public KernelArg
+/* A by-value argument in the byte layout of the kernel's parameter */
+class KernelArgValue : public KernelArg
 {
 protected:
-	T _value;
+	std::vector<char> _bytes;
 
 public:
-	KernelArgInt(T value)
-		: _value(value)
-	{
-	}
+	KernelArgValue(const void* ptr, size_t size,
+			KernelArgType type = KernelArgType::Value);
+	~KernelArgValue();
 
-	~KernelArgInt()
-	{
-	}
+	const std::vector<char>& bytes() const;
+};
 
-	T value() const
-	{
-		return _value;
-	}
+/* The contents of a __constant buffer, which are copied to the indirect state
+ * of each dispatch and read through a surface like any buffer. This is not a
+ * push constant in the CURBE; the copy merely saves the caller a buffer of its
+ * own. */
+class KernelArgDispatchConstant final : public KernelArgValue
+{
+public:
+	/* Like the largest constant buffer that OpenCL guarantees */
+	static constexpr size_t MAX_SIZE = 64 * 1024;
+
+	KernelArgDispatchConstant(const void* ptr, size_t size);
+	~KernelArgDispatchConstant();
 };
 
 class KernelArgPtr : public KernelArg
@@ -46,28 +66,47 @@ class KernelArgPtr : public KernelArg
 protected:
 	void* _ptr;
 	const size_t _size;
+	const CacheHint _cache_hint;
 
 public:
-	KernelArgPtr(size_t page_size, void* ptr, size_t size);
+	KernelArgPtr(size_t page_size, void* ptr, size_t size, CacheHint cache_hint);
 	~KernelArgPtr();
 
 	void* ptr();
 	size_t size() const;
+	CacheHint cache_hint() const;
 };
 
 class KernelArgGEMName : public KernelArg
 {
 protected:
 	I915RTEImpl& rte;
+	const uint32_t _name;
+	const CacheHint _cache_hint;
 	uint32_t _handle;
 	size_t _size;
 
 public:
-	KernelArgGEMName(I915RTEImpl& rte, uint32_t name);
+	KernelArgGEMName(I915RTEImpl& rte, uint32_t name, CacheHint cache_hint);
 	~KernelArgGEMName();
 
+	uint32_t name() const;
 	uint32_t handle() const;
 	size_t size() const;
+	CacheHint cache_hint() const;
+};
+
+/* Size of a __local pointer argument's SLM allocation */
+class KernelArgLocal : public KernelArg
+{
+protected:
+	const size_t _size;
+
+public:
+	KernelArgLocal(size_t size);
+	~KernelArgLocal();
+
+	size_t size() const;
 };
 
 class I915RingCmd
@@ -106,6 +145,22 @@ inline uint32_t slm_size_from_idesc(uint32_t s)
 	return v;
 }
 
+/* SLM is allocated in powers of two >= 1kiB */
+inline uint32_t slm_allocation_size(uint32_t v)
+{
+	if (v == 0)
+		return 0;
+
+	if (v > 64 * 1024)
+		throw std::invalid_argument("requested SLM size > 64kiB");
+
+	uint32_t s = 1024;
+	while (s < v)
+		s *= 2;
+
+	return s;
+}
+
 inline uint32_t slm_size_to_idesc(uint32_t v)
 {
 	if (v == 0)
@@ -126,16 +181,159 @@ inline uint32_t slm_size_to_idesc(uint32_t v)
 	return s;
 }
 
-/* Invoke with @param dst = nullptr and @param capacity = 0 to determine the
- * required buffer size. */
-size_t build_cross_thread_data(
-		const KernelParameters& params,
+/* Encoding of MEDIA_VFE_STATE's per thread scratch space: 1kiB << value */
+inline uint32_t scratch_size_to_vfe(uint32_t v)
+{
+	if (v > 2 * 1024 * 1024)
+		throw std::invalid_argument("Scratch size > 2MiB");
+
+	uint32_t s = 0;
+	uint32_t v_prime = 1024;
+
+	while (v_prime < v)
+	{
+		v_prime *= 2;
+		s += 1;
+	}
+
+	return s;
+}
+
+/* Kind of a kernel argument, decoded from its KernelArgumentInfo */
+enum class KernelArgKind
+{
+	Unsupported,
+	Int32,
+	UInt32,
+	Int64,
+	UInt64,
+	Float,
+	Double,
+
+	/* Any other by-value type, e.g. vectors and structs */
+	Value,
+
+	Buffer,
+
+	/* A __constant pointer; bound like a buffer */
+	Constant,
+
+	/* A __local pointer, which receives an offset into the SLM */
+	Local
+};
+
+inline bool is_buffer_kind(KernelArgKind kind)
+{
+	return kind == KernelArgKind::Buffer || kind == KernelArgKind::Constant;
+}
+
+/* Copy size bytes from source_offset of a value to offset in the
+ * cross-thread data. For NDRange values, source_offset selects the
+ * dimension (0, 4 or 8). */
+struct CrossThreadPatch
+{
+	uint32_t offset = 0;
+	uint32_t size = 0;
+	uint32_t source_offset = 0;
+};
+
+struct KernelArgPlan
+{
+	/* nullptr if the kernel has no argument at this position */
+	const KernelParameters::KernelArgumentInfo* info = nullptr;
+	KernelArgKind kind = KernelArgKind::Unsupported;
+
+	/* Size of the value of by-value arguments; 0 for other arguments */
+	uint32_t value_size = 0;
+	std::vector<CrossThreadPatch> value_patches;
+
+	/* Buffer arguments: binding table entry in argument order, the slots
+	 * that receive it, and the slots of stateless pointers to the buffer */
+	int bt_index = -1;
+	std::vector<CrossThreadPatch> bt_index_patches;
+	std::vector<CrossThreadPatch> pointer_patches;
+
+	/* __local pointer arguments: alignment of the allocation and the slots
+	 * that receive its SLM offset */
+	uint32_t slm_alignment = 1;
+	std::vector<CrossThreadPatch> slm_offset_patches;
+};
+
+/* How the arguments and the NDRange are bound to the kernel's state, compiled
+ * from the patch tokens when the kernel is loaded. All patches are validated
+ * against the cross-thread data size. */
+struct KernelBindingPlan
+{
+	std::vector<KernelArgPlan> args;
+
+	/* Arguments with a binding table entry; empty if the kernel has no
+	 * binding table */
+	std::vector<unsigned> bt_args;
+
+	/* __constant pointer arguments */
+	std::vector<unsigned> constant_args;
+
+	/* __local pointer arguments, whose allocations follow the kernel's own
+	 * SLM in argument order */
+	std::vector<unsigned> local_args;
+	uint32_t inline_slm_size = 0;
+
+	std::vector<CrossThreadPatch> global_offset_patches;
+	std::vector<CrossThreadPatch> local_size_patches;
+	std::vector<CrossThreadPatch> enqueued_local_size_patches;
+
+	/* The program-scope constant surface, if the kernel uses it: its binding
+	 * table entry (-1 if it has none) and the slots of stateless pointers to
+	 * it */
+	bool has_constant_surface = false;
+	uint32_t constant_buffer_index = 0;
+	int constant_surface_bt_index = -1;
+	std::vector<CrossThreadPatch> constant_surface_patches;
+};
+
+/* @param surface_state_pointers holds the offsets of the surface states of
+ * the binding table entries. Their number must match the number of buffer
+ * arguments plus the constant surface's entry unless it is 0. */
+KernelBindingPlan compile_binding_plan(const KernelParameters& params,
+		const std::vector<uint32_t>& surface_state_pointers, size_t cross_thread_size);
+
+/* SLM required by the kernel and its __local arguments in bytes, not
+ * rounded to the allocation granularity */
+uint32_t local_memory_size(const KernelBindingPlan& plan,
+		const std::vector<std::unique_ptr<KernelArg>>& args);
+
+/* Write @param address to the pointer slots @param patches */
+void write_cross_thread_pointer(const std::vector<CrossThreadPatch>& patches,
+		uint64_t address, char* dst);
+
+/* Write the slots of @param plan to @param dst, which holds the kernel's
+ * cross-thread data. @param local_size is the enqueued local size, which is
+ * also written to the local work size slots. Pointers to dispatch constants and
+ * the constant surface are left untouched.
+ *
+ * If @param dirty_args is given, only the slots of the arguments marked in it
+ * are written, and slots that do not depend on arguments are left untouched.
+ * Relocations are reported for all arguments in any case. */
+void build_cross_thread_data(
+		const KernelBindingPlan& plan,
 		const NDRange& global_offset,
 		const NDRange& local_size,
 		const std::vector<std::unique_ptr<KernelArg>>& args,
-		const char* surface_state_base, size_t surface_state_size,
-		char* dst, size_t capacity,
-		std::vector<std::tuple<uint32_t, uint64_t>>& relocs);
+		char* dst,
+		std::vector<std::tuple<uint32_t, uint64_t>>& relocs,
+		const std::vector<bool>* dirty_args = nullptr);
+
+/* Overwrite the local work size slots, e.g. for the partial work groups at the
+ * end of a non-uniform NDRange */
+void set_local_work_size(
+		const KernelBindingPlan& plan,
+		const NDRange& local_size,
+		char* dst);
+
+/* Partial work groups at the end of an NDRange are defined only by OpenCL
+ * 2.0 and later, and -cl-uniform-work-group-size disables them again. Without
+ * -cl-std the compiler defaults to OpenCL 1.2. */
+bool build_options_allow_non_uniform_groups(const char* options);
 
 }
 
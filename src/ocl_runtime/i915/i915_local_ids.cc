@@ -0,0 +1,195 @@
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include "i915_local_ids.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_INTRINSICS 1
+#endif
+
+using namespace std;
+
+namespace OCL
+{
+
+/* A work group has at most 1024 work items; lanes of the last thread may
+ * exceed them */
+static constexpr unsigned MAX_LANES = 1024 + 32;
+
+/* Vectorized fills may write up to one vector past the last lane */
+static constexpr unsigned PADDING = 16;
+
+/* Ids of all lanes in linear order */
+struct LinearIds
+{
+	alignas(32) uint16_t x[MAX_LANES + PADDING];
+	alignas(32) uint16_t y[MAX_LANES + PADDING];
+	alignas(32) uint16_t z[MAX_LANES + PADDING];
+};
+
+/* Fill the @param count lanes starting at @param n, which belong to one row
+ * of the work group */
+typedef void (*fill_row_t)(LinearIds& ids, unsigned n, unsigned count,
+		uint16_t y, uint16_t z);
+
+static void validate_shape(const I915LocalIdShape& shape)
+{
+	if (shape.simd_size != 8 && shape.simd_size != 16 && shape.simd_size != 32)
+		throw invalid_argument("Invalid SIMD size for local ids");
+
+	if (shape.local_size[0] < 1 || shape.local_size[1] < 1 || shape.local_size[2] < 1)
+		throw invalid_argument("Invalid local size for local ids");
+
+	if ((size_t) shape.cnt_threads * shape.simd_size > MAX_LANES)
+		throw invalid_argument("Too many lanes for local ids");
+
+	if (shape.local_id_size < 2 * shape.simd_size ||
+			shape.per_thread_size < 3 * shape.local_id_size)
+	{
+		throw invalid_argument("Per-thread payload too small for local ids");
+	}
+}
+
+static void generate(const I915LocalIdShape& shape, char* dst, fill_row_t fill_row)
+{
+	validate_shape(shape);
+
+	LinearIds ids;
+
+	/* Rows are contiguous in the linear order, hence no division is needed.
+	 * Like the hardware's own enumeration, z is not wrapped. */
+	unsigned cnt_lanes = shape.cnt_threads * shape.simd_size;
+	uint16_t y = 0;
+	uint16_t z = 0;
+
+	for (unsigned n = 0; n < cnt_lanes; n += shape.local_size[0])
+	{
+		fill_row(ids, n, min(shape.local_size[0], cnt_lanes - n), y, z);
+
+		if (++y == shape.local_size[1])
+		{
+			y = 0;
+			z++;
+		}
+	}
+
+	/* Distribute to the threads */
+	size_t lane_bytes = shape.simd_size * sizeof(uint16_t);
+
+	for (unsigned t = 0; t < shape.cnt_threads; t++)
+	{
+		char* thread_dst = dst + t * shape.per_thread_size;
+		unsigned n = t * shape.simd_size;
+
+		memcpy(thread_dst, ids.x + n, lane_bytes);
+		memcpy(thread_dst + shape.local_id_size, ids.y + n, lane_bytes);
+		memcpy(thread_dst + 2 * shape.local_id_size, ids.z + n, lane_bytes);
+	}
+}
+
+
+static void fill_row_scalar(LinearIds& ids, unsigned n, unsigned count,
+		uint16_t y, uint16_t z)
+{
+	for (unsigned k = 0; k < count; k++)
+	{
+		ids.x[n + k] = k;
+		ids.y[n + k] = y;
+		ids.z[n + k] = z;
+	}
+}
+
+bool generate_local_ids_scalar(const I915LocalIdShape& shape, char* dst)
+{
+	generate(shape, dst, fill_row_scalar);
+	return true;
+}
+
+
+#ifdef HAVE_X86_INTRINSICS
+
+__attribute__((target("sse2")))
+static void fill_row_sse2(LinearIds& ids, unsigned n, unsigned count,
+		uint16_t y, uint16_t z)
+{
+	const __m128i step = _mm_set1_epi16(8);
+	const __m128i vy = _mm_set1_epi16(y);
+	const __m128i vz = _mm_set1_epi16(z);
+	__m128i vx = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (unsigned k = 0; k < count; k += 8)
+	{
+		_mm_storeu_si128((__m128i*) (ids.x + n + k), vx);
+		_mm_storeu_si128((__m128i*) (ids.y + n + k), vy);
+		_mm_storeu_si128((__m128i*) (ids.z + n + k), vz);
+
+		vx = _mm_add_epi16(vx, step);
+	}
+}
+
+__attribute__((target("avx2")))
+static void fill_row_avx2(LinearIds& ids, unsigned n, unsigned count,
+		uint16_t y, uint16_t z)
+{
+	const __m256i step = _mm256_set1_epi16(16);
+	const __m256i vy = _mm256_set1_epi16(y);
+	const __m256i vz = _mm256_set1_epi16(z);
+	__m256i vx = _mm256_setr_epi16(
+			0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	for (unsigned k = 0; k < count; k += 16)
+	{
+		_mm256_storeu_si256((__m256i*) (ids.x + n + k), vx);
+		_mm256_storeu_si256((__m256i*) (ids.y + n + k), vy);
+		_mm256_storeu_si256((__m256i*) (ids.z + n + k), vz);
+
+		vx = _mm256_add_epi16(vx, step);
+	}
+}
+
+bool generate_local_ids_sse2(const I915LocalIdShape& shape, char* dst)
+{
+	if (!__builtin_cpu_supports("sse2"))
+		return false;
+
+	generate(shape, dst, fill_row_sse2);
+	return true;
+}
+
+bool generate_local_ids_avx2(const I915LocalIdShape& shape, char* dst)
+{
+	if (!__builtin_cpu_supports("avx2"))
+		return false;
+
+	generate(shape, dst, fill_row_avx2);
+	return true;
+}
+
+#else
+
+bool generate_local_ids_sse2(const I915LocalIdShape&, char*)
+{
+	return false;
+}
+
+bool generate_local_ids_avx2(const I915LocalIdShape&, char*)
+{
+	return false;
+}
+
+#endif /* HAVE_X86_INTRINSICS */
+
+
+void generate_local_ids(const I915LocalIdShape& shape, char* dst)
+{
+	if (generate_local_ids_avx2(shape, dst))
+		return;
+
+	if (generate_local_ids_sse2(shape, dst))
+		return;
+
+	generate_local_ids_scalar(shape, dst);
+}
+
+}
@@ -0,0 +1,45 @@
+/** Generation of the per-thread local id payload.
+ *
+ * Each thread of a work group receives the x, y and z ids of its SIMD lanes
+ * as 16 bit values, one block of local_id_size bytes per dimension. Lanes are
+ * numbered linearly in x, y, z order; lanes past the end of the work group
+ * continue the sequence and are disabled by the walker's execution mask. The
+ * payload depends only on the work group's shape, hence the runtime generates
+ * it once per shape. */
+#ifndef __I915_LOCAL_IDS_H
+#define __I915_LOCAL_IDS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace OCL
+{
+
+struct I915LocalIdShape
+{
+	uint32_t local_size[3] = {};
+	unsigned simd_size = 0;
+	unsigned cnt_threads = 0;
+
+	/* Bytes per dimension and thread, >= 2 * simd_size */
+	size_t local_id_size = 0;
+
+	/* Distance between the payloads of consecutive threads, >= 3 *
+	 * local_id_size */
+	size_t per_thread_size = 0;
+};
+
+/* Write the local ids of all threads to @param dst, which holds
+ * shape.cnt_threads * shape.per_thread_size bytes. Bytes that do not hold
+ * ids are left untouched. Uses AVX2 or SSE2 if the CPU supports them. */
+void generate_local_ids(const I915LocalIdShape& shape, char* dst);
+
+/* Variants for benchmarking; they return false if the CPU does not support
+ * the instruction set */
+bool generate_local_ids_scalar(const I915LocalIdShape& shape, char* dst);
+bool generate_local_ids_sse2(const I915LocalIdShape& shape, char* dst);
+bool generate_local_ids_avx2(const I915LocalIdShape& shape, char* dst);
+
+}
+
+#endif /* __I915_LOCAL_IDS_H */
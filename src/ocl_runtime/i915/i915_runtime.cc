@@ -15,9 +15,13 @@
 #include <stdexcept>
 #include <system_error>
 #include <list>
+#include <chrono>
+#include <thread>
 #include "hash.h"
 #include "i915_runtime_impl.h"
+#include "i915_local_ids.h"
 #include "i915_utils.h"
+#include "i915_fake_backend.h"
 #include "igc_progbin.h"
 #include "utils.h"
 #include "macros.h"
@@ -47,20 +51,6 @@ using namespace HWInt;
 
 constexpr int GRF_SIZE = 32;
 
-/* Helper classes */
-struct RelocBo final
-{
-	uint32_t handle;
-	size_t size;
-	uint64_t reloc_offset;
-
-	RelocBo(uint32_t handle, size_t size, uint64_t reloc_offset)
-		: handle(handle), size(size), reloc_offset(reloc_offset)
-	{
-	}
-};
-
-
 /* (Mandatory) methods of public interface */
 I915Kernel::~I915Kernel()
 {
@@ -70,200 +60,141 @@ I915PreparedKernel::~I915PreparedKernel()
 {
 }
 
+I915CommandQueue::~I915CommandQueue()
+{
+}
+
 I915RTE::~I915RTE()
 {
 }
 
 unique_ptr<I915RTE> create_i915_rte(const char* device)
 {
-	return make_unique<I915RTEImpl>(device);
+	return make_unique<I915RTEImpl>(make_shared<I915DrmBackend>(device));
+}
+
+unique_ptr<I915RTE> create_i915_rte(shared_ptr<I915FakeDevice> device)
+{
+	auto backend = dynamic_pointer_cast<I915FakeBackend>(device);
+	if (!backend)
+		throw invalid_argument("Given device must be created by create_i915_fake_device");
+
+	return make_unique<I915RTEImpl>(backend);
 }
 
 /* Actual Kernel class */
 I915KernelImpl::I915KernelImpl(
+		I915RTEImpl& rte,
 		const string& name,
 		const KernelParameters& params,
+		const ProgramParameters& program_params,
 		unique_ptr<Heap>&& kernel_heap,
 		unique_ptr<Heap>&& dynamic_state_heap,
 		unique_ptr<Heap>&& surface_state_heap,
-		const string& build_log)
+		const string& build_log,
+		bool non_uniform_groups)
 	:
 		name(name),
 		params(params),
-		kernel_heap(move(kernel_heap)),
-		dynamic_state_heap(move(dynamic_state_heap)),
 		surface_state_heap(move(surface_state_heap)),
-		build_log(build_log)
-{
-}
-
-I915KernelImpl::~I915KernelImpl()
-{
-}
-
-string I915KernelImpl::get_build_log()
-{
-	return build_log;
-}
-
-
-/* Actual prepared kernel class */
-I915PreparedKernelImpl::I915PreparedKernelImpl(I915RTEImpl& rte, shared_ptr<I915KernelImpl> kernel)
-	: rte(rte), kernel(kernel)
+		build_log(build_log),
+		code(rte.instruction_heap, kernel_heap->size),
+		supports_non_uniform_groups(non_uniform_groups)
 {
-}
+	if (!dynamic_state_heap)
+		throw invalid_argument("Kernel has no dynamic state heap");
 
-I915PreparedKernelImpl::~I915PreparedKernelImpl()
-{
-}
+	decode_state(*dynamic_state_heap);
 
-template<typename T, const char* C>
-void I915PreparedKernelImpl::add_argument_int(T val)
-{
-	unsigned index = args.size();
+	binding_plan = compile_binding_plan(params, surface_state_pointers,
+			cross_thread_constant_data_read_length * 32);
 
-	for (auto& exp : kernel->params.kernel_argument_infos)
+	/* Each kernel keeps a copy of the program's constants s.t. it does not
+	 * depend on the program binary */
+	if (binding_plan.has_constant_surface)
 	{
-		if (exp.argument_number == index)
+		const ProgramParameters::AllocateConstantMemorySurface* surface = nullptr;
+		for (auto& s : program_params.allocate_constant_memory_surfaces)
 		{
-			/* Compare argument types */
-			if (
-					exp.address_qualifier == "__private" &&
-					exp.access_qualifier == "NONE" &&
-					exp.type_name == C &&
-					exp.type_qualifier == "NONE")
-			{
-				args.push_back(make_unique<KernelArgInt<T>>(val));
-				return;
-			}
-
-			throw invalid_argument(
-					string("Argument type `") + C + "' does not match kernel signature (`"
-					+ exp.type_name + "' expected for argument `" + exp.argument_name + "')");
+			if (s.constant_buffer_index == binding_plan.constant_buffer_index)
+				surface = &s;
 		}
-	}
 
-	throw invalid_argument("No such kernel argument position");
-}
+		if (!surface)
+			throw invalid_argument("Kernel uses a constant surface that the program does not define");
 
-void I915PreparedKernelImpl::add_argument(uint32_t val)
-{
-	static const char tid[] = "uint;4";
-	add_argument_int<uint32_t, tid>(val);
-}
+		constant_surface_size = max<size_t>(surface->inline_data.size(), 1);
+		constant_surface_bo = make_shared<I915UserptrBo>(rte, constant_surface_size);
+		memcpy(constant_surface_bo->ptr(), surface->inline_data.data(),
+				surface->inline_data.size());
+	}
 
-void I915PreparedKernelImpl::add_argument(int32_t val)
-{
-	static const char tid[] = "int;4";
-	add_argument_int<int32_t, tid>(val);
+	/* Upload kernel code */
+	memcpy(code.ptr(), kernel_heap->ptr(), kernel_heap->size);
 }
 
-void I915PreparedKernelImpl::add_argument(uint64_t val)
+I915KernelImpl::~I915KernelImpl()
 {
-	static const char tid[] = "ulong;8";
-	add_argument_int<uint64_t, tid>(val);
 }
 
-void I915PreparedKernelImpl::add_argument(int64_t val)
+void I915KernelImpl::write_per_thread_data(const I915LocalIdShape& shape, char* dst)
 {
-	static const char tid[] = "long;8";
-	add_argument_int<int64_t, tid>(val);
-}
+	array<uint32_t, 3> key = { shape.local_size[0], shape.local_size[1], shape.local_size[2] };
+	size_t size = shape.per_thread_size * shape.cnt_threads;
 
-void I915PreparedKernelImpl::add_argument(void* ptr, size_t size)
-{
-	unsigned index = args.size();
+	lock_guard<mutex> lock(per_thread_data_mutex);
 
-	for (auto& exp : kernel->params.kernel_argument_infos)
+	auto i = per_thread_data_cache.find(key);
+	if (i != per_thread_data_cache.end())
 	{
-		if (exp.argument_number == index)
-		{
-			/* Compare argument types */
-			if (
-					exp.address_qualifier == "__global" &&
-					exp.access_qualifier == "NONE" &&
-					exp.type_name.size() >= 3 &&
-					exp.type_name.find("*;8", exp.type_name.size() - 3) != decltype(exp.type_name)::npos &&
-					exp.type_qualifier == "NONE")
-			{
-				args.push_back(make_unique<KernelArgPtr>(rte.get_page_size(), ptr, size));
-				return;
-			}
-
-			throw invalid_argument(
-					string("Argument `") + exp.type_name + "' is of non-pointer type `" +
-						exp.type_name + "', but a pointer type is given");
-		}
-
-		// printf("DEBUG:\n");
-		// printf("    argument_number: %d\n", (int) exp.argument_number);
-		// printf("    address_qualifier: %s\n", exp.address_qualifier.c_str());
-		// printf("    access_qualifier: %s\n", exp.access_qualifier.c_str());
-		// printf("    argument_name: %s\n", exp.argument_name.c_str());
-		// printf("    type_name: %s\n", exp.type_name.c_str());
-		// printf("    type_qualifier: %s\n", exp.type_qualifier.c_str());
-		// printf("\n\n");
+		i->second.last_use = ++per_thread_data_use_counter;
+		memcpy(dst, i->second.data.data(), size);
+		return;
 	}
 
-	throw invalid_argument("No such kernel argument position");
-}
+	/* Generate into the destination and keep a copy */
+	memset(dst, 0, size);
 
-void I915PreparedKernelImpl::add_argument_gem_name(uint32_t name)
-{
-	unsigned index = args.size();
+	auto& tp = *(params.thread_payload);
+	if (tp.local_id_x_present + tp.local_id_y_present + tp.local_id_z_present > 0)
+		generate_local_ids(shape, dst);
 
-	for (auto& exp : kernel->params.kernel_argument_infos)
+	if (per_thread_data_cache.size() >= PER_THREAD_DATA_CACHE_SIZE)
 	{
-		if (exp.argument_number == index)
+		auto lru = per_thread_data_cache.begin();
+		for (auto j = per_thread_data_cache.begin(); j != per_thread_data_cache.end(); j++)
 		{
-			/* Compare argument types */
-			if (
-					exp.address_qualifier == "__global" &&
-					exp.access_qualifier == "NONE" &&
-					exp.type_name.size() >= 3 &&
-					exp.type_name.find("*;8", exp.type_name.size() - 3) != decltype(exp.type_name)::npos &&
-					exp.type_qualifier == "NONE")
-			{
-				args.push_back(make_unique<KernelArgGEMName>(rte, name));
-				return;
-			}
-
-			throw invalid_argument(
-					string("Argument `") + exp.type_name + "' is of non-pointer type `" +
-						exp.type_name + "', but a pointer type is given");
+			if (j->second.last_use < lru->second.last_use)
+				lru = j;
 		}
+
+		per_thread_data_cache.erase(lru);
 	}
 
-	throw invalid_argument("No such kernel argument position");
+	auto& entry = per_thread_data_cache[key];
+	entry.data.assign(dst, dst + size);
+	entry.last_use = ++per_thread_data_use_counter;
 }
 
-void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
+void I915KernelImpl::decode_state(const Heap& dynamic_state_heap)
 {
-	/* Ensure that all arguments are bound */
-	if (args.size() != kernel->params.kernel_argument_infos.size())
-		throw runtime_error("Not all arguments where bound");
-
-
 	/* Kernel parameters */
-	if (!kernel->params.media_interface_descriptor_load)
+	if (!params.media_interface_descriptor_load)
 		throw invalid_argument("Kernel has no MediaInterfaceDescriptorLoad param");
 
 
 	/* Interpret supplied interface descriptor */
 	/* Will be used by the RTE */
-	Gen9::INTERFACE_DESCRIPTOR_DATA idesc;
+	auto& idesc = idesc_template;
 
 	/* Supplied with the kernel (by the compiler) */
 	Gen9::INTERFACE_DESCRIPTOR_DATA idesc_kernel;
 
-	uint64_t kernel_idesc_offset = kernel->params.media_interface_descriptor_load->data_offset;
-	if (!kernel->dynamic_state_heap || kernel->dynamic_state_heap->size < (
-				kernel_idesc_offset + idesc_kernel.cnt_bytes))
-	{
+	uint64_t kernel_idesc_offset = params.media_interface_descriptor_load->data_offset;
+	if (dynamic_state_heap.size < kernel_idesc_offset + idesc_kernel.cnt_bytes)
 		throw invalid_argument("Kernel dynamic state heap too small for interface descriptor");
-	}
 
-	if (kernel->dynamic_state_heap->size != idesc_kernel.cnt_bytes)
+	if (dynamic_state_heap.size != idesc_kernel.cnt_bytes)
 	{
 		throw invalid_argument("Kernel dynamic state heap contains more than "
 				"an interface descriptor but this is not supported yet");
@@ -271,11 +202,17 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 
 	memcpy(
 			idesc_kernel.data,
-			kernel->dynamic_state_heap->ptr() + kernel_idesc_offset,
+			dynamic_state_heap.ptr() + kernel_idesc_offset,
 			idesc_kernel.cnt_bytes);
 
 	uint64_t kernel_start_pointer = idesc_kernel.get_kernel_start_pointer() << 6;
-	idesc.set_kernel_start_pointer(canonical_address(kernel_start_pointer) >> 6);
+
+	/* To clarify: Does the instruction heap contain the kernel offset or not?
+	 * */
+	if (kernel_start_pointer != 0)
+		throw runtime_error("kernel_start_pointer != 0 not implemented yet.");
+
+	idesc.set_kernel_start_pointer((code.offset() + kernel_start_pointer) >> 6);
 	idesc.set_denorm_mode(idesc_kernel.get_denorm_mode());
 	idesc.set_floating_point_mode(idesc_kernel.get_floating_point_mode());
 
@@ -283,8 +220,8 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	if (idesc_kernel.get_sampler_count() != Gen9::INTERFACE_DESCRIPTOR_DATA::SamplerCount_Nosamplersused)
 		throw invalid_argument("Kernel uses sampelers but samplers are not supported yet");
 
-	uint64_t binding_table_pointer = idesc_kernel.get_binding_table_pointer() << 5;
-	uint32_t binding_table_entry_count = idesc_kernel.get_binding_table_entry_count();
+	binding_table_pointer = idesc_kernel.get_binding_table_pointer() << 5;
+	binding_table_entry_count = idesc_kernel.get_binding_table_entry_count();
 	// printf("binding table entry count: %d\n", (int) binding_table_entry_count);
 
 	uint32_t constant_urb_read_length = idesc_kernel.get_constant_urb_entry_read_length();
@@ -300,12 +237,12 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	if (idesc_kernel.get_global_barrier_enable())
 		throw invalid_argument("Kernel uses global barriers but global barriers are not supported");
 
-	uint32_t cross_thread_constant_data_read_length =
+	cross_thread_constant_data_read_length =
 		idesc_kernel.get_cross_thread_constant_data_read_length();
 
-	if (kernel->params.interface_descriptor_data)
+	if (params.interface_descriptor_data)
 	{
-		auto& idd = *(kernel->params.interface_descriptor_data);
+		auto& idd = *(params.interface_descriptor_data);
 
 		if (idd.offset != kernel_idesc_offset)
 			throw invalid_argument("InterfaceDescriptorData param offset mismatch");
@@ -321,31 +258,6 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	}
 
 
-	/* State memory areas */
-	size_t general_state_size = (1024 * rte.dev_info.max_cs_threads);
-	size_t dynamic_state_size = 1024;
-	size_t instruction_buffer_size = kernel->kernel_heap->size + kernel_start_pointer;
-	size_t bindless_surface_size = 1024;
-
-	if (dynamic_state_size < idesc.cnt_bytes)
-		dynamic_state_size = idesc.cnt_bytes;
-
-	general_state_size = rte.align_size_to_page(general_state_size);
-	I915UserptrBo general_state_bo(rte, general_state_size);
-
-	dynamic_state_size = rte.align_size_to_page(dynamic_state_size);
-	I915UserptrBo dynamic_state_bo(rte, dynamic_state_size);
-
-	instruction_buffer_size = rte.align_size_to_page(instruction_buffer_size);
-	I915UserptrBo instruction_buffer_bo(rte, instruction_buffer_size);
-
-	bindless_surface_size = rte.align_size_to_page(bindless_surface_size);
-	I915UserptrBo bindless_surface_bo(rte, bindless_surface_size);
-
-	size_t gp_bo_size = rte.align_size_to_page(sizeof(uint64_t));
-	I915UserptrBo gp_bo(rte, gp_bo_size);
-
-
 	/* Add missing fields in interface descriptor */
 	idesc.set_single_program_flow(false);
 	idesc.set_thread_priority(Gen9::INTERFACE_DESCRIPTOR_DATA::ThreadPriority_NormalPriority);
@@ -356,39 +268,16 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	idesc.set_barrier_enable(true);
 
 
-	/* Copy surface state heap */
-	size_t surface_state_size = 1024;
-
-	if (kernel->surface_state_heap)
-	{
-		if (surface_state_size < kernel->surface_state_heap->size)
-			surface_state_size = kernel->surface_state_heap->size;
-	}
-
-	surface_state_size = rte.align_size_to_page(surface_state_size);
-	I915UserptrBo surface_state_bo(rte, surface_state_size);
-
-	if (kernel->surface_state_heap)
-	{
-		memcpy(
-				surface_state_bo.ptr(),
-				kernel->surface_state_heap->ptr(),
-				kernel->surface_state_heap->size);
-	}
-
-	/* Validate binding table and set surface pointers */
-	list<I915UserptrBo> arg_userptr_bos;
-	list<RelocBo> arg_reloc_bos;
-
+	/* Validate binding table */
 	if (binding_table_entry_count > 0)
 	{
-		if (!kernel->params.binding_table_state)
+		if (!params.binding_table_state)
 		{
 			throw invalid_argument("Kernel requries a binding table but has "
 					"no binding table state param");
 		}
 
-		auto& param_bts = *(kernel->params.binding_table_state);
+		auto& param_bts = *(params.binding_table_state);
 		if (
 				param_bts.offset != binding_table_pointer ||
 				param_bts.count != binding_table_entry_count ||
@@ -397,7 +286,7 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 			throw invalid_argument("Kernel has an unsupported binding table state param");
 		}
 
-		if (!kernel->surface_state_heap)
+		if (!surface_state_heap)
 		{
 			throw invalid_argument("Kernel requires a binding table but has "
 					"no surface state heap");
@@ -407,54 +296,27 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 		Gen9::RENDER_SURFACE_STATE rss;
 
 		if (binding_table_pointer + binding_table_entry_count * bts.cnt_bytes >
-				kernel->surface_state_heap->size)
+				surface_state_heap->size)
 		{
 			throw invalid_argument("Not all binding table entries are located "
 					"in the surface state heap");
 		}
 
-		size_t cnt_buffer_args = 0;
-		for (auto& arg : args)
-		{
-			if (
-					dynamic_cast<KernelArgPtr*>(arg.get()) ||
-					dynamic_cast<KernelArgGEMName*>(arg.get()))
-			{
-				cnt_buffer_args++;
-			}
-		}
-
-		if (cnt_buffer_args != binding_table_entry_count)
-			throw runtime_error("Kernel binding table entry count != buffer-like kernel argument count");
-
-		auto i_kernel_arg = args.begin();
-
 		for (unsigned i = 0; i < binding_table_entry_count; i++)
 		{
-			/* Safety check */
-			if (i_kernel_arg == args.end())
-				throw runtime_error("No more buffer-like arguments");
-
-			while (
-					dynamic_cast<KernelArgPtr*>(i_kernel_arg->get()) == nullptr &&
-					dynamic_cast<KernelArgGEMName*>(i_kernel_arg->get()) == nullptr)
-			{
-				i_kernel_arg++;
-			}
-
 			memcpy(
 					bts.data,
-					(char*) surface_state_bo.ptr() + binding_table_pointer + bts.cnt_bytes * i,
+					surface_state_heap->ptr() + binding_table_pointer + bts.cnt_bytes * i,
 					bts.cnt_bytes);
 
 			uint64_t surface_state_pointer = bts.get_surface_state_pointer() << 6;
-			if (surface_state_pointer + rss.cnt_bytes > kernel->surface_state_heap->size)
+			if (surface_state_pointer + rss.cnt_bytes > surface_state_heap->size)
 			{
 				throw invalid_argument("Surface state block does not fit in "
 						"supplied surface state heap");
 			}
 
-			memcpy(rss.data, (char*) surface_state_bo.ptr() + surface_state_pointer, rss.cnt_bytes);
+			memcpy(rss.data, surface_state_heap->ptr() + surface_state_pointer, rss.cnt_bytes);
 
 			/* Validate RENDER_SURFACE_STATE */
 			if (rss.get_surface_type() != Gen9::RENDER_SURFACE_STATE::SurfaceType_SURFTYPE_BUFFER)
@@ -509,43 +371,7 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 				throw invalid_argument("Surface with auxiliary surface mode != None");
 			}
 
-			/* Bind surface to buffer-argument */
-			size_t buf_size;
-
-			auto kernel_arg_ptr = dynamic_cast<KernelArgPtr*>(i_kernel_arg->get());
-			if (kernel_arg_ptr)
-			{
-				buf_size = kernel_arg_ptr->size();
-				if (buf_size < 1)
-					throw invalid_argument("Kernel buffer argument with size < 1");
-
-				rss.set_surface_base_address(canonical_address(kernel_arg_ptr->ptr()));
-				arg_userptr_bos.emplace_back(rte, kernel_arg_ptr->ptr(), buf_size);
-			}
-			else
-			{
-				auto kernel_arg_gn = dynamic_cast<KernelArgGEMName*>(i_kernel_arg->get());
-				if (!kernel_arg_gn)
-					throw runtime_error("Expected a pointer-like kernel argument");
-
-				buf_size = kernel_arg_gn->size();
-				if (buf_size < 1)
-					throw invalid_argument("Kernel buffer argument with size < 1");
-
-				rss.set_surface_base_address(0);
-				uint64_t reloc_offset = surface_state_pointer + 8*4;
-				arg_reloc_bos.emplace_back(
-						kernel_arg_gn->handle(), buf_size, reloc_offset);
-			}
-
-			uint32_t surface_size = buf_size - 1;
-			rss.set_width(surface_size & 0x7f);
-			rss.set_height((surface_size >> 7) & 0x3fff);
-			rss.set_depth((surface_size >> 21) & 0x7ff);
-
-			memcpy((char*) surface_state_bo.ptr() + surface_state_pointer, rss.data, rss.cnt_bytes);
-
-			i_kernel_arg++;
+			surface_state_pointers.push_back(surface_state_pointer);
 		}
 
 		idesc.set_binding_table_pointer(binding_table_pointer >> 5);
@@ -555,18 +381,18 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 
 
 	/* Check other kernel params */
-	if (kernel->params.kernel_attributes_info &&
-			kernel->params.kernel_attributes_info->attributes.size() > 0)
+	if (params.kernel_attributes_info &&
+			params.kernel_attributes_info->attributes.size() > 0)
 	{
 		throw invalid_argument("Kernel has an attributes info param but that "
 				"is not supported yet");
 	}
 
 
-	if (!kernel->params.execution_environment)
+	if (!params.execution_environment)
 		throw invalid_argument("ExecutionEnvironment missing from kernel params");
 
-	auto& exe = *(kernel->params.execution_environment);
+	auto& exe = *(params.execution_environment);
 
 	/* Setup execution environment */
 	if (exe.may_access_undeclared_resource != 0)
@@ -578,12 +404,6 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 				"fences are not supported yet.");
 	}
 
-	if (exe.uses_stateless_spill_fill != 0)
-	{
-		throw invalid_argument("Kernel uses stateless-spill fill, but is not "
-				"supported yet");
-	}
-
 	if (exe.uses_multi_scratch_spaces != 0)
 	{
 		throw invalid_argument("Kernel uses multi scratch spaces, but is not "
@@ -611,9 +431,6 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	if (exe.use_bindless_mode != 0)
 		throw invalid_argument("Kernel has bindless_mode != 0");
 
-
-	/* Distribute threads */
-	/* Choose a SIMD size */
 	int simd_size = exe.largest_compiled_simd_size;
 	if (simd_size != 8 && simd_size != 16 && simd_size != 32)
 	{
@@ -621,82 +438,12 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 				std::to_string(simd_size));
 	}
 
-	if (local_size.x < 1 || local_size.y < 1 || local_size.z < 1)
-		throw invalid_argument("Invalid work group size");
-
-	int cnt_ocl_threads = local_size.x * local_size.y * local_size.z;
-	if (cnt_ocl_threads > 1024)
-		throw invalid_argument("At most 1024 threads per work group are supported");
-
-	uint32_t cnt_threads;
-	uint32_t threads_x;
-
-	for (;; simd_size /= 2)
-	{
-		if (simd_size < 8)
-			throw invalid_argument("Could not choose a SIMD-channel configuration");
-
-		if (simd_size == 32 && exe.compiled_simd32 != 1)
-			continue;
-
-		if (simd_size == 16 && exe.compiled_simd16 != 1)
-			continue;
-
-		if (simd_size == 8 && exe.compiled_simd8 != 1)
-			continue;
-
-		if (local_size.x % simd_size != 0)
-			continue;
-
-		threads_x = local_size.x / simd_size;
-		cnt_threads = threads_x * local_size.y * local_size.z;
-
-		if (cnt_threads > rte.dev_info.max_cs_threads)
-			continue;
-
-		break;
-	}
-
-	if (simd_size == 32 && cnt_threads > 32)
-	{
-		throw invalid_argument("simd_size is 32 and more than 32 dispatches "
-				"in thread group");
-	}
-	else if (simd_size != 32 && cnt_threads > 64)
-	{
-		throw invalid_argument("more than 64 dispatches in thread group "
-				"(simd_size is < 32)");
-	}
-
-	// printf("Chosen SIMD-size: %d, %dx%dx%d threads, %d threads total\n",
-	// 		(int) simd_size,
-	// 		(int) threads_x,
-	// 		(int) local_size.y,
-	// 		(int) local_size.z,
-	// 		(int) cnt_threads);
-
-
-	if (
-			global_size.x % local_size.x != 0 ||
-			global_size.y % local_size.y != 0 ||
-			global_size.z % local_size.z != 0)
-	{
-		throw invalid_argument("Global sizes must be multiples of local sizes");
-	}
-
-	NDRange thread_groups(
-			global_size.x / local_size.x,
-			global_size.y / local_size.y,
-			global_size.z / local_size.z);
-
-	idesc.set_number_of_threads_in_gpgpu_thread_group(cnt_threads);
 
-
-	/* Setup CURBE data */
-	if (!kernel->params.thread_payload)
+	/* Check thread payload */
+	if (!params.thread_payload)
 		throw invalid_argument("Kernel has no ThreadPayload param");
 
-	auto& tp = *(kernel->params.thread_payload);
+	auto& tp = *(params.thread_payload);
 
 	if (tp.indirect_payload_storage != 1)
 		throw invalid_argument("Kernel does not use indirect payload storate");
@@ -713,25 +460,6 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 	if (tp.local_id_flattened_present != 0)
 		throw invalid_argument("Kernel uses flattened local id");
 
-	if (constant_urb_read_offset != 0)
-		throw invalid_argument("Kernel param for constant URB entry read offset != 0");
-
-	auto cross_thread_size_bytes = cross_thread_constant_data_read_length * 32;
-	DynamicBuffer<char> indirect_data(cross_thread_size_bytes);
-
-	/* Build cross-thread data */
-	vector<tuple<uint32_t, uint64_t>> indirect_data_relocs;
-	build_cross_thread_data(
-			kernel->params,
-			NDRange(0, 0, 0),
-			local_size,
-			args,
-			(const char*) surface_state_bo.ptr(), surface_state_size,
-			indirect_data.ptr(), cross_thread_size_bytes,
-			indirect_data_relocs);
-
-
-	/* Build per-thread data */
 	size_t local_id_cnt = tp.local_id_x_present +
 		tp.local_id_y_present + tp.local_id_z_present;
 
@@ -741,760 +469,2299 @@ void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
 				"thread payload yet.");
 	}
 
-	size_t local_id_size_bytes = GRF_SIZE * (simd_size == 32 ? 2 : 1);
-	size_t per_thread_size_bytes = local_id_cnt * local_id_size_bytes;
-
-	if (tp.unused_per_thread_constant_present > 0)
-		per_thread_size_bytes += GRF_SIZE;
-
-	indirect_data.ensure_size(cross_thread_size_bytes + per_thread_size_bytes * cnt_threads);
-
-	char* per_thread_ptr = indirect_data.ptr() + cross_thread_size_bytes;
-
-	uint16_t x = 0;
-	uint16_t y = 0;
-	uint16_t z = 0;
-
-	for (unsigned i = 0; i < cnt_threads; i++)
-	{
-		if (local_id_cnt > 0)
-		{
-			auto local_id_x = (uint16_t*) (per_thread_ptr);
-			auto local_id_y = (uint16_t*) (per_thread_ptr + local_id_size_bytes);
-			auto local_id_z = (uint16_t*) (per_thread_ptr + local_id_size_bytes*2);
-
-			for (int j = 0; j < simd_size; j++)
-			{
-				local_id_x[j] = x;
-				local_id_y[j] = y;
-				local_id_z[j] = z;
-
-				x += 1;
-				y += x / local_size.x;
-				x = x % local_size.x;
-				z += y / local_size.y;
-				y = y % local_size.y;
-			}
-
-			per_thread_ptr += local_id_size_bytes*3;
-		}
-
-		if (tp.unused_per_thread_constant_present > 0)
-			per_thread_ptr += GRF_SIZE;
-	}
-
 	if (tp.get_local_id_present)
 		throw invalid_argument("get_local_id_present");
 
 	if (tp.get_group_id_present)
 		throw invalid_argument("get_group_id_present");
 
-	if (tp.get_global_offset_present)
-		throw invalid_argument("get_global_offset_present");
-
-	// printf("DEBUG header_present: %d\n", (int) tp.header_present);
-	// printf("DEBUG local_id_x_present: %d\n", (int) tp.local_id_x_present);
-	// printf("DEBUG local_id_y_present: %d\n", (int) tp.local_id_y_present);
-	// printf("DEBUG local_id_z_present: %d\n", (int) tp.local_id_z_present);
-	// printf("DEBUG local_id_flattened_present: %d\n", (int) tp.local_id_flattened_present);
-	// printf("DEBUG indirect_payload_storage: %d\n", (int) tp.indirect_payload_storage);
-	// printf("DEBUG unused_per_thread_constant_present: %d\n", (int) tp.unused_per_thread_constant_present);
-	// printf("DEBUG get_local_id_present: %d\n", (int) tp.get_local_id_present);
-	// printf("DEBUG get_group_id_present: %d\n", (int) tp.get_group_id_present);
-	// printf("DEBUG get_global_offset_present: %d\n", (int) tp.get_global_offset_present);
-	// printf("DEBUG stage_in_grid_origin_present: %d\n", (int) tp.stage_in_grid_origin_present);
-	// printf("DEBUG stage_in_grid_size_present: %d\n", (int) tp.stage_in_grid_size_present);
-	// printf("DEBUG offset_to_skip_per_thread_data_load: %d\n", (int) tp.offset_to_skip_per_thread_data_load);
-	// printf("DEBUG offset_to_skip_set_ffidgp: %d\n", (int) tp.offset_to_skip_set_ffidgp);
-	// printf("DEBUG pass_inline_data: %d\n", (int) tp.pass_inline_data);
-
+	if (constant_urb_read_offset != 0)
+		throw invalid_argument("Kernel param for constant URB entry read offset != 0");
 
 	if (constant_urb_read_length != 0)
 		throw invalid_argument("constant_urb_read_length from patch tokens != 0");
 
-	constant_urb_read_length = DIV_ROUND_UP(per_thread_size_bytes, 32);
-
-	idesc.set_constant_urb_entry_read_length(constant_urb_read_length);
 	idesc.set_constant_urb_entry_read_offset(constant_urb_read_offset);
 	idesc.set_cross_thread_constant_data_read_length(cross_thread_constant_data_read_length);
 
-	// printf("const urb read length: %d / cross thread: %d\n",
-	// 		(int) constant_urb_read_length,
-	// 		(int) cross_thread_constant_data_read_length);
-
-	uint32_t indirect_data_length =
-		constant_urb_read_length * 32 * cnt_threads +
-		cross_thread_constant_data_read_length * 32;
-
-
-	/* From SKL PRM 2a, p. 488: "the total size of indirect data must be less
-	 * than 63,488 (2048 URB lines - 64 lines for interface Descriptors)" */
-	if (indirect_data_length >= 63488)
-		throw invalid_argument("indirect_data_length too large");
-
-	size_t indirect_object_size = indirect_data_length;
-	indirect_object_size = rte.align_size_to_page(indirect_object_size);
-	I915UserptrBo indirect_object_bo(rte, indirect_object_size);
-
-	memset(indirect_object_bo.ptr(), 0, indirect_object_bo.size());
-
-	memcpy(indirect_object_bo.ptr(),
-		indirect_data.ptr(),
-		cross_thread_size_bytes + per_thread_size_bytes * cnt_threads);
-
 
 	/* Allocate SLM */
-	uint32_t slm_size = 0;
+	slm_size = 0;
 
-	if (kernel->params.allocate_local_surface)
+	if (params.allocate_local_surface)
 	{
-		auto& als = *kernel->params.allocate_local_surface;
+		auto& als = *params.allocate_local_surface;
 		if (als.offset != 0)
 			throw invalid_argument("allocate_local_surface.offset != 0");
 
-		if (als.total_inline_local_memory_size > 0)
-		{
-			/* Round up to next power of two */
-			unsigned slm_req = 1024;
-			while (slm_req < als.total_inline_local_memory_size)
-			{
-				if (slm_req >= 65536)
-					throw invalid_argument("requested SLM size > 64kiB");
-
-				slm_req *= 2;
-			}
-
-			slm_size = slm_req;
-		}
+		slm_size = slm_allocation_size(als.total_inline_local_memory_size);
 	}
 
 	// printf("SLM size: %d\n", (int) slm_size);
 	idesc.set_shared_local_memory_size(slm_size_to_idesc(slm_size));
 
-	/* Allocate L3 */
-	/* NOTE: l3_* numbers must be multiples of two */
-	int l3_slm = slm_size > 0 ? 64 : 0;
-	int l3_urb = 64;
-	int l3_cache = 192 - l3_slm - l3_urb;
 
-	if (l3_cache < 0)
-		throw runtime_error("Not enough L3 memory");
+	/* Allocate scratch space for register spills */
+	scratch_size = 0;
 
-	if (l3_cache > 0x40 * 2)
-		l3_cache = 0x40 * 2;
-
-	// printf("L3 allocation: SLM: %d, URB: %d, cache: %d\n", l3_slm, l3_urb, l3_cache);
-
-	int urb_allocation_size = 1922;
-	if (
-			(urb_allocation_size +
-			cross_thread_size_bytes + per_thread_size_bytes * cnt_threads +
-			64)
-				<
-			(size_t) l3_urb * 1024 / 32)
+	if (params.media_vfe_state_slot1 &&
+			params.media_vfe_state_slot1->per_thread_scratch_space > 0)
 	{
-		throw runtime_error("Not enough L3 memory for URB");
+		throw invalid_argument("Kernel uses a second scratch space");
 	}
 
+	if (params.media_vfe_state && params.media_vfe_state->per_thread_scratch_space > 0)
+	{
+		/* MEDIA_VFE_STATE takes powers of two from 1kiB to 2MiB */
+		unsigned scratch_req = 1024;
+		while (scratch_req < params.media_vfe_state->per_thread_scratch_space)
+		{
+			if (scratch_req >= 2 * 1024 * 1024)
+				throw invalid_argument("requested scratch size > 2MiB per thread");
 
-	/* Copy kernel code */
-	/* To clarify: Does the instruction heap contain the kernel offset or not?
-	 * */
-	if (kernel_start_pointer != 0)
-		throw runtime_error("kernel_start_pointer != 0 not implemented yet.");
-
-	memcpy(
-			(char*) instruction_buffer_bo.ptr() + kernel_start_pointer,
-			kernel->kernel_heap->ptr(),
-			kernel->kernel_heap->size);
+			scratch_req *= 2;
+		}
 
+		scratch_size = scratch_req;
+	}
+}
 
-	/* Copy interface descriptor to dynamic state heap */
-	memcpy(dynamic_state_bo.ptr(), idesc.data, idesc.cnt_bytes);
+string I915KernelImpl::get_build_log()
+{
+	return build_log;
+}
 
 
-	/* Build second batch buffer */
-	vector<unique_ptr<I915RingCmd>> cmds2;
+/* Actual prepared kernel class */
+I915PreparedKernelImpl::I915PreparedKernelImpl(I915RTEImpl& rte, shared_ptr<I915KernelImpl> kernel)
+	: rte(rte), kernel(kernel), profile(&rte.host_profiler.get_kernel(kernel->name))
+{
+	auto cnt_args = kernel->binding_plan.args.size();
 
-	{
-		cmds2.push_back(make_unique<Gen9::CmdMediaStateFlush>());
-	}
+	args.resize(cnt_args);
+	dirty_args.resize(cnt_args, true);
+}
 
-	{
-		auto cmd = make_unique<Gen9::CmdMediaInterfaceDescriptorLoad>();
-		static_assert(idesc.cnt_bytes == 32);
-		cmd->interface_descriptor_total_length = 32;
-		cmds2.push_back(move(cmd));
-	}
+I915PreparedKernelImpl::~I915PreparedKernelImpl()
+{
+}
 
-	{
-		auto cmd = make_unique<Gen9::CmdGpgpuWalker>();
+const KernelArgPlan& I915PreparedKernelImpl::argument_plan(unsigned index) const
+{
+	auto& plan = kernel->binding_plan;
+	if (index >= plan.args.size() || !plan.args[index].info)
+		throw invalid_argument("No such kernel argument position");
 
-		cmd->predicate_enable = false;
-		cmd->indirect_parameter_enable = false;
-		cmd->interface_descriptor_offset = 0;
-		cmd->indirect_data_length = indirect_data_length;
-		cmd->indirect_data_start_address = 0;
-		cmd->thread_width_counter_maximum = threads_x - 1;
-		cmd->thread_height_counter_maximum = local_size.y - 1;
-		cmd->thread_depth_counter_maximum = local_size.z - 1;
-		cmd->simd_size =
-			simd_size == 32 ? Gen9::CmdGpgpuWalker::SIMD32 :
-			simd_size == 16 ? Gen9::CmdGpgpuWalker::SIMD16 :
-			Gen9::CmdGpgpuWalker::SIMD8;
+	return plan.args[index];
+}
 
-		cmd->thread_group_id_starting_x = 0;
-		cmd->thread_group_id_x_dimension = thread_groups.x;
-		cmd->thread_group_id_starting_y = 0;
-		cmd->thread_group_id_y_dimension = thread_groups.y;
-		cmd->thread_group_id_starting_resume_z = 0;
-		cmd->thread_group_id_z_dimension = thread_groups.z;
-		cmd->right_execution_mask = 0xffffffff;
-		cmd->bottom_execution_mask = 0xffffffff;
+void I915PreparedKernelImpl::bind_argument(unsigned index, unique_ptr<KernelArg>&& arg)
+{
+	args[index] = move(arg);
+	dirty_args[index] = true;
+}
 
-		cmds2.push_back(move(cmd));
-	}
+template<typename T, KernelArgKind K, const char* C>
+void I915PreparedKernelImpl::set_argument_scalar(unsigned index, T val)
+{
+	auto& plan = argument_plan(index);
 
+	/* Compare argument types */
+	if (plan.kind != K)
 	{
-		cmds2.push_back(make_unique<Gen9::CmdMediaStateFlush>());
+		throw invalid_argument(
+				string("Argument type `") + C + "' does not match kernel signature (`"
+				+ plan.info->type_name + "' expected for argument `" +
+				plan.info->argument_name + "')");
 	}
 
+	bind_value(index, &val, sizeof(val));
+}
+
+void I915PreparedKernelImpl::bind_value(unsigned index, const void* ptr, size_t size)
+{
+	/* Rebinding the same value does not invalidate any state */
+	auto cur = args[index].get();
+	if (cur && cur->type == KernelArgType::Value &&
+			memcmp(static_cast<KernelArgValue*>(cur)->bytes().data(), ptr, size) == 0)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmds2.push_back(move(cmd));
+		return;
 	}
 
+	bind_argument(index, make_unique<KernelArgValue>(ptr, size));
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, uint32_t val)
+{
+	static const char tid[] = "uint;4";
+	set_argument_scalar<uint32_t, KernelArgKind::UInt32, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, int32_t val)
+{
+	static const char tid[] = "int;4";
+	set_argument_scalar<int32_t, KernelArgKind::Int32, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, uint64_t val)
+{
+	static const char tid[] = "ulong;8";
+	set_argument_scalar<uint64_t, KernelArgKind::UInt64, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, int64_t val)
+{
+	static const char tid[] = "long;8";
+	set_argument_scalar<int64_t, KernelArgKind::Int64, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, float val)
+{
+	static const char tid[] = "float;4";
+	set_argument_scalar<float, KernelArgKind::Float, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument(unsigned index, double val)
+{
+	static const char tid[] = "double;8";
+	set_argument_scalar<double, KernelArgKind::Double, tid>(index, val);
+}
+
+void I915PreparedKernelImpl::set_argument_value(unsigned index, const void* ptr, size_t size)
+{
+	auto& plan = argument_plan(index);
+
+	if (plan.value_size == 0)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmd->dc_flush_enable = true;
-		cmd->post_sync_operation = Gen9::CmdPipeControl::WriteImmediateData;
-		cmd->address = canonical_address(gp_bo.ptr()) >> 2;
-		cmd->immediate_data = 0x1;
-		cmds2.push_back(move(cmd));
+		throw invalid_argument(
+				string("Argument `") + plan.info->argument_name + "' of type `" +
+					plan.info->type_name + "' cannot be passed by value");
 	}
 
+	if (size != plan.value_size)
 	{
-		cmds2.push_back(make_unique<Gen9::CmdMiBatchBufferEnd>());
-		cmds2.push_back(make_unique<Gen9::CmdMiNoop>());
+		throw invalid_argument(
+				"Value of " + std::to_string(size) + " bytes given for argument `" +
+				plan.info->argument_name + "' of type `" + plan.info->type_name + "'");
 	}
 
-	/* Copy to a Bo */
-	size_t bb2_bo_size = 0;
-	for (auto& cmd : cmds2)
-		bb2_bo_size += cmd->bin_size();
-
-	I915UserptrBo bb2(rte, bb2_bo_size);
-	auto bb2_ptr = (char*) bb2.ptr();
-	for (auto& cmd : cmds2)
-		bb2_ptr += cmd->bin_write(bb2_ptr);
+	bind_value(index, ptr, size);
+}
 
+void I915PreparedKernelImpl::set_argument_constant(unsigned index, const void* ptr, size_t size)
+{
+	auto& plan = argument_plan(index);
 
-	/* Build first batch buffer */
-	vector<unique_ptr<I915RingCmd>> cmds;
+	if (plan.kind != KernelArgKind::Constant)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmd->texture_cache_invalidation_enable = true;
-		cmd->constant_cache_invalidation_enable = true;
-		cmd->state_cache_invalidation_enable = true;
-		cmd->instruction_cache_invalidate_enable = true;
-		cmd->render_target_cache_flush_enable = true;
-		cmd->dc_flush_enable = true;
-		cmd->depth_cache_flush_enable = true;
-		cmds.push_back(move(cmd));
+		throw invalid_argument(
+				string("Argument `") + plan.info->argument_name + "' of type `" +
+					plan.info->type_name + "' is not a __constant pointer");
 	}
 
+	auto cur = args[index].get();
+	if (cur && cur->type == KernelArgType::DispatchConstant)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmd->render_target_cache_flush_enable = true;
-		cmd->dc_flush_enable = true;
-		cmd->depth_cache_flush_enable = true;
-		cmds.push_back(move(cmd));
+		auto& bytes = static_cast<KernelArgDispatchConstant*>(cur)->bytes();
+		if (bytes.size() == size && memcmp(bytes.data(), ptr, size) == 0)
+			return;
 	}
 
+	bind_argument(index, make_unique<KernelArgDispatchConstant>(ptr, size));
+}
+
+void I915PreparedKernelImpl::set_argument_local(unsigned index, size_t size)
+{
+	auto& plan = argument_plan(index);
+
+	if (plan.kind != KernelArgKind::Local)
 	{
-		auto cmd = make_unique<Gen9::CmdPipelineSelect>();
-		cmd->pipeline_selection = Gen9::CmdPipelineSelect::GPGPU;
-		cmd->media_sampler_dop_clock_gate_enable = true;
-		cmd->mask_bits = 0x13;
-		cmds.push_back(move(cmd));
+		throw invalid_argument(
+				string("Argument `") + plan.info->argument_name + "' of type `" +
+					plan.info->type_name + "' is not a __local pointer");
 	}
 
+	auto cur = args[index].get();
+	if (cur && cur->type == KernelArgType::Local &&
+			static_cast<KernelArgLocal*>(cur)->size() == size)
 	{
-		Gen9::REG_L3CNTLREG reg;
+		return;
+	}
 
-		reg.set_slm_enable(l3_slm > 0);
+	bind_argument(index, make_unique<KernelArgLocal>(size));
+}
 
-		reg.set_urb_allocation(l3_urb / 2);
-		reg.set_all_allocation(l3_cache / 2);
+void I915PreparedKernelImpl::set_argument(unsigned index, void* ptr, size_t size)
+{
+	set_argument(index, ptr, size, CacheHint::Default);
+}
 
-		auto cmd = make_unique<Gen9::CmdMiLoadRegisterImm>();
-		cmd->register_offset = reg.address >> 2;
-		cmd->data_dword = reg.data[0];
-		cmds.push_back(move(cmd));
-	}
+void I915PreparedKernelImpl::set_argument(unsigned index, void* ptr, size_t size,
+		CacheHint hint)
+{
+	auto& plan = argument_plan(index);
 
+	/* Compare argument types */
+	if (!is_buffer_kind(plan.kind))
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmd->render_target_cache_flush_enable = true;
-		cmd->dc_flush_enable = true;
-		cmd->depth_cache_flush_enable = true;
-		cmds.push_back(move(cmd));
+		throw invalid_argument(
+				string("Argument `") + plan.info->argument_name + "' is of non-pointer type `" +
+					plan.info->type_name + "', but a pointer type is given");
 	}
 
+	auto cur = args[index].get();
+	if (cur && cur->type == KernelArgType::Ptr &&
+			static_cast<KernelArgPtr*>(cur)->ptr() == ptr &&
+			static_cast<KernelArgPtr*>(cur)->size() == size &&
+			static_cast<KernelArgPtr*>(cur)->cache_hint() == hint)
 	{
-		auto cmd = make_unique<Gen9::CmdMediaVfeState>();
-		cmd->scratch_space_base_pointer = 0x0;
-		cmd->stack_size = 0;
-		cmd->per_thread_scratch_space = 0;
-		cmd->maximum_number_of_threads = rte.dev_info.max_cs_threads - 1;
-		cmd->number_of_urb_entries = 1;
-		cmd->urb_entry_allocation_size = urb_allocation_size;
-		cmds.push_back(move(cmd));
+		return;
 	}
 
-	{
-		Gen9::REG_CS_CHICKEN1 reg;
-		reg.set_replay_mode(Gen9::REG_CS_CHICKEN1::ReplayMode_MidcmdbufferPreemption);
+	bind_argument(index, make_unique<KernelArgPtr>(rte.get_page_size(), ptr, size, hint));
+}
+
+void I915PreparedKernelImpl::set_argument_gem_name(unsigned index, uint32_t name)
+{
+	set_argument_gem_name(index, name, CacheHint::Default);
+}
+
+void I915PreparedKernelImpl::set_argument_gem_name(unsigned index, uint32_t name,
+		CacheHint hint)
+{
+	auto& plan = argument_plan(index);
 
-		auto cmd= make_unique<Gen9::CmdMiLoadRegisterImm>();
-		cmd->register_offset = reg.address >> 2;
-		cmd->data_dword = reg.data[0];
-		cmds.push_back(move(cmd));
+	/* Compare argument types */
+	if (!is_buffer_kind(plan.kind))
+	{
+		throw invalid_argument(
+				string("Argument `") + plan.info->argument_name + "' is of non-pointer type `" +
+					plan.info->type_name + "', but a pointer type is given");
 	}
 
+	auto cur = args[index].get();
+	if (cur && cur->type == KernelArgType::GEMName &&
+			static_cast<KernelArgGEMName*>(cur)->name() == name &&
+			static_cast<KernelArgGEMName*>(cur)->cache_hint() == hint)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->texture_cache_invalidation_enable = true;
-		cmd->dc_flush_enable = true;
-		cmds.push_back(move(cmd));
+		return;
 	}
 
+	bind_argument(index, make_unique<KernelArgGEMName>(rte, name, hint));
+}
+
+void I915PreparedKernelImpl::set_l3_config(const I915L3Config& config)
+{
+	if (!I915Batch::is_valid_l3_config(config))
 	{
-		auto cmd = make_unique<Gen9::CmdStateBaseAddress>();
+		throw invalid_argument("Unsupported L3 configuration (" +
+				std::to_string(config.slm_ways) + ", " +
+				std::to_string(config.urb_ways) + ", " +
+				std::to_string(config.all_ways) + ")");
+	}
+
+	if ((kernel->slm_size > 0 || !kernel->binding_plan.local_args.empty()) &&
+			config.slm_ways == 0)
+		throw invalid_argument("The kernel uses SLM, but the L3 configuration provides none");
+
+	has_l3_override = true;
+	l3_override = config;
+}
+
+void I915PreparedKernelImpl::reset_l3_config()
+{
+	has_l3_override = false;
+}
 
-		cmd->general_state_base_address = canonical_address(general_state_bo.ptr()) >> 12;
-		cmd->general_state_mocs = I915_MOCS_UNCACHED << 1;
-		cmd->general_state_base_address_modify_enable = true;
-		cmd->general_state_buffer_size = DIV_ROUND_UP(general_state_size, 4096);
-		cmd->general_state_buffer_size_modify_enable = true;
+void I915PreparedKernelImpl::add_argument(uint32_t val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
+
+void I915PreparedKernelImpl::add_argument(int32_t val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
 
-		cmd->stateless_data_port_access_mocs = I915_MOCS_CACHED << 1;
+void I915PreparedKernelImpl::add_argument(uint64_t val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
 
-		cmd->surface_state_base_address = canonical_address(surface_state_bo.ptr()) >> 12;
-		cmd->surface_state_mocs = I915_MOCS_UNCACHED << 1;
-		cmd->surface_state_base_address_modify_enable = true;
+void I915PreparedKernelImpl::add_argument(int64_t val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
 
-		cmd->dynamic_state_base_address = canonical_address(dynamic_state_bo.ptr()) >> 12;
-		cmd->dynamic_state_mocs = I915_MOCS_UNCACHED << 1;
-		cmd->dynamic_state_base_address_modify_enable = true;
-		cmd->dynamic_state_buffer_size = DIV_ROUND_UP(dynamic_state_size, 4096);
-		cmd->dynamic_state_buffer_size_modify_enable = true;
+void I915PreparedKernelImpl::add_argument(float val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
 
-		cmd->indirect_object_base_address = canonical_address(indirect_object_bo.ptr()) >> 12;
-		cmd->indirect_object_mocs = I915_MOCS_UNCACHED << 1;
-		cmd->indirect_object_base_address_modify_enable = true;
-		cmd->indirect_object_buffer_size = DIV_ROUND_UP(indirect_object_size, 4096);
-		cmd->indirect_object_buffer_size_modify_enable = true;
+void I915PreparedKernelImpl::add_argument(double val)
+{
+	set_argument(next_argument, val);
+	next_argument++;
+}
 
-		cmd->instruction_base_address = canonical_address(instruction_buffer_bo.ptr()) >> 12;
-		cmd->instruction_mocs = I915_MOCS_CACHED << 1;
-		cmd->instruction_base_address_modify_enable = true;
-		cmd->instruction_buffer_size = DIV_ROUND_UP(instruction_buffer_size, 4096);
-		cmd->instruction_buffer_size_modify_enable = true;
+void I915PreparedKernelImpl::add_argument(void* ptr, size_t size)
+{
+	set_argument(next_argument, ptr, size);
+	next_argument++;
+}
 
-		cmd->bindless_surface_state_base_address = canonical_address(bindless_surface_bo.ptr()) >> 12;
-		cmd->bindless_surface_state_mocs = I915_MOCS_UNCACHED << 1;
-		cmd->bindless_surface_state_base_address_modify_enable = true;
-		// cmd->bindless_surface_state_size = 0;
+void I915PreparedKernelImpl::add_argument(void* ptr, size_t size, CacheHint hint)
+{
+	set_argument(next_argument, ptr, size, hint);
+	next_argument++;
+}
 
-		cmds.push_back(move(cmd));
-	}
+void I915PreparedKernelImpl::add_argument_gem_name(uint32_t name)
+{
+	set_argument_gem_name(next_argument, name);
+	next_argument++;
+}
+
+void I915PreparedKernelImpl::add_argument_gem_name(uint32_t name, CacheHint hint)
+{
+	set_argument_gem_name(next_argument, name, hint);
+	next_argument++;
+}
+
+void I915PreparedKernelImpl::add_argument_value(const void* ptr, size_t size)
+{
+	set_argument_value(next_argument, ptr, size);
+	next_argument++;
+}
+
+void I915PreparedKernelImpl::add_argument_constant(const void* ptr, size_t size)
+{
+	set_argument_constant(next_argument, ptr, size);
+	next_argument++;
+}
+
+void I915PreparedKernelImpl::add_argument_local(size_t size)
+{
+	set_argument_local(next_argument, size);
+	next_argument++;
+}
+
+static void set_buffer_surface_size(Gen9::RENDER_SURFACE_STATE& rss, size_t buf_size)
+{
+	uint32_t surface_size = buf_size - 1;
+	rss.set_width(surface_size & 0x7f);
+	rss.set_height((surface_size >> 7) & 0x3fff);
+	rss.set_depth((surface_size >> 21) & 0x7ff);
+}
+
+void I915PreparedKernelImpl::bind_surface_state(unsigned index)
+{
+	/* The surface state has been validated when the kernel was loaded */
+	uint64_t surface_state_pointer = kernel->surface_state_pointers[
+		kernel->binding_plan.args[index].bt_index];
+	char* rss_ptr = surface_state_image.data() + surface_state_pointer;
+
+	Gen9::RENDER_SURFACE_STATE rss;
+	memcpy(rss.data, rss_ptr, rss.cnt_bytes);
 
+	/* Bind surface to buffer-argument */
+	size_t buf_size;
+	CacheHint cache_hint;
+
+	auto arg = args[index].get();
+	if (!arg || arg->type == KernelArgType::Value)
+		throw runtime_error("Expected a pointer-like kernel argument");
+
+	if (arg->type == KernelArgType::Ptr)
 	{
-		auto cmd = make_unique<Gen9::CmdPipeControl>();
-		cmd->command_streamer_stall_enable = true;
-		cmds.push_back(move(cmd));
+		auto kernel_arg_ptr = static_cast<KernelArgPtr*>(arg);
+		buf_size = kernel_arg_ptr->size();
+		cache_hint = kernel_arg_ptr->cache_hint();
+		if (buf_size < 1)
+			throw invalid_argument("Kernel buffer argument with size < 1");
+
+		rss.set_surface_base_address(canonical_address(kernel_arg_ptr->ptr()));
 	}
+	else if (arg->type == KernelArgType::DispatchConstant)
+	{
+		buf_size = static_cast<KernelArgDispatchConstant*>(arg)->bytes().size();
+		cache_hint = CacheHint::Default;
 
+		/* Set per dispatch */
+		rss.set_surface_base_address(0);
+	}
+	else
 	{
-		auto cmd = make_unique<Gen9::CmdMiBatchBufferStart>();
-		cmd->address_space_indicator = Gen9::CmdMiBatchBufferStart::ASI_PPGTT;
-		cmd->batch_buffer_start_address = canonical_address(bb2.ptr()) >> 2;
-		cmds.push_back(move(cmd));
+		auto kernel_arg_gn = static_cast<KernelArgGEMName*>(arg);
+		buf_size = kernel_arg_gn->size();
+		cache_hint = kernel_arg_gn->cache_hint();
+		if (buf_size < 1)
+			throw invalid_argument("Kernel buffer argument with size < 1");
+
+		/* Relocated when submitting */
+		rss.set_surface_base_address(0);
 	}
 
+	/* MOCS is an index into the kernel's MOCS table, shifted by one */
+	switch (cache_hint)
 	{
-		cmds.push_back(make_unique<Gen9::CmdMiNoop>());
-	}
+	case CacheHint::Default:
+		{
+			Gen9::RENDER_SURFACE_STATE orig;
+			memcpy(orig.data, kernel->surface_state_heap->ptr() + surface_state_pointer,
+					orig.cnt_bytes);
+
+			rss.set_mocs(orig.get_mocs());
+		}
+		break;
 
-	/* Copy to a Bo */
-	size_t bb_bo_size = 0;
-	for (auto& cmd : cmds)
-		bb_bo_size += cmd->bin_size();
+	case CacheHint::Cached:
+		rss.set_mocs(I915_MOCS_CACHED << 1);
+		break;
 
-	I915UserptrBo bb(rte, bb_bo_size);
-	auto bb_ptr = (char*) bb.ptr();
-	for (auto& cmd : cmds)
-		bb_ptr += cmd->bin_write(bb_ptr);
+	case CacheHint::Streaming:
+		rss.set_mocs(I915_MOCS_UNCACHED << 1);
+		break;
+	}
 
-	/* Execute Bo */
-	vector<tuple<uint32_t, void*, vector<struct drm_i915_gem_relocation_entry>>> bos;
-	vector<struct drm_i915_gem_relocation_entry> ssbo_relocs;
+	set_buffer_surface_size(rss, buf_size);
+	memcpy(rss_ptr, rss.data, rss.cnt_bytes);
+}
 
-	for (auto& bo : arg_userptr_bos)
-		bos.emplace_back(bo.handle(), bo.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+void I915PreparedKernelImpl::bind_constant_surface()
+{
+	auto& plan = kernel->binding_plan;
+	uint64_t address = (uintptr_t) kernel->constant_surface_bo->ptr();
 
-	for (auto& bo : arg_reloc_bos)
+	if (plan.constant_surface_bt_index >= 0)
 	{
-		bos.emplace_back(bo.handle, (void*) (uintptr_t) 0,
-				vector<struct drm_i915_gem_relocation_entry>());
+		uint64_t surface_state_pointer =
+			kernel->surface_state_pointers[plan.constant_surface_bt_index];
+		char* rss_ptr = surface_state_image.data() + surface_state_pointer;
+
+		Gen9::RENDER_SURFACE_STATE rss;
+		memcpy(rss.data, rss_ptr, rss.cnt_bytes);
 
-		struct drm_i915_gem_relocation_entry reloc = { 0 };
-		reloc.target_handle = bo.handle;
-		reloc.offset = bo.reloc_offset;
-		reloc.write_domain = reloc.read_domains = I915_GEM_DOMAIN_RENDER;
+		/* Constants are read by all threads; keep them in the L3 */
+		rss.set_surface_base_address(canonical_address(address));
+		rss.set_mocs(I915_MOCS_CACHED << 1);
+		set_buffer_surface_size(rss, kernel->constant_surface_size);
 
-		ssbo_relocs.push_back(reloc);
+		memcpy(rss_ptr, rss.data, rss.cnt_bytes);
 	}
 
-	vector<struct drm_i915_gem_relocation_entry> iobo_relocs;
-	for (auto [handle, offset] : indirect_data_relocs)
+	write_cross_thread_pointer(plan.constant_surface_patches, address,
+			cross_thread_image.data());
+}
+
+void I915PreparedKernelImpl::update_images(NDRange global_offset, NDRange local_size)
+{
+	bool range_changed = !images_valid ||
+		global_offset.x != image_global_offset[0] ||
+		global_offset.y != image_global_offset[1] ||
+		global_offset.z != image_global_offset[2] ||
+		local_size.x != image_local_size[0] ||
+		local_size.y != image_local_size[1] ||
+		local_size.z != image_local_size[2];
+
+	PROFILE_PHASE(profile, SurfaceState);
+
+	try
 	{
-		/* Ensure that the bo is in the list of bos passed to EXECBUFFER2 */
-		bool found = false;
-		for (auto& bo : bos)
+		if (!images_valid)
 		{
-			if (get<0>(bo) == handle)
+			surface_state_image.clear();
+			if (kernel->surface_state_heap)
 			{
-				found = true;
-				break;
+				surface_state_image.assign(
+						kernel->surface_state_heap->ptr(),
+						kernel->surface_state_heap->ptr() + kernel->surface_state_heap->size);
 			}
+
+			cross_thread_image.assign(kernel->cross_thread_constant_data_read_length * 32, 0);
+			fill(dirty_args.begin(), dirty_args.end(), true);
+
+			if (kernel->constant_surface_bo)
+				bind_constant_surface();
+		}
+
+		/* Patch the surface states of changed buffer arguments */
+		bool any_dirty = find(dirty_args.begin(), dirty_args.end(), true) != dirty_args.end();
+		for (auto i : kernel->binding_plan.bt_args)
+		{
+			if (dirty_args[i])
+				bind_surface_state(i);
 		}
 
-		if (!found)
+		if (range_changed || any_dirty)
 		{
-			throw runtime_error("Bo specified for indirect object buffer "
-					"relocation but is not in list of bos");
+			PROFILE_NEXT_PHASE(CrossThreadData);
+
+			cross_thread_relocs.clear();
+			build_cross_thread_data(
+					kernel->binding_plan,
+					global_offset,
+					local_size,
+					args,
+					cross_thread_image.data(),
+					cross_thread_relocs,
+					range_changed ? nullptr : &dirty_args);
 		}
+	}
+	catch (...)
+	{
+		images_valid = false;
+		throw;
+	}
+
+	images_valid = true;
+	image_global_offset[0] = global_offset.x;
+	image_global_offset[1] = global_offset.y;
+	image_global_offset[2] = global_offset.z;
+	image_local_size[0] = local_size.x;
+	image_local_size[1] = local_size.y;
+	image_local_size[2] = local_size.z;
+
+	fill(dirty_args.begin(), dirty_args.end(), false);
+}
+
+void I915PreparedKernelImpl::execute(NDRange global_size, NDRange local_size)
+{
+	execute(NDRange(0, 0, 0), global_size, local_size);
+}
+
+shared_ptr<Event> I915PreparedKernelImpl::execute_async(NDRange global_size, NDRange local_size)
+{
+	return execute_async(NDRange(0, 0, 0), global_size, local_size);
+}
 
-		struct drm_i915_gem_relocation_entry reloc = { 0 };
-		reloc.target_handle = handle;
-		reloc.offset = offset;
-		reloc.write_domain = reloc.read_domains = I915_GEM_DOMAIN_RENDER;
+void I915PreparedKernelImpl::execute(NDRange global_offset,
+		NDRange global_size, NDRange local_size)
+{
+	auto event = execute_async(global_offset, global_size, local_size);
 
-		iobo_relocs.push_back(reloc);
+	{
+		PROFILE_PHASE(profile, Wait);
+		event->wait();
 	}
 
-	bos.emplace_back(general_state_bo.handle(), general_state_bo.ptr(),
-			vector<struct drm_i915_gem_relocation_entry>());
+	PROFILE_COMMIT(profile);
+}
+
+shared_ptr<Event> I915PreparedKernelImpl::execute_async(NDRange global_offset,
+		NDRange global_size, NDRange local_size)
+{
+	return submit(global_offset, global_size, local_size, rte.profiling);
+}
 
-	bos.emplace_back(surface_state_bo.handle(), surface_state_bo.ptr(), ssbo_relocs);
+shared_ptr<Event> I915PreparedKernelImpl::submit(NDRange global_offset,
+		NDRange global_size, NDRange local_size, bool profiling)
+{
+	auto layout = plan_dispatch(global_offset, global_size, local_size);
 
-	bos.emplace_back(dynamic_state_bo.handle(), dynamic_state_bo.ptr(),
-			vector<struct drm_i915_gem_relocation_entry>());
+	I915Batch batch(rte, profiling);
+	batch.profile = profile;
 
-	bos.emplace_back(indirect_object_bo.handle(), indirect_object_bo.ptr(), iobo_relocs);
+	if (!batch.fits(layout))
+		throw invalid_argument("Kernel state does not fit into a batch");
 
-	bos.emplace_back(instruction_buffer_bo.handle(), instruction_buffer_bo.ptr(),
-			vector<struct drm_i915_gem_relocation_entry>());
+	record_dispatch(batch, layout, global_offset, local_size);
 
-	bos.emplace_back(bindless_surface_bo.handle(), bindless_surface_bo.ptr(),
-			vector<struct drm_i915_gem_relocation_entry>());
+	auto submission = batch.submit();
+	PROFILE_COMMIT(profile);
 
-	bos.emplace_back(gp_bo.handle(), gp_bo.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+	if (profiling)
+		return make_shared<I915EventImpl>(rte, rte.waiter, submission,
+				vector<shared_ptr<I915Submission>>{submission});
 
-	bos.emplace_back(bb2.handle(), bb2.ptr(), vector<struct drm_i915_gem_relocation_entry>());
-	bos.emplace_back(bb.handle(), bb.ptr(), vector<struct drm_i915_gem_relocation_entry>());
+	return make_shared<I915EventImpl>(rte, rte.waiter, submission);
+}
 
-	volatile uint64_t* sync_ptr = (uint64_t*) gp_bo.ptr();
-	*sync_ptr = 0;
+void I915PreparedKernelImpl::execute(NDRange global_size)
+{
+	execute(NDRange(0, 0, 0), global_size, choose_local_size(global_size));
+}
 
-	gem_execbuffer2(rte.fd, rte.ctx_id, bos, bb_bo_size);
+shared_ptr<Event> I915PreparedKernelImpl::execute_async(NDRange global_size)
+{
+	return execute_async(NDRange(0, 0, 0), global_size, choose_local_size(global_size));
+}
 
-	/* Wait for GPU */
-	/* This IOCTL causes a reasonably high power consumption according to
-	 * intel_gpu_top - maybe verify with monitoring chip power at some point...
-	 * However, it improves latency */
-	gem_wait(rte.fd, bb.handle(), 500 * 1000 * 1000);
+/* The largest size <= @param budget for a work group dimension of @param
+ * global items; sizes that are multiples of @param granularity are preferred.
+ * If @param exact, the size must divide the global size. */
+static uint32_t choose_group_dimension(uint32_t global, uint32_t budget,
+		uint32_t granularity, bool exact)
+{
+	budget = max(budget, 1U);
 
-	for (;;)
+	if (!exact)
 	{
-		if (*sync_ptr == 1)
-			break;
+		if (budget >= global)
+			return global;
 
-		usleep(500);
+		if (budget > granularity)
+			budget -= budget % granularity;
+
+		return budget;
 	}
-}
 
+	uint32_t largest_divisor = 0;
+	for (uint32_t s = min(budget, global); s > 0; s--)
+	{
+		if (global % s != 0)
+			continue;
 
-/* Adapted from intel-compute-runtime -
- * shared/offline_compiler/source/decoder/binary_decoder.cpp */
-shared_ptr<I915KernelImpl> I915KernelImpl::read_kernel(
-		const char* bin, size_t size, const string& name, const string& build_log)
+		if (s % granularity == 0)
+			return s;
+
+		if (largest_divisor == 0)
+			largest_divisor = s;
+	}
+
+	return largest_divisor;
+}
+
+NDRange I915PreparedKernelImpl::choose_local_size(NDRange global_size)
 {
-	shared_ptr<I915KernelImpl> kernel;
+	if (
+			auto_tuning_generation == rte.tuning_generation &&
+			global_size.x == auto_global_size[0] &&
+			global_size.y == auto_global_size[1] &&
+			global_size.z == auto_global_size[2])
+	{
+		return NDRange(auto_local_size[0], auto_local_size[1], auto_local_size[2]);
+	}
 
-	auto hdr = read_program_binary_header(bin, size);
+	if (global_size.x < 1 || global_size.y < 1 || global_size.z < 1)
+		throw invalid_argument("Invalid global size");
+
+	auto& exe = *(kernel->params.execution_environment);
+	bool exact = !kernel->supports_non_uniform_groups;
+	uint32_t local[3];
 
-	if (hdr.PatchListSize != 0)
+	const I915TuningEntry* tuned = nullptr;
+	if (rte.tuning_db)
 	{
-		throw runtime_error("Program has patch tokens but patch tokens are "
-				"not supported at program level yet.");
+		tuned = rte.tuning_db->lookup(get_tuning_key(global_size));
+
+		/* Entries are shared by similar global sizes, which the local size
+		 * may not divide */
+		if (tuned && exact && (
+					global_size.x % tuned->local_size[0] != 0 ||
+					global_size.y % tuned->local_size[1] != 0 ||
+					global_size.z % tuned->local_size[2] != 0))
+		{
+			tuned = nullptr;
+		}
 	}
 
-	/* Parse kernels and find ours */
-	for (uint32_t i = 0; i < hdr.NumberOfKernels; i++)
+	if (exe.required_work_group_size_x > 0)
 	{
-		switch (hdr.Device)
+		/* Kernel was compiled with reqd_work_group_size */
+		local[0] = exe.required_work_group_size_x;
+		local[1] = max(exe.required_work_group_size_y, 1U);
+		local[2] = max(exe.required_work_group_size_z, 1U);
+	}
+	else if (tuned)
+	{
+		for (int d = 0; d < 3; d++)
+			local[d] = tuned->local_size[d];
+	}
+	else
+	{
+		uint32_t simd_size, max_threads;
+		get_group_limits(simd_size, max_threads);
+
+		uint32_t threads = max_threads;
+
+		/* Groups of kernels with barriers or SLM are as large as possible, as
+		 * the SLM limits the number of groups per subslice. Other kernels
+		 * gain nothing from large groups, hence the groups are kept small
+		 * enough to occupy all subslices. */
+		if (!exe.has_barriers && kernel->slm_size == 0 &&
+				kernel->binding_plan.local_args.empty())
 		{
-		case IGFX_GEN9_CORE:
-			{
-				auto kernel_hdr = read_kernel_binary_header_gen9(bin, size);
-				auto kernel_data_start = bin;
+			uint64_t items = (uint64_t) global_size.x * global_size.y * global_size.z;
+			uint64_t total_threads = DIV_ROUND_UP(items, simd_size);
+			uint64_t threads_per_subslice = DIV_ROUND_UP(total_threads,
+					max(rte.dev_info.subslice_total, 1U));
 
-				auto kernel_name = read_kernel_name(bin, size, kernel_hdr);
+			threads = min<uint64_t>(max(threads_per_subslice, (uint64_t) 1), max_threads);
+		}
 
-				/* Read heaps */
-				if (kernel_hdr.GeneralStateHeapSize != 0)
-				{
-					throw invalid_argument("Read a kernel with general state "
-							"heap size != 0, which is not supported");
-				}
+		/* Fill the group along x first, which matches row-major buffers */
+		uint32_t budget = min<uint32_t>(threads * simd_size, 1024);
 
-				size_t heaps_size =
-					kernel_hdr.KernelHeapSize +
-					kernel_hdr.GeneralStateHeapSize +
-					kernel_hdr.DynamicStateHeapSize +
-					kernel_hdr.SurfaceStateHeapSize;
+		local[0] = choose_group_dimension(global_size.x, budget, simd_size, exact);
+		local[1] = choose_group_dimension(global_size.y, budget / local[0], 1, exact);
+		local[2] = choose_group_dimension(global_size.z,
+				budget / (local[0] * local[1]), 1, exact);
+	}
 
-				if (size < heaps_size)
-					throw invalid_argument("Kernel heaps too small.");
+	auto_global_size[0] = global_size.x;
+	auto_global_size[1] = global_size.y;
+	auto_global_size[2] = global_size.z;
 
-				auto kernel_heap = make_unique<Heap>(
-						bin,
-						kernel_hdr.KernelUnpaddedSize,
-						kernel_hdr.KernelHeapSize);
+	for (int d = 0; d < 3; d++)
+		auto_local_size[d] = local[d];
 
-				bin += kernel_hdr.KernelHeapSize;
+	auto_tuning_generation = rte.tuning_generation;
 
-				auto dynamic_state_heap = make_unique<Heap>(
-						bin,
-						kernel_hdr.DynamicStateHeapSize,
-						kernel_hdr.DynamicStateHeapSize);
+	return NDRange(local[0], local[1], local[2]);
+}
 
-				bin += kernel_hdr.DynamicStateHeapSize;
+void I915PreparedKernelImpl::get_group_limits(uint32_t& simd_size, uint32_t& max_threads) const
+{
+	auto& exe = *(kernel->params.execution_environment);
 
-				auto surface_state_heap = make_unique<Heap>(
-						bin,
-						kernel_hdr.SurfaceStateHeapSize,
-						kernel_hdr.SurfaceStateHeapSize);
+	/* The SIMD size that plan_dispatch will choose */
+	simd_size = exe.largest_compiled_simd_size;
+	while (simd_size > 8 &&
+			!(simd_size == 32 && exe.compiled_simd32 == 1) &&
+			!(simd_size == 16 && exe.compiled_simd16 == 1))
+	{
+		simd_size /= 2;
+	}
 
-				bin += kernel_hdr.SurfaceStateHeapSize;
+	/* A group's threads run on one subslice, and the walker dispatches at
+	 * most 64 (SIMD32: 32) threads per group */
+	max_threads = min<uint32_t>(rte.dev_info.max_cs_threads, simd_size == 32 ? 32 : 64);
+}
+
+I915TuningKey I915PreparedKernelImpl::get_tuning_key(NDRange global_size) const
+{
+	return I915TuningKey(kernel->params.checksum, rte.dev_id, global_size);
+}
+
+vector<array<uint32_t, 3>> I915PreparedKernelImpl::get_tuning_candidates(
+		NDRange global_size) const
+{
+	uint32_t simd_size, max_threads;
+	get_group_limits(simd_size, max_threads);
+
+	auto& exe = *(kernel->params.execution_environment);
+	if (exe.required_work_group_size_x > 0)
+	{
+		return { {
+			exe.required_work_group_size_x,
+			max(exe.required_work_group_size_y, 1U),
+			max(exe.required_work_group_size_z, 1U) } };
+	}
+
+	return tuning_candidates(global_size, simd_size, max_threads,
+			!kernel->supports_non_uniform_groups);
+}
+
+I915DispatchLayout I915PreparedKernelImpl::plan_dispatch(NDRange global_offset,
+		NDRange global_size, NDRange local_size) const
+{
+	PROFILE_PHASE(profile, Validation);
+
+	/* Ensure that all arguments are bound */
+	for (auto& arg : args)
+	{
+		if (!arg)
+			throw runtime_error("Not all arguments where bound");
+	}
+
+	I915DispatchLayout layout;
+
+	/* Distribute threads */
+	/* Choose a SIMD size */
+	auto& exe = *(kernel->params.execution_environment);
+	int simd_size = exe.largest_compiled_simd_size;
+
+	if (local_size.x < 1 || local_size.y < 1 || local_size.z < 1)
+		throw invalid_argument("Invalid work group size");
+
+	if (global_size.x < 1 || global_size.y < 1 || global_size.z < 1)
+		throw invalid_argument("Invalid global size");
+
+	int cnt_ocl_threads = local_size.x * local_size.y * local_size.z;
+	if (cnt_ocl_threads > 1024)
+		throw invalid_argument("At most 1024 threads per work group are supported");
+
+	/* The threads of a work group are dispatched as a single row. Lanes of
+	 * the last thread beyond the work group are disabled by the walker's
+	 * right execution mask, hence the local size need not be a multiple of
+	 * the SIMD size. */
+	uint32_t cnt_threads;
+
+	for (;; simd_size /= 2)
+	{
+		if (simd_size < 8)
+			throw invalid_argument("Could not choose a SIMD-channel configuration");
+
+		if (simd_size == 32 && exe.compiled_simd32 != 1)
+			continue;
+
+		if (simd_size == 16 && exe.compiled_simd16 != 1)
+			continue;
+
+		if (simd_size == 8 && exe.compiled_simd8 != 1)
+			continue;
+
+		cnt_threads = DIV_ROUND_UP(cnt_ocl_threads, simd_size);
+
+		if (cnt_threads > rte.dev_info.max_cs_threads)
+			continue;
+
+		break;
+	}
+
+	if (simd_size == 32 && cnt_threads > 32)
+	{
+		throw invalid_argument("simd_size is 32 and more than 32 dispatches "
+				"in thread group");
+	}
+	else if (simd_size != 32 && cnt_threads > 64)
+	{
+		throw invalid_argument("more than 64 dispatches in thread group "
+				"(simd_size is < 32)");
+	}
+
+
+	/* Global ids must fit into 32 bit */
+	if (
+			global_offset.x > UINT32_MAX - global_size.x ||
+			global_offset.y > UINT32_MAX - global_size.y ||
+			global_offset.z > UINT32_MAX - global_size.z)
+	{
+		throw invalid_argument("Global offset + global size exceeds 32 bit");
+	}
+
+	bool uniform =
+		global_size.x % local_size.x == 0 &&
+		global_size.y % local_size.y == 0 &&
+		global_size.z % local_size.z == 0;
+
+	if (!uniform && !kernel->supports_non_uniform_groups)
+	{
+		throw invalid_argument("Global sizes must be multiples of local sizes "
+				"for kernels not built with -cl-std=CL2.0 or later without "
+				"-cl-uniform-work-group-size");
+	}
+
+	layout.simd_size = simd_size;
+	layout.scratch_size = kernel->scratch_size;
+	layout.has_l3_override = has_l3_override;
+	layout.l3_override = l3_override;
+
+
+	/* Size of CURBE data */
+	auto& tp = *(kernel->params.thread_payload);
+
+	layout.cross_thread_size_bytes = kernel->cross_thread_constant_data_read_length * 32;
+
+	size_t local_id_cnt = tp.local_id_x_present +
+		tp.local_id_y_present + tp.local_id_z_present;
+
+	size_t local_id_size_bytes = GRF_SIZE * (simd_size == 32 ? 2 : 1);
+	layout.per_thread_size_bytes = local_id_cnt * local_id_size_bytes;
+
+	if (tp.unused_per_thread_constant_present > 0)
+		layout.per_thread_size_bytes += GRF_SIZE;
+
+	layout.constant_urb_read_length = DIV_ROUND_UP(layout.per_thread_size_bytes, 32);
+
+	uint32_t indirect_data_length =
+		layout.constant_urb_read_length * 32 * cnt_threads +
+		layout.cross_thread_size_bytes;
+
+
+	/* From SKL PRM 2a, p. 488: "the total size of indirect data must be less
+	 * than 63,488 (2048 URB lines - 64 lines for interface Descriptors)" */
+	if (indirect_data_length >= 63488)
+		throw invalid_argument("indirect_data_length too large");
+
+	/* The indirect data of a walker is loaded into the VFE's URB entry */
+	if (indirect_data_length > (size_t) I915Batch::URB_ALLOCATION_SIZE * 32)
+		throw invalid_argument("Indirect data exceeds the URB entry");
+
+
+	/* A non-uniform NDRange ends with a partial work group in each dimension
+	 * whose global size is not a multiple of the local size. Each
+	 * combination of full and partial groups is dispatched by a walker of
+	 * its own, as the work group size is fixed per walker. */
+	struct GroupRange
+	{
+		uint32_t start;
+		uint32_t end;
+		uint32_t local_size;
+	};
+
+	const uint32_t global[3] = { global_size.x, global_size.y, global_size.z };
+	const uint32_t local[3] = { local_size.x, local_size.y, local_size.z };
+
+	GroupRange ranges[3][2];
+	unsigned cnt_ranges[3];
+
+	for (int d = 0; d < 3; d++)
+	{
+		uint32_t cnt_full = global[d] / local[d];
+		uint32_t remainder = global[d] % local[d];
+
+		cnt_ranges[d] = 0;
+
+		if (cnt_full > 0)
+			ranges[d][cnt_ranges[d]++] = { 0, cnt_full, local[d] };
+
+		if (remainder > 0)
+			ranges[d][cnt_ranges[d]++] = { cnt_full, cnt_full + 1, remainder };
+	}
+
+	for (unsigned z = 0; z < cnt_ranges[2]; z++)
+	{
+		for (unsigned y = 0; y < cnt_ranges[1]; y++)
+		{
+			for (unsigned x = 0; x < cnt_ranges[0]; x++)
+			{
+				const GroupRange* r[3] = { &ranges[0][x], &ranges[1][y], &ranges[2][z] };
+				auto& walker = layout.walkers[layout.cnt_walkers++];
+
+				for (int d = 0; d < 3; d++)
+				{
+					walker.local_size[d] = r[d]->local_size;
+					walker.group_start[d] = r[d]->start;
+					walker.group_end[d] = r[d]->end;
+				}
+
+				uint32_t cnt_items =
+					walker.local_size[0] * walker.local_size[1] * walker.local_size[2];
+
+				walker.cnt_threads = DIV_ROUND_UP(cnt_items, simd_size);
+
+				uint32_t last_lanes = cnt_items - (walker.cnt_threads - 1) * simd_size;
+				walker.right_execution_mask = last_lanes >= 32 ?
+					0xffffffff : (1U << last_lanes) - 1;
+
+				walker.indirect_data_length =
+					layout.constant_urb_read_length * 32 * walker.cnt_threads +
+					layout.cross_thread_size_bytes;
+
+				layout.indirect_data_size +=
+					align_value(walker.indirect_data_length, I915Batch::STATE_ALIGNMENT);
+			}
+		}
+	}
+
+	for (auto i : kernel->binding_plan.constant_args)
+	{
+		auto arg = args[i].get();
+		if (arg->type == KernelArgType::DispatchConstant)
+		{
+			layout.dispatch_constant_size += align_value(
+					static_cast<KernelArgDispatchConstant*>(arg)->bytes().size(),
+					I915Batch::STATE_ALIGNMENT);
+		}
+	}
+
+	layout.indirect_data_size += layout.dispatch_constant_size;
+
+	/* The sizes of __local arguments may change between dispatches */
+	layout.slm_size = kernel->binding_plan.local_args.empty() ? kernel->slm_size :
+		slm_allocation_size(local_memory_size(kernel->binding_plan, args));
+
+	if (kernel->surface_state_heap)
+		layout.surface_state_size = kernel->surface_state_heap->size;
+
+	return layout;
+}
+
+void I915PreparedKernelImpl::record_dispatch(I915Batch& batch,
+		const I915DispatchLayout& layout, NDRange global_offset, NDRange local_size)
+{
+	/* Interface descriptor; starts with the kernel's pre-decoded fields */
+	Gen9::INTERFACE_DESCRIPTOR_DATA idesc = kernel->idesc_template;
+	idesc.set_shared_local_memory_size(slm_size_to_idesc(layout.slm_size));
+
+	auto binding_table_entry_count = kernel->binding_table_entry_count;
+	auto binding_table_pointer = kernel->binding_table_pointer;
+
+
+	/* Apply changed arguments */
+	update_images(global_offset, local_size);
+
+	PROFILE_PHASE(profile, SurfaceState);
+
+	/* Copy surface state heap. All dispatches of a batch share one surface
+	 * state base address, hence the binding table and the surface state
+	 * pointers in it are moved to the copy's offset. */
+	size_t ssh_offset = 0;
+	char* ssh = nullptr;
+
+	if (layout.surface_state_size > 0)
+	{
+		ssh_offset = batch.alloc_surface_state(layout.surface_state_size);
+		ssh = (char*) batch.surface_state_bo.ptr() + ssh_offset;
+
+		memcpy(ssh, surface_state_image.data(), layout.surface_state_size);
+
+		idesc.set_binding_table_pointer((ssh_offset + binding_table_pointer) >> 5);
+	}
+
+	/* Make buffer arguments accessible */
+	PROFILE_NEXT_PHASE(BoRegistration);
+
+	auto& plan = kernel->binding_plan;
+
+	auto relocate_bt_entry = [&](int bt_index) -> uint64_t {
+		Gen9::BINDING_TABLE_STATE bts;
+		uint64_t surface_state_pointer = kernel->surface_state_pointers[bt_index];
+
+		char* bts_ptr = ssh + binding_table_pointer + bts.cnt_bytes * bt_index;
+		memcpy(bts.data, bts_ptr, bts.cnt_bytes);
+		bts.set_surface_state_pointer((ssh_offset + surface_state_pointer) >> 6);
+		memcpy(bts_ptr, bts.data, bts.cnt_bytes);
+
+		return surface_state_pointer;
+	};
+
+	if (binding_table_entry_count > 0)
+	{
+		for (auto i : plan.bt_args)
+		{
+			uint64_t surface_state_pointer = relocate_bt_entry(plan.args[i].bt_index);
+
+			auto arg = args[i].get();
+			if (arg->type == KernelArgType::Ptr)
+			{
+				auto kernel_arg_ptr = static_cast<KernelArgPtr*>(arg);
+				batch.add_userptr_argument(kernel_arg_ptr->ptr(), kernel_arg_ptr->size());
+			}
+			else if (arg->type == KernelArgType::GEMName)
+			{
+				auto kernel_arg_gn = static_cast<KernelArgGEMName*>(arg);
+				batch.add_surface_state_reloc(kernel_arg_gn->handle(),
+						ssh_offset + surface_state_pointer + 8*4);
+			}
+		}
+
+		if (plan.constant_surface_bt_index >= 0)
+			relocate_bt_entry(plan.constant_surface_bt_index);
+	}
+
+	batch.add_kernel(kernel);
+
+	if (kernel->constant_surface_bo)
+		batch.add_userptr_bo(kernel->constant_surface_bo);
+
+	/* __constant arguments are copied to the indirect state of each
+	 * dispatch; the surface states and stateless pointers refer to the
+	 * copies */
+	dispatch_constant_addresses.clear();
+
+	for (auto i : plan.constant_args)
+	{
+		auto arg = args[i].get();
+		if (arg->type != KernelArgType::DispatchConstant)
+			continue;
+
+		auto& bytes = static_cast<KernelArgDispatchConstant*>(arg)->bytes();
+		size_t offset = batch.alloc_indirect_object(bytes.size());
+		char* ptr = (char*) batch.indirect_object_bo.ptr() + offset;
+		memcpy(ptr, bytes.data(), bytes.size());
+
+		uint64_t address = (uintptr_t) ptr;
+		dispatch_constant_addresses.push_back({i, address});
+
+		if (binding_table_entry_count > 0)
+		{
+			Gen9::RENDER_SURFACE_STATE rss;
+			char* rss_ptr = ssh + kernel->surface_state_pointers[plan.args[i].bt_index];
+
+			memcpy(rss.data, rss_ptr, rss.cnt_bytes);
+			rss.set_surface_base_address(canonical_address(address));
+			memcpy(rss_ptr, rss.data, rss.cnt_bytes);
+		}
+	}
+
+
+	/* Setup CURBE data */
+	auto simd_size = layout.simd_size;
+	auto cross_thread_size_bytes = layout.cross_thread_size_bytes;
+
+	idesc.set_constant_urb_entry_read_length(layout.constant_urb_read_length);
+
+	vector<unique_ptr<I915RingCmd>> cmds;
+
+	for (unsigned w = 0; w < layout.cnt_walkers; w++)
+	{
+		auto& walker = layout.walkers[w];
+		auto cnt_threads = walker.cnt_threads;
+
+		uint32_t walker_local_size[3] = {
+			walker.local_size[0], walker.local_size[1], walker.local_size[2] };
+
+		/* Cross-thread data is taken from the image. Partial work groups see
+		 * their actual size as local size; the enqueued local size stays. */
+		PROFILE_NEXT_PHASE(CrossThreadData);
+
+		size_t ioh_offset = batch.alloc_indirect_object(walker.indirect_data_length);
+		char* ioh = (char*) batch.indirect_object_bo.ptr() + ioh_offset;
+
+		memcpy(ioh, cross_thread_image.data(), cross_thread_size_bytes);
+
+		for (auto& [i, address] : dispatch_constant_addresses)
+			write_cross_thread_pointer(plan.args[i].pointer_patches, address, ioh);
+
+		if (
+				walker_local_size[0] != local_size.x ||
+				walker_local_size[1] != local_size.y ||
+				walker_local_size[2] != local_size.z)
+		{
+			set_local_work_size(kernel->binding_plan,
+					NDRange(walker_local_size[0], walker_local_size[1], walker_local_size[2]),
+					ioh);
+		}
+
+		/* Per-thread data is cached per work group shape */
+		PROFILE_NEXT_PHASE(LocalIds);
+
+		I915LocalIdShape shape;
+		copy(walker.local_size, walker.local_size + 3, shape.local_size);
+		shape.simd_size = layout.simd_size;
+		shape.cnt_threads = walker.cnt_threads;
+		shape.local_id_size = GRF_SIZE * (layout.simd_size == 32 ? 2 : 1);
+		shape.per_thread_size = layout.per_thread_size_bytes;
+
+		kernel->write_per_thread_data(shape, ioh + cross_thread_size_bytes);
+
+		size_t used = cross_thread_size_bytes + shape.per_thread_size * shape.cnt_threads;
+		memset(ioh + used, 0, walker.indirect_data_length - used);
+
+		PROFILE_NEXT_PHASE(BatchBuild);
+
+		for (auto [handle, offset] : cross_thread_relocs)
+			batch.add_indirect_object_reloc(handle, ioh_offset + offset);
+
+
+		/* Copy interface descriptor to dynamic state heap */
+		idesc.set_number_of_threads_in_gpgpu_thread_group(cnt_threads);
+
+		size_t dsh_offset = batch.alloc_dynamic_state(idesc.cnt_bytes);
+		memcpy((char*) batch.dynamic_state_bo.ptr() + dsh_offset, idesc.data, idesc.cnt_bytes);
+
+
+		/* Commands */
+		{
+			auto cmd = make_unique<Gen9::CmdMediaInterfaceDescriptorLoad>();
+			static_assert(idesc.cnt_bytes == 32);
+			cmd->interface_descriptor_total_length = 32;
+			cmd->interface_descriptor_data_start_address = dsh_offset;
+			cmds.push_back(move(cmd));
+		}
+
+		{
+			auto cmd = make_unique<Gen9::CmdGpgpuWalker>();
+
+			cmd->predicate_enable = false;
+			cmd->indirect_parameter_enable = false;
+			cmd->interface_descriptor_offset = 0;
+			cmd->indirect_data_length = walker.indirect_data_length;
+			cmd->indirect_data_start_address = ioh_offset >> 6;
+			cmd->thread_width_counter_maximum = cnt_threads - 1;
+			cmd->thread_height_counter_maximum = 0;
+			cmd->thread_depth_counter_maximum = 0;
+			cmd->simd_size =
+				simd_size == 32 ? Gen9::CmdGpgpuWalker::SIMD32 :
+				simd_size == 16 ? Gen9::CmdGpgpuWalker::SIMD16 :
+				Gen9::CmdGpgpuWalker::SIMD8;
+
+			/* Partial work groups keep their group ids. The global offset is
+			 * passed in the cross-thread data and added to the global ids by
+			 * the kernel, hence it does not shift the group ids. */
+			cmd->thread_group_id_starting_x = walker.group_start[0];
+			cmd->thread_group_id_x_dimension = walker.group_end[0];
+			cmd->thread_group_id_starting_y = walker.group_start[1];
+			cmd->thread_group_id_y_dimension = walker.group_end[1];
+			cmd->thread_group_id_starting_resume_z = walker.group_start[2];
+			cmd->thread_group_id_z_dimension = walker.group_end[2];
+
+			/* All threads of a group lie in one row, hence the bottom mask
+			 * applies to each of them and must not disable any lane */
+			cmd->right_execution_mask = walker.right_execution_mask;
+			cmd->bottom_execution_mask = 0xffffffff;
+
+			cmds.push_back(move(cmd));
+		}
+
+		{
+			cmds.push_back(make_unique<Gen9::CmdMediaStateFlush>());
+		}
+	}
+
+	batch.add_dispatch(move(cmds), layout.slm_size, layout);
+
+	PROFILE_STOP();
+	PROFILE_COMMIT(profile);
+}
+
+
+/* Adapted from intel-compute-runtime -
+ * shared/offline_compiler/source/decoder/binary_decoder.cpp */
+shared_ptr<I915KernelImpl> I915KernelImpl::read_kernel(
+		I915RTEImpl& rte,
+		const char* bin, size_t size, const string& name, const string& build_log,
+		bool non_uniform_groups)
+{
+	shared_ptr<I915KernelImpl> kernel;
+
+	auto hdr = read_program_binary_header(bin, size);
+
+	ProgramParameters program_params;
+	read_program_patchlist(bin, size, hdr, program_params);
+
+	/* Parse kernels and find ours */
+	for (uint32_t i = 0; i < hdr.NumberOfKernels; i++)
+	{
+		switch (hdr.Device)
+		{
+		case IGFX_GEN9_CORE:
+			{
+				auto kernel_hdr = read_kernel_binary_header_gen9(bin, size);
+				auto kernel_data_start = bin;
+
+				auto kernel_name = read_kernel_name(bin, size, kernel_hdr);
+
+				/* Read heaps */
+				if (kernel_hdr.GeneralStateHeapSize != 0)
+				{
+					throw invalid_argument("Read a kernel with general state "
+							"heap size != 0, which is not supported");
+				}
+
+				size_t heaps_size =
+					kernel_hdr.KernelHeapSize +
+					kernel_hdr.GeneralStateHeapSize +
+					kernel_hdr.DynamicStateHeapSize +
+					kernel_hdr.SurfaceStateHeapSize;
+
+				if (size < heaps_size)
+					throw invalid_argument("Kernel heaps too small.");
+
+				auto kernel_heap = make_unique<Heap>(
+						bin,
+						kernel_hdr.KernelUnpaddedSize,
+						kernel_hdr.KernelHeapSize);
+
+				bin += kernel_hdr.KernelHeapSize;
+
+				auto dynamic_state_heap = make_unique<Heap>(
+						bin,
+						kernel_hdr.DynamicStateHeapSize,
+						kernel_hdr.DynamicStateHeapSize);
+
+				bin += kernel_hdr.DynamicStateHeapSize;
+
+				auto surface_state_heap = make_unique<Heap>(
+						bin,
+						kernel_hdr.SurfaceStateHeapSize,
+						kernel_hdr.SurfaceStateHeapSize);
+
+				bin += kernel_hdr.SurfaceStateHeapSize;
+
+				size -= heaps_size;
+
+				/* Read patchlist */
+				auto params = build_kernel_params(hdr, kernel_hdr);
+				read_kernel_patchlist(bin, size, kernel_hdr, params);
+
+				/* Verify checksum */
+				auto checksum = gen_hash(kernel_data_start, bin - kernel_data_start) & 0xffffffff;
+				if (kernel_hdr.CheckSum != checksum)
+					throw invalid_argument("Kernel checksum mismatch for kernel `" + kernel_name + "'");
+
+				/* Construct kernel */
+				if (kernel_name == name)
+				{
+					if (kernel)
+					{
+						throw invalid_argument(
+								"The given binary contains multiple kernels "
+								"with the requested name.");
+					}
+
+					kernel = make_shared<I915KernelImpl>(
+							rte,
+							kernel_name,
+							params,
+							program_params,
+							move(kernel_heap),
+							move(dynamic_state_heap),
+							move(surface_state_heap),
+							build_log,
+							non_uniform_groups);
+				}
+			}
+			break;
+
+		default:
+			throw invalid_argument("Unsupported device family");
+		};
+	}
+
+	if (size != 0)
+		throw invalid_argument("Remaining size in binary file is not zero");
+
+	if (!kernel)
+	{
+		throw invalid_argument(
+				"A kernel with the given name was not found in the given binary.");
+	}
+
+	return kernel;
+}
+
+
+I915UserptrBo::I915UserptrBo(I915RTEImpl& rte, size_t req_size)
+	: rte(rte), allocated(true)
+{
+	auto page_size = rte.get_page_size();
+	_size = ((req_size + page_size - 1) / page_size) * page_size;
+
+	_ptr = aligned_alloc(page_size, _size);
+	if (!_ptr)
+		throw system_error(errno, generic_category(), "Failed to allocate memory");
+
+	try
+	{
+		_handle = rte.gem_userptr(_ptr, _size);
+	}
+	catch (...)
+	{
+		free(_ptr);
+		throw;
+	}
+}
+
+I915UserptrBo::I915UserptrBo(I915RTEImpl& rte, void* _ptr, size_t _size)
+	: rte(rte), allocated(false), _ptr(_ptr), _size(_size)
+{
+	auto page_size = rte.get_page_size();
+	if (_size % page_size != 0 || (uintptr_t) _ptr % page_size != 0)
+		throw invalid_argument("size and ptr must be aligned to the system's page size");
+
+	_handle = rte.gem_userptr(_ptr, _size);
+}
+
+I915UserptrBo::~I915UserptrBo()
+{
+	rte.gem_close(_handle);
+
+	if (allocated)
+		free(_ptr);
+}
+
+void* I915UserptrBo::ptr() const
+{
+	return _ptr;
+}
+
+size_t I915UserptrBo::size() const
+{
+	return _size;
+}
+
+uint32_t I915UserptrBo::handle() const
+{
+	return _handle;
+}
+
+
+I915PooledBo::I915PooledBo(I915BoPool& pool, unique_ptr<I915UserptrBo>&& bo)
+	: pool(&pool), bo(move(bo))
+{
+}
+
+I915PooledBo::I915PooledBo(I915PooledBo&& o)
+	: pool(o.pool), bo(move(o.bo))
+{
+}
+
+I915PooledBo& I915PooledBo::operator=(I915PooledBo&& o)
+{
+	if (this != &o)
+	{
+		if (bo)
+			pool->put(move(bo));
+
+		pool = o.pool;
+		bo = move(o.bo);
+	}
+
+	return *this;
+}
+
+I915PooledBo::~I915PooledBo()
+{
+	if (bo)
+		pool->put(move(bo));
+}
+
+void* I915PooledBo::ptr() const
+{
+	return bo->ptr();
+}
+
+size_t I915PooledBo::size() const
+{
+	return bo->size();
+}
+
+uint32_t I915PooledBo::handle() const
+{
+	return bo->handle();
+}
+
+
+I915BoPool::I915BoPool(I915RTEImpl& rte, size_t max_cached_bytes)
+	: rte(rte), max_cached_bytes(max_cached_bytes)
+{
+}
+
+I915BoPool::~I915BoPool()
+{
+}
+
+unsigned I915BoPool::size_class(size_t size) const
+{
+	auto page_size = rte.get_page_size();
+
+	unsigned c = 0;
+	while ((page_size << c) < size)
+		c++;
+
+	return c;
+}
+
+I915PooledBo I915BoPool::get(size_t req_size)
+{
+	auto c = size_class(req_size);
+
+	if (c < free_bos.size() && free_bos[c].size() > 0)
+	{
+		auto bo = move(free_bos[c].back());
+		free_bos[c].pop_back();
+
+		cached_bos--;
+		cached_bytes -= bo->size();
+		cnt_reused++;
+
+		return I915PooledBo(*this, move(bo));
+	}
+
+	auto bo = make_unique<I915UserptrBo>(rte, rte.get_page_size() << c);
+	cnt_allocated++;
+
+	return I915PooledBo(*this, move(bo));
+}
+
+void I915BoPool::put(unique_ptr<I915UserptrBo>&& bo)
+{
+	if (cached_bytes + bo->size() > max_cached_bytes)
+		return;
+
+	auto c = size_class(bo->size());
+	if (free_bos.size() <= c)
+		free_bos.resize(c + 1);
+
+	cached_bos++;
+	cached_bytes += bo->size();
+	free_bos[c].push_back(move(bo));
+}
+
+void I915BoPool::trim()
+{
+	free_bos.clear();
+	cached_bos = 0;
+	cached_bytes = 0;
+}
+
+void I915BoPool::get_stats(I915BoPoolStats& stats) const
+{
+	stats.allocated = cnt_allocated;
+	stats.reused = cnt_reused;
+	stats.cached_bos = cached_bos;
+	stats.cached_bytes = cached_bytes;
+}
+
+
+I915UserptrCache::I915UserptrCache(I915RTEImpl& rte, size_t max_implicit_entries)
+	: rte(rte), max_implicit_entries(max_implicit_entries)
+{
+}
+
+I915UserptrCache::~I915UserptrCache()
+{
+}
+
+void I915UserptrCache::drop_overlapping(uintptr_t start, uintptr_t end)
+{
+	auto i = entries.upper_bound(start);
+	if (i != entries.begin())
+		i--;
+
+	while (i != entries.end() && i->first < end)
+	{
+		auto entry_end = i->first + i->second.bo->size();
+		if (entry_end <= start)
+		{
+			i++;
+			continue;
+		}
+
+		if (i->second.explicit_registration)
+		{
+			throw invalid_argument("Range overlaps registered host memory "
+					"partially");
+		}
+
+		i = entries.erase(i);
+		cnt_implicit--;
+		cnt_evictions++;
+	}
+}
+
+void I915UserptrCache::drop_lru()
+{
+	auto lru = entries.end();
+	for (auto i = entries.begin(); i != entries.end(); i++)
+	{
+		if (i->second.explicit_registration)
+			continue;
+
+		if (lru == entries.end() || i->second.last_use < lru->second.last_use)
+			lru = i;
+	}
+
+	if (lru != entries.end())
+	{
+		entries.erase(lru);
+		cnt_implicit--;
+		cnt_evictions++;
+	}
+}
+
+shared_ptr<I915UserptrBo> I915UserptrCache::get(void* ptr, size_t size)
+{
+	auto start = (uintptr_t) ptr;
+	auto end = start + size;
+
+	/* The only entry that can contain the range is the one with the largest
+	 * start address <= start. Registered ranges are reused for all ranges
+	 * they contain. Implicit entries may refer to memory that was freed and
+	 * allocated again with a different layout, hence they are reused for
+	 * the exact range only. */
+	auto i = entries.upper_bound(start);
+	if (i != entries.begin())
+	{
+		i--;
+
+		auto& entry = i->second;
+		bool hit = entry.explicit_registration ?
+			end <= i->first + entry.bo->size() :
+			i->first == start && entry.bo->size() == size;
+
+		if (hit)
+		{
+			entry.last_use = ++use_counter;
+			cnt_hits++;
+			return entry.bo;
+		}
+	}
+
+	cnt_misses++;
+
+	drop_overlapping(start, end);
+
+	Entry entry;
+	entry.bo = make_shared<I915UserptrBo>(rte, ptr, size);
+	entry.last_use = ++use_counter;
+
+	auto bo = entry.bo;
+	entries.emplace(start, move(entry));
+	cnt_implicit++;
+
+	while (cnt_implicit > max_implicit_entries)
+		drop_lru();
+
+	return bo;
+}
+
+void I915UserptrCache::register_range(void* ptr, size_t size)
+{
+	auto start = (uintptr_t) ptr;
+	auto end = start + size;
+
+	auto i = entries.find(start);
+	if (i != entries.end() && i->second.explicit_registration)
+		throw invalid_argument("Host memory is already registered");
+
+	/* Implicit entries are replaced, whether they cover the range exactly or
+	 * not */
+	drop_overlapping(start, end);
+
+	Entry entry;
+	entry.bo = make_shared<I915UserptrBo>(rte, ptr, size);
+	entry.explicit_registration = true;
+
+	entries.emplace(start, move(entry));
+}
+
+void I915UserptrCache::unregister_range(void* ptr)
+{
+	auto i = entries.find((uintptr_t) ptr);
+	if (i == entries.end() || !i->second.explicit_registration)
+		throw invalid_argument("Host memory is not registered");
+
+	entries.erase(i);
+}
+
+void I915UserptrCache::clear()
+{
+	entries.clear();
+	cnt_implicit = 0;
+}
+
+void I915UserptrCache::get_stats(I915UserptrCacheStats& stats) const
+{
+	stats.hits = cnt_hits;
+	stats.misses = cnt_misses;
+	stats.evictions = cnt_evictions;
+	stats.explicit_ranges = entries.size() - cnt_implicit;
+	stats.implicit_ranges = cnt_implicit;
+}
+
+
+I915GEMNameCache::I915GEMNameCache(I915RTEImpl& rte)
+	: rte(rte)
+{
+}
+
+I915GEMNameCache::~I915GEMNameCache()
+{
+}
+
+void I915GEMNameCache::acquire(uint32_t name, uint32_t& handle, uint64_t& size)
+{
+	auto i = imports.find(name);
+	if (i == imports.end())
+	{
+		I915GEMNameImport import;
+		import.name = name;
+		rte.gem_open(name, import.handle, import.size);
+
+		i = imports.emplace(name, import).first;
+	}
+
+	i->second.refs++;
+	handle = i->second.handle;
+	size = i->second.size;
+}
+
+void I915GEMNameCache::release(uint32_t name)
+{
+	auto i = imports.find(name);
+	if (i == imports.end() || i->second.refs == 0)
+		throw runtime_error("GEM name released more often than acquired");
+
+	i->second.refs--;
+}
+
+void I915GEMNameCache::evict(uint32_t name)
+{
+	auto i = imports.find(name);
+	if (i == imports.end())
+		throw invalid_argument("GEM name is not imported");
+
+	if (i->second.refs > 0)
+		throw invalid_argument("GEM name is still referenced by a kernel argument");
+
+	/* Submissions that use the object keep it alive in the kernel */
+	rte.gem_close(i->second.handle);
+	imports.erase(i);
+}
+
+void I915GEMNameCache::evict_unused()
+{
+	for (auto i = imports.begin(); i != imports.end();)
+	{
+		if (i->second.refs == 0)
+		{
+			rte.gem_close(i->second.handle);
+			i = imports.erase(i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void I915GEMNameCache::clear()
+{
+	for (auto& [name, import] : imports)
+		rte.gem_close(import.handle);
+
+	imports.clear();
+}
+
+vector<I915GEMNameImport> I915GEMNameCache::get_imports() const
+{
+	vector<I915GEMNameImport> v;
+	for (auto& [name, import] : imports)
+		v.push_back(import);
+
+	return v;
+}
+
+
+I915InstructionHeapRange::I915InstructionHeapRange(I915InstructionHeap& heap, size_t size)
+	: heap(heap), _size(size)
+{
+	_offset = heap.alloc(_size);
+}
+
+I915InstructionHeapRange::~I915InstructionHeapRange()
+{
+	heap.free(_offset, _size);
+}
+
+char* I915InstructionHeapRange::ptr() const
+{
+	return heap.ptr() + _offset;
+}
+
+size_t I915InstructionHeapRange::offset() const
+{
+	return _offset;
+}
+
+size_t I915InstructionHeapRange::size() const
+{
+	return _size;
+}
+
+
+I915InstructionHeap::I915InstructionHeap(I915RTEImpl& rte, size_t size)
+	: rte(rte), _size(size)
+{
+	free_ranges.emplace(0, _size);
+}
+
+I915InstructionHeap::~I915InstructionHeap()
+{
+}
+
+size_t I915InstructionHeap::alloc(size_t size)
+{
+	size = align_value(max(size, (size_t) 1), ALIGNMENT);
+
+	if (!bo)
+	{
+		bo = make_unique<I915UserptrBo>(rte, _size);
+		memset(bo->ptr(), 0, bo->size());
+	}
+
+	/* First fit */
+	for (auto i = free_ranges.begin(); i != free_ranges.end(); i++)
+	{
+		if (i->second < size)
+			continue;
+
+		auto offset = i->first;
+		auto remaining = i->second - size;
+
+		free_ranges.erase(i);
+		if (remaining > 0)
+			free_ranges.emplace(offset + size, remaining);
+
+		return offset;
+	}
+
+	throw runtime_error("Instruction heap exhausted");
+}
+
+void I915InstructionHeap::free(size_t offset, size_t size)
+{
+	size = align_value(max(size, (size_t) 1), ALIGNMENT);
+
+	auto i = free_ranges.emplace(offset, size).first;
+
+	/* Merge with adjacent free ranges */
+	auto next = std::next(i);
+	if (next != free_ranges.end() && offset + size == next->first)
+	{
+		i->second += next->second;
+		free_ranges.erase(next);
+	}
+
+	if (i != free_ranges.begin())
+	{
+		auto prev = std::prev(i);
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += i->second;
+			free_ranges.erase(i);
+		}
+	}
+}
+
+void I915InstructionHeap::release()
+{
+	bo.reset();
+}
+
+bool I915InstructionHeap::allocated() const
+{
+	return (bool) bo;
+}
+
+char* I915InstructionHeap::ptr() const
+{
+	return (char*) bo->ptr();
+}
+
+size_t I915InstructionHeap::size() const
+{
+	return _size;
+}
+
+uint32_t I915InstructionHeap::handle() const
+{
+	return bo->handle();
+}
+
+
+I915Submission::I915Submission()
+{
+}
+
+I915Submission::~I915Submission()
+{
+}
+
+bool I915Submission::is_complete() const
+{
+	/* Submissions without batch buffer (e.g. of an empty queue) are complete
+	 * immediately */
+	if (!sync_ptr)
+		return true;
+
+	return *sync_ptr == 1;
+}
+
+
+I915Waiter::I915Waiter(I915RTEImpl& rte, const I915WaitPolicy& policy)
+	: rte(rte), policy(policy)
+{
+}
+
+I915Waiter::~I915Waiter()
+{
+}
+
+void I915Waiter::record_latency(const I915Submission& submission)
+{
+	if (!policy.measure_latency || !submission.timestamp_ptr)
+		return;
+
+	/* Both timestamps stem from the render engine's timestamp counter, which
+	 * has 36 valid bits */
+	const uint64_t mask = (1ULL << 36) - 1;
+	uint64_t ticks = (rte.read_gpu_timestamp() - *submission.timestamp_ptr) & mask;
+
+	auto latency = rte.gpu_timestamp_to_ns(ticks);
+
+	if (stats.latency_samples == 0 || latency < stats.latency_min)
+		stats.latency_min = latency;
+
+	if (latency > stats.latency_max)
+		stats.latency_max = latency;
+
+	stats.latency_total += latency;
+	stats.latency_samples++;
+}
+
+void I915Waiter::check_lost(const I915Submission& submission)
+{
+	if (submission.is_complete())
+		return;
+
+	if (rte.submission_lost(submission))
+		throw GpuHangError("The GPU hung or the context was banned while executing a kernel");
+}
+
+/* steady_clock::now() + timeout overflows for large timeouts like
+ * nanoseconds::max() */
+static chrono::steady_clock::time_point deadline_after(chrono::nanoseconds timeout)
+{
+	auto now = chrono::steady_clock::now();
+	if (timeout <= chrono::nanoseconds(0))
+		return now;
+
+	if (timeout >= chrono::steady_clock::time_point::max() - now)
+		return chrono::steady_clock::time_point::max();
+
+	return now + timeout;
+}
+
+bool I915Waiter::wait_until(const I915Submission& submission,
+		chrono::steady_clock::time_point deadline)
+{
+	if (submission.is_complete())
+		return true;
+
+	stats.waits++;
+
+	/* Spin on the completion location. A hung batch never sets it, hence
+	 * check from time to time if the batch is still executing. */
+	if (policy.mode != I915WaitMode::Blocking)
+	{
+		auto spin_end = deadline;
+		if (policy.mode == I915WaitMode::Adaptive)
+			spin_end = min(deadline, deadline_after(policy.spin_time));
 
-				size -= heaps_size;
+		auto next_check = chrono::steady_clock::now() + chrono::milliseconds(10);
 
-				/* Read patchlist */
-				auto params = build_kernel_params(hdr, kernel_hdr);
-				read_kernel_patchlist(bin, size, kernel_hdr, params);
+		for (;;)
+		{
+			if (submission.is_complete())
+				break;
 
-				/* Verify checksum */
-				auto checksum = gen_hash(kernel_data_start, bin - kernel_data_start) & 0xffffffff;
-				if (kernel_hdr.CheckSum != checksum)
-					throw invalid_argument("Kernel checksum mismatch for kernel `" + kernel_name + "'");
+			auto now = chrono::steady_clock::now();
+			if (now >= spin_end)
+				break;
 
-				/* Construct kernel */
-				if (kernel_name == name)
-				{
-					if (kernel)
-					{
-						throw invalid_argument(
-								"The given binary contains multiple kernels "
-								"with the requested name.");
-					}
+			if (now >= next_check)
+			{
+				if (rte.gem_wait(submission.bb_handle, 0) >= 0)
+					check_lost(submission);
 
-					kernel = make_shared<I915KernelImpl>(
-							kernel_name,
-							params,
-							move(kernel_heap),
-							move(dynamic_state_heap),
-							move(surface_state_heap),
-							build_log);
-				}
+				next_check = now + chrono::milliseconds(10);
 			}
-			break;
+		}
 
-		default:
-			throw invalid_argument("Unsupported device family");
-		};
+		if (submission.is_complete())
+		{
+			stats.spin_completions++;
+			record_latency(submission);
+			return true;
+		}
+
+		if (policy.mode == I915WaitMode::BusyPoll)
+			return false;
 	}
 
-	if (size != 0)
-		throw invalid_argument("Remaining size in binary file is not zero");
+	/* Wait for the batch buffer to become idle. The PIPE_CONTROL's post-sync
+	 * write is done when the batch retired, hence the sync location is
+	 * usually set once GEM_WAIT returned. If it is not, the batch may have
+	 * been lost in a GPU reset. */
+	stats.blocking_waits++;
 
-	if (!kernel)
+	while (!submission.is_complete())
 	{
-		throw invalid_argument(
-				"A kernel with the given name was not found in the given binary.");
+		chrono::nanoseconds remaining = deadline - chrono::steady_clock::now();
+		if (remaining <= chrono::nanoseconds(0))
+			return false;
+
+		remaining = min<chrono::nanoseconds>(remaining, chrono::milliseconds(500));
+
+		stats.gem_wait_ioctls++;
+		if (rte.gem_wait(submission.bb_handle, remaining.count()) >= 0 &&
+				!submission.is_complete())
+		{
+			check_lost(submission);
+			this_thread::yield();
+		}
 	}
 
-	return kernel;
+	record_latency(submission);
+	return true;
 }
 
+void I915Waiter::set_policy(const I915WaitPolicy& policy)
+{
+	this->policy = policy;
+}
 
-I915UserptrBo::I915UserptrBo(I915RTEImpl& rte, size_t req_size)
-	: rte(rte), allocated(true)
+I915WaitPolicy I915Waiter::get_policy() const
 {
-	auto page_size = rte.get_page_size();
-	_size = ((req_size + page_size - 1) / page_size) * page_size;
+	return policy;
+}
 
-	_ptr = aligned_alloc(page_size, _size);
-	if (!_ptr)
-		throw system_error(errno, generic_category(), "Failed to allocate memory");
+I915WaitStats I915Waiter::get_stats() const
+{
+	return stats;
+}
 
-	try
-	{
-		_handle = rte.gem_userptr(_ptr, _size);
-	}
-	catch (...)
+
+I915EventImpl::I915EventImpl(I915RTEImpl& rte, shared_ptr<I915Waiter> waiter,
+		shared_ptr<I915Submission> submission,
+		vector<shared_ptr<I915Submission>> profiled_submissions)
+	:
+		rte(rte), waiter(waiter), submission(submission),
+		profiled_submissions(move(profiled_submissions))
+{
+}
+
+I915EventImpl::~I915EventImpl()
+{
+}
+
+void I915EventImpl::wait()
+{
+	auto timeout = waiter->get_policy().timeout;
+	if (timeout <= chrono::nanoseconds(0))
 	{
-		free(_ptr);
-		throw;
+		waiter->wait_until(*submission, chrono::steady_clock::time_point::max());
+		return;
 	}
+
+	if (!waiter->wait_until(*submission, deadline_after(timeout)))
+		throw TimeoutError("Timeout while waiting for kernel completion");
 }
 
-I915UserptrBo::I915UserptrBo(I915RTEImpl& rte, void* _ptr, size_t _size)
-	: rte(rte), allocated(false), _ptr(_ptr), _size(_size)
+bool I915EventImpl::is_complete()
 {
-	auto page_size = rte.get_page_size();
-	if (_size % page_size != 0 || (uintptr_t) _ptr % page_size != 0)
-		throw invalid_argument("size and ptr must be aligned to the system's page size");
+	return submission->is_complete();
+}
 
-	_handle = rte.gem_userptr(_ptr, _size);
+bool I915EventImpl::wait_for(chrono::nanoseconds timeout)
+{
+	return waiter->wait_until(*submission, deadline_after(timeout));
 }
 
-I915UserptrBo::~I915UserptrBo()
+void I915RTEImpl::set_batch_dump(FILE* f)
 {
-	rte.gem_close(_handle);
+	batch_dump = f;
+}
 
-	if (allocated)
-		free(_ptr);
+void I915RTEImpl::set_tuning_database(const char* path)
+{
+	if (path)
+		tuning_db = make_unique<I915TuningDatabase>(path);
+	else
+		tuning_db = nullptr;
+
+	tuning_generation++;
 }
 
-void* I915UserptrBo::ptr() const
+void I915RTEImpl::set_tuning_timer(shared_ptr<I915TuningTimer> timer)
 {
-	return _ptr;
+	tuning_timer = timer;
 }
 
-size_t I915UserptrBo::size() const
+NDRange I915RTEImpl::tune(PreparedKernel& _kernel, NDRange global_size)
 {
-	return _size;
+	auto kernel = dynamic_cast<I915PreparedKernelImpl*>(&_kernel);
+	if (!kernel)
+		throw invalid_argument("Given PreparedKernel must be an I915PreparedKernel");
+
+	if (!tuning_db)
+		throw runtime_error("No tuning database has been set");
+
+	/* Report errors that do not depend on the local size, e.g. unbound
+	 * arguments, instead of discarding all candidates */
+	auto initial = kernel->choose_local_size(global_size);
+	kernel->plan_dispatch(NDRange(0, 0, 0), global_size, initial);
+
+	auto candidates = kernel->get_tuning_candidates(global_size);
+	candidates.push_back({ initial.x, initial.y, initial.z });
+
+	sort(candidates.begin(), candidates.end());
+	candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+	candidates.erase(remove_if(candidates.begin(), candidates.end(),
+				[&](const array<uint32_t, 3>& c) {
+					try
+					{
+						kernel->plan_dispatch(NDRange(0, 0, 0), global_size,
+								NDRange(c[0], c[1], c[2]));
+						return false;
+					}
+					catch (exception&)
+					{
+						return true;
+					}
+				}),
+			candidates.end());
+
+	I915GpuTuningTimer gpu_timer;
+	I915TuningTimer& timer = tuning_timer ? *tuning_timer : gpu_timer;
+
+	I915TuningEntry entry;
+	auto best = select_fastest(timer, *kernel, global_size, candidates,
+			TUNING_SAMPLES, entry.time_ns);
+
+	entry.local_size = candidates[best];
+	tuning_db->store(kernel->get_tuning_key(global_size), entry);
+	tuning_generation++;
+
+	return NDRange(entry.local_size[0], entry.local_size[1], entry.local_size[2]);
 }
 
-uint32_t I915UserptrBo::handle() const
+vector<I915KernelProfile> I915RTEImpl::get_profile()
 {
-	return _handle;
+	return host_profiler.get_profile();
+}
+
+void I915RTEImpl::reset_profile()
+{
+	host_profiler.reset();
+}
+
+vector<DispatchTimes> I915EventImpl::get_dispatch_times()
+{
+	if (!submission->is_complete())
+		throw runtime_error("The event has not completed yet");
+
+	/* The timestamp counter has 36 valid bits */
+	const uint64_t mask = (1ULL << 36) - 1;
+
+	vector<DispatchTimes> times;
+
+	for (auto& s : profiled_submissions)
+	{
+		for (unsigned i = 0; i < s->cnt_profiled_dispatches; i++)
+		{
+			uint64_t start = s->query_ptr[2*i] & mask;
+			uint64_t end = s->query_ptr[2*i + 1] & mask;
+
+			DispatchTimes t;
+			t.start = rte.gpu_timestamp_to_ns(start);
+			t.end = t.start + rte.gpu_timestamp_to_ns((end - start) & mask);
+			times.push_back(t);
+		}
+	}
+
+	return times;
 }
 
 
 /************************** Actual OpenCL Runtime class ***********************/
-I915RTEImpl::I915RTEImpl(const char* device)
-	: device_path(device)
+I915RTEImpl::I915RTEImpl(shared_ptr<I915Backend> backend)
+	:
+		backend(backend),
+		bo_pool(*this, 64 * 1024 * 1024),
+		userptr_cache(*this, 64),
+		gem_name_cache(*this),
+		instruction_heap(*this, 4 * 1024 * 1024),
+		waiter(make_shared<I915Waiter>(*this, I915WaitPolicy()))
 {
 	/* Ensure that the page size is 4kib */
 	page_size = OCL::get_page_size();
 	if (page_size != 4096)
 		throw runtime_error("The system's page size is not 4096.");
 
-	/* Try to open DRM device */
-	fd = open(device_path.c_str(), O_RDWR);
-	if (fd < 0)
-		throw system_error(errno, generic_category(), "Failed to open DRM device");
+	/* Query driver version */
+	memset(driver_name, 0, ARRAY_SIZE(driver_name));
+	driver_version = backend->get_drm_version(driver_name, ARRAY_SIZE(driver_name));
 
-	try
-	{
-		/* Query driver version */
-		memset(driver_name, 0, ARRAY_SIZE(driver_name));
-		driver_version = get_drm_version(fd, driver_name, ARRAY_SIZE(driver_name));
+	if (strcmp(driver_name, "i915") != 0)
+		throw runtime_error(string("Unsupported DRM driver:") + driver_name);
 
-		if (strcmp(driver_name, "i915") != 0)
-			throw runtime_error(string("Unsupported DRM driver:") + driver_name);
+	/* Query device info using MESA's functions */
+	if (!backend->get_device_info(dev_info))
+		throw runtime_error("Failed to query drm device info");
 
-		/* Query device info using MESA's functions */
-		if (!intel_get_device_info_from_fd(fd, &dev_info))
-			throw runtime_error("Failed to query drm device info");
+	/* Query chipset id and revision */
+	dev_id = backend->i915_getparam(I915_PARAM_CHIPSET_ID);
+	dev_revision = backend->i915_getparam(I915_PARAM_REVISION);
 
-		/* Query chipset id and revision */
-		dev_id = i915_getparam(fd, I915_PARAM_CHIPSET_ID);
-		dev_revision = i915_getparam(fd, I915_PARAM_REVISION);
+	/* Only support Gen9 for now */
+	if (dev_info.ver != 9)
+		throw runtime_error("Currently only Gen9 devices are supported");
 
-		/* Only support Gen9 for now */
-		if (dev_info.ver != 9)
-			throw runtime_error("Currently only Gen9 devices are supported");
+	/* We only support cpu-cache coherent write-combining mmap topologies by
+	 * now (i.e. newer integrated graphics). */
+	if (!backend->gem_supports_wc_mmap())
+		throw runtime_error("Coherent wc mmap is not supported by GPU");
 
-		/* We only support cpu-cache coherent write-combining mmap topologies by
-		 * now (i.e. newer integrated graphics). */
-		if (!gem_supports_wc_mmap(fd))
-			throw runtime_error("Coherent wc mmap is not supported by GPU");
+	/* Check if we have execbuf2 */
+	if (backend->i915_getparam(I915_PARAM_HAS_EXECBUF2) != 1)
+		throw runtime_error("Device does not support EXECBUF2");
 
-		/* Check if we have execbuf2 */
-		if (i915_getparam(fd, I915_PARAM_HAS_EXECBUF2) != 1)
-			throw runtime_error("Device does not support EXECBUF2");
+	/* Check if other required capabilities are supported */
+	if (backend->i915_getparam(I915_PARAM_HAS_EXEC_NO_RELOC) != 1)
+		throw runtime_error("Devices does not suport EXEC_NO_RELOC");
 
-		/* Check if other required capabilities are supported */
-		if (i915_getparam(fd, I915_PARAM_HAS_EXEC_NO_RELOC) != 1)
-			throw runtime_error("Devices does not suport EXEC_NO_RELOC");
+	try
+	{
+		has_userptr_probe = false;
+		has_userptr_probe = backend->i915_getparam(I915_PARAM_HAS_USERPTR_PROBE) > 0 ? true : false;
+	}
+	catch (system_error& e)
+	{
+		if (e.code().value() != EINVAL)
+			throw;
+	}
 
-		try
-		{
-			has_userptr_probe = false;
-			has_userptr_probe = i915_getparam(fd, I915_PARAM_HAS_USERPTR_PROBE) > 0 ? true : false;
-		}
-		catch (system_error& e)
-		{
-			if (e.code().value() != EINVAL)
-				throw;
-		}
+	/* Create context */
+	vm_id = backend->gem_vm_create();
 
-		/* Create context */
-		vm_id = gem_vm_create(fd);
+	try
+	{
+		ctx_id = backend->gem_context_create();
 
 		try
 		{
-			ctx_id = gem_context_create(fd);
-
-			try
-			{
-				gem_context_set_vm(fd, ctx_id, vm_id);
-			}
-			catch (...)
-			{
-				gem_context_destroy(fd, ctx_id);
-				throw;
-			}
+			backend->gem_context_set_vm(ctx_id, vm_id);
 		}
 		catch (...)
 		{
-			gem_vm_destroy(fd, vm_id);
+			backend->gem_context_destroy(ctx_id);
 			throw;
 		}
 	}
 	catch (...)
 	{
-		close(fd);
+		backend->gem_vm_destroy(vm_id);
 		throw;
 	}
 }
 
 I915RTEImpl::~I915RTEImpl()
 {
-	gem_context_destroy(fd, ctx_id);
-	gem_vm_destroy(fd, vm_id);
-	close(fd);
+	/* The GPU must not access the bos of submissions anymore when they are
+	 * freed. Submissions lost in a GPU reset never complete. */
+	for (auto& submission : in_flight)
+	{
+		try
+		{
+			while (!submission->is_complete())
+			{
+				if (gem_wait(submission->bb_handle, 500 * 1000 * 1000) >= 0 &&
+						!submission->is_complete() &&
+						submission_lost(*submission))
+				{
+					break;
+				}
+			}
+		}
+		catch (...)
+		{
+		}
+	}
+
+	in_flight.clear();
+
+	/* Cached bos must be closed while the device is still open */
+	bo_pool.trim();
+	userptr_cache.clear();
+	gem_name_cache.clear();
+	instruction_heap.release();
+	general_state_bo = nullptr;
+
+	backend->gem_context_destroy(ctx_id);
+	backend->gem_vm_destroy(vm_id);
 }
 
 shared_ptr<Kernel> I915RTEImpl::compile_kernel(
@@ -1510,7 +2777,8 @@ shared_ptr<Kernel> I915RTEImpl::compile_kernel(
 		throw runtime_error("Failed to compile kernel:\n" + build_log);
 
 	/* Read IGC kernel binary */
-	return I915KernelImpl::read_kernel(kernel_bin->get_bin(), kernel_bin->bin_size, name, build_log);
+	return I915KernelImpl::read_kernel(*this, kernel_bin->get_bin(), kernel_bin->bin_size, name, build_log,
+			build_options_allow_non_uniform_groups(options));
 
 #else
 	throw runtime_error("Online compiler for I915 not enabled in this version of llt_gpgpu_rt");
@@ -1527,8 +2795,9 @@ shared_ptr<Kernel> I915RTEImpl::read_compiled_kernel(
 				"the current architecture");
 	}
 
-	return I915KernelImpl::read_kernel(bin->first, bin->second, name,
-			"Kernel has been compiled offline, hence no build log is available");
+	return I915KernelImpl::read_kernel(*this, bin->first, bin->second, name,
+			"Kernel has been compiled offline, hence no build log is available",
+			build_options_allow_non_uniform_groups(program.get_build_options()));
 }
 
 unique_ptr<PreparedKernel> I915RTEImpl::prepare_kernel(std::shared_ptr<Kernel> _kernel)
@@ -1541,6 +2810,11 @@ unique_ptr<PreparedKernel> I915RTEImpl::prepare_kernel(std::shared_ptr<Kernel> _
 	return pkernel;
 }
 
+unique_ptr<I915CommandQueue> I915RTEImpl::create_command_queue()
+{
+	return make_unique<I915CommandQueueImpl>(*this);
+}
+
 size_t I915RTEImpl::get_page_size()
 {
 	return page_size;
@@ -1551,28 +2825,210 @@ size_t I915RTEImpl::align_size_to_page(size_t size)
 	return ((size + page_size - 1) / page_size) * page_size;
 }
 
+shared_ptr<I915UserptrBo> I915RTEImpl::get_general_state_bo(uint32_t scratch_size)
+{
+	if (!general_state_bo || scratch_size > general_state_scratch_size)
+	{
+		/* Each hardware thread of the device has a scratch slot of its own;
+		 * max_cs_threads is per subslice */
+		size_t cnt_threads = (size_t) dev_info.max_cs_threads *
+			max(dev_info.subslice_total, 1U);
+
+		general_state_bo = make_shared<I915UserptrBo>(*this,
+				SCRATCH_OFFSET + (size_t) scratch_size * cnt_threads);
+
+		general_state_scratch_size = scratch_size;
+	}
+
+	return general_state_bo;
+}
+
 uint32_t I915RTEImpl::gem_userptr(void* ptr, size_t size)
 {
-	return OCL::gem_userptr(fd, ptr, size, has_userptr_probe);
+	cnt_userptr_ioctls++;
+	return backend->gem_userptr(ptr, size, has_userptr_probe);
 }
 
 void I915RTEImpl::gem_open(uint32_t name, uint32_t& handle, uint64_t& size)
 {
-	OCL::gem_open(fd, name, handle, size);
+	backend->gem_open(name, handle, size);
+}
+
+void I915RTEImpl::acquire_gem_name(uint32_t name, uint32_t& handle, uint64_t& size)
+{
+	gem_name_cache.acquire(name, handle, size);
+}
+
+void I915RTEImpl::release_gem_name(uint32_t name)
+{
+	gem_name_cache.release(name);
 }
 
 void I915RTEImpl::gem_close(uint32_t handle)
 {
-	OCL::gem_close(fd, handle);
+	cnt_gem_close_ioctls++;
+	backend->gem_close(handle);
+}
+
+int64_t I915RTEImpl::gem_wait(uint32_t handle, int64_t timeout_ns)
+{
+	return backend->gem_wait(handle, timeout_ns);
+}
+
+uint64_t I915RTEImpl::read_gpu_timestamp()
+{
+	/* The render engine's TIMESTAMP register */
+	return backend->reg_read(0x2358 | I915_REG_READ_8B_WA);
+}
+
+chrono::nanoseconds I915RTEImpl::gpu_timestamp_to_ns(uint64_t ticks)
+{
+	/* Uses the CS timestamp frequency reported by the kernel */
+	return chrono::nanoseconds(intel_device_info_timebase_scale(&dev_info, ticks));
+}
+
+void I915RTEImpl::add_in_flight(shared_ptr<I915Submission> submission)
+{
+	retire_submissions();
+	in_flight.push_back(submission);
+}
+
+void I915RTEImpl::retire_submissions()
+{
+	/* Bos of completed submissions are returned to the pool when the last
+	 * event referencing the submission is destroyed */
+	for (auto i = in_flight.begin(); i != in_flight.end();)
+	{
+		auto& s = **i;
+		if (s.is_complete() ||
+				(s.ctx_generation != ctx_generation && gem_wait(s.bb_handle, 0) >= 0))
+		{
+			i = in_flight.erase(i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void I915RTEImpl::recreate_context()
+{
+	uint32_t new_ctx_id = backend->gem_context_create();
+
+	try
+	{
+		backend->gem_context_set_vm(new_ctx_id, vm_id);
+	}
+	catch (...)
+	{
+		backend->gem_context_destroy(new_ctx_id);
+		throw;
+	}
+
+	backend->gem_context_destroy(ctx_id);
+
+	ctx_id = new_ctx_id;
+	ctx_generation++;
+	cnt_gpu_hangs++;
+}
+
+bool I915RTEImpl::submission_lost(const I915Submission& submission)
+{
+	/* The context was replaced after a hang; its batches which are idle but
+	 * did not complete were lost */
+	if (submission.ctx_generation != ctx_generation)
+		return true;
+
+	/* The reset stats of a context count batches that were active (hung)
+	 * or pending during a GPU reset. The kernel bans contexts that hang
+	 * repeatedly, hence replace the context right away. */
+	uint32_t batch_active, batch_pending;
+	backend->gem_get_reset_stats(ctx_id, batch_active, batch_pending);
+
+	if (batch_active == 0 && batch_pending == 0)
+		return false;
+
+	recreate_context();
+	return true;
 }
 
 drm_magic_t I915RTEImpl::get_drm_magic()
 {
-	drm_magic_t magic;
-	if (drmGetMagic(fd, &magic) != 0)
-		throw runtime_error("drmGetMagic failed");
+	return backend->get_drm_magic();
+}
+
+void I915RTEImpl::register_host_memory(void* ptr, size_t size)
+{
+	userptr_cache.register_range(ptr, size);
+}
+
+void I915RTEImpl::unregister_host_memory(void* ptr)
+{
+	userptr_cache.unregister_range(ptr);
+}
+
+I915UserptrCacheStats I915RTEImpl::get_userptr_cache_stats()
+{
+	I915UserptrCacheStats stats;
+	userptr_cache.get_stats(stats);
+	return stats;
+}
+
+vector<I915GEMNameImport> I915RTEImpl::get_gem_name_imports()
+{
+	return gem_name_cache.get_imports();
+}
+
+void I915RTEImpl::evict_gem_name(uint32_t name)
+{
+	gem_name_cache.evict(name);
+}
+
+void I915RTEImpl::evict_unused_gem_names()
+{
+	gem_name_cache.evict_unused();
+}
+
+void I915RTEImpl::set_wait_policy(const I915WaitPolicy& policy)
+{
+	waiter->set_policy(policy);
+}
+
+I915WaitPolicy I915RTEImpl::get_wait_policy()
+{
+	return waiter->get_policy();
+}
+
+I915WaitStats I915RTEImpl::get_wait_stats()
+{
+	return waiter->get_stats();
+}
+
+void I915RTEImpl::set_profiling(bool enable)
+{
+	profiling = enable;
+}
+
+uint64_t I915RTEImpl::get_gpu_hang_count()
+{
+	return cnt_gpu_hangs;
+}
+
+I915BoPoolStats I915RTEImpl::get_bo_pool_stats()
+{
+	I915BoPoolStats stats;
+	bo_pool.get_stats(stats);
 
-	return magic;
+	stats.userptr_ioctls = cnt_userptr_ioctls;
+	stats.gem_close_ioctls = cnt_gem_close_ioctls;
+
+	return stats;
+}
+
+void I915RTEImpl::trim_bo_pool()
+{
+	bo_pool.trim();
 }
 
 }
@@ -5,9 +5,18 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <llt_gpgpu_rt/i915_runtime.h>
 #include "igc_progbin.h"
 #include "i915_kernel_utils.h"
+#include "i915_local_ids.h"
+#include "i915_host_profiler.h"
+#include "i915_backend.h"
+#include "i915_autotuner.h"
+#include "gen9_hw_int.h"
 
 extern "C" {
 #include <xf86drm.h>
@@ -23,6 +32,34 @@ namespace OCL
 /* Prototypes */
 class I915PreparedKernelImpl;
 class I915RTEImpl;
+class I915BoPool;
+class I915InstructionHeap;
+class I915Submission;
+class I915Batch;
+class I915Waiter;
+class I915UserptrBo;
+
+/* A range of the RTE's instruction heap which is freed upon destruction. */
+class I915InstructionHeapRange final
+{
+protected:
+	I915InstructionHeap& heap;
+
+	size_t _offset;
+	size_t _size;
+
+public:
+	I915InstructionHeapRange(I915InstructionHeap& heap, size_t size);
+
+	I915InstructionHeapRange(const I915InstructionHeapRange&) = delete;
+	I915InstructionHeapRange& operator=(const I915InstructionHeapRange&) = delete;
+
+	~I915InstructionHeapRange();
+
+	char* ptr() const;
+	size_t offset() const;
+	size_t size() const;
+};
 
 class I915KernelImpl : public I915Kernel
 {
@@ -32,20 +69,75 @@ protected:
 	const std::string name;
 	const KernelParameters params;
 
-	std::unique_ptr<Heap> kernel_heap;
-	std::unique_ptr<Heap> dynamic_state_heap;
 	std::unique_ptr<Heap> surface_state_heap;
 
 	std::string build_log;
 
+	/* The kernel's code, uploaded to the instruction heap when the kernel is
+	 * loaded */
+	I915InstructionHeapRange code;
+
+	/* Kernel-invariant state, decoded and validated when the kernel is
+	 * loaded. The interface descriptor template lacks only the fields that
+	 * depend on the dispatch (thread count and per-thread data length). */
+	HWInt::Gen9::INTERFACE_DESCRIPTOR_DATA idesc_template;
+
+	uint32_t binding_table_pointer = 0;
+	uint32_t binding_table_entry_count = 0;
+	uint32_t cross_thread_constant_data_read_length = 0;
+	uint32_t slm_size = 0;
+
+	/* Per-thread scratch space; 0 or a power of two >= 1kiB */
+	uint32_t scratch_size = 0;
+
+	/* Whether the kernel was built with OpenCL 2.0 semantics for partial
+	 * work groups; otherwise the compiler may assume that every work group
+	 * has the enqueued local size, and the local size must divide the global
+	 * size */
+	bool supports_non_uniform_groups = false;
+
+	/* Offsets of the RENDER_SURFACE_STATEs referenced by the binding table
+	 * entries */
+	std::vector<uint32_t> surface_state_pointers;
+
+	KernelBindingPlan binding_plan;
+
+	/* Copy of the program-scope constant surface, if the kernel uses it */
+	std::shared_ptr<I915UserptrBo> constant_surface_bo;
+	size_t constant_surface_size = 0;
+
+	/* Per-thread data of the walkers by work group shape, shared by the
+	 * kernel's prepared kernels. The SIMD size and thread payload are fixed
+	 * per kernel, hence the local size determines the shape. The least
+	 * recently used shape is evicted when the cache is full. */
+	struct PerThreadData
+	{
+		std::vector<char> data;
+		uint64_t last_use = 0;
+	};
+
+	std::mutex per_thread_data_mutex;
+	std::map<std::array<uint32_t, 3>, PerThreadData> per_thread_data_cache;
+	uint64_t per_thread_data_use_counter = 0;
+	static constexpr size_t PER_THREAD_DATA_CACHE_SIZE = 32;
+
+	void decode_state(const Heap& dynamic_state_heap);
+
+	/* Write the per-thread data of a walker with the given shape to @param
+	 * dst, which holds shape.cnt_threads * shape.per_thread_size bytes */
+	void write_per_thread_data(const I915LocalIdShape& shape, char* dst);
+
 public:
 	I915KernelImpl(
+			I915RTEImpl& rte,
 			const std::string& name,
 			const KernelParameters& params,
+			const ProgramParameters& program_params,
 			std::unique_ptr<Heap>&& kernel_heap,
 			std::unique_ptr<Heap>&& dynamic_state_heap,
 			std::unique_ptr<Heap>&& surface_state_heap,
-			const std::string& build_log);
+			const std::string& build_log,
+			bool non_uniform_groups);
 
 	I915KernelImpl(const I915KernelImpl&) = delete;
 	I915KernelImpl& operator=(const I915KernelImpl&) = delete;
@@ -55,10 +147,60 @@ public:
 	std::string get_build_log() override;
 
 	static std::shared_ptr<I915KernelImpl> read_kernel(
+			I915RTEImpl& rte,
 			const char* bin, size_t size, const std::string& name,
-			const std::string& build_log);
+			const std::string& build_log, bool non_uniform_groups);
+};
+
+
+/* A GPGPU_WALKER over the work groups group_start ... group_end - 1, which
+ * have the same size */
+struct I915WalkerLayout
+{
+	uint32_t local_size[3] = {};
+	uint32_t group_start[3] = {};
+	uint32_t group_end[3] = {};
+
+	uint32_t cnt_threads = 0;
+	uint32_t right_execution_mask = 0;
+	uint32_t indirect_data_length = 0;
 };
 
+/* Layout of a dispatch's state, determined before the state is recorded s.t.
+ * the batch can be flushed first if the state does not fit into it anymore */
+struct I915DispatchLayout
+{
+	int simd_size = 0;
+
+	size_t cross_thread_size_bytes = 0;
+	size_t per_thread_size_bytes = 0;
+	uint32_t constant_urb_read_length = 0;
+
+	/* Full work groups and, for non-uniform NDRanges, the partial groups at
+	 * the end of each dimension */
+	I915WalkerLayout walkers[8];
+	unsigned cnt_walkers = 0;
+
+	/* Sum of the walkers' indirect data, each aligned to the state alignment */
+	size_t indirect_data_size = 0;
+
+	/* Per-thread scratch space of the kernel */
+	uint32_t scratch_size = 0;
+
+	/* Copies of the __constant arguments, each aligned to the state alignment; part
+	 * of indirect_data_size */
+	size_t dispatch_constant_size = 0;
+
+	/* SLM of the kernel and its __local arguments, rounded to the allocation
+	 * size */
+	uint32_t slm_size = 0;
+
+	/* Set by I915PreparedKernel::set_l3_config */
+	bool has_l3_override = false;
+	I915L3Config l3_override;
+
+	size_t surface_state_size = 0;
+};
 
 class I915PreparedKernelImpl : public I915PreparedKernel
 {
@@ -66,7 +208,43 @@ protected:
 	I915RTEImpl& rte;
 	std::shared_ptr<I915KernelImpl> kernel;
 
+	/* Indexed by argument number; unbound arguments are nullptr */
 	std::vector<std::unique_ptr<KernelArg>> args;
+	unsigned next_argument = 0;
+
+	/* Surface state heap and cross-thread data with the arguments applied.
+	 * They are patched for changed arguments only, and copied into the batch
+	 * for each dispatch. */
+	std::vector<bool> dirty_args;
+	bool images_valid = false;
+	uint32_t image_global_offset[3] = {};
+	uint32_t image_local_size[3] = {};
+
+	/* Local size chosen for the last global size that was passed without
+	 * one */
+	uint32_t auto_global_size[3] = {};
+	uint32_t auto_local_size[3] = {};
+	uint64_t auto_tuning_generation = 0;
+
+	std::vector<char> surface_state_image;
+	std::vector<char> cross_thread_image;
+	std::vector<std::tuple<uint32_t, uint64_t>> cross_thread_relocs;
+
+	/* Argument number and address of the __constant copies of the dispatch
+	 * that is being recorded */
+	std::vector<std::tuple<unsigned, uint64_t>> dispatch_constant_addresses;
+
+	bool has_l3_override = false;
+	I915L3Config l3_override;
+
+	I915KernelPhaseStats* profile;
+
+	const KernelArgPlan& argument_plan(unsigned index) const;
+	void bind_argument(unsigned index, std::unique_ptr<KernelArg>&& arg);
+
+	void bind_surface_state(unsigned index);
+	void bind_constant_surface();
+	void update_images(NDRange global_offset, NDRange local_size);
 
 public:
 	I915PreparedKernelImpl(I915RTEImpl& rte, std::shared_ptr<I915KernelImpl> kernel);
@@ -80,15 +258,76 @@ public:
 	void add_argument(int32_t) override;
 	void add_argument(uint64_t) override;
 	void add_argument(int64_t) override;
+	void add_argument(float) override;
+	void add_argument(double) override;
 
 	/* @param size is in bytes */
 	void add_argument(void*, size_t) override;
+	void add_argument(void*, size_t, CacheHint hint) override;
 	void add_argument_gem_name(uint32_t name) override;
-
-	template<typename T, const char* C>
-	void add_argument_int(T);
+	void add_argument_gem_name(uint32_t name, CacheHint hint) override;
+	void add_argument_value(const void*, size_t) override;
+	void add_argument_constant(const void*, size_t) override;
+	void add_argument_local(size_t) override;
+
+	void set_argument(unsigned index, uint32_t) override;
+	void set_argument(unsigned index, int32_t) override;
+	void set_argument(unsigned index, uint64_t) override;
+	void set_argument(unsigned index, int64_t) override;
+	void set_argument(unsigned index, float) override;
+	void set_argument(unsigned index, double) override;
+
+	void set_argument(unsigned index, void*, size_t) override;
+	void set_argument(unsigned index, void*, size_t, CacheHint hint) override;
+	void set_argument_gem_name(unsigned index, uint32_t name) override;
+	void set_argument_gem_name(unsigned index, uint32_t name, CacheHint hint) override;
+	void set_argument_value(unsigned index, const void*, size_t) override;
+	void set_argument_constant(unsigned index, const void*, size_t) override;
+	void set_argument_local(unsigned index, size_t) override;
+
+	void set_l3_config(const I915L3Config& config) override;
+	void reset_l3_config() override;
+
+	void bind_value(unsigned index, const void* ptr, size_t size);
+
+	template<typename T, KernelArgKind K, const char* C>
+	void set_argument_scalar(unsigned index, T);
 
 	void execute(NDRange global_size, NDRange local_size) override;
+	std::shared_ptr<Event> execute_async(NDRange global_size, NDRange local_size) override;
+
+	void execute(NDRange global_offset,
+			NDRange global_size, NDRange local_size) override;
+
+	std::shared_ptr<Event> execute_async(NDRange global_offset,
+			NDRange global_size, NDRange local_size) override;
+
+	void execute(NDRange global_size) override;
+	std::shared_ptr<Event> execute_async(NDRange global_size) override;
+
+	/* Records GPU timestamps if @param profiling regardless of the RTE's
+	 * setting */
+	std::shared_ptr<Event> submit(NDRange global_offset,
+			NDRange global_size, NDRange local_size, bool profiling);
+
+	/* Local size for dispatches without one */
+	NDRange choose_local_size(NDRange global_size);
+
+	/* SIMD size that plan_dispatch chooses and the largest number of threads
+	 * per work group */
+	void get_group_limits(uint32_t& simd_size, uint32_t& max_threads) const;
+
+	I915TuningKey get_tuning_key(NDRange global_size) const;
+	std::vector<std::array<uint32_t, 3>> get_tuning_candidates(NDRange global_size) const;
+
+	/* Validate the dispatch and compute the size of its state */
+	I915DispatchLayout plan_dispatch(NDRange global_offset,
+			NDRange global_size, NDRange local_size) const;
+
+	/* Write the dispatch's state and commands into @param batch, which must
+	 * have room for it (see I915Batch::fits) */
+	void record_dispatch(I915Batch& batch, const I915DispatchLayout& layout,
+			NDRange global_offset, NDRange local_size);
 };
 
 /* NOTE: Keep care that the RTE is not destructed while objects of this class
@@ -122,21 +361,480 @@ public:
 	uint32_t handle() const;
 };
 
+/* A bo handed out by the RTE's bo pool. It is returned to the pool when
+ * destructed. */
+class I915PooledBo final
+{
+protected:
+	I915BoPool* pool;
+	std::unique_ptr<I915UserptrBo> bo;
+
+public:
+	I915PooledBo(I915BoPool& pool, std::unique_ptr<I915UserptrBo>&& bo);
+
+	I915PooledBo(I915PooledBo&& o);
+	I915PooledBo& operator=(I915PooledBo&& o);
+
+	I915PooledBo(const I915PooledBo&) = delete;
+	I915PooledBo& operator=(const I915PooledBo&) = delete;
+
+	~I915PooledBo();
+
+	void* ptr() const;
+	size_t size() const;
+	uint32_t handle() const;
+};
+
+/* Caches userptr bos s.t. they need not be allocated and registered with the
+ * kernel for each submission. Bos are sorted into size classes of
+ * power-of-two pages. Bos must only be returned when the GPU is done with
+ * them. */
+class I915BoPool final
+{
+protected:
+	I915RTEImpl& rte;
+
+	/* Free bos per size class */
+	std::vector<std::vector<std::unique_ptr<I915UserptrBo>>> free_bos;
+
+	/* Upper limit for the memory held by cached bos; excess bos are released
+	 * when returned. */
+	const size_t max_cached_bytes;
+	size_t cached_bytes = 0;
+	size_t cached_bos = 0;
+
+	uint64_t cnt_allocated = 0;
+	uint64_t cnt_reused = 0;
+
+	unsigned size_class(size_t size) const;
+
+public:
+	I915BoPool(I915RTEImpl& rte, size_t max_cached_bytes);
+
+	I915BoPool(const I915BoPool&) = delete;
+	I915BoPool& operator=(const I915BoPool&) = delete;
+
+	~I915BoPool();
+
+	/* The returned bo's size will be >= @param req_size */
+	I915PooledBo get(size_t req_size);
+	void put(std::unique_ptr<I915UserptrBo>&& bo);
+
+	void trim();
+
+	void get_stats(I915BoPoolStats& stats) const;
+};
+
+/* Registered host memory ranges, which are used as buffer arguments. A
+ * buffer argument that lies within a cached range reuses its bo. Ranges do
+ * not overlap, as bos are pinned at their host address. Explicitly
+ * registered ranges stay until they are unregistered; other ones are dropped
+ * in LRU order. Submissions keep references to the bos they use. */
+class I915UserptrCache final
+{
+protected:
+	I915RTEImpl& rte;
+
+	struct Entry
+	{
+		std::shared_ptr<I915UserptrBo> bo;
+		bool explicit_registration = false;
+		uint64_t last_use = 0;
+	};
+
+	/* Start address -> entry */
+	std::map<uintptr_t, Entry> entries;
+
+	const size_t max_implicit_entries;
+	size_t cnt_implicit = 0;
+	uint64_t use_counter = 0;
+
+	uint64_t cnt_hits = 0;
+	uint64_t cnt_misses = 0;
+	uint64_t cnt_evictions = 0;
+
+	/* Drop implicit entries overlapping the given range; throws if an
+	 * explicitly registered range overlaps it */
+	void drop_overlapping(uintptr_t start, uintptr_t end);
+	void drop_lru();
+
+public:
+	I915UserptrCache(I915RTEImpl& rte, size_t max_implicit_entries);
+
+	I915UserptrCache(const I915UserptrCache&) = delete;
+	I915UserptrCache& operator=(const I915UserptrCache&) = delete;
+
+	~I915UserptrCache();
+
+	/* @returns a bo that covers the given range; either a registered range
+	 * that contains it or an implicit entry for exactly this range */
+	std::shared_ptr<I915UserptrBo> get(void* ptr, size_t size);
+
+	void register_range(void* ptr, size_t size);
+	void unregister_range(void* ptr);
+
+	/* Drop all entries, including explicitly registered ones */
+	void clear();
+
+	void get_stats(I915UserptrCacheStats& stats) const;
+};
+
+/* GEM objects imported by flink name. Imports are refcounted by the kernel
+ * arguments referring to them, and stay open when they are not referenced
+ * anymore until they are evicted. Importing the same name twice would
+ * otherwise yield two handles for one object. */
+class I915GEMNameCache final
+{
+protected:
+	I915RTEImpl& rte;
+
+	/* Name -> import */
+	std::map<uint32_t, I915GEMNameImport> imports;
+
+public:
+	I915GEMNameCache(I915RTEImpl& rte);
+
+	I915GEMNameCache(const I915GEMNameCache&) = delete;
+	I915GEMNameCache& operator=(const I915GEMNameCache&) = delete;
+
+	~I915GEMNameCache();
+
+	/* Increments the import's refcount */
+	void acquire(uint32_t name, uint32_t& handle, uint64_t& size);
+	void release(uint32_t name);
+
+	void evict(uint32_t name);
+	void evict_unused();
+
+	/* Close all imports, including referenced ones */
+	void clear();
+
+	std::vector<I915GEMNameImport> get_imports() const;
+};
+
+/* Memory for kernel code, which stays resident as long as the kernels exist.
+ * All kernels share one bo s.t. one instruction base address covers all of
+ * them. The bo is allocated when the first kernel is loaded. */
+class I915InstructionHeap final
+{
+protected:
+	I915RTEImpl& rte;
+	const size_t _size;
+
+	std::unique_ptr<I915UserptrBo> bo;
+
+	/* Free ranges; offset -> size */
+	std::map<size_t, size_t> free_ranges;
+
+public:
+	/* Kernel start pointers are specified in units of 64 bytes */
+	static constexpr size_t ALIGNMENT = 64;
+
+	I915InstructionHeap(I915RTEImpl& rte, size_t size);
+
+	I915InstructionHeap(const I915InstructionHeap&) = delete;
+	I915InstructionHeap& operator=(const I915InstructionHeap&) = delete;
+
+	~I915InstructionHeap();
+
+	/* @returns the offset of the allocated range */
+	size_t alloc(size_t size);
+	void free(size_t offset, size_t size);
+
+	/* Release the bo; no ranges must be allocated anymore */
+	void release();
+
+	bool allocated() const;
+	char* ptr() const;
+	size_t size() const;
+	uint32_t handle() const;
+};
+
+/* Resources of a submitted batch buffer, which must stay alive until the GPU
+ * finished the batch */
+class I915Submission final
+{
+public:
+	std::vector<I915PooledBo> bos;
+	std::vector<std::shared_ptr<I915UserptrBo>> arg_userptr_bos;
+	std::shared_ptr<I915UserptrBo> general_state_bo;
+
+	/* Kernels whose code the batch executes; their ranges of the instruction
+	 * heap must not be reused before */
+	std::vector<std::shared_ptr<I915KernelImpl>> kernels;
+
+	/* The GPU writes 1 to this location when it finished the batch */
+	volatile uint64_t* sync_ptr = nullptr;
+
+	/* The GPU's timestamp when it finished the batch */
+	volatile uint64_t* timestamp_ptr = nullptr;
+	uint32_t bb_handle = 0;
+
+	/* Generation of the RTE's GPU context that executes the batch */
+	uint64_t ctx_generation = 0;
+
+	/* Start and end timestamps of profiled dispatches */
+	volatile uint64_t* query_ptr = nullptr;
+	unsigned cnt_profiled_dispatches = 0;
+
+	I915Submission();
+
+	I915Submission(const I915Submission&) = delete;
+	I915Submission& operator=(const I915Submission&) = delete;
+
+	~I915Submission();
+
+	bool is_complete() const;
+};
+
+/* State and commands of one or more dispatches, which are submitted to the
+ * GPU in one batch buffer with a common prologue. The dispatches share one
+ * surface state, dynamic state and indirect object heap each; dispatches are
+ * placed at increasing offsets in them. */
+class I915Batch final
+{
+protected:
+	I915RTEImpl& rte;
+
+	/* Dispatch commands, which go to the second level batch buffer */
+	std::vector<std::unique_ptr<I915RingCmd>> cmds;
+	unsigned cnt_dispatches = 0;
+	bool barrier_pending = false;
+
+	/* Largest requirements of all dispatches */
+	uint32_t slm_size = 0;
+	uint32_t scratch_size = 0;
+
+	/* L3 partitioning of the dispatches, if they set one */
+	bool has_l3_override = false;
+	I915L3Config l3_override;
+
+	/* Receives the timestamps of dispatches if profiling is enabled */
+	const bool profiling;
+	std::unique_ptr<I915PooledBo> query_bo;
+
+	/* Bos of GEM name arguments */
+	std::vector<uint32_t> reloc_handles;
+
+	std::vector<struct drm_i915_gem_relocation_entry> surface_state_relocs;
+	std::vector<struct drm_i915_gem_relocation_entry> indirect_object_relocs;
+
+	size_t surface_state_used = 0;
+	size_t dynamic_state_used = 0;
+	size_t indirect_object_used = 0;
+
+	static size_t alloc_state(size_t& used, size_t capacity, size_t size);
+
+public:
+	/* Binding table pointers are limited to 64KiB */
+	static constexpr size_t SURFACE_STATE_SIZE = 64 * 1024;
+	static constexpr size_t DYNAMIC_STATE_SIZE = 4096;
+	static constexpr size_t INDIRECT_OBJECT_SIZE = 256 * 1024;
+
+	/* State placed in the heaps is aligned to 64 bytes, which satisfies the
+	 * binding table, interface descriptor and indirect data alignments */
+	static constexpr size_t STATE_ALIGNMENT = 64;
+
+	/* A start- and end timestamp per profiled dispatch */
+	static constexpr size_t QUERY_SIZE = 4096;
+
+	/* A single VFE URB entry of 1922 256-bit lines, like
+	 * intel-compute-runtime */
+	static constexpr int URB_ALLOCATION_SIZE = 1922;
+	static constexpr int URB_ENTRIES = 1;
+
+	/* URB lines reserved for interface descriptors */
+	static constexpr int URB_IDESC_LINES = 64;
+
+	/* @returns whether @param config is a validated Gen9 configuration */
+	static bool is_valid_l3_config(const I915L3Config& config);
+
+	/* The configuration with the largest cache partition that provides SLM
+	 * if required and the URB of the VFE state */
+	static I915L3Config choose_l3_config(const struct intel_device_info& dev_info,
+			bool slm);
+
+	std::shared_ptr<I915Submission> submission;
+
+	/* Receives the timings of building and submitting the batch */
+	I915KernelPhaseStats* profile = nullptr;
+
+	I915PooledBo surface_state_bo;
+	I915PooledBo dynamic_state_bo;
+	I915PooledBo indirect_object_bo;
+
+	I915Batch(I915RTEImpl& rte, bool profiling = false);
+
+	I915Batch(const I915Batch&) = delete;
+	I915Batch& operator=(const I915Batch&) = delete;
+
+	~I915Batch();
+
+	bool empty() const;
+	bool fits(const I915DispatchLayout& layout) const;
+
+	/* @returns the offset of the allocated state in the respective heap */
+	size_t alloc_surface_state(size_t size);
+	size_t alloc_dynamic_state(size_t size);
+	size_t alloc_indirect_object(size_t size);
+
+	/* Make a host buffer accessible at its host address */
+	void add_userptr_argument(void* ptr, size_t size);
+
+	/* Make a bo that the runtime allocated accessible */
+	void add_userptr_bo(const std::shared_ptr<I915UserptrBo>& bo);
+
+	/* Keep the code of @param kernel alive until the batch completed */
+	void add_kernel(const std::shared_ptr<I915KernelImpl>& kernel);
+
+	/* Relocate the given locations to the address of bo @param handle */
+	void add_surface_state_reloc(uint32_t handle, uint64_t offset);
+	void add_indirect_object_reloc(uint32_t handle, uint64_t offset);
+
+	void add_dispatch(std::vector<std::unique_ptr<I915RingCmd>>&& dispatch_cmds,
+			uint32_t slm_size, const I915DispatchLayout& layout);
+
+	/* Wait for all previous dispatches before starting the next one */
+	void barrier();
+
+	/* Stalls the command streamer until all previous commands completed and
+	 * writes the GPU's timestamp to @param address */
+	static std::unique_ptr<I915RingCmd> build_timestamp_write(void* address);
+
+	/* Build the batch buffers and submit them. The batch must not be used
+	 * afterwards. */
+	std::shared_ptr<I915Submission> submit();
+};
+
+class I915CommandQueueImpl final : public I915CommandQueue
+{
+protected:
+	I915RTEImpl& rte;
+
+	std::unique_ptr<I915Batch> batch;
+	std::shared_ptr<I915Submission> last_submission;
+
+	bool profiling;
+	I915KernelPhaseStats* profile;
+
+	/* Profiled submissions since the last flush */
+	std::vector<std::shared_ptr<I915Submission>> profiled_submissions;
+
+	std::shared_ptr<I915Waiter> waiter;
+
+	void submit_batch();
+
+public:
+	I915CommandQueueImpl(I915RTEImpl& rte);
+
+	I915CommandQueueImpl(const I915CommandQueueImpl&) = delete;
+	I915CommandQueueImpl& operator=(const I915CommandQueueImpl&) = delete;
+
+	~I915CommandQueueImpl();
+
+	void enqueue(PreparedKernel& kernel,
+			NDRange global_size, NDRange local_size) override;
+
+	void enqueue(PreparedKernel& kernel, NDRange global_offset,
+			NDRange global_size, NDRange local_size) override;
+
+	void enqueue(PreparedKernel& kernel, NDRange global_size) override;
+
+	void barrier() override;
+	std::shared_ptr<Event> flush() override;
+	void finish() override;
+
+	void set_wait_policy(const I915WaitPolicy& policy) override;
+	I915WaitStats get_wait_stats() override;
+
+	void set_profiling(bool enable) override;
+};
+
+/* Waits for submissions according to a wait policy and collects statistics.
+ * Shared by the RTE or a command queue and the events created by it. */
+class I915Waiter final
+{
+protected:
+	I915RTEImpl& rte;
+
+	I915WaitPolicy policy;
+	I915WaitStats stats;
+
+	void record_latency(const I915Submission& submission);
+
+	/* @throws GpuHangError if the submission's batch is idle but the
+	 * submission did not complete */
+	void check_lost(const I915Submission& submission);
+
+public:
+	I915Waiter(I915RTEImpl& rte, const I915WaitPolicy& policy);
+
+	I915Waiter(const I915Waiter&) = delete;
+	I915Waiter& operator=(const I915Waiter&) = delete;
+
+	~I915Waiter();
+
+	/* @returns false if the deadline passed before the submission
+	 * completed */
+	bool wait_until(const I915Submission& submission,
+			std::chrono::steady_clock::time_point deadline);
+
+	void set_policy(const I915WaitPolicy& policy);
+	I915WaitPolicy get_policy() const;
+	I915WaitStats get_stats() const;
+};
+
+class I915EventImpl final : public Event
+{
+protected:
+	I915RTEImpl& rte;
+	std::shared_ptr<I915Waiter> waiter;
+	std::shared_ptr<I915Submission> submission;
+
+	/* Submissions whose dispatch times are reported by the event; they
+	 * complete before @var submission */
+	std::vector<std::shared_ptr<I915Submission>> profiled_submissions;
+
+public:
+	I915EventImpl(I915RTEImpl& rte, std::shared_ptr<I915Waiter> waiter,
+			std::shared_ptr<I915Submission> submission,
+			std::vector<std::shared_ptr<I915Submission>> profiled_submissions = {});
+
+	I915EventImpl(const I915EventImpl&) = delete;
+	I915EventImpl& operator=(const I915EventImpl&) = delete;
+
+	~I915EventImpl();
+
+	void wait() override;
+	bool is_complete() override;
+	bool wait_for(std::chrono::nanoseconds timeout) override;
+
+	std::vector<DispatchTimes> get_dispatch_times() override;
+};
+
 class I915RTEImpl final : public I915RTE
 {
+	friend I915KernelImpl;
+	friend I915Waiter;
 	friend I915PreparedKernelImpl;
+	friend I915Batch;
+	friend I915CommandQueueImpl;
+	friend I915EventImpl;
 
 protected:
-	const std::string device_path;
 	long page_size = 0;
 
 	char driver_name[32];
 	drm_version_t driver_version;
 
-	int fd = -1;
+	std::shared_ptr<I915Backend> backend;
 	uint32_t ctx_id = 0;
 	uint32_t vm_id = 0;
 
+	/* Incremented when the context is recreated after a GPU hang */
+	uint64_t ctx_generation = 0;
+	uint64_t cnt_gpu_hangs = 0;
+
 	/* Information about the device */
 	struct intel_device_info dev_info{};
 
@@ -145,8 +843,62 @@ protected:
 
 	bool has_userptr_probe = false;
 
+	/* Ioctl counters */
+	uint64_t cnt_userptr_ioctls = 0;
+	uint64_t cnt_gem_close_ioctls = 0;
+
+	I915BoPool bo_pool;
+	I915UserptrCache userptr_cache;
+	I915GEMNameCache gem_name_cache;
+	I915InstructionHeap instruction_heap;
+
+	/* General state heap, which holds the scratch space behind its first
+	 * page. It is replaced by a larger one when a batch needs more scratch
+	 * space per thread; submissions keep the bo they use. */
+	std::shared_ptr<I915UserptrBo> general_state_bo;
+	uint32_t general_state_scratch_size = 0;
+
+	/* MEDIA_VFE_STATE disables scratch space if its pointer is 0 */
+	static constexpr size_t SCRATCH_OFFSET = 4096;
+
+	/* Used by execute() and execute_async() */
+	std::shared_ptr<I915Waiter> waiter;
+	bool profiling = false;
+
+	I915HostProfiler host_profiler;
+
+	FILE* batch_dump = nullptr;
+
+	/* L3CNTLREG value last submitted to the GPU context; batches program it
+	 * only if it differs */
+	bool l3cntlreg_valid = false;
+	uint32_t l3cntlreg = 0;
+	uint64_t l3cntlreg_ctx_generation = 0;
+
+	std::unique_ptr<I915TuningDatabase> tuning_db;
+	std::shared_ptr<I915TuningTimer> tuning_timer;
+
+	/* Invalidates the local sizes chosen by prepared kernels */
+	uint64_t tuning_generation = 1;
+
+	/* Measurements per candidate local size */
+	static constexpr unsigned TUNING_SAMPLES = 5;
+
+	/* Submissions that may still be executed by the GPU */
+	std::list<std::shared_ptr<I915Submission>> in_flight;
+
+	void add_in_flight(std::shared_ptr<I915Submission> submission);
+	void retire_submissions();
+
+	/* Replace the GPU context, e.g. after it was banned */
+	void recreate_context();
+
+	/* To be called if a submission's batch is idle but the submission did
+	 * not complete. @returns true if the batch was lost in a GPU reset. */
+	bool submission_lost(const I915Submission& submission);
+
 public:
-	I915RTEImpl(const char* device);
+	I915RTEImpl(std::shared_ptr<I915Backend> backend);
 
 	I915RTEImpl(const I915RTEImpl&) = delete;
 	I915RTEImpl& operator=(const I915RTEImpl&) = delete;
@@ -160,15 +912,59 @@ public:
 			const I915CompiledProgram& program, const char* name) override;
 
 	std::unique_ptr<PreparedKernel> prepare_kernel(std::shared_ptr<Kernel> kernel) override;
+	std::unique_ptr<I915CommandQueue> create_command_queue() override;
 
 	size_t get_page_size() override;
 	size_t align_size_to_page(size_t size);
 
+	/* @param scratch_size per thread */
+	std::shared_ptr<I915UserptrBo> get_general_state_bo(uint32_t scratch_size);
+
 	uint32_t gem_userptr(void* ptr, size_t size);
 	void gem_open(uint32_t name, uint32_t& handle, uint64_t& size);
+
+	/* Imports through the GEM name cache */
+	void acquire_gem_name(uint32_t name, uint32_t& handle, uint64_t& size);
+	void release_gem_name(uint32_t name);
 	void gem_close(uint32_t handle);
 
+	/* @returns the remaining time or -1 if the timeout expired */
+	int64_t gem_wait(uint32_t handle, int64_t timeout_ns);
+
+	uint64_t read_gpu_timestamp();
+
+	/* Convert a difference of GPU timestamps to nanoseconds */
+	std::chrono::nanoseconds gpu_timestamp_to_ns(uint64_t ticks);
+
 	virtual drm_magic_t get_drm_magic() override;
+
+	void register_host_memory(void* ptr, size_t size) override;
+	void unregister_host_memory(void* ptr) override;
+	I915UserptrCacheStats get_userptr_cache_stats() override;
+
+	void set_wait_policy(const I915WaitPolicy& policy) override;
+	I915WaitPolicy get_wait_policy() override;
+	I915WaitStats get_wait_stats() override;
+
+	void set_profiling(bool enable) override;
+
+	void set_batch_dump(FILE* f) override;
+
+	void set_tuning_database(const char* path) override;
+	void set_tuning_timer(std::shared_ptr<I915TuningTimer> timer) override;
+	NDRange tune(PreparedKernel& kernel, NDRange global_size) override;
+
+	std::vector<I915KernelProfile> get_profile() override;
+	void reset_profile() override;
+
+	uint64_t get_gpu_hang_count() override;
+
+	std::vector<I915GEMNameImport> get_gem_name_imports() override;
+	void evict_gem_name(uint32_t name) override;
+	void evict_unused_gem_names() override;
+
+	I915BoPoolStats get_bo_pool_stats() override;
+	void trim_bo_pool() override;
 };
 
 }
@@ -241,7 +241,7 @@ void gem_execbuffer2(int fd, uint32_t ctx_id,
 				obj->relocation_count = relocs.size();
 				obj->relocs_ptr = (uintptr_t) relocs.data();
 			}
-			else
+			else if (obj->offset != 0)
 			{
 				obj->flags |= EXEC_OBJECT_PINNED;
 			}
@@ -278,10 +278,39 @@ int64_t gem_wait(int fd, uint32_t bo, int64_t timeout_ns)
 	cmd.timeout_ns = timeout_ns;
 
 	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_WAIT, &cmd))
+	{
+		if (errno == ETIME)
+			return -1;
+
 		throw system_error(errno, generic_category(), "DRM_IOCTL_I915_GEM_WAIT failed");
+	}
 
 	/* Remaining time */
 	return cmd.timeout_ns;
 }
 
+void gem_get_reset_stats(int fd, uint32_t ctx_id,
+		uint32_t& batch_active, uint32_t& batch_pending)
+{
+	struct drm_i915_reset_stats cmd = { 0 };
+	cmd.ctx_id = ctx_id;
+
+	if (drmIoctl(fd, DRM_IOCTL_I915_GET_RESET_STATS, &cmd))
+		throw system_error(errno, generic_category(), "DRM_IOCTL_I915_GET_RESET_STATS failed");
+
+	batch_active = cmd.batch_active;
+	batch_pending = cmd.batch_pending;
+}
+
+uint64_t reg_read(int fd, uint64_t offset)
+{
+	struct drm_i915_reg_read cmd = { 0 };
+	cmd.offset = offset;
+
+	if (drmIoctl(fd, DRM_IOCTL_I915_REG_READ, &cmd))
+		throw system_error(errno, generic_category(), "DRM_IOCTL_I915_REG_READ failed");
+
+	return cmd.val;
+}
+
 }
@@ -34,8 +34,15 @@ void gem_execbuffer2(int fd, uint32_t ctx_id,
 		std::vector<std::tuple<uint32_t, void*, std::vector<struct drm_i915_gem_relocation_entry>>>& bos,
 		size_t batch_len);
 
+/* @returns the remaining time or -1 if the timeout expired */
 int64_t gem_wait(int fd, uint32_t bo, int64_t timeout_ns);
 
+void gem_get_reset_stats(int fd, uint32_t ctx_id,
+		uint32_t& batch_active, uint32_t& batch_pending);
+
+/* @param offset may include I915_REG_READ_8B_WA */
+uint64_t reg_read(int fd, uint64_t offset);
+
 }
 
 #endif /* __I915_UTILS_H */
@@ -198,6 +198,64 @@ iOpenCL::SKernelBinaryHeaderGen9 read_kernel_binary_header_gen9(
 }
 
 
+void read_program_patchlist(
+		const char*& bin, size_t& size,
+		const iOpenCL::SProgramBinaryHeader& hdr,
+		ProgramParameters& params)
+{
+	if (size < hdr.PatchListSize)
+		throw invalid_argument("Program patch list too small");
+
+	auto patch_list_size = hdr.PatchListSize;
+	while (patch_list_size > 0)
+	{
+		if (patch_list_size < 8)
+			throw invalid_argument("Not enough remaining data for patch item header");
+
+		auto token = read_binary<uint32_t>(bin);
+		auto item_size = read_binary<uint32_t>(bin);
+
+		if (item_size < 8 || patch_list_size < item_size)
+			throw invalid_argument("Not enough remaining data for patch item");
+
+		switch (token)
+		{
+		case iOpenCL::PATCH_TOKEN_ALLOCATE_CONSTANT_MEMORY_SURFACE_PROGRAM_BINARY_INFO:
+			{
+				static_assert(sizeof(iOpenCL::SPatchAllocateConstantMemorySurfaceProgramBinaryInfo) == 8 + 2*4);
+				if (item_size != 8 + 2*4)
+					throw invalid_argument("Failed to read patch item AllocateConstantMemorySurfaceProgramBinaryInfo");
+
+				ProgramParameters::AllocateConstantMemorySurface s;
+				s.constant_buffer_index = read_binary<uint32_t>(bin);
+				uint32_t inline_data_size = read_binary<uint32_t>(bin);
+
+				/* Like intel-compute-runtime, the data follows the item
+				 * and is not included in its size */
+				if (patch_list_size - item_size < inline_data_size)
+					throw invalid_argument("Not enough remaining data for constant surface");
+
+				s.inline_data.assign(bin, bin + inline_data_size);
+				bin += inline_data_size;
+				patch_list_size -= inline_data_size;
+
+				params.allocate_constant_memory_surfaces.push_back(move(s));
+			}
+			break;
+
+		default:
+			throw invalid_argument("Unsupported program patch item with token \"" +
+					std::to_string(token) + "\" and of size " +
+					std::to_string(item_size) + ".");
+		}
+
+		patch_list_size -= item_size;
+	}
+
+	size -= hdr.PatchListSize;
+}
+
+
 KernelParameters build_kernel_params(
 		const iOpenCL::SProgramBinaryHeader& hdr,
 		const iOpenCL::SKernelBinaryHeader& kernel_hdr)
@@ -239,6 +297,22 @@ void read_kernel_patchlist(
 
 		switch (token)
 		{
+		case iOpenCL::PATCH_TOKEN_MEDIA_VFE_STATE:
+		case iOpenCL::PATCH_TOKEN_MEDIA_VFE_STATE_SLOT1:
+			{
+				auto& vfe = token == iOpenCL::PATCH_TOKEN_MEDIA_VFE_STATE ?
+					params.media_vfe_state : params.media_vfe_state_slot1;
+
+				static_assert(sizeof(iOpenCL::SPatchMediaVFEState) == 8 + 2*4);
+				if (item_size != 8 + 2*4 || vfe)
+					throw invalid_argument("Failed to read patch item MediaVFEState");
+
+				vfe.emplace();
+				vfe->scratch_space_offset = read_binary<uint32_t>(bin);
+				vfe->per_thread_scratch_space = read_binary<uint32_t>(bin);
+			}
+			break;
+
 		case iOpenCL::PATCH_TOKEN_MEDIA_INTERFACE_DESCRIPTOR_LOAD:
 			{
 				static_assert(sizeof(iOpenCL::SPatchMediaInterfaceDescriptorLoad) == 8 + 4);
@@ -316,6 +390,43 @@ void read_kernel_patchlist(
 			}
 			break;
 
+		case iOpenCL::PATCH_TOKEN_STATELESS_CONSTANT_MEMORY_OBJECT_KERNEL_ARGUMENT:
+			{
+				static_assert(sizeof(iOpenCL::SPatchStatelessConstantMemoryObjectKernelArgument) == 8 + 7*4);
+				if (item_size != 8 + 7*4)
+					throw invalid_argument("Failed to read patch item StatelessConstantMemoryObjectKernelArgument");
+
+				KernelParameters::StatelessGlobalMemoryObjectKernelArgument scmoa;
+				scmoa.argument_number = read_binary<uint32_t>(bin);
+				scmoa.surface_state_heap_offset = read_binary<uint32_t>(bin);
+				scmoa.data_param_offset = read_binary<uint32_t>(bin);
+				scmoa.data_param_size = read_binary<uint32_t>(bin);
+				scmoa.location_index = read_binary<uint32_t>(bin);
+				scmoa.location_index2 = read_binary<uint32_t>(bin);
+				scmoa.is_emulation_argument = read_binary<uint32_t>(bin);
+
+				params.stateless_constant_memory_object_kernel_arguments.push_back(scmoa);
+			}
+			break;
+
+		case iOpenCL::PATCH_TOKEN_ALLOCATE_STATELESS_CONSTANT_MEMORY_SURFACE_WITH_INITIALIZATION:
+			{
+				static_assert(sizeof(iOpenCL::SPatchAllocateStatelessConstantMemorySurfaceWithInitialization) == 8 + 4*4);
+				if (item_size != 8 + 4*4 ||
+						params.allocate_stateless_constant_memory_surface_with_initialization)
+				{
+					throw invalid_argument("Failed to read patch item "
+							"AllocateStatelessConstantMemorySurfaceWithInitialization");
+				}
+
+				auto& a = params.allocate_stateless_constant_memory_surface_with_initialization.emplace();
+				a.constant_buffer_index = read_binary<uint32_t>(bin);
+				a.surface_state_heap_offset = read_binary<uint32_t>(bin);
+				a.data_param_offset = read_binary<uint32_t>(bin);
+				a.data_param_size = read_binary<uint32_t>(bin);
+			}
+			break;
+
 		case iOpenCL::PATCH_TOKEN_DATA_PARAMETER_STREAM:
 			{
 				static_assert(sizeof(iOpenCL::SPatchDataParameterStream) == 8 + 4);
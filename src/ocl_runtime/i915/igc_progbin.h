@@ -49,6 +49,14 @@ struct KernelParameters final
 
 	/* From patch tokens (adapted from
 	 * ocl_igc_shared/executable_format/patch*.h) */
+	struct MediaVfeState
+	{
+		uint32_t scratch_space_offset = 0;
+		uint32_t per_thread_scratch_space = 0;
+	};
+	std::optional<MediaVfeState> media_vfe_state;
+	std::optional<MediaVfeState> media_vfe_state_slot1;
+
 	struct MediaInterfaceDescriptorLoad
 	{
 		uint32_t data_offset = 0;
@@ -98,6 +106,22 @@ struct KernelParameters final
 	std::vector<StatelessGlobalMemoryObjectKernelArgument>
 		stateless_global_memory_object_kernel_arguments;
 
+	/* SPatchStatelessConstantMemoryObjectKernelArgument has the same
+	 * layout */
+	std::vector<StatelessGlobalMemoryObjectKernelArgument>
+		stateless_constant_memory_object_kernel_arguments;
+
+	/* Binds the program's constant surface with the given index */
+	struct AllocateStatelessConstantMemorySurfaceWithInitialization
+	{
+		uint32_t constant_buffer_index = 0;
+		uint32_t surface_state_heap_offset = 0;
+		uint32_t data_param_offset = 0;
+		uint32_t data_param_size = 0;
+	};
+	std::optional<AllocateStatelessConstantMemorySurfaceWithInitialization>
+		allocate_stateless_constant_memory_surface_with_initialization;
+
 	struct DataParameterStream
 	{
 		uint32_t data_parameter_stream_size = 0;
@@ -197,6 +221,18 @@ struct KernelParameters final
 	std::optional<AllocateLocalSurface> allocate_local_surface;
 };
 
+/* From the program's patch tokens, which are shared by all kernels */
+struct ProgramParameters final
+{
+	/* Program-scope __constant data */
+	struct AllocateConstantMemorySurface
+	{
+		uint32_t constant_buffer_index = 0;
+		std::vector<char> inline_data;
+	};
+	std::vector<AllocateConstantMemorySurface> allocate_constant_memory_surfaces;
+};
+
 
 iOpenCL::SProgramBinaryHeader read_program_binary_header(const char*& bin, size_t& size);
 std::string to_string(const iOpenCL::SProgramBinaryHeader& hdr);
@@ -211,6 +247,11 @@ std::string read_kernel_name(const char*& bin, size_t& size,
 iOpenCL::SKernelBinaryHeaderGen9 read_kernel_binary_header_gen9(
 		const char*& bin, size_t& size);
 
+void read_program_patchlist(
+		const char*& bin, size_t& size,
+		const iOpenCL::SProgramBinaryHeader& hdr,
+		ProgramParameters& params);
+
 KernelParameters build_kernel_params(
 		const iOpenCL::SProgramBinaryHeader& hdr,
 		const iOpenCL::SKernelBinaryHeader& kernel_hdr);
@@ -10,6 +10,10 @@ NDRange::NDRange(uint32_t x, uint32_t y, uint32_t z)
 {
 }
 
+Event::~Event()
+{
+}
+
 Kernel::~Kernel()
 {
 }
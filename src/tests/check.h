@@ -0,0 +1,74 @@
+#ifndef __TESTS_CHECK_H
+#define __TESTS_CHECK_H
+
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+/* Failed checks throw s.t. the check program reports the condition and its
+ * location and exits with an error */
+#define CHECK(X) \
+	do { \
+		if (!(X)) \
+		{ \
+			throw std::runtime_error(std::string(__FILE__) + ":" + \
+					std::to_string(__LINE__) + ": check failed: " #X); \
+		} \
+	} while (0)
+
+/* Checks that @param X throws an exception of type @param E */
+#define CHECK_THROWS(E, X) \
+	do { \
+		bool thrown = false; \
+		try \
+		{ \
+			X; \
+		} \
+		catch (E&) \
+		{ \
+			thrown = true; \
+		} \
+		if (!thrown) \
+		{ \
+			throw std::runtime_error(std::string(__FILE__) + ":" + \
+					std::to_string(__LINE__) + ": " #X " did not throw " #E); \
+		} \
+	} while (0)
+
+class AlignedBuffer
+{
+protected:
+	char* _ptr;
+	size_t _size;
+
+public:
+	AlignedBuffer(size_t alignment, size_t size_arg)
+		: _size(((size_arg + alignment - 1) / alignment) * alignment)
+	{
+		_ptr = (char*) aligned_alloc(alignment, _size);
+		if (!_ptr)
+			throw std::system_error(errno, std::generic_category(), "Failed to allocate aligned memory");
+	}
+
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+	~AlignedBuffer()
+	{
+		free(_ptr);
+	}
+
+	char* ptr()
+	{
+		return _ptr;
+	}
+
+	size_t size()
+	{
+		return _size;
+	}
+};
+
+#endif /* __TESTS_CHECK_H */
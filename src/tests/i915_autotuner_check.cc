@@ -0,0 +1,275 @@
+/** Checks the autotuner with a scripted timer: candidate local sizes, the
+ * selection by median time, and the tuning database's file format. Also
+ * checks which build options permit partial work groups. */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "memset_fixture.h"
+#include "i915_autotuner.h"
+#include "i915_kernel_utils.h"
+
+using namespace std;
+
+
+typedef array<uint32_t, 3> LocalSize;
+
+/* Returns the scripted times of a local size in turn, and a default time
+ * for local sizes without a script or when the script is exhausted */
+class ScriptedTimer : public OCL::I915TuningTimer
+{
+public:
+	map<LocalSize, vector<uint64_t>> script;
+	map<LocalSize, size_t> calls;
+	uint64_t default_time = 1000;
+
+	chrono::nanoseconds measure(OCL::PreparedKernel& kernel,
+			OCL::NDRange global_size, OCL::NDRange local_size) override
+	{
+		LocalSize l{ local_size.x, local_size.y, local_size.z };
+		auto n = calls[l]++;
+
+		auto i = script.find(l);
+		if (i != script.end() && n < i->second.size())
+			return chrono::nanoseconds(i->second[n]);
+
+		return chrono::nanoseconds(default_time);
+	}
+};
+
+/* A temporary directory for tuning databases */
+class TempDir
+{
+public:
+	string path;
+	vector<string> files;
+
+	TempDir()
+	{
+		char tmpl[] = "/tmp/i915_autotuner_check.XXXXXX";
+		if (!mkdtemp(tmpl))
+			throw system_error(errno, generic_category(), "Failed to create a temporary directory");
+
+		path = tmpl;
+	}
+
+	~TempDir()
+	{
+		for (auto& f : files)
+			unlink(f.c_str());
+
+		rmdir(path.c_str());
+	}
+
+	string file(const string& name)
+	{
+		files.push_back(path + "/" + name);
+		return files.back();
+	}
+};
+
+static string read_file(const string& path)
+{
+	auto fp = fopen(path.c_str(), "r");
+	CHECK(fp);
+
+	string s;
+	char buf[256];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		s.append(buf, n);
+
+	fclose(fp);
+	return s;
+}
+
+static void write_file(const string& path, const char* content)
+{
+	auto fp = fopen(path.c_str(), "w");
+	CHECK(fp);
+	fputs(content, fp);
+	CHECK(fclose(fp) == 0);
+}
+
+
+static void check_candidates()
+{
+	/* x in multiples of the SIMD size up to the global size */
+	auto c = OCL::tuning_candidates(OCL::NDRange(96), 16, 8, false);
+	CHECK((c == vector<LocalSize>{ { 16, 1, 1 }, { 32, 1, 1 }, { 64, 1, 1 }, { 96, 1, 1 } }));
+
+	/* Only divisors of the global size for kernels without non-uniform
+	 * work groups */
+	c = OCL::tuning_candidates(OCL::NDRange(96), 16, 8, true);
+	CHECK((c == vector<LocalSize>{ { 16, 1, 1 }, { 32, 1, 1 }, { 96, 1, 1 } }));
+
+	c = OCL::tuning_candidates(OCL::NDRange(16, 6), 16, 8, true);
+	CHECK((c == vector<LocalSize>{ { 16, 1, 1 }, { 16, 2, 1 }, { 16, 6, 1 } }));
+
+	c = OCL::tuning_candidates(OCL::NDRange(16, 6), 16, 8, false);
+	CHECK((c == vector<LocalSize>{ { 16, 1, 1 }, { 16, 2, 1 }, { 16, 4, 1 }, { 16, 6, 1 } }));
+
+	/* At most 1024 work items */
+	c = OCL::tuning_candidates(OCL::NDRange(4096, 4096), 32, 56, false);
+	for (auto& l : c)
+		CHECK((uint64_t) l[0] * l[1] * l[2] <= 1024);
+}
+
+static void check_build_options()
+{
+	using OCL::build_options_allow_non_uniform_groups;
+
+	CHECK(!build_options_allow_non_uniform_groups(nullptr));
+	CHECK(!build_options_allow_non_uniform_groups(""));
+	CHECK(!build_options_allow_non_uniform_groups("-cl-std=CL1.2"));
+	CHECK(build_options_allow_non_uniform_groups("-cl-std=CL2.0"));
+	CHECK(build_options_allow_non_uniform_groups("-O2  -cl-std=CL3.0\t-DX=1"));
+	CHECK(!build_options_allow_non_uniform_groups(
+				"-cl-std=CL2.0 -cl-uniform-work-group-size"));
+
+	/* The last -cl-std counts */
+	CHECK(!build_options_allow_non_uniform_groups("-cl-std=CL2.0 -cl-std=CL1.2"));
+}
+
+static void check_median(MemsetFixture& f)
+{
+	ScriptedTimer timer;
+	vector<LocalSize> candidates{ { 16, 1, 1 }, { 32, 1, 1 }, { 64, 1, 1 } };
+
+	/* The first time is the warm-up run. The fastest single sample and the
+	 * fastest mean belong to other candidates than the fastest median. */
+	timer.script[{ 16, 1, 1 }] = { 1, 1, 500, 500, 500, 500 };
+	timer.script[{ 32, 1, 1 }] = { 1, 100, 100, 100, 9000, 9000 };
+	timer.script[{ 64, 1, 1 }] = { 1, 200, 200, 200, 200, 200 };
+
+	uint64_t time_ns = 0;
+	auto best = OCL::select_fastest(timer, *f.kernel, OCL::NDRange(4096),
+			candidates, 5, time_ns);
+
+	CHECK(best == 1);
+	CHECK(time_ns == 100);
+
+	for (auto& l : candidates)
+		CHECK(timer.calls[l] == 6);
+
+	CHECK_THROWS(invalid_argument, OCL::select_fastest(timer, *f.kernel,
+				OCL::NDRange(4096), vector<LocalSize>(), 5, time_ns));
+}
+
+static void check_tune(MemsetFixture& f, TempDir& dir)
+{
+	auto timer = make_shared<ScriptedTimer>();
+	timer->script[{ 64, 1, 1 }] = vector<uint64_t>(16, 10);
+
+	auto db_path = dir.file("tune.db");
+
+	CHECK_THROWS(runtime_error, f.rte->tune(*f.kernel, OCL::NDRange(768)));
+
+	f.rte->set_tuning_database(db_path.c_str());
+	f.rte->set_tuning_timer(timer);
+
+	auto local = f.rte->tune(*f.kernel, OCL::NDRange(768));
+	CHECK(local.x == 64 && local.y == 1 && local.z == 1);
+
+	/* The offline compiled kernel has uniform work groups only, hence
+	 * only divisors of the global size are timed */
+	CHECK(!timer->calls.empty());
+	for (auto& [l, n] : timer->calls)
+		CHECK(768 % l[0] == 0 && l[1] == 1 && l[2] == 1);
+
+	/* The entry is written back with the median time */
+	auto content = read_file(db_path);
+	CHECK(content.find(" 64 1 1 10\n") != string::npos);
+
+	/* Dispatches with the tuned local size */
+	f.kernel->execute(OCL::NDRange(768));
+
+	f.rte->set_tuning_timer(nullptr);
+	f.rte->set_tuning_database(nullptr);
+}
+
+static void check_database(TempDir& dir)
+{
+	auto path = dir.file("roundtrip.db");
+
+	OCL::I915TuningKey k1(0x12345678, 0x1912, OCL::NDRange(1000, 3));
+	OCL::I915TuningKey k2(0x9abcdef0, 0x1912, OCL::NDRange(64));
+
+	OCL::I915TuningEntry e1;
+	e1.local_size = { 128, 2, 1 };
+	e1.time_ns = 123456789012ULL;
+
+	OCL::I915TuningEntry e2;
+	e2.local_size = { 64, 1, 1 };
+	e2.time_ns = 42;
+
+	{
+		OCL::I915TuningDatabase db(path);
+		CHECK(!db.lookup(k1));
+
+		db.store(k1, e1);
+		db.store(k2, e2);
+	}
+
+	{
+		OCL::I915TuningDatabase db(path);
+
+		auto l1 = db.lookup(k1);
+		auto l2 = db.lookup(k2);
+		CHECK(l1 && l2);
+
+		CHECK(l1->local_size == e1.local_size && l1->time_ns == e1.time_ns);
+		CHECK(l2->local_size == e2.local_size && l2->time_ns == e2.time_ns);
+
+		/* Global sizes of the same class share entries */
+		CHECK(db.lookup(OCL::I915TuningKey(0x12345678, 0x1912, OCL::NDRange(1024, 4))));
+		CHECK(!db.lookup(OCL::I915TuningKey(0x12345678, 0x1912, OCL::NDRange(1025, 4))));
+		CHECK(!db.lookup(OCL::I915TuningKey(0x12345678, 0x3e92, OCL::NDRange(1000, 3))));
+	}
+
+	/* Malformed databases are rejected instead of being overwritten */
+	const char* malformed[] = {
+		"12345678 1912 10 2 0 128 2 1\n",
+		"12345678 1912 10 2 0 128 0 1 100\n",
+		"12345678 1912 33 2 0 128 2 1 100\n",
+		"not a tuning database\n",
+	};
+
+	auto bad_path = dir.file("malformed.db");
+	for (auto content : malformed)
+	{
+		write_file(bad_path, content);
+		CHECK_THROWS(runtime_error, OCL::I915TuningDatabase db(bad_path));
+	}
+
+	CHECK(read_file(bad_path) == malformed[3]);
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+		TempDir dir;
+
+		check_candidates();
+		check_build_options();
+		check_median(f);
+		check_tune(f, dir);
+		check_database(dir);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
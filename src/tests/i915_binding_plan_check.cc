@@ -0,0 +1,315 @@
+/** Checks the binding plan of a kernel described by hand-built patch tokens:
+ * by-value structs, buffer, __constant and __local pointer arguments and the
+ * NDRange slots. The cross-thread data built from it must match the expected
+ * layout, and partial updates of changed arguments must yield the same bytes
+ * as a full rebuild. */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <unistd.h>
+
+#include "check.h"
+#include "i915_kernel_utils.h"
+
+using namespace std;
+using namespace OCL;
+
+
+static constexpr size_t CROSS_THREAD_SIZE = 96;
+
+struct Value
+{
+	uint32_t a;
+	float b;
+	uint64_t c;
+};
+
+static_assert(sizeof(Value) == 16);
+
+/* void kernel(struct Value s, __global uint* buf, __constant uint* table,
+ *		__local uint* l1, __local float4* l2, uint n) */
+static KernelParameters make_params()
+{
+	KernelParameters p;
+
+	auto arg = [&](uint32_t n, const char* aq, const char* type) {
+		KernelParameters::KernelArgumentInfo i;
+		i.argument_number = n;
+		i.address_qualifier = aq;
+		i.access_qualifier = "NONE";
+		i.type_name = type;
+		i.type_qualifier = "NONE";
+		p.kernel_argument_infos.push_back(i);
+	};
+
+	arg(0, "__private", "struct Value;16");
+	arg(1, "__global", "uint*;8");
+	arg(2, "__constant", "uint*;8");
+	arg(3, "__local", "uint*;8");
+	arg(4, "__local", "float4*;8");
+	arg(5, "__private", "uint;4");
+
+	auto dpb = [&](uint32_t type, uint32_t n, uint32_t offset, uint32_t size,
+			uint32_t source_offset) {
+		KernelParameters::DataParameterBuffer d;
+		d.type = type;
+		d.argument_number = n;
+		d.offset = offset;
+		d.data_size = size;
+		d.source_offset = source_offset;
+		p.data_parameter_buffers.push_back(d);
+	};
+
+	/* Structs are passed as one parameter per member */
+	dpb(iOpenCL::DATA_PARAMETER_KERNEL_ARGUMENT, 0, 0, 4, 0);
+	dpb(iOpenCL::DATA_PARAMETER_KERNEL_ARGUMENT, 0, 4, 4, 4);
+	dpb(iOpenCL::DATA_PARAMETER_KERNEL_ARGUMENT, 0, 8, 8, 8);
+
+	dpb(iOpenCL::DATA_PARAMETER_BUFFER_STATEFUL, 1, 24, 4, 0);
+	dpb(iOpenCL::DATA_PARAMETER_BUFFER_STATEFUL, 2, 40, 4, 0);
+
+	/* The source offset is the alignment of the allocation */
+	dpb(iOpenCL::DATA_PARAMETER_SUM_OF_LOCAL_MEMORY_OBJECT_ARGUMENT_SIZES, 3, 44, 4, 16);
+	dpb(iOpenCL::DATA_PARAMETER_SUM_OF_LOCAL_MEMORY_OBJECT_ARGUMENT_SIZES, 4, 48, 4, 64);
+
+	dpb(iOpenCL::DATA_PARAMETER_KERNEL_ARGUMENT, 5, 52, 4, 0);
+
+	for (uint32_t d = 0; d < 3; d++)
+	{
+		dpb(iOpenCL::DATA_PARAMETER_GLOBAL_WORK_OFFSET, 0, 56 + 4 * d, 4, 4 * d);
+		dpb(iOpenCL::DATA_PARAMETER_LOCAL_WORK_SIZE, 0, 68 + 4 * d, 4, 4 * d);
+		dpb(iOpenCL::DATA_PARAMETER_ENQUEUED_LOCAL_WORK_SIZE, 0, 80 + 4 * d, 4, 4 * d);
+	}
+
+	KernelParameters::StatelessGlobalMemoryObjectKernelArgument so;
+	so.argument_number = 1;
+	so.data_param_offset = 16;
+	so.data_param_size = 8;
+	p.stateless_global_memory_object_kernel_arguments.push_back(so);
+
+	so.argument_number = 2;
+	so.data_param_offset = 32;
+	p.stateless_constant_memory_object_kernel_arguments.push_back(so);
+
+	KernelParameters::AllocateLocalSurface als;
+	als.total_inline_local_memory_size = 100;
+	p.allocate_local_surface = als;
+
+	return p;
+}
+
+template<typename T>
+static T read_slot(const vector<char>& data, size_t offset)
+{
+	T v;
+	memcpy(&v, data.data() + offset, sizeof(v));
+	return v;
+}
+
+struct Arguments
+{
+	Value s{ 1, 2.5f, 0x123456789abcdefULL };
+	uint32_t table[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	uint32_t n = 42;
+	size_t local_sizes[2] = { 100, 256 };
+
+	vector<unique_ptr<KernelArg>> make(void* buf, size_t buf_size) const
+	{
+		vector<unique_ptr<KernelArg>> args;
+		args.push_back(make_unique<KernelArgValue>(&s, sizeof(s)));
+		args.push_back(make_unique<KernelArgPtr>(sysconf(_SC_PAGESIZE),
+					buf, buf_size, CacheHint::Default));
+		args.push_back(make_unique<KernelArgDispatchConstant>(table, sizeof(table)));
+		args.push_back(make_unique<KernelArgLocal>(local_sizes[0]));
+		args.push_back(make_unique<KernelArgLocal>(local_sizes[1]));
+		args.push_back(make_unique<KernelArgValue>(&n, sizeof(n)));
+		return args;
+	}
+};
+
+static vector<char> build(const KernelBindingPlan& plan,
+		const vector<unique_ptr<KernelArg>>& args)
+{
+	vector<char> data(CROSS_THREAD_SIZE);
+	vector<tuple<uint32_t, uint64_t>> relocs;
+
+	build_cross_thread_data(plan, NDRange(5, 6, 7), NDRange(8, 4, 2), args,
+			data.data(), relocs);
+
+	CHECK(relocs.empty());
+	return data;
+}
+
+static void check_plan(const KernelParameters& params)
+{
+	auto plan = compile_binding_plan(params, { 0, 64 }, CROSS_THREAD_SIZE);
+
+	CHECK(plan.args.size() == 6);
+	CHECK(plan.args[0].kind == KernelArgKind::Value);
+	CHECK(plan.args[0].value_size == 16);
+	CHECK(plan.args[0].value_patches.size() == 3);
+	CHECK(plan.args[1].kind == KernelArgKind::Buffer);
+	CHECK(plan.args[2].kind == KernelArgKind::Constant);
+	CHECK(plan.args[3].kind == KernelArgKind::Local);
+	CHECK(plan.args[4].kind == KernelArgKind::Local);
+	CHECK(plan.args[5].kind == KernelArgKind::UInt32);
+
+	/* Buffer-like arguments take the binding table entries in order */
+	CHECK(plan.args[1].bt_index == 0);
+	CHECK(plan.args[2].bt_index == 1);
+	CHECK((plan.bt_args == vector<unsigned>{ 1, 2 }));
+	CHECK((plan.constant_args == vector<unsigned>{ 2 }));
+	CHECK((plan.local_args == vector<unsigned>{ 3, 4 }));
+
+	CHECK(plan.args[3].slm_alignment == 16);
+	CHECK(plan.args[4].slm_alignment == 64);
+	CHECK(plan.inline_slm_size == 100);
+
+	CHECK(plan.global_offset_patches.size() == 3);
+	CHECK(plan.local_size_patches.size() == 3);
+	CHECK(plan.enqueued_local_size_patches.size() == 3);
+
+	/* Without a binding table, no argument has an entry */
+	auto stateless = compile_binding_plan(params, {}, CROSS_THREAD_SIZE);
+	CHECK(stateless.bt_args.empty());
+	CHECK(stateless.args[1].bt_index == 0);
+}
+
+static void check_cross_thread_data(const KernelParameters& params)
+{
+	auto plan = compile_binding_plan(params, { 0, 64 }, CROSS_THREAD_SIZE);
+
+	AlignedBuffer buf(sysconf(_SC_PAGESIZE), 4096);
+	Arguments a;
+	auto args = a.make(buf.ptr(), buf.size());
+
+	auto data = build(plan, args);
+
+	CHECK(read_slot<uint32_t>(data, 0) == 1);
+	CHECK(read_slot<float>(data, 4) == 2.5f);
+	CHECK(read_slot<uint64_t>(data, 8) == 0x123456789abcdefULL);
+
+	CHECK(read_slot<uint64_t>(data, 16) == (uintptr_t) buf.ptr());
+	CHECK(read_slot<uint32_t>(data, 24) == 0);
+
+	/* The __constant copy's address is set per dispatch */
+	CHECK(read_slot<uint64_t>(data, 32) == 0);
+	CHECK(read_slot<uint32_t>(data, 40) == 1);
+
+	write_cross_thread_pointer(plan.args[2].pointer_patches, 0x1000, data.data());
+	CHECK(read_slot<uint64_t>(data, 32) == 0x1000);
+
+	/* __local arguments follow the kernel's own SLM at their alignment */
+	CHECK(read_slot<uint32_t>(data, 44) == 112);
+	CHECK(read_slot<uint32_t>(data, 48) == 256);
+	CHECK(local_memory_size(plan, args) == 512);
+
+	CHECK(read_slot<uint32_t>(data, 52) == 42);
+
+	for (uint32_t d = 0; d < 3; d++)
+	{
+		const uint32_t offset[3] = { 5, 6, 7 };
+		const uint32_t local[3] = { 8, 4, 2 };
+
+		CHECK(read_slot<uint32_t>(data, 56 + 4 * d) == offset[d]);
+		CHECK(read_slot<uint32_t>(data, 68 + 4 * d) == local[d]);
+		CHECK(read_slot<uint32_t>(data, 80 + 4 * d) == local[d]);
+	}
+
+	/* Partial work groups see their size only in the local work size slots */
+	set_local_work_size(plan, NDRange(3, 4, 2), data.data());
+	CHECK(read_slot<uint32_t>(data, 68) == 3);
+	CHECK(read_slot<uint32_t>(data, 80) == 8);
+}
+
+/* Updates the image of @param before with the arguments marked in @param
+ * dirty and compares it to a full rebuild with @param after */
+static void check_update(const KernelBindingPlan& plan, void* buf, size_t buf_size,
+		const Arguments& before, const Arguments& after, const vector<bool>& dirty)
+{
+	auto data = build(plan, before.make(buf, buf_size));
+
+	auto args = after.make(buf, buf_size);
+	vector<tuple<uint32_t, uint64_t>> relocs;
+
+	build_cross_thread_data(plan, NDRange(5, 6, 7), NDRange(8, 4, 2), args,
+			data.data(), relocs, &dirty);
+
+	CHECK(data == build(plan, args));
+}
+
+static void check_partial_update(const KernelParameters& params)
+{
+	auto plan = compile_binding_plan(params, { 0, 64 }, CROSS_THREAD_SIZE);
+
+	AlignedBuffer buf(sysconf(_SC_PAGESIZE), 4096);
+	Arguments before;
+
+	Arguments after = before;
+	after.s = { 3, -1.0f, 7 };
+	after.n = 13;
+	check_update(plan, buf.ptr(), buf.size(), before, after,
+			{ true, false, false, false, false, true });
+
+	/* A changed __local size moves the later allocations */
+	after = before;
+	after.local_sizes[0] = 300;
+	check_update(plan, buf.ptr(), buf.size(), before, after,
+			{ false, false, false, true, false, false });
+
+	after = before;
+	after.table[0] = 100;
+	check_update(plan, buf.ptr(), buf.size(), before, after,
+			{ false, false, true, false, false, false });
+
+	/* Unchanged arguments need no update */
+	check_update(plan, buf.ptr(), buf.size(), before, before, {});
+}
+
+static void check_invalid(const KernelParameters& params)
+{
+	/* Each buffer-like argument needs a binding table entry */
+	CHECK_THROWS(invalid_argument, compile_binding_plan(params, { 0 }, CROSS_THREAD_SIZE));
+
+	/* Slots must lie within the cross-thread data */
+	CHECK_THROWS(invalid_argument, compile_binding_plan(params, { 0, 64 }, 64));
+
+	auto p = params;
+	p.data_parameter_buffers[3].argument_number = 5;
+	CHECK_THROWS(invalid_argument, compile_binding_plan(p, { 0, 64 }, CROSS_THREAD_SIZE));
+
+	/* A struct member beyond the struct's size */
+	p = params;
+	p.data_parameter_buffers[2].data_size = 16;
+	CHECK_THROWS(invalid_argument, compile_binding_plan(p, { 0, 64 }, 128));
+
+	/* The SLM offset of a non-__local argument */
+	p = params;
+	p.data_parameter_buffers[5].argument_number = 0;
+	CHECK_THROWS(invalid_argument, compile_binding_plan(p, { 0, 64 }, CROSS_THREAD_SIZE));
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		auto params = make_params();
+
+		check_plan(params);
+		check_cross_thread_data(params);
+		check_partial_update(params);
+		check_invalid(params);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
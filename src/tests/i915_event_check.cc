@@ -0,0 +1,261 @@
+/** Checks completion events against the emulated device with manual
+ * completion: pending, partially and fully completed submissions, the wait
+ * modes and the retirement of submissions that are in flight, including the
+ * code of kernels that were destroyed while their dispatches ran. */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <thread>
+
+#include "memset_fixture.h"
+
+using namespace std;
+
+
+static void check_pending(MemsetFixture& f)
+{
+	f.device->set_manual_completion(true);
+
+	auto event = f.submit();
+	CHECK(f.device->get_stats().pending_batches == 1);
+
+	CHECK(!event->is_complete());
+	CHECK(!event->wait_for(chrono::milliseconds(1)));
+	CHECK_THROWS(runtime_error, event->get_dispatch_times());
+
+	CHECK(f.device->complete_next());
+	CHECK(f.device->get_stats().pending_batches == 0);
+
+	CHECK(event->is_complete());
+	CHECK(event->wait_for(chrono::nanoseconds(0)));
+	event->wait();
+
+	f.device->set_manual_completion(false);
+}
+
+static void check_partial(MemsetFixture& f)
+{
+	f.device->set_manual_completion(true);
+
+	auto e1 = f.submit();
+	auto e2 = f.submit();
+
+	auto queue = f.rte->create_command_queue();
+	queue->enqueue(*f.kernel, f.global_size, f.local_size);
+	queue->enqueue(*f.kernel, f.global_size, f.local_size);
+	auto e3 = queue->flush();
+
+	CHECK(f.device->get_stats().pending_batches == 3);
+
+	/* Batches complete in submission order */
+	CHECK(f.device->complete_next());
+	CHECK(e1->is_complete());
+	CHECK(!e2->is_complete());
+	CHECK(!e3->is_complete());
+	CHECK(!e3->wait_for(chrono::milliseconds(1)));
+
+	CHECK(f.device->complete_all() == 2);
+	CHECK(e2->is_complete());
+	CHECK(e3->is_complete());
+	CHECK(!f.device->complete_next());
+
+	/* An empty queue's event is complete right away */
+	CHECK(queue->flush()->is_complete());
+
+	f.device->set_manual_completion(false);
+}
+
+static void check_wait_mode(MemsetFixture& f, OCL::I915WaitMode mode)
+{
+	OCL::I915WaitPolicy policy;
+	policy.mode = mode;
+	policy.spin_time = chrono::milliseconds(1);
+	f.rte->set_wait_policy(policy);
+
+	f.device->set_manual_completion(true);
+
+	auto event = f.submit();
+	auto before = f.rte->get_wait_stats();
+
+	/* Complete the batch while the event is being waited for */
+	thread completer([&]() {
+		this_thread::sleep_for(chrono::milliseconds(20));
+		f.device->complete_all();
+	});
+
+	try
+	{
+		event->wait();
+	}
+	catch (...)
+	{
+		completer.join();
+		throw;
+	}
+
+	completer.join();
+
+	auto after = f.rte->get_wait_stats();
+	CHECK(event->is_complete());
+	CHECK(after.waits == before.waits + 1);
+
+	switch (mode)
+	{
+	case OCL::I915WaitMode::BusyPoll:
+		CHECK(after.spin_completions == before.spin_completions + 1);
+		CHECK(after.blocking_waits == before.blocking_waits);
+		break;
+
+	case OCL::I915WaitMode::Adaptive:
+	case OCL::I915WaitMode::Blocking:
+		CHECK(after.spin_completions == before.spin_completions);
+		CHECK(after.blocking_waits == before.blocking_waits + 1);
+		CHECK(after.gem_wait_ioctls > before.gem_wait_ioctls);
+		break;
+	}
+
+	/* Neither mode waits past the timeout of wait_for() */
+	event = f.submit();
+	CHECK(!event->wait_for(chrono::milliseconds(2)));
+
+	f.device->set_manual_completion(false);
+	CHECK(event->wait_for(chrono::milliseconds(2)));
+
+	f.rte->set_wait_policy(OCL::I915WaitPolicy());
+}
+
+static void check_in_flight(MemsetFixture& f)
+{
+	f.device->set_manual_completion(true);
+
+	/* Bos of a pending submission are not returned to the pool, even if no
+	 * event refers to it anymore */
+	f.submit();
+	f.rte->trim_bo_pool();
+
+	f.submit();
+	CHECK(f.rte->get_bo_pool_stats().cached_bos == 0);
+
+	/* Completed submissions are retired when the next one is submitted */
+	CHECK(f.device->complete_all() == 2);
+	f.device->set_manual_completion(false);
+
+	f.kernel->execute(f.global_size, f.local_size);
+	CHECK(f.rte->get_bo_pool_stats().cached_bos > 0);
+}
+
+/* @returns the kernel start pointer of the last interface descriptor in the
+ * batch dump @param f */
+static uint64_t read_kernel_start(FILE* f)
+{
+	static const string field = "kernel_start_pointer: ";
+
+	uint64_t kernel_start = 0;
+	bool found = false;
+
+	rewind(f);
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		string l(line);
+		auto pos = l.find(field);
+		if (pos != string::npos)
+		{
+			kernel_start = stoull(l.substr(pos + field.size()), nullptr, 16);
+			found = true;
+		}
+	}
+
+	CHECK(found);
+	return kernel_start;
+}
+
+/* Loads cl_memset again and submits it. The kernel is destroyed on return,
+ * while the dispatch may still be pending. */
+static shared_ptr<OCL::Event> submit_new_kernel(MemsetFixture& f, uint64_t& kernel_start)
+{
+	FILE* dump = tmpfile();
+	CHECK(dump);
+
+	shared_ptr<OCL::Event> event;
+
+	try
+	{
+		f.rte->set_batch_dump(dump);
+
+		auto kernel = f.rte->prepare_kernel(f.rte->read_compiled_kernel(
+					CompiledGPUProgramsI915::i915_memset(), "cl_memset"));
+
+		kernel->add_argument((unsigned) f.buf->size() / 4);
+		kernel->add_argument(0x12345678U);
+		kernel->add_argument((void*) f.buf->ptr(), f.buf->size());
+
+		event = kernel->execute_async(f.global_size, f.local_size);
+
+		f.rte->set_batch_dump(nullptr);
+		kernel_start = read_kernel_start(dump);
+	}
+	catch (...)
+	{
+		f.rte->set_batch_dump(nullptr);
+		fclose(dump);
+		throw;
+	}
+
+	fclose(dump);
+	return event;
+}
+
+static void check_kernel_lifetime(MemsetFixture& f)
+{
+	f.device->set_manual_completion(true);
+
+	/* The code of a destroyed kernel is not overwritten by the next kernel
+	 * while a dispatch may still execute it */
+	uint64_t start1, start2;
+	auto e1 = submit_new_kernel(f, start1);
+	auto e2 = submit_new_kernel(f, start2);
+	CHECK(start2 != start1);
+
+	CHECK(f.device->complete_all() == 2);
+	CHECK(e1->is_complete());
+	CHECK(e2->is_complete());
+
+	e1.reset();
+	e2.reset();
+
+	/* Once the submissions are retired, the code's range is reused */
+	f.device->set_manual_completion(false);
+	f.kernel->execute(f.global_size, f.local_size);
+
+	uint64_t start3;
+	submit_new_kernel(f, start3)->wait();
+	CHECK(start3 == start1);
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_pending(f);
+		check_partial(f);
+		check_wait_mode(f, OCL::I915WaitMode::BusyPoll);
+		check_wait_mode(f, OCL::I915WaitMode::Adaptive);
+		check_wait_mode(f, OCL::I915WaitMode::Blocking);
+		check_in_flight(f);
+		check_kernel_lifetime(f);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+/** Checks that the emulated device rejects invalid submissions like the
+ * kernel, and that the RTE stays usable after a rejected request. The
+ * submissions are issued through the device's backend interface. */
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "memset_fixture.h"
+#include "i915_backend.h"
+
+using namespace std;
+
+
+/* A page with an MI_BATCH_BUFFER_END and a context to submit it */
+struct Submission
+{
+	shared_ptr<OCL::I915Backend> backend;
+	AlignedBuffer page;
+	uint32_t bb_handle = 0;
+	uint32_t ctx_id = 0;
+
+	Submission(shared_ptr<OCL::I915FakeDevice> device)
+		:
+			backend(dynamic_pointer_cast<OCL::I915Backend>(device)),
+			page(4096, 4096)
+	{
+		CHECK(backend);
+
+		memset(page.ptr(), 0, page.size());
+		const uint32_t bb_end = 0x0a << 23;
+		memcpy(page.ptr(), &bb_end, sizeof(bb_end));
+
+		bb_handle = backend->gem_userptr(page.ptr(), page.size(), false);
+		ctx_id = backend->gem_context_create();
+	}
+
+	~Submission()
+	{
+		backend->gem_context_destroy(ctx_id);
+		backend->gem_close(bb_handle);
+	}
+
+	OCL::I915ExecBo bb()
+	{
+		return OCL::I915ExecBo(bb_handle, page.ptr(),
+				vector<struct drm_i915_gem_relocation_entry>());
+	}
+};
+
+/* @returns the error of the system_error thrown by @param f, or 0 */
+static int errno_of(const function<void()>& f)
+{
+	try
+	{
+		f();
+	}
+	catch (system_error& e)
+	{
+		return e.code().value();
+	}
+
+	return 0;
+}
+
+static void check_submissions(MemsetFixture& f)
+{
+	Submission s(f.device);
+	auto& backend = *s.backend;
+
+	auto execbufs = f.device->get_stats().execbufs;
+
+	/* A valid submission */
+	{
+		vector<OCL::I915ExecBo> bos{ s.bb() };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}
+
+	/* Missing handle */
+	CHECK(errno_of([&]() {
+		vector<OCL::I915ExecBo> bos{
+			OCL::I915ExecBo(0xdead, nullptr, vector<struct drm_i915_gem_relocation_entry>()),
+			s.bb() };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}) == ENOENT);
+
+	/* Missing context */
+	CHECK(errno_of([&]() {
+		vector<OCL::I915ExecBo> bos{ s.bb() };
+		backend.gem_execbuffer2(0xdead, bos, 4);
+	}) == ENOENT);
+
+	/* Relocation target that is not part of the submission */
+	CHECK(errno_of([&]() {
+		struct drm_i915_gem_relocation_entry reloc = {};
+		reloc.target_handle = 0xdead;
+		reloc.offset = 8;
+
+		vector<OCL::I915ExecBo> bos{
+			OCL::I915ExecBo(s.bb_handle, nullptr,
+					vector<struct drm_i915_gem_relocation_entry>{ reloc }) };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}) == ENOENT);
+
+	/* Relocation outside of its bo */
+	CHECK(errno_of([&]() {
+		struct drm_i915_gem_relocation_entry reloc = {};
+		reloc.target_handle = s.bb_handle;
+		reloc.offset = 4096;
+
+		vector<OCL::I915ExecBo> bos{
+			OCL::I915ExecBo(s.bb_handle, nullptr,
+					vector<struct drm_i915_gem_relocation_entry>{ reloc }) };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}) == EINVAL);
+
+	/* Overlapping pinned bos */
+	AlignedBuffer other(4096, 2 * 4096);
+	auto other_handle = backend.gem_userptr(other.ptr(), other.size(), false);
+
+	CHECK(errno_of([&]() {
+		vector<OCL::I915ExecBo> bos{
+			OCL::I915ExecBo(other_handle, s.page.ptr() - 4096,
+					vector<struct drm_i915_gem_relocation_entry>()),
+			s.bb() };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}) == EINVAL);
+
+	/* The same bo twice */
+	CHECK(errno_of([&]() {
+		vector<OCL::I915ExecBo> bos{ s.bb(), s.bb() };
+		backend.gem_execbuffer2(s.ctx_id, bos, 4);
+	}) == EINVAL);
+
+	backend.gem_close(other_handle);
+
+	/* Batches must end within the batch length */
+	memset(s.page.ptr(), 0, s.page.size());
+	CHECK(errno_of([&]() {
+		vector<OCL::I915ExecBo> bos{ s.bb() };
+		backend.gem_execbuffer2(s.ctx_id, bos, 64);
+	}) == EINVAL);
+
+	/* Only the valid submission was executed */
+	CHECK(f.device->get_stats().execbufs == execbufs + 1);
+
+	/* Unknown handles and names */
+	CHECK(errno_of([&]() { backend.gem_close(0xdead); }) == EINVAL);
+	CHECK(errno_of([&]() {
+		uint32_t handle;
+		uint64_t size;
+		backend.gem_open(0xdead, handle, size);
+	}) == ENOENT);
+}
+
+static void check_runtime(MemsetFixture& f)
+{
+	auto kernel = dynamic_cast<OCL::I915PreparedKernel*>(f.kernel.get());
+	CHECK(kernel);
+
+	auto open_handles = f.device->get_stats().open_handles;
+
+	/* An unknown GEM name is rejected when it is bound */
+	CHECK(errno_of([&]() { kernel->set_argument_gem_name(2, 0xdead); }) == ENOENT);
+	CHECK(f.rte->get_gem_name_imports().empty());
+	CHECK(f.device->get_stats().open_handles == open_handles);
+
+	/* The kernel and RTE stay usable */
+	auto name = f.device->create_named_bo(MemsetFixture::BUFFER_SIZE);
+	kernel->set_argument_gem_name(2, name);
+	f.kernel->execute(f.global_size, f.local_size);
+
+	f.kernel->set_argument(2, (void*) f.buf->ptr(), f.buf->size());
+	f.kernel->execute(f.global_size, f.local_size);
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_submissions(f);
+		check_runtime(f);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+/** Checks dispatches with buffers that are imported by GEM name. Imported bos
+ * are relocation targets, which the kernel places, hence several of them may
+ * be used in one batch. */
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+#include "memset_fixture.h"
+
+using namespace std;
+
+
+static void check_imports(MemsetFixture& f)
+{
+	auto kernel = dynamic_cast<OCL::I915PreparedKernel*>(f.kernel.get());
+	CHECK(kernel);
+
+	auto name1 = f.device->create_named_bo(MemsetFixture::BUFFER_SIZE);
+	auto name2 = f.device->create_named_bo(MemsetFixture::BUFFER_SIZE);
+
+	/* Both imports end up in the same batch */
+	auto queue = f.rte->create_command_queue();
+
+	kernel->set_argument_gem_name(2, name1);
+	queue->enqueue(*kernel, f.global_size, f.local_size);
+
+	kernel->set_argument_gem_name(2, name2);
+	queue->enqueue(*kernel, f.global_size, f.local_size);
+
+	kernel->set_argument_gem_name(2, name1);
+	queue->enqueue(*kernel, f.global_size, f.local_size);
+
+	auto execbufs = f.device->get_stats().execbufs;
+	queue->finish();
+	CHECK(f.device->get_stats().execbufs == execbufs + 1);
+
+	/* Each name is imported once */
+	auto imports = f.rte->get_gem_name_imports();
+	CHECK(imports.size() == 2);
+
+	/* Imports and userptr bos in one batch */
+	kernel->set_argument(2, (void*) f.buf->ptr(), f.buf->size());
+	queue->enqueue(*kernel, f.global_size, f.local_size);
+	kernel->set_argument_gem_name(2, name2);
+	queue->enqueue(*kernel, f.global_size, f.local_size);
+	queue->finish();
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_imports(f);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/** Checks the RTE's reaction to GPU hangs and resets, which are injected into
+ * the emulated device: waits time out while a batch hangs, fail with a
+ * GpuHangError after the reset, and later dispatches succeed. */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+
+#include "memset_fixture.h"
+
+using namespace std;
+
+
+static void check_hang(MemsetFixture& f, OCL::I915WaitMode mode)
+{
+	OCL::I915WaitPolicy policy;
+	policy.mode = mode;
+	policy.timeout = chrono::milliseconds(20);
+	f.rte->set_wait_policy(policy);
+
+	auto hangs = f.rte->get_gpu_hang_count();
+	auto resets = f.device->get_stats().resets;
+
+	/* The second batch queues up behind the hung one */
+	f.device->hang_next_batch();
+	auto e1 = f.submit();
+	auto e2 = f.submit();
+
+	CHECK_THROWS(OCL::TimeoutError, e1->wait());
+	CHECK(!e2->wait_for(chrono::milliseconds(2)));
+	CHECK(!f.device->complete_next());
+	CHECK(f.device->get_stats().pending_batches == 2);
+
+	/* Both batches were lost in the reset */
+	f.device->reset_gpu();
+	CHECK(f.device->get_stats().resets == resets + 1);
+	CHECK(f.device->get_stats().pending_batches == 0);
+
+	CHECK_THROWS(OCL::GpuHangError, e1->wait());
+	CHECK_THROWS(OCL::GpuHangError, e2->wait());
+	CHECK(!e1->is_complete());
+	CHECK(f.rte->get_gpu_hang_count() == hangs + 1);
+
+	/* The RTE continues on a new context */
+	f.kernel->execute(f.global_size, f.local_size);
+	f.submit()->wait();
+	CHECK(f.rte->get_gpu_hang_count() == hangs + 1);
+
+	f.rte->set_wait_policy(OCL::I915WaitPolicy());
+}
+
+static void check_unbounded_timeout(MemsetFixture& f)
+{
+	/* A complete event */
+	auto event = f.submit();
+	CHECK(event->wait_for(chrono::nanoseconds::max()));
+
+	/* The deadline must not overflow s.t. the wait returns right away */
+	OCL::I915WaitPolicy policy;
+	policy.timeout = chrono::nanoseconds::max();
+	f.rte->set_wait_policy(policy);
+
+	f.device->set_manual_completion(true);
+	auto e1 = f.submit();
+	auto e2 = f.submit();
+
+	thread completer([&]() {
+		this_thread::sleep_for(chrono::milliseconds(20));
+		f.device->complete_next();
+		this_thread::sleep_for(chrono::milliseconds(20));
+		f.device->complete_next();
+	});
+
+	bool e1_complete = false;
+	try
+	{
+		e1_complete = e1->wait_for(chrono::nanoseconds::max());
+		e2->wait();
+	}
+	catch (...)
+	{
+		completer.join();
+		throw;
+	}
+
+	completer.join();
+
+	CHECK(e1_complete);
+	CHECK(e2->is_complete());
+
+	f.device->set_manual_completion(false);
+	f.rte->set_wait_policy(OCL::I915WaitPolicy());
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_hang(f, OCL::I915WaitMode::Blocking);
+		check_hang(f, OCL::I915WaitMode::Adaptive);
+		check_hang(f, OCL::I915WaitMode::BusyPoll);
+		check_unbounded_timeout(f);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,12 @@
+/* vim: set ft=c: */
+
+/* Each work item writes the size of its work group, which is smaller than the
+ * enqueued local size in partial work groups */
+void __kernel cl_local_size(uint width, uint height, __global uint* dst)
+{
+	uint x = get_global_id(0);
+	uint y = get_global_id(1);
+
+	if (x < width && y < height)
+		dst[y * width + x] = get_local_size(0) | get_local_size(1) << 16;
+}
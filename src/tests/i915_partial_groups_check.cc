@@ -0,0 +1,279 @@
+/** Checks the dispatch of non-uniform NDRanges. A kernel built with
+ * -cl-std=CL2.0 is dispatched with global sizes that are no multiples of the
+ * local size; the batch dump must show a walker per combination of full and
+ * partial work groups, with the partial groups' ids, the lanes of their last
+ * thread and their size in the local work size slots of the cross-thread
+ * data. Kernels built with -cl-std=CL1.2 must reject such NDRanges. */
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <llt_gpgpu_rt/i915_runtime.h>
+#include "check.h"
+#include "i915_local_size.clch"
+#include "i915_memset.clch"
+
+using namespace std;
+
+
+struct Walker
+{
+	map<string, uint64_t> fields;
+	vector<uint32_t> cross_thread_data;
+};
+
+/* Reads the GPGPU_WALKERs of the batch dump with their fields and
+ * cross-thread data */
+static vector<Walker> read_walkers(FILE* f)
+{
+	vector<Walker> walkers;
+	bool in_walker = false;
+	bool in_cross_thread_data = false;
+
+	rewind(f);
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		string l(line);
+		while (!l.empty() && (l.back() == '\n' || l.back() == ' '))
+			l.pop_back();
+
+		auto start = l.find_first_not_of(' ');
+		if (start == string::npos)
+			continue;
+
+		l = l.substr(start);
+
+		if (l == "GPGPU_WALKER")
+		{
+			walkers.emplace_back();
+			in_walker = true;
+			in_cross_thread_data = false;
+			continue;
+		}
+
+		if (!in_walker)
+			continue;
+
+		auto sep = l.find(": ");
+
+		if (l == "cross_thread_data:")
+		{
+			in_cross_thread_data = true;
+		}
+		else if (in_cross_thread_data && l.compare(0, 2, "0x") == 0 && l.back() != ':')
+		{
+			istringstream s(l);
+			string dw;
+			while (s >> dw)
+				walkers.back().cross_thread_data.push_back(stoul(dw, nullptr, 16));
+		}
+		else if (!in_cross_thread_data && sep != string::npos)
+		{
+			walkers.back().fields[l.substr(0, sep)] = stoull(l.substr(sep + 2), nullptr, 0);
+		}
+		else
+		{
+			/* The next command or its address */
+			in_walker = false;
+			in_cross_thread_data = false;
+		}
+	}
+
+	return walkers;
+}
+
+static uint32_t simd_size(const Walker& w)
+{
+	switch (w.fields.at("simd_size"))
+	{
+	case 0:
+		return 8;
+	case 1:
+		return 16;
+	default:
+		return 32;
+	}
+}
+
+/* Checks the walker that dispatches the work groups @param group_start ...
+ * @param group_end - 1 of local size @param local. @param full is the
+ * cross-thread data of a walker of full work groups of size @param
+ * enqueued. */
+static void check_walker(const Walker& w,
+		const uint32_t (&group_start)[2], const uint32_t (&group_end)[2],
+		const uint32_t (&local)[2], const uint32_t (&enqueued)[2],
+		const vector<uint32_t>& full)
+{
+	CHECK(w.fields.at("thread_group_id_starting_x") == group_start[0]);
+	CHECK(w.fields.at("thread_group_id_x_dimension") == group_end[0]);
+	CHECK(w.fields.at("thread_group_id_starting_y") == group_start[1]);
+	CHECK(w.fields.at("thread_group_id_y_dimension") == group_end[1]);
+	CHECK(w.fields.at("thread_group_id_starting_resume_z") == 0);
+	CHECK(w.fields.at("thread_group_id_z_dimension") == 1);
+
+	/* The threads of a group form a row; only the last one may have
+	 * disabled lanes */
+	auto simd = simd_size(w);
+	uint32_t cnt_items = local[0] * local[1];
+	uint32_t cnt_threads = (cnt_items + simd - 1) / simd;
+	uint32_t last_lanes = cnt_items - (cnt_threads - 1) * simd;
+
+	CHECK(w.fields.at("thread_width_counter_maximum") == cnt_threads - 1);
+	CHECK(w.fields.at("right_execution_mask") ==
+			(last_lanes >= 32 ? 0xffffffffU : (1U << last_lanes) - 1));
+	CHECK(w.fields.at("bottom_execution_mask") == 0xffffffffU);
+
+	/* The cross-thread data differs from the full groups' only in the local
+	 * work size slots; the enqueued local size stays */
+	CHECK(!w.cross_thread_data.empty());
+	CHECK(w.cross_thread_data.size() == full.size());
+
+	bool found[2] = { local[0] == enqueued[0], local[1] == enqueued[1] };
+
+	for (size_t i = 0; i < full.size(); i++)
+	{
+		if (w.cross_thread_data[i] == full[i])
+			continue;
+
+		bool slot = false;
+		for (int d = 0; d < 2; d++)
+		{
+			if (full[i] == enqueued[d] && w.cross_thread_data[i] == local[d])
+			{
+				slot = true;
+				found[d] = true;
+			}
+		}
+
+		CHECK(slot);
+	}
+
+	CHECK(found[0]);
+	CHECK(found[1]);
+}
+
+static vector<Walker> dispatch(OCL::I915RTE& rte, OCL::PreparedKernel& kernel,
+		OCL::NDRange global_size, OCL::NDRange local_size)
+{
+	FILE* dump = tmpfile();
+	CHECK(dump);
+
+	vector<Walker> walkers;
+
+	try
+	{
+		rte.set_batch_dump(dump);
+		kernel.execute(global_size, local_size);
+		rte.set_batch_dump(nullptr);
+
+		walkers = read_walkers(dump);
+	}
+	catch (...)
+	{
+		rte.set_batch_dump(nullptr);
+		fclose(dump);
+		throw;
+	}
+
+	fclose(dump);
+	return walkers;
+}
+
+static void check_1d(OCL::I915RTE& rte)
+{
+	const uint32_t width = 1003;
+
+	AlignedBuffer buf(rte.get_page_size(), width * 4);
+
+	auto kernel = rte.prepare_kernel(rte.read_compiled_kernel(
+				CompiledGPUProgramsI915::i915_local_size(), "cl_local_size"));
+
+	kernel->add_argument(width);
+	kernel->add_argument(1U);
+	kernel->add_argument((void*) buf.ptr(), buf.size());
+
+	/* Three full groups and one of 235 work items */
+	auto walkers = dispatch(rte, *kernel, OCL::NDRange(width), OCL::NDRange(256));
+	CHECK(walkers.size() == 2);
+
+	auto full = walkers[0].cross_thread_data;
+	check_walker(walkers[0], {0, 0}, {3, 1}, {256, 1}, {256, 1}, full);
+	check_walker(walkers[1], {3, 0}, {4, 1}, {235, 1}, {256, 1}, full);
+}
+
+static void check_2d(OCL::I915RTE& rte)
+{
+	const uint32_t width = 40;
+	const uint32_t height = 10;
+
+	AlignedBuffer buf(rte.get_page_size(), width * height * 4);
+
+	auto kernel = rte.prepare_kernel(rte.read_compiled_kernel(
+				CompiledGPUProgramsI915::i915_local_size(), "cl_local_size"));
+
+	kernel->add_argument(width);
+	kernel->add_argument(height);
+	kernel->add_argument((void*) buf.ptr(), buf.size());
+
+	/* x: two full groups and one of 8; y: two full groups and one of 2.
+	 * Walkers are ordered by x first. */
+	auto walkers = dispatch(rte, *kernel,
+			OCL::NDRange(width, height), OCL::NDRange(16, 4));
+
+	CHECK(walkers.size() == 4);
+
+	auto full = walkers[0].cross_thread_data;
+	check_walker(walkers[0], {0, 0}, {2, 2}, {16, 4}, {16, 4}, full);
+	check_walker(walkers[1], {2, 0}, {3, 2}, {8, 4}, {16, 4}, full);
+	check_walker(walkers[2], {0, 2}, {2, 3}, {16, 2}, {16, 4}, full);
+	check_walker(walkers[3], {2, 2}, {3, 3}, {8, 2}, {16, 4}, full);
+
+	/* Uniform NDRanges need a single walker */
+	walkers = dispatch(rte, *kernel, OCL::NDRange(32, 8), OCL::NDRange(16, 4));
+	CHECK(walkers.size() == 1);
+	check_walker(walkers[0], {0, 0}, {2, 2}, {16, 4}, {16, 4},
+			walkers[0].cross_thread_data);
+}
+
+static void check_uniform_only(OCL::I915RTE& rte)
+{
+	AlignedBuffer buf(rte.get_page_size(), 1003 * 4);
+
+	auto kernel = rte.prepare_kernel(rte.read_compiled_kernel(
+				CompiledGPUProgramsI915::i915_memset(), "cl_memset"));
+
+	kernel->add_argument(1003U);
+	kernel->add_argument(0U);
+	kernel->add_argument((void*) buf.ptr(), buf.size());
+
+	CHECK_THROWS(invalid_argument, kernel->execute(OCL::NDRange(1003), OCL::NDRange(256)));
+	kernel->execute(OCL::NDRange(1024), OCL::NDRange(256));
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		auto device = OCL::create_i915_fake_device();
+		auto rte = OCL::create_i915_rte(device);
+
+		check_1d(*rte);
+		check_2d(*rte);
+		check_uniform_only(*rte);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+/** Checks the command stream of profiled dispatches and the conversion of
+ * their timestamps. The batches are decoded by the RTE's batch dump:
+ * PIPE_CONTROLs that write timestamps must bracket each GPGPU_WALKER. The
+ * emulated device's timestamp counter advances by a fixed step per write, s.t.
+ * each dispatch takes exactly one step. */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "memset_fixture.h"
+#include "third_party/mesa/intel_device_info.h"
+
+using namespace std;
+
+
+/* A PIPE_CONTROL that writes a timestamp or a GPGPU_WALKER */
+struct Cmd
+{
+	bool walker = false;
+	uint64_t address = 0;
+};
+
+/* Reads the batch dump's commands of interest. Commands start at the
+ * beginning of a line, their fields are indented. */
+static vector<Cmd> read_commands(FILE* f)
+{
+	vector<Cmd> cmds;
+	string current;
+	bool timestamp = false;
+	uint64_t address = 0;
+
+	auto finish_command = [&]() {
+		if (current == "GPGPU_WALKER")
+		{
+			Cmd c;
+			c.walker = true;
+			cmds.push_back(c);
+		}
+		else if (current == "PIPE_CONTROL" && timestamp)
+		{
+			Cmd c;
+			c.address = address;
+			cmds.push_back(c);
+		}
+
+		current.clear();
+		timestamp = false;
+		address = 0;
+	};
+
+	rewind(f);
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		string l(line);
+		if (!l.empty() && l.back() == '\n')
+			l.pop_back();
+
+		if (l.empty())
+			continue;
+
+		if (l[0] != ' ')
+		{
+			/* Decoder warnings and addresses are no commands */
+			if (l.compare(0, 8, "WARNING:") == 0 || l.back() == ':')
+				continue;
+
+			finish_command();
+			current = l;
+		}
+		else if (l == "  post_sync_operation: 3")
+		{
+			timestamp = true;
+		}
+		else if (l.compare(0, 11, "  address: ") == 0)
+		{
+			address = stoull(l.substr(11), nullptr, 16);
+		}
+	}
+
+	finish_command();
+	return cmds;
+}
+
+static void check_command_stream(MemsetFixture& f, bool profiling, unsigned cnt_dispatches)
+{
+	FILE* dump = tmpfile();
+	CHECK(dump);
+
+	try
+	{
+		f.rte->set_profiling(profiling);
+		f.rte->set_batch_dump(dump);
+
+		auto queue = f.rte->create_command_queue();
+		for (unsigned i = 0; i < cnt_dispatches; i++)
+			queue->enqueue(*f.kernel, f.global_size, f.local_size);
+
+		queue->finish();
+
+		f.rte->set_batch_dump(nullptr);
+		f.rte->set_profiling(false);
+
+		auto cmds = read_commands(dump);
+
+		/* The last timestamp is the batch's completion timestamp */
+		CHECK(!cmds.empty() && !cmds.back().walker);
+		cmds.pop_back();
+
+		if (profiling)
+		{
+			CHECK(cmds.size() == 3 * cnt_dispatches);
+
+			for (size_t i = 0; i < cmds.size(); i += 3)
+			{
+				CHECK(!cmds[i].walker);
+				CHECK(cmds[i + 1].walker);
+				CHECK(!cmds[i + 2].walker);
+
+				/* Start and end of a dispatch are adjacent query slots;
+				 * addresses are in dwords */
+				CHECK(cmds[i + 2].address == cmds[i].address + 2);
+				if (i > 0)
+					CHECK(cmds[i].address == cmds[i - 1].address + 2);
+			}
+		}
+		else
+		{
+			CHECK(cmds.size() == cnt_dispatches);
+			for (auto& c : cmds)
+				CHECK(c.walker);
+		}
+	}
+	catch (...)
+	{
+		f.rte->set_batch_dump(nullptr);
+		fclose(dump);
+		throw;
+	}
+
+	fclose(dump);
+}
+
+static void check_dispatch_times(MemsetFixture& f, uint64_t step)
+{
+	struct intel_device_info dev_info{};
+	CHECK(intel_get_device_info_from_pci_id(0x1912, &dev_info));
+	CHECK(dev_info.timestamp_frequency > 0);
+
+	f.device->set_timestamp_step(step);
+	f.rte->set_profiling(true);
+
+	auto queue = f.rte->create_command_queue();
+	queue->enqueue(*f.kernel, f.global_size, f.local_size);
+	queue->enqueue(*f.kernel, f.global_size, f.local_size);
+	auto event = queue->flush();
+	event->wait();
+
+	f.rte->set_profiling(false);
+	f.device->set_timestamp_step(0);
+
+	auto times = event->get_dispatch_times();
+	CHECK(times.size() == 2);
+
+	auto expected = chrono::nanoseconds(step * 1000000000ULL / dev_info.timestamp_frequency);
+	for (auto& t : times)
+		CHECK(t.end - t.start == expected);
+
+	/* The timestamps are written in order. Absolute times are rounded
+	 * separately. */
+	CHECK(times[1].start >= times[0].end);
+	CHECK(times[1].start - times[0].end <= expected + chrono::nanoseconds(1));
+
+	/* Unprofiled dispatches have no times */
+	CHECK(f.submit()->get_dispatch_times().empty());
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_command_stream(f, true, 1);
+		check_command_stream(f, true, 3);
+		check_command_stream(f, false, 2);
+
+		/* 1ms and a single tick on 12MHz devices */
+		check_dispatch_times(f, 12000);
+		check_dispatch_times(f, 1);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/** Checks which buffer arguments reuse the bos of the RTE's userptr cache:
+ * registered ranges cover all arguments within them, implicitly cached
+ * arguments only the same address and size. */
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+#include "memset_fixture.h"
+
+using namespace std;
+
+
+static void dispatch(MemsetFixture& f, char* ptr, size_t size)
+{
+	f.kernel->set_argument(2, (void*) ptr, size);
+	f.kernel->execute(OCL::NDRange(size / 4), f.local_size);
+}
+
+static void check_implicit(MemsetFixture& f)
+{
+	auto page_size = f.rte->get_page_size();
+	auto ptr = f.buf->ptr();
+
+	auto before = f.rte->get_userptr_cache_stats();
+
+	dispatch(f, ptr, 4 * page_size);
+	dispatch(f, ptr, 4 * page_size);
+
+	auto s = f.rte->get_userptr_cache_stats();
+	CHECK(s.misses == before.misses + 1);
+	CHECK(s.hits == before.hits + 1);
+
+	/* A range within the cached one, which is replaced */
+	dispatch(f, ptr + page_size, page_size);
+
+	s = f.rte->get_userptr_cache_stats();
+	CHECK(s.misses == before.misses + 2);
+	CHECK(s.evictions == before.evictions + 1);
+	CHECK(s.implicit_ranges == before.implicit_ranges + 1);
+}
+
+static void check_registered(MemsetFixture& f)
+{
+	/* Past the ranges of check_implicit() */
+	auto page_size = f.rte->get_page_size();
+	auto ptr = f.buf->ptr() + 8 * page_size;
+
+	/* Implicit entries are replaced by the registered range regardless of
+	 * their size */
+	dispatch(f, ptr, page_size);
+	dispatch(f, ptr + 2 * page_size, 2 * page_size);
+
+	auto before = f.rte->get_userptr_cache_stats();
+	f.rte->register_host_memory(ptr, 4 * page_size);
+
+	auto s = f.rte->get_userptr_cache_stats();
+	CHECK(s.explicit_ranges == before.explicit_ranges + 1);
+	CHECK(s.implicit_ranges == before.implicit_ranges - 2);
+
+	CHECK_THROWS(invalid_argument, f.rte->register_host_memory(ptr, 4 * page_size));
+	CHECK_THROWS(invalid_argument, f.rte->register_host_memory(ptr, 2 * page_size));
+
+	/* Ranges within the registered one hit */
+	dispatch(f, ptr, 4 * page_size);
+	dispatch(f, ptr + page_size, page_size);
+	dispatch(f, ptr + 3 * page_size, page_size);
+
+	s = f.rte->get_userptr_cache_stats();
+	CHECK(s.hits == before.hits + 3);
+	CHECK(s.misses == before.misses);
+
+	f.rte->unregister_host_memory(ptr);
+	CHECK_THROWS(invalid_argument, f.rte->unregister_host_memory(ptr));
+
+	s = f.rte->get_userptr_cache_stats();
+	CHECK(s.explicit_ranges == before.explicit_ranges);
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		MemsetFixture f;
+
+		check_implicit(f);
+		check_registered(f);
+	}
+	catch (exception& e)
+	{
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
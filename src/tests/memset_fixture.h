@@ -0,0 +1,56 @@
+/** An emulated device and RTE with a prepared cl_memset kernel, which the
+ * check programs dispatch */
+#ifndef __TESTS_MEMSET_FIXTURE_H
+#define __TESTS_MEMSET_FIXTURE_H
+
+#include <cstring>
+#include <memory>
+
+#include <llt_gpgpu_rt/i915_runtime.h>
+#include "check.h"
+#include "i915_memset.clch"
+
+struct MemsetFixture
+{
+	static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+	std::shared_ptr<OCL::I915FakeDevice> device;
+	std::unique_ptr<OCL::I915RTE> rte;
+	std::unique_ptr<AlignedBuffer> buf;
+	std::unique_ptr<OCL::PreparedKernel> kernel;
+
+	const OCL::NDRange global_size{BUFFER_SIZE / 4};
+	const OCL::NDRange local_size{256};
+
+	MemsetFixture()
+		:
+			device(OCL::create_i915_fake_device()),
+			rte(OCL::create_i915_rte(device))
+	{
+		buf = std::make_unique<AlignedBuffer>(rte->get_page_size(), BUFFER_SIZE);
+		memset(buf->ptr(), 0, buf->size());
+
+		kernel = rte->prepare_kernel(rte->read_compiled_kernel(
+					CompiledGPUProgramsI915::i915_memset(), "cl_memset"));
+
+		kernel->add_argument((unsigned) buf->size() / 4);
+		kernel->add_argument(0x12345678U);
+		kernel->add_argument((void*) buf->ptr(), buf->size());
+	}
+
+	~MemsetFixture()
+	{
+		/* The RTE waits for all submissions when it is destroyed, hence
+		 * complete them or drop hung ones */
+		device->set_manual_completion(false);
+		if (device->get_stats().pending_batches > 0)
+			device->reset_gpu();
+	}
+
+	std::shared_ptr<OCL::Event> submit()
+	{
+		return kernel->execute_async(global_size, local_size);
+	}
+};
+
+#endif /* __TESTS_MEMSET_FIXTURE_H */
@@ -176,6 +176,47 @@ def generate_conversion_from_packed(ctx, expr, t):
         error("No conversion from packed defined for type `%s'" % t)
 
 
+def generate_print_format(ctx, t, expr):
+    if t in ctx['enums']:
+        return '%d', '(int) %s' % expr
+    elif t == 'bool':
+        return '%d', '(int) %s' % expr
+    elif t == 'int':
+        return '%lld', '(long long) %s' % expr
+    elif t in ('uint', 'u4.1', 'u4.8'):
+        return '%llu', '(unsigned long long) %s' % expr
+    elif t in ('address', 'offset'):
+        return '0x%llx', '(unsigned long long) %s' % expr
+    elif t == 'float':
+        return '%f', '(double) %s' % expr
+    else:
+        error("No print format defined for type `%s'" % t)
+
+def generate_field_extract(ctx, cnt_dwords, start, end, t, src):
+    """ Code that assembles the field's packed value in a variable `v' """
+    code = '%s v{};\n' % max_int_type(ctx, t)
+
+    for i in range(cnt_dwords):
+        dw_start = i * 32
+        dw_end = dw_start + 31
+
+        if start > dw_end or end < dw_start:
+            continue
+
+        get_sw = dw_start - start
+        get_shift = '<<' if get_sw >= 0 else '>>'
+        get_sw = -get_sw if get_sw < 0 else get_sw
+
+        get_mask_start = max(start, dw_start) - start
+        get_mask_end = min(end, dw_end) - start
+        get_mask = ((1 << (get_mask_end - get_mask_start + 1)) - 1) << get_mask_start
+
+        code += 'v |= ((unsigned long long) %s[%d] %s %dULL) & 0x%xULL;\n' % \
+                (src, i, get_shift, get_sw, get_mask)
+
+    return code
+
+
 def generate_enum(ctx, elem):
     text = ''
     ctx['enums'].add(elem.attrib['name'])
@@ -285,6 +326,8 @@ def generate_struct(ctx, elem):
     text += '\tuint32_t data[%d] = { 0 };\n\n' % cnt_dwords
     text += '\tstatic constexpr size_t cnt_bytes = %d;\n' % (cnt_dwords * 4)
 
+    print_code = ''
+
     for field in elem:
         if field.tag == 'field':
             if max(int(field.attrib['start']), int(field.attrib['end'])) > cnt_dwords * 32:
@@ -293,10 +336,20 @@ def generate_struct(ctx, elem):
 
             text += generate_struct_field(ctx, cnt_dwords, field, 0)
 
+            name = convert_field_name(field.attrib['name'])
+            fmt, arg = generate_print_format(ctx, field.attrib['type'], 'get_%s()' % name)
+            print_code += '\t\tfprintf(f, "%%s  %s: %s\\n", indent, %s);\n' % (
+                    name, fmt, arg)
+
         else:
             error("Struct %s has field with invalid XML tag `%s'." %
                     (elem.attrib['name'], field.tag))
 
+    text += '\tvoid print(FILE* f, const char* indent = "") const\n\t{\n'
+    text += '\t\tfprintf(f, "%%s%s\\n", indent);\n' % struct_name
+    text += print_code
+    text += '\t}\n'
+
     text += '} __attribute__((packed));\n'
     text += 'static_assert(sizeof(%s) == %d);\n\n' % (struct_name, cnt_dwords * 4);
 
@@ -326,9 +379,9 @@ def generate_instruction(ctx, elem):
             size = end - start + 1
             ctype = type_to_c_type(ctx, type_, size)
 
-            fields_to_gen.append((start, end, name, type_))
-
             default = field.attrib.get('default')
+            fields_to_gen.append((start, end, name, type_, default))
+
             if default is not None:
                 init = ' = %s' % int(default)
             else:
@@ -395,7 +448,7 @@ def generate_instruction(ctx, elem):
         bit_start = i * 32
         bit_end = bit_start + 31
 
-        for start, end, name, type_ in fields_to_gen:
+        for start, end, name, type_, _ in fields_to_gen:
             if start > bit_end or end < bit_start:
                 continue
 
@@ -416,6 +469,40 @@ def generate_instruction(ctx, elem):
 
     text += '\n\t\treturn %d;\n\t}\n' % (cnt_dwords * 4)
 
+    # Disassemble command
+    text += '\n\t/* @returns false if the fields with fixed values (opcode, length) do not\n' \
+            '\t * match */\n'
+    text += '\tbool bin_read(const char* _src)\n\t{\n'
+    text += '\t\tuint32_t src[%d];\n' % cnt_dwords
+    text += '\t\tmemcpy(src, _src, sizeof(src));\n'
+
+    for start, end, name, type_, default in fields_to_gen:
+        code = generate_field_extract(ctx, cnt_dwords, start, end, type_, 'src')
+        text += '\n\t\t{\n'
+        text += ''.join('\t\t\t%s\n' % l for l in code.splitlines())
+
+        if default is not None:
+            text += '\t\t\tif (v != %dULL)\n\t\t\t\treturn false;\n' % int(default)
+        else:
+            text += '\t\t\t%s = %s;\n' % (name, generate_conversion_from_packed(ctx, 'v', type_))
+
+        text += '\t\t}\n'
+
+    text += '\n\t\treturn true;\n\t}\n'
+
+    # Print fields
+    text += '\n\tvoid print(FILE* f, const char* indent = "") const\n\t{\n'
+    text += '\t\tfprintf(f, "%%s%s\\n", indent);\n' % elem.attrib['name']
+
+    for start, end, name, type_, default in fields_to_gen:
+        if default is not None:
+            continue
+
+        fmt, arg = generate_print_format(ctx, type_, name)
+        text += '\t\tfprintf(f, "%%s  %s: %s\\n", indent, %s);\n' % (name, fmt, arg)
+
+    text += '\t}\n'
+
     text += '};\n\n'
     return text
 
@@ -498,7 +585,8 @@ def generate_hdr(xml_text, file_name):
     hdr_text += "#define %s\n" % include_guard_name
 
     hdr_text += "\n#include <stdint.h>\n"
-    hdr_text += "\n#include <cstring>\n"
+    hdr_text += "\n#include <cstdio>\n"
+    hdr_text += "#include <cstring>\n"
     hdr_text += "\nstatic_assert(sizeof(float) == 4);\n\n"
 
     hdr_text += """/* Like C++20's std::bit_cast but for older compilers */